@@ -1,43 +1,314 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "syscall_fail.h"
 #include "b_plus_tree.h"
 
-static void update_index(bpt_t new_key, struct gen_stk *stk);
+static void update_index(bpt_key_t new_key, struct gen_stk *stk);
 static int internal_insert(struct bpt_node left_node, struct bpt_node right_node,
     struct gen_stk *stk, struct bpt_stat *bstat);
-static int leaf_insert(struct bpt_entry new_entry, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+static int leaf_insert(struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct bpt_node leaf, struct gen_stk *stk, struct bpt_stat *bstat);
 static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat);
 
+#ifdef BPT_STATS
+#define COUNT(bstat, field, n) ((bstat)->counters.field += (n))
+
+static __thread struct bpt_stat *rd_tree;         // the concurrent tree the calling thread is reading
+static __thread struct bpt_counters *rd_counters; // the counters of its reader slot there
+
+// counting by a reader of a concurrent tree, into its own slot if it entered one
+#define RD_COUNT(bstat, field, n) (rd_tree == (bstat) ? \
+    __atomic_store_n(&rd_counters->field, rd_counters->field + (n), __ATOMIC_RELAXED) : (void)COUNT(bstat, field, n))
+#else
+#define COUNT(bstat, field, n) ((void)0)
+#define RD_COUNT(bstat, field, n) ((void)0)
+#endif
+#define KEY_CMP(bstat, a, b, cmp) (COUNT(bstat, cmps, 1), bpt_key_cmp(a, b, cmp))
+#define RD_KEY_CMP(bstat, a, b, cmp) (RD_COUNT(bstat, cmps, 1), bpt_key_cmp(a, b, cmp))
+
+/*
+ * Built with BPT_SDT, operations and structural changes fire USDT probes of provider bpt,
+ * e.g. bpt:insert__start, bpt:leaf__split or bpt:node__new__done, for bpftrace or perf to
+ * attach to. Every probe takes the struct bpt_stat pointer first.
+ */
+#ifdef BPT_SDT
+#include <sys/sdt.h>
+#define PROBE(...) STAP_PROBEV(bpt, __VA_ARGS__)
+#else
+#define PROBE(...) ((void)0)
+#endif
+
+#ifdef BPT_LATENCY
+#include <time.h>
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define LAT_START(bstat, v) uint64_t v = (bstat)->lat != NULL ? now_ns() : 0
+#define LAT_END(bstat, op, v) ((bstat)->lat != NULL ? bpt_hist_record(&(bstat)->lat[op], now_ns() - (v)) : (void)0)
+#else
+#define LAT_START(bstat, v)
+#define LAT_END(bstat, op, v) ((void)0)
+#endif
+
 struct bpt_node bpt_null_node = { .entries = NULL };
 
+static inline struct bpt_node arena_node(struct bpt_stat *bstat, off_t off)
+{
+  struct bpt_node node = { .entries = (struct bpt_entry *)(bstat->base + off) };
+  return node;
+}
+
 /**
- * bpt_node_new: allocate a new B+ tree node
- * @order: order of this B+ tree
- * @prv: previous node of this new one
- * @nxt: next node of this new one
+ * arena_unlink: take a freed node off the free list of the arena
  *
- * return bpt_null_node on system call failure
+ * A freed node is marked with BPT_FREE_NKEY, and keeps the offsets of the next and
+ * previous freed nodes in the key and the value of its first entry.
+ */
+static void arena_unlink(struct bpt_stat *bstat, struct bpt_node node)
+{
+  struct bpt_arena *arena = (struct bpt_arena *)bstat->base;
+  off_t nxt = BPT_KEY_WORD(node.entries[0].key).off, prv = node.entries[0].val.off;
+
+  if (prv != 0)
+    BPT_KEY_WORD(arena_node(bstat, prv).entries[0].key).off = nxt;
+  else
+    arena->free_head = nxt;
+  if (nxt != 0)
+    arena_node(bstat, nxt).entries[0].val.off = prv;
+}
+
+/**
+ * arena_node_new: take a node out of the arena of a B+ tree
+ * @near: the node the new one should be placed right behind, e.g. the leaf it is split from,
+ *        so that a scan along the sibling links reads the arena sequentially. May be bpt_null_node.
+ *
+ * return bpt_null_node if the arena is exhausted
+ */
+static struct bpt_node arena_node_new(struct bpt_stat *bstat, struct bpt_node near)
+{
+  struct bpt_arena *arena = (struct bpt_arena *)bstat->base;
+  struct bpt_node new_node = { .entries = NULL };
+  off_t off;
+  int i;
+
+  if (near.entries != NULL) {
+    off = (char *)near.entries - bstat->base;
+    for (i = 0; i < BPT_PLACE_WINDOW && (off += arena->node_sz) < arena->brk; i++) {
+      new_node = arena_node(bstat, off);
+      if (bpt_node_nkey(new_node, bstat->order) == BPT_FREE_NKEY) {
+        arena_unlink(bstat, new_node);
+        return new_node;
+      }
+    }
+    if (off == arena->brk && arena->brk + arena->node_sz <= arena->size) {
+      arena->brk += arena->node_sz;
+      return arena_node(bstat, off);
+    }
+    new_node = bpt_null_node;
+  }
+  if (arena->free_head != 0) {
+    new_node = arena_node(bstat, arena->free_head);
+    arena_unlink(bstat, new_node);
+  } else if (arena->brk + arena->node_sz <= arena->size) {
+    new_node.entries = (struct bpt_entry *)(bstat->base + arena->brk);
+    arena->brk += arena->node_sz;
+  } else {
+    errno = ENOMEM;
+    syscall_fail("bpt_arena");
+  }
+  return new_node;
+}
+
+/**
+ * node_size: bytes of a heap node, one entry more for the generation or the version of copy-on-write
+ * or concurrent trees, or the message buffer of write-optimized ones, and another for the high key
+ * of B-link trees
  */
-struct bpt_node bpt_node_new(int order, struct bpt_node prv, struct bpt_node nxt)
+static inline size_t node_size(struct bpt_stat *bstat)
+{
+  int extra = bstat->cow != NULL || bstat->olc != NULL || bstat->be != NULL ? 3 : 2;
+
+  if (bstat->olc != NULL && bstat->olc->blink)
+    extra++;
+  return (bstat->order + extra) * sizeof (struct bpt_entry);
+}
+
+static struct bpt_node node_alloc(struct bpt_stat *bstat, struct bpt_node prv, struct bpt_node nxt)
 {
   struct bpt_node new_node;
+  int order = bstat->order;
 
-  if ((new_node.entries = malloc((order + 2) * sizeof(struct bpt_entry))) == NULL)
+  if (bstat->base != NULL) {
+    if ((new_node = arena_node_new(bstat, prv)).entries == NULL)
+      return new_node;
+  } else if (bstat->olc != NULL && !gen_stk_empty(&bstat->olc->pool)) {
+    gen_stk_pop(&bstat->olc->pool, &new_node);
+    bstat->olc->ebr.reused++;
+  } else if ((new_node.entries = malloc(node_size(bstat))) == NULL)
   {
     syscall_fail("malloc");
     return new_node;
   }
+  if (bstat->cow != NULL)
+    BPT_KEY_WORD(new_node.entries[order+2].key).off = bstat->cow->gen;
+  else if (bstat->olc != NULL)
+    BPT_KEY_WORD(new_node.entries[order+2].key).off = 0; // the version
+  else if (bstat->be != NULL)
+    BPT_KEY_WORD(new_node.entries[order+2].key).ptr = NULL; // no messages
   bpt_node_set_nkey(new_node, order, 0);
-  bpt_node_set_prv(new_node, order, prv);
-  bpt_node_set_nxt(new_node, order, nxt);
+  bpt_node_set_prv(new_node, prv, bstat);
+  bpt_node_set_nxt(new_node, nxt, bstat);
+
+  return new_node;
+}
+
+/**
+ * bpt_node_new: allocate a new B+ tree node
+ * @bstat: pointer to the struct stating the B+ tree, whose arena supplies the node if there's one
+ * @prv: previous node of this new one
+ * @nxt: next node of this new one
+ *
+ * return bpt_null_node on system call failure
+ */
+struct bpt_node bpt_node_new(struct bpt_stat *bstat, struct bpt_node prv, struct bpt_node nxt)
+{
+  struct bpt_node new_node;
+  LAT_START(bstat, start);
 
+  PROBE(node__new__start, bstat);
+  new_node = node_alloc(bstat, prv, nxt);
+  PROBE(node__new__done, bstat, new_node.entries);
+  LAT_END(bstat, BPT_LAT_NODE_NEW, start);
   return new_node;
 }
 
+/**
+ * node_gen: the generation at which a node of a copy-on-write tree was made
+ */
+static inline off_t node_gen(struct bpt_stat *bstat, struct bpt_node node)
+{
+  return BPT_KEY_WORD(node.entries[bstat->order+2].key).off;
+}
+
+/**
+ * node_shared: if a node of a copy-on-write tree may be read by a live snapshot
+ */
+static inline int node_shared(struct bpt_stat *bstat, struct bpt_node node)
+{
+  return node_gen(bstat, node) <= __atomic_load_n(&bstat->cow->snap_max, __ATOMIC_ACQUIRE);
+}
+
+static void cow_lock(struct bpt_cow *cow)
+{
+  while (__atomic_test_and_set(&cow->lock, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void cow_unlock(struct bpt_cow *cow)
+{
+  __atomic_clear(&cow->lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * bpt_node_delete: release a node, either to the heap or to the free list of the arena
+ *
+ * A node that some snapshot may still read is retired instead, and freed when the last such snapshot is released.
+ * So is every node of a concurrent tree, until no reader can be looking at it.
+ */
+void bpt_node_delete(struct bpt_stat *bstat, struct bpt_node node)
+{
+  struct bpt_arena *arena;
+  struct bpt_retired retired;
+
+  if (bstat->cow != NULL && node_shared(bstat, node)) {
+    retired.node = node;
+    retired.died = bstat->cow->gen;
+    cow_lock(bstat->cow);
+    gen_stk_push(&bstat->cow->retired, &retired); // on failure the node is leaked, never freed too early
+    cow_unlock(bstat->cow);
+  } else if (bstat->olc != NULL) {
+    retired.node = node;
+    retired.died = bstat->olc->epoch;
+    if (gen_stk_push(&bstat->olc->retired, &retired) == 0) // on failure the node is leaked, never freed under a reader
+      bstat->olc->ebr.retired++;
+    if (bstat->olc->retired.cnt > bstat->olc->ebr.max_pending)
+      bstat->olc->ebr.max_pending = bstat->olc->retired.cnt;
+  } else if (bstat->base == NULL) {
+    free(node.entries);
+  } else {
+    arena = (struct bpt_arena *)bstat->base;
+    bpt_node_set_nkey(node, bstat->order, BPT_FREE_NKEY);
+    BPT_KEY_WORD(node.entries[0].key).off = arena->free_head;
+    node.entries[0].val.off = 0;
+    if (arena->free_head != 0)
+      arena_node(bstat, arena->free_head).entries[0].val.off = (char *)node.entries - bstat->base;
+    arena->free_head = (char *)node.entries - bstat->base;
+  }
+}
+
+/**
+ * set_root: replace the root node and the height of a B+ tree
+ *
+ * An arena based tree also publishes them in the arena header,
+ * so that the tree can be attached again from the region alone.
+ */
+static void set_root(struct bpt_stat *bstat, struct bpt_node root, int height)
+{
+  struct bpt_arena *arena;
+
+  if (bstat->olc != NULL) {
+    __atomic_store_n(&bstat->olc->seq, bstat->olc->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  bstat->root_node = root;
+  bstat->height = height;
+  if (bstat->base != NULL) {
+    arena = (struct bpt_arena *)bstat->base;
+    arena->root = (char *)root.entries - bstat->base;
+    arena->height = height;
+  }
+  if (bstat->olc != NULL)
+    __atomic_store_n(&bstat->olc->seq, bstat->olc->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void init_param(struct bpt_stat *bstat, int order)
+{
+  bstat->order = order;
+  bstat->paged = 0;
+  bstat->page_sz = sysconf(_SC_PAGESIZE);
+  bstat->log = NULL;
+  bstat->trace = NULL;
+  bstat->cow = NULL;
+  bstat->olc = NULL;
+  bstat->be = NULL;
+#ifdef BPT_LATENCY
+  bstat->lat = NULL;
+#endif
+#ifdef BPT_STATS
+  memset(&bstat->counters, 0, sizeof (bstat->counters));
+#endif
+  bstat->leaf_order = order * sizeof (struct bpt_entry) / sizeof (struct bpt_slot);
+  bstat->old_leaf_nkey = bstat->leaf_order/2 + 1;
+  bstat->new_leaf_nkey = bstat->leaf_order + 1 - bstat->old_leaf_nkey;
+  bstat->old_inter_nkey = order - order / 2;
+  bstat->new_inter_nkey = order - bstat->old_inter_nkey;
+  bstat->min_leaf_nkey = bstat->new_leaf_nkey;
+  bstat->min_inter_nkey = bstat->new_inter_nkey;
+}
+
 /**
  * bpt_init: allocte a new B+ tree and initialize the struct stating it
  * @bstat: pointer to that struct
@@ -47,52 +318,1717 @@ struct bpt_node bpt_node_new(int order, struct bpt_node prv, struct bpt_node nxt
  */
 int bpt_init(struct bpt_stat *bstat, int order)
 {
-  bstat->root_node = bpt_node_new(order, bpt_null_node, bpt_null_node);
+  init_param(bstat, order);
+  bstat->base = NULL;
+  bstat->root_node = bpt_node_new(bstat, bpt_null_node, bpt_null_node);
   if (bstat->root_node.entries == NULL) 
     return -1;
-  bstat->order = order;
   bstat->height = 0;
 
-  bstat->old_leaf_nkey = order/2 + 1;
-  bstat->new_leaf_nkey = order + 1 - bstat->old_leaf_nkey;
-  bstat->old_inter_nkey = order - order / 2;
-  bstat->new_inter_nkey = order - bstat->old_inter_nkey;
+  return 0;
+}
+
+/**
+ * bpt_init_arena: make a new B+ tree inside a caller supplied region, e.g. a POSIX shared memory mapping
+ * @bstat: pointer to the struct stating the B+ tree
+ * @order: the order of B+ tree
+ * @base: start of the region, aligned at least as a struct bpt_arena
+ * @size: size of the region in bytes
+ *
+ * Every node of the tree lives in the region, and links between nodes are offsets relative to @base.
+ *
+ * Returns 0 if OK, -1 if the region is too small.
+ */
+int bpt_init_arena(struct bpt_stat *bstat, int order, void *base, size_t size)
+{
+  struct bpt_arena *arena = base;
+  struct bpt_node root;
+
+  init_param(bstat, order);
+  bstat->base = base;
+  arena->magic = BPT_ARENA_MAGIC;
+  arena->order = order;
+  arena->size = size;
+  arena->node_sz = (order + 2) * sizeof (struct bpt_entry);
+  arena->brk = (sizeof (struct bpt_arena) + 63) & ~(off_t)63;
+  arena->free_head = 0;
+  if ((root = bpt_node_new(bstat, bpt_null_node, bpt_null_node)).entries == NULL)
+    return -1;
+  set_root(bstat, root, 0);
+
+  return 0;
+}
+
+/**
+ * bpt_attach_arena: state a B+ tree that was made by bpt_init_arena() in a region now mapped at @base
+ *
+ * The region may have been relocated or be mapped by another process. Attaching again
+ * picks up the latest root node and height published by the writer.
+ *
+ * Returns 0 if OK, -1 if @base does not hold a B+ tree.
+ */
+int bpt_attach_arena(struct bpt_stat *bstat, void *base)
+{
+  struct bpt_arena *arena = base;
+
+  if (arena->magic != BPT_ARENA_MAGIC) {
+    errno = EINVAL;
+    return -1;
+  }
+  init_param(bstat, arena->order);
+  bstat->base = base;
+  bstat->root_node.entries = (struct bpt_entry *)(bstat->base + arena->root);
+  bstat->height = arena->height;
+
+  return 0;
+}
+
+/**
+ * bpt_init_cow: allocate a new copy-on-write B+ tree
+ * @bstat: pointer to the struct stating the B+ tree
+ * @order: the order of B+ tree
+ *
+ * Mutations of such a tree never overwrite a node that a snapshot taken by bpt_snapshot() may read,
+ * they copy the affected path instead. Without live snapshots nodes are updated in place.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_init_cow(struct bpt_stat *bstat, int order)
+{
+  struct bpt_cow *cow;
+
+  if ((cow = malloc(sizeof (struct bpt_cow))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  cow->gen = 0;
+  cow->snap_max = -1;
+  cow->snaps = NULL;
+  cow->lock = 0;
+  if (gen_stk_init(&cow->retired, BPT_STK_CAP_INIT, sizeof (struct bpt_retired)) == -1) {
+    free(cow);
+    return -1;
+  }
+  init_param(bstat, order);
+  bstat->base = NULL;
+  bstat->cow = cow;
+  bstat->root_node = bpt_node_new(bstat, bpt_null_node, bpt_null_node);
+  if (bstat->root_node.entries == NULL) {
+    gen_stk_delete(&cow->retired);
+    free(cow);
+    return -1;
+  }
+  bstat->height = 0;
+
+  return 0;
+}
+
+/**
+ * bpt_snapshot: take a point-in-time snapshot of a copy-on-write tree
+ * @bstat: pointer to the struct stating the B+ tree
+ * @snap: the snapshot, which stays valid until released by bpt_snapshot_release()
+ *
+ * Must be called by the writer. It costs nothing but a generation bump: nodes are copied
+ * lazily, by the mutations that come later.
+ *
+ * Returns 0 if OK, -1 if the tree is not a copy-on-write one.
+ */
+int bpt_snapshot(struct bpt_stat *bstat, struct bpt_snap *snap)
+{
+  struct bpt_cow *cow = bstat->cow;
+
+  if (cow == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  snap->view = *bstat;
+  snap->view.trace = NULL; // readers of the snapshot run on other threads than the tracer
+  snap->gen = cow->gen;
+  cow_lock(cow);
+  snap->next = cow->snaps;
+  cow->snaps = snap;
+  __atomic_store_n(&cow->snap_max, snap->gen, __ATOMIC_RELEASE);
+  cow_unlock(cow);
+  cow->gen++;
+  return 0;
+}
+
+/**
+ * cow_reclaim: free retired nodes no live snapshot can read anymore, with the cow lock held
+ */
+static void cow_reclaim(struct bpt_stat *bstat)
+{
+  struct bpt_cow *cow = bstat->cow;
+  struct bpt_retired *retired = cow->retired.addr;
+  struct bpt_snap *snap;
+  size_t i, n = 0;
+  off_t born;
+
+  for (i = 0; i < cow->retired.cnt; i++) {
+    born = node_gen(bstat, retired[i].node);
+    for (snap = cow->snaps; snap != NULL; snap = snap->next) {
+      if (snap->gen >= born && snap->gen < retired[i].died)
+        break;
+    }
+    if (snap == NULL)
+      free(retired[i].node.entries);
+    else
+      retired[n++] = retired[i];
+  }
+  cow->retired.cnt = n;
+}
+
+/**
+ * bpt_snapshot_release: drop a snapshot and free the nodes only it was keeping
+ *
+ * May be called by any thread.
+ */
+void bpt_snapshot_release(struct bpt_stat *bstat, struct bpt_snap *snap)
+{
+  struct bpt_cow *cow = bstat->cow;
+  struct bpt_snap **pp;
+  off_t snap_max = -1;
+
+  cow_lock(cow);
+  for (pp = &cow->snaps; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == snap) {
+      *pp = snap->next;
+      break;
+    }
+  }
+  for (snap = cow->snaps; snap != NULL; snap = snap->next) {
+    if (snap->gen > snap_max)
+      snap_max = snap->gen;
+  }
+  __atomic_store_n(&cow->snap_max, snap_max, __ATOMIC_RELEASE);
+  cow_reclaim(bstat);
+  cow_unlock(cow);
+}
+
+static int snap_walk(struct bpt_stat *view, struct bpt_node node, int h,
+    int (*fn)(struct bpt_slot *entry, void *arg), void *arg)
+{
+  int i, m = bpt_node_nkey(node, view->order), rst;
+
+  if (h == 0) {
+    for (i = 0; i < m; i++) {
+      if ((rst = fn(&bpt_leaf_slots(node)[i], arg)) != 0)
+        return rst;
+    }
+  } else {
+    for (i = 0; i <= m; i++) {
+      if ((rst = snap_walk(view, bpt_node_child(node, i, view), h - 1, fn, arg)) != 0)
+        return rst;
+    }
+  }
+  return 0;
+}
+
+/**
+ * bpt_snap_foreach: call @fn on every entry of a snapshot in key order
+ *
+ * Stops at the first non-zero return of @fn, and returns it. Returns 0 otherwise.
+ */
+int bpt_snap_foreach(struct bpt_snap *snap, int (*fn)(struct bpt_slot *entry, void *arg), void *arg)
+{
+  return snap_walk(&snap->view, snap->view.root_node, snap->view.height, fn, arg);
+}
+
+/**
+ * cow_copy: replace a node shared with some snapshot by a private copy
+ * @node: the shared node
+ * @parent: the private parent of @node, bpt_null_node if @node is the root node
+ * @poff: which child of @parent @node is
+ *
+ * Sibling links of the neighbours are redirected in place: snapshots never follow them.
+ *
+ * return bpt_null_node on system call failure
+ */
+static struct bpt_node cow_copy(struct bpt_stat *bstat, struct bpt_node node, struct bpt_node parent, int poff)
+{
+  struct bpt_node copy, prv, nxt;
+
+  if ((copy = bpt_node_new(bstat, bpt_null_node, bpt_null_node)).entries == NULL)
+    return copy;
+  memcpy(copy.entries, node.entries, (bstat->order + 2) * sizeof (struct bpt_entry));
+  if ((prv = bpt_node_prv(copy, bstat)).entries != NULL)
+    bpt_node_set_nxt(prv, copy, bstat);
+  if ((nxt = bpt_node_nxt(copy, bstat)).entries != NULL)
+    bpt_node_set_prv(nxt, copy, bstat);
+  if (parent.entries == NULL)
+    set_root(bstat, copy, bstat->height);
+  else
+    bpt_node_set_child(parent, poff, copy, bstat);
+  bpt_node_delete(bstat, node);
+  return copy;
+}
+
+/**
+ * cow_sibling: make a sibling of a node on the traversal journal private
+ * @frms: frames of the journal, the node at depth @d is @frms[@d].node, or the leaf if @d is the journal size
+ * @d: depth of the node, 0 for the root node
+ * @dir: -1 for the previous sibling, 1 for the next one
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int cow_sibling(struct bpt_stat *bstat, struct bpt_frm *frms, int d, struct bpt_node node, int dir)
+{
+  struct bpt_node sib, parent;
+  int poff;
+
+  sib = dir < 0 ? bpt_node_prv(node, bstat) : bpt_node_nxt(node, bstat);
+  if (sib.entries == NULL || !node_shared(bstat, sib))
+    return 0;
+  parent = frms[d-1].node;
+  poff = frms[d-1].offset + dir;
+  if (poff < 0 || poff > bpt_node_nkey(parent, bstat->order)) {
+    // a cousin, hanging under the sibling of the parent
+    if (cow_sibling(bstat, frms, d - 1, parent, dir) == -1)
+      return -1;
+    parent = dir < 0 ? bpt_node_prv(parent, bstat) : bpt_node_nxt(parent, bstat);
+    poff = dir < 0 ? bpt_node_nkey(parent, bstat->order) : 0;
+  }
+  return cow_copy(bstat, sib, parent, poff).entries == NULL ? -1 : 0;
+}
+
+enum COW_OP {
+  COW_IN_PLACE,    // only the leaf and its ancestors change
+  COW_INSERT_FULL, // insertion into a full leaf, which may push an entry to a sibling
+  COW_DELETE       // deletion, which may rebalance with siblings all the way up
+};
+
+/**
+ * cow_prepare: make private every node a mutation of @leafp may modify
+ * @stk: the traversal journal down to the leaf, whose frames are updated to the private copies
+ * @leafp: the leaf, updated to its private copy
+ * @op: an enum COW_OP telling which nodes besides the path may be modified
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int cow_prepare(struct bpt_stat *bstat, struct gen_stk *stk, struct bpt_node *leafp, int op)
+{
+  struct bpt_frm *frms = stk->addr;
+  struct bpt_node node, parent = bpt_null_node;
+  int d, depth = stk->cnt, poff = 0, minimal;
+
+  for (d = 0; d <= depth; d++) {
+    node = d < depth ? frms[d].node : *leafp;
+    if (node_shared(bstat, node) && (node = cow_copy(bstat, node, parent, poff)).entries == NULL)
+      return -1;
+    if (d < depth) {
+      frms[d].node = parent = node;
+      poff = frms[d].offset;
+    } else
+      *leafp = node;
+  }
+  if (op == COW_IN_PLACE || depth == 0)
+    return 0;
+  node = *leafp;
+  minimal = op == COW_INSERT_FULL ? bstat->order : bstat->min_leaf_nkey;
+  for (d = depth; d > 0 && bpt_node_nkey(node, bstat->order) == minimal; ) {
+    if (cow_sibling(bstat, frms, d, node, -1) == -1 || cow_sibling(bstat, frms, d, node, 1) == -1)
+      return -1;
+    if (op == COW_INSERT_FULL) // a split never touches the content of internal siblings
+      break;
+    node = frms[--d].node;
+    minimal = bstat->min_inter_nkey;
+  }
+  return 0;
+}
+
+static inline off_t *node_version(struct bpt_stat *bstat, struct bpt_node node)
+{
+  return &BPT_KEY_WORD(node.entries[bstat->order+2].key).off;
+}
+
+/**
+ * read_begin: wait out a writer of a node, or of the root of a concurrent tree
+ *
+ * Returns the version a read starts from.
+ */
+static inline off_t read_begin(off_t *ver)
+{
+  off_t v;
 
+  while ((v = __atomic_load_n(ver, __ATOMIC_ACQUIRE)) & 1)
+    sched_yield();
+  return v;
+}
+
+/**
+ * read_valid: if what was read since read_begin() returned @v is consistent
+ */
+static inline int read_valid(off_t *ver, off_t v)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(ver, __ATOMIC_RELAXED) == v;
+}
+
+struct olc_held {
+  struct bpt_node node;
+  int height; // levels above the leaves
+};
+
+/**
+ * olc_lock: make the version of a node odd until the running write is over
+ *
+ * Writers are serialized, so a node found odd was locked by the running write already.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int olc_lock(struct bpt_stat *bstat, struct bpt_node node, int height)
+{
+  struct olc_held held = { .node = node, .height = height };
+  off_t *ver;
+
+  if (node.entries == NULL || (*(ver = node_version(bstat, node)) & 1))
+    return 0;
+  if (gen_stk_push(&bstat->olc->locked, &held) == -1)
+    return -1;
+  __atomic_store_n(ver, *ver + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
   return 0;
 }
 
+static void olc_unlock_all(struct bpt_stat *bstat)
+{
+  struct olc_held held;
+  off_t *ver;
+
+  while (!gen_stk_empty(&bstat->olc->locked)) {
+    gen_stk_pop(&bstat->olc->locked, &held);
+    ver = node_version(bstat, held.node);
+    __atomic_store_n(ver, *ver + 1, __ATOMIC_RELEASE);
+  }
+}
+
+static inline int blink_mode(struct bpt_stat *bstat)
+{
+  return bstat->olc != NULL && bstat->olc->blink;
+}
+
+static inline bpt_key_t *node_high(struct bpt_stat *bstat, struct bpt_node node)
+{
+  return &node.entries[bstat->order+3].key;
+}
+
+/**
+ * blink_couple: lock the parent an insert goes on to, then unlock the nodes below it
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int blink_couple(struct bpt_stat *bstat, struct bpt_node parent, int height)
+{
+  struct olc_held held;
+
+  if (olc_lock(bstat, parent, height) == -1)
+    return -1;
+  gen_stk_pop(&bstat->olc->locked, &held);
+  olc_unlock_all(bstat);
+  gen_stk_push(&bstat->olc->locked, &held); // can't fail, the stack just held it
+  return 0;
+}
+
+/**
+ * blink_split: give the two halves of a split node their high keys
+ * @mid: the least key of @right
+ */
+static inline void blink_split(struct bpt_stat *bstat, struct bpt_node left, struct bpt_node right, bpt_key_t mid)
+{
+  *node_high(bstat, right) = *node_high(bstat, left);
+  *node_high(bstat, left) = mid;
+}
+
+static bpt_key_t subtree_min(struct bpt_stat *bstat, struct bpt_node node, int height)
+{
+  for (; height > 0; height--)
+    node = bpt_node_child(node, 0, bstat);
+  return bpt_leaf_slots(node)[0].key;
+}
+
+static inline void set_high(struct bpt_stat *bstat, struct bpt_node node, bpt_key_t high)
+{
+  if (memcmp(node_high(bstat, node), &high, sizeof (bpt_key_t)) != 0)
+    *node_high(bstat, node) = high;
+}
+
+/**
+ * blink_fences: set again the high keys a delete may have made wrong
+ * @dead_from: index in the retired list of the first node the delete removed
+ *
+ * Keys only cross the boundaries of the nodes the delete locked, and of their previous nodes.
+ * High keys that didn't change aren't written, the others belong to locked nodes, or the
+ * delete made @moves odd.
+ */
+static void blink_fences(struct bpt_stat *bstat, size_t dead_from)
+{
+  struct bpt_olc *olc = bstat->olc;
+  struct olc_held *held = olc->locked.addr;
+  struct bpt_retired *retired = olc->retired.addr;
+  struct bpt_node nxt, prv;
+  size_t i, j;
+
+  for (i = 0; i < olc->locked.cnt; i++) {
+    for (j = dead_from; j < olc->retired.cnt && retired[j].node.entries != held[i].node.entries; j++)
+      ;
+    if (j < olc->retired.cnt)
+      continue;
+    if ((nxt = bpt_node_nxt(held[i].node, bstat)).entries != NULL)
+      set_high(bstat, held[i].node, subtree_min(bstat, nxt, held[i].height));
+    if ((prv = bpt_node_prv(held[i].node, bstat)).entries != NULL)
+      set_high(bstat, prv, subtree_min(bstat, held[i].node, held[i].height));
+  }
+}
+
+/**
+ * olc_sibling: lock the sibling of a node at depth @d, and the nodes above it up to its common
+ * ancestor with the node, the counterpart of cow_sibling()
+ * @dir: -1 for the previous sibling, 1 for the next one
+ * @height: levels of @node above the leaves
+ *
+ * Keys taken from a cousin cross a separator above its parent, which a reader may have read
+ * before the move and still be headed down the cousin's side with.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int olc_sibling(struct bpt_stat *bstat, struct bpt_frm *frms, int d, struct bpt_node node, int dir, int height)
+{
+  struct bpt_node sib;
+  int poff;
+
+  sib = dir < 0 ? bpt_node_prv(node, bstat) : bpt_node_nxt(node, bstat);
+  if (sib.entries == NULL)
+    return 0;
+  if (olc_lock(bstat, sib, height) == -1)
+    return -1;
+  poff = frms[d-1].offset + dir;
+  if (poff < 0 || poff > bpt_node_nkey(frms[d-1].node, bstat->order))
+    return olc_sibling(bstat, frms, d - 1, frms[d-1].node, dir, height + 1);
+  return 0;
+}
+
+/**
+ * olc_prepare: lock every node a mutation of @leaf may modify, the counterpart of cow_prepare()
+ * @offset: where in @leaf the entry goes or is deleted from
+ *
+ * Ancestors are locked from the shallowest one the mutation may reach down: the first one
+ * a split stops at, or the ones holding the separators a borrow from a sibling moves.
+ * Siblings are locked at every level that may borrow or merge, cousins along with their parents.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int olc_prepare(struct bpt_stat *bstat, struct gen_stk *stk, struct bpt_node leaf, int op, int offset)
+{
+  struct bpt_frm *frms = stk->addr;
+  struct bpt_node node;
+  int d, depth = stk->cnt, top = depth, order = bstat->order, minimal;
+
+  if (olc_lock(bstat, leaf, 0) == -1)
+    return -1;
+  if (op == COW_INSERT_FULL && blink_mode(bstat)) {
+    // the leaf splits, internal_insert() locks its way up
+  } else if (op == COW_INSERT_FULL) {
+    if (olc_lock(bstat, bpt_node_prv(leaf, bstat), 0) == -1 || olc_lock(bstat, bpt_node_nxt(leaf, bstat), 0) == -1)
+      return -1;
+    for (d = depth - 1; d >= 0 && frms[d].offset == 0; d--)
+      ;
+    top = d >= 0 && d < top ? d : top;
+    for (d = depth - 1; d >= 0 && frms[d].offset == bpt_node_nkey(frms[d].node, order); d--)
+      ;
+    top = d >= 0 && d < top ? d : top;
+    for (d = depth - 1; d >= 0; d--) {
+      top = d < top ? d : top;
+      if (bpt_node_nkey(frms[d].node, order) < order)
+        break;
+    }
+  } else if (op == COW_DELETE && depth > 0) {
+    if (bpt_node_nkey(leaf, order) == bstat->min_leaf_nkey) {
+      top = 0; // merges move separators anywhere up the path
+      if (blink_mode(bstat)) {
+        __atomic_store_n(&bstat->olc->moves, bstat->olc->moves + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+      }
+      node = leaf;
+      minimal = bstat->min_leaf_nkey;
+      for (d = depth; d > 0 && bpt_node_nkey(node, order) == minimal; ) {
+        if (olc_sibling(bstat, frms, d, node, -1, depth - d) == -1 ||
+            olc_sibling(bstat, frms, d, node, 1, depth - d) == -1)
+          return -1;
+        node = frms[--d].node;
+        minimal = bstat->min_inter_nkey;
+      }
+    } else if (offset == 0) {
+      for (d = depth - 1; d >= 0 && frms[d].offset == 0; d--)
+        ;
+      top = d >= 0 ? d : top;
+      // the high keys down the left side of the separator follow it
+      for (d = top + 1; blink_mode(bstat) && top < depth && d <= depth; d++) {
+        node = d < depth ? frms[d].node : leaf;
+        if (olc_lock(bstat, bpt_node_prv(node, bstat), depth - d) == -1)
+          return -1;
+      }
+    }
+  }
+  for (d = top; d < depth; d++) {
+    if (olc_lock(bstat, frms[d].node, depth - d) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+static int olc_init(struct bpt_stat *bstat, int order, int blink)
+{
+  struct bpt_olc *olc;
+
+  if ((olc = malloc(sizeof (struct bpt_olc))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  if (gen_stk_init(&olc->stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    goto fail;
+  if (gen_stk_init(&olc->locked, BPT_STK_CAP_INIT, sizeof (struct olc_held)) == -1)
+    goto fail_stk;
+  if (gen_stk_init(&olc->retired, BPT_STK_CAP_INIT, sizeof (struct bpt_retired)) == -1)
+    goto fail_locked;
+  if (gen_stk_init(&olc->pool, BPT_STK_CAP_INIT, sizeof (struct bpt_node)) == -1)
+    goto fail_retired;
+  pthread_mutex_init(&olc->wlock, NULL);
+  olc->seq = 0;
+  olc->blink = blink;
+  olc->moves = 0;
+  olc->epoch = 1;
+  olc->retired_max = BPT_EBR_RETIRED_MAX;
+  memset(&olc->ebr, 0, sizeof (olc->ebr));
+  memset(olc->slots, 0, sizeof (olc->slots));
+  init_param(bstat, order);
+  bstat->base = NULL;
+  bstat->olc = olc;
+  bstat->height = 0;
+  bstat->root_node = bpt_node_new(bstat, bpt_null_node, bpt_null_node);
+  if (bstat->root_node.entries != NULL)
+    return 0;
+  pthread_mutex_destroy(&olc->wlock);
+  gen_stk_delete(&olc->pool);
+fail_retired:
+  gen_stk_delete(&olc->retired);
+fail_locked:
+  gen_stk_delete(&olc->locked);
+fail_stk:
+  gen_stk_delete(&olc->stk);
+fail:
+  free(olc);
+  return -1;
+}
+
+/**
+ * bpt_init_olc: allocate a new B+ tree that threads may search concurrently with a writer
+ * @bstat: pointer to the struct stating the B+ tree
+ * @order: the order of B+ tree
+ *
+ * Such a tree is searched with bpt_olc_search() and mutated with bpt_olc_insert() and bpt_olc_delete(),
+ * from any thread. A thread searches it between bpt_olc_enter() and bpt_olc_exit() on a slot it
+ * got from bpt_olc_register().
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_init_olc(struct bpt_stat *bstat, int order)
+{
+  return olc_init(bstat, order, 0);
+}
+
+/**
+ * bpt_init_blink: bpt_init_olc() for a B-link tree
+ *
+ * Full leaves always split, so readers mostly move right past concurrent inserts rather than
+ * start over.
+ */
+int bpt_init_blink(struct bpt_stat *bstat, int order)
+{
+  return olc_init(bstat, order, 1);
+}
+
+/**
+ * blink_search: bpt_olc_search() of a B-link tree
+ *
+ * A node is read again when it changed while being read, and a reader only starts over from
+ * the root when a delete moved keys meanwhile.
+ */
+static int blink_search(struct bpt_stat *bstat, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), bpt_t *valp)
+{
+  struct bpt_olc *olc = bstat->olc;
+  struct bpt_node node, next;
+  struct bpt_slot *ls;
+  off_t mv, s, v;
+#ifndef BPT_SET
+  bpt_t val;
+#endif
+  int h, i, m, found, order = bstat->order;
+
+restart:
+  mv = read_begin(&olc->moves);
+  s = read_begin(&olc->seq);
+  node.entries = __atomic_load_n(&bstat->root_node.entries, __ATOMIC_RELAXED);
+  h = __atomic_load_n(&bstat->height, __ATOMIC_RELAXED);
+  if (!read_valid(&olc->seq, s))
+    goto restart;
+  while (1) {
+    v = read_begin(node_version(bstat, node));
+    RD_COUNT(bstat, visits, 1);
+    if ((next = bpt_node_nxt(node, bstat)).entries != NULL &&
+        RD_KEY_CMP(bstat, search_for, *node_high(bstat, node), cmp) >= 0) {
+      if (read_valid(node_version(bstat, node), v))
+        node = next; // split since its parent was read
+      continue;
+    }
+    if (h == 0)
+      break;
+    if ((m = bpt_node_nkey(node, order)) > order)
+      m = order;
+    for (i = 0; i < m; i++) {
+      if (RD_KEY_CMP(bstat, search_for, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    next = bpt_node_child(node, i, bstat);
+    if (read_valid(node_version(bstat, node), v)) {
+      node = next;
+      h--;
+    }
+  }
+  if ((m = bpt_node_nkey(node, order)) > bstat->leaf_order)
+    m = bstat->leaf_order;
+  ls = bpt_leaf_slots(node);
+  for (i = 0, found = -1; i < m && found == -1; i++) {
+    if (RD_KEY_CMP(bstat, search_for, ls[i].key, cmp) == 0)
+      found = i;
+  }
+#ifndef BPT_SET
+  if (found != -1)
+    val = ls[found].val;
+#endif
+  if (!read_valid(node_version(bstat, node), v))
+    goto restart;
+  if (!read_valid(&olc->moves, mv))
+    goto restart;
+  if (found == -1)
+    return -1;
+#ifndef BPT_SET
+  if (valp != NULL)
+    *valp = val;
+#endif
+  return 0;
+}
+
+/**
+ * bpt_olc_search: look a key up in a concurrent tree, from any thread
+ * @valp: where the value found is stored, unless NULL
+ *
+ * The calling thread must be between bpt_olc_enter() and bpt_olc_exit(). @cmp may be handed
+ * keys torn by a concurrent write, whose results are thrown away.
+ *
+ * Returns 0 if found, -1 if not.
+ */
+int bpt_olc_search(struct bpt_stat *bstat, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), bpt_t *valp)
+{
+  struct bpt_olc *olc = bstat->olc;
+  struct bpt_node node, child;
+  struct bpt_slot *ls;
+  off_t s, v, cv;
+#ifndef BPT_SET
+  bpt_t val;
+#endif
+  int h, i, m, found, order = bstat->order;
+
+  RD_COUNT(bstat, searches, 1);
+  if (olc->blink)
+    return blink_search(bstat, search_for, cmp, valp);
+restart:
+  s = read_begin(&olc->seq);
+  node.entries = __atomic_load_n(&bstat->root_node.entries, __ATOMIC_RELAXED);
+  h = __atomic_load_n(&bstat->height, __ATOMIC_RELAXED);
+  v = read_begin(node_version(bstat, node));
+  if (!read_valid(&olc->seq, s))
+    goto restart;
+  RD_COUNT(bstat, visits, h + 1);
+  for (; h > 0; h--) {
+    if ((m = bpt_node_nkey(node, order)) > order) // never read past the node, whatever a writer left
+      m = order;
+    for (i = 0; i < m; i++) {
+      if (RD_KEY_CMP(bstat, search_for, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    child = bpt_node_child(node, i, bstat);
+    if (!read_valid(node_version(bstat, node), v))
+      goto restart;
+    cv = read_begin(node_version(bstat, child));
+    if (!read_valid(node_version(bstat, node), v))
+      goto restart;
+    node = child;
+    v = cv;
+  }
+  if ((m = bpt_node_nkey(node, order)) > bstat->leaf_order)
+    m = bstat->leaf_order;
+  ls = bpt_leaf_slots(node);
+  for (i = 0, found = -1; i < m && found == -1; i++) {
+    if (RD_KEY_CMP(bstat, search_for, ls[i].key, cmp) == 0)
+      found = i;
+  }
+#ifndef BPT_SET
+  if (found != -1)
+    val = ls[found].val;
+#endif
+  if (!read_valid(node_version(bstat, node), v))
+    goto restart;
+  if (found == -1)
+    return -1;
+#ifndef BPT_SET
+  if (valp != NULL)
+    *valp = val;
+#endif
+  return 0;
+}
+
+/**
+ * bpt_olc_register: take a reader slot of a concurrent tree for the calling thread
+ *
+ * Returns the slot, or -1 if BPT_EBR_READERS threads hold one already.
+ */
+int bpt_olc_register(struct bpt_stat *bstat)
+{
+  int i, unused;
+
+  for (i = 0; i < BPT_EBR_READERS; i++) {
+    unused = 0;
+    if (__atomic_compare_exchange_n(&bstat->olc->slots[i].used, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return i;
+  }
+  return -1;
+}
+
+void bpt_olc_unregister(struct bpt_stat *bstat, int slot)
+{
+  __atomic_store_n(&bstat->olc->slots[slot].epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&bstat->olc->slots[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * bpt_olc_enter: start reading a concurrent tree, nodes can't be reclaimed under the thread until
+ * bpt_olc_exit()
+ *
+ * Any number of searches may go between the two. A reader that stays long holds back the
+ * reclamation of every node removed meanwhile, and at last the writers.
+ */
+void bpt_olc_enter(struct bpt_stat *bstat, int slot)
+{
+  struct bpt_olc *olc = bstat->olc;
+
+  __atomic_store_n(&olc->slots[slot].epoch, __atomic_load_n(&olc->epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST); // the epoch is announced before any node is read
+#ifdef BPT_STATS
+  rd_tree = bstat;
+  rd_counters = &olc->slots[slot].counters;
+#endif
+}
+
+void bpt_olc_exit(struct bpt_stat *bstat, int slot)
+{
+  __atomic_store_n(&bstat->olc->slots[slot].epoch, 0, __ATOMIC_RELEASE);
+#ifdef BPT_STATS
+  rd_tree = NULL;
+#endif
+}
+
+/**
+ * ebr_advance: move the epoch on if every reader reads in the current one
+ */
+static void ebr_advance(struct bpt_olc *olc)
+{
+  off_t e;
+  int i;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST); // nodes were unlinked before the slots are read
+  for (i = 0; i < BPT_EBR_READERS; i++) {
+    e = __atomic_load_n(&olc->slots[i].epoch, __ATOMIC_ACQUIRE);
+    if (e != 0 && e != olc->epoch)
+      return;
+  }
+  __atomic_store_n(&olc->epoch, olc->epoch + 1, __ATOMIC_RELEASE);
+  olc->ebr.advances++;
+}
+
+/**
+ * ebr_collect: reclaim the retired nodes no reader can reach any more
+ *
+ * A reader announcing the epoch a node was retired in may have reached it before it was unlinked,
+ * one announcing the next one may have announced it late. Later readers can't reach it.
+ */
+static void ebr_collect(struct bpt_olc *olc)
+{
+  struct bpt_retired *retired = olc->retired.addr;
+  size_t i, n = olc->retired.cnt;
+
+  for (i = 0; i < n && retired[i].died + 2 <= olc->epoch; i++) {
+    if (olc->epoch - retired[i].died > olc->ebr.max_lag)
+      olc->ebr.max_lag = olc->epoch - retired[i].died;
+    if (olc->pool.cnt >= BPT_EBR_POOL_MAX || gen_stk_push(&olc->pool, &retired[i].node) == -1)
+      free(retired[i].node.entries);
+  }
+  memmove(&retired[0], &retired[i], (n - i) * sizeof (struct bpt_retired));
+  olc->retired.cnt = n - i;
+  olc->ebr.reclaimed += i;
+}
+
+/**
+ * ebr_tick: reclaim what a write may, waiting for readers while @retired_max nodes are retired
+ */
+static void ebr_tick(struct bpt_olc *olc)
+{
+  if (gen_stk_empty(&olc->retired))
+    return;
+  ebr_advance(olc);
+  ebr_collect(olc);
+  if (olc->retired.cnt < olc->retired_max)
+    return;
+  olc->ebr.stalls++;
+  do {
+    sched_yield();
+    ebr_advance(olc);
+    ebr_collect(olc);
+  } while (olc->retired.cnt >= olc->retired_max);
+}
+
+/**
+ * bpt_olc_insert: bpt_insert() into a concurrent tree, from any thread
+ */
+int bpt_olc_insert(struct bpt_stat *bstat, struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t),
+    int (*pred)(bpt_t, bpt_t))
+{
+  struct bpt_olc *olc = bstat->olc;
+  int rst;
+
+  pthread_mutex_lock(&olc->wlock);
+  rst = bpt_insert(new_entry, cmp, pred, &olc->stk, 1, bstat);
+  olc_unlock_all(bstat);
+  ebr_tick(olc);
+  pthread_mutex_unlock(&olc->wlock);
+  return rst;
+}
+
+/**
+ * bpt_olc_delete: bpt_delete() from a concurrent tree, from any thread
+ */
+int bpt_olc_delete(struct bpt_stat *bstat, struct bpt_entry pair, int (*cmp)(bpt_key_t, bpt_key_t),
+    int (*pred)(bpt_t, bpt_t))
+{
+  struct bpt_olc *olc = bstat->olc;
+  size_t dead_from;
+  int rst;
+
+  pthread_mutex_lock(&olc->wlock);
+  dead_from = olc->retired.cnt;
+  rst = bpt_delete(pair, cmp, pred, &olc->stk, 1, bstat);
+  if (olc->blink)
+    blink_fences(bstat, dead_from);
+  if (olc->moves & 1)
+    __atomic_store_n(&olc->moves, olc->moves + 1, __ATOMIC_RELEASE);
+  olc_unlock_all(bstat);
+  ebr_tick(olc);
+  pthread_mutex_unlock(&olc->wlock);
+  return rst;
+}
+
+/**
+ * bpt_olc_reclaim: free the nodes removed from a concurrent tree so far, and the pool of reclaimed ones
+ *
+ * The caller must know that no bpt_olc_search() started before the call is still running,
+ * as when every reader thread was joined.
+ */
+void bpt_olc_reclaim(struct bpt_stat *bstat)
+{
+  struct bpt_olc *olc = bstat->olc;
+  struct bpt_retired *retired = olc->retired.addr;
+  struct bpt_node node;
+  size_t i;
+
+  pthread_mutex_lock(&olc->wlock);
+  for (i = 0; i < olc->retired.cnt; i++)
+    free(retired[i].node.entries);
+  olc->ebr.reclaimed += olc->retired.cnt;
+  olc->retired.cnt = 0;
+  while (!gen_stk_empty(&olc->pool)) {
+    gen_stk_pop(&olc->pool, &node);
+    free(node.entries);
+  }
+  pthread_mutex_unlock(&olc->wlock);
+}
+
+static inline struct bpt_be_buf *node_buf(struct bpt_stat *bstat, struct bpt_node node)
+{
+  return BPT_KEY_WORD(node.entries[bstat->order+2].key).ptr;
+}
+
+/**
+ * be_find: where the message for a key is, or would go, in a buffer
+ */
+static int be_find(struct bpt_stat *bstat, struct bpt_be_buf *buf, bpt_key_t key, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  int lo = 0, hi = buf->n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (KEY_CMP(bstat, buf->msgs[mid].key, key, cmp) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * be_combine: the one message doing what @old then @new do
+ */
+static inline struct bpt_be_msg be_combine(struct bpt_be_msg old, struct bpt_be_msg new)
+{
+  if (new.op != BPT_BE_ADD)
+    return new;
+  if (old.op == BPT_BE_DEL) {
+    new.op = BPT_BE_PUT;
+  } else {
+    new.op = old.op;
+    new.val.off += old.val.off;
+  }
+  return new;
+}
+
+/**
+ * be_add: merge sorted messages, newer than those the buffer of a node has, into it
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int be_add(struct bpt_stat *bstat, struct bpt_node node, const struct bpt_be_msg *msgs, int n,
+    int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_be_buf *buf = node_buf(bstat, node);
+  struct bpt_be_msg msg;
+  int i, j, w, c, lo, hi, mid, same, cap, old_n = buf != NULL ? buf->n : 0;
+
+  if (buf == NULL || old_n + n > buf->cap) {
+    cap = old_n + n > bstat->be->buf_max + 1 ? old_n + n : bstat->be->buf_max + 1;
+    if ((buf = realloc(buf, sizeof (*buf) + cap * sizeof (struct bpt_be_msg))) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    buf->n = old_n;
+    buf->cap = cap;
+    BPT_KEY_WORD(node.entries[bstat->order+2].key).ptr = buf;
+  }
+  // from the back, so that nothing is overwritten before it is read, the messages in
+  // between two new ones moved at once
+  for (i = old_n - 1, j = n - 1, w = old_n + n - 1; j >= 0; j--) {
+    for (lo = 0, hi = i + 1; lo < hi; ) {
+      mid = (lo + hi) / 2;
+      if (KEY_CMP(bstat, buf->msgs[mid].key, msgs[j].key, cmp) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    same = lo <= i && KEY_CMP(bstat, buf->msgs[lo].key, msgs[j].key, cmp) == 0;
+    c = i + 1 - lo - same;
+    memmove(&buf->msgs[w-c+1], &buf->msgs[lo+same], c * sizeof (struct bpt_be_msg));
+    w -= c;
+    msg = same ? be_combine(buf->msgs[lo], msgs[j]) : msgs[j];
+    buf->msgs[w--] = msg;
+    i = lo - 1;
+  }
+  if (w > i) // messages of the same keys left a gap
+    memmove(&buf->msgs[i+1], &buf->msgs[w+1], (old_n + n - 1 - w) * sizeof (struct bpt_be_msg));
+  buf->n = i + 1 + old_n + n - 1 - w;
+  return 0;
+}
+
+/**
+ * be_descend: note the nodes on the way to a key in the path of a write-optimized tree
+ */
+static void be_descend(struct bpt_stat *bstat, bpt_key_t key, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_node node = bstat->root_node;
+  int h, i, m;
+
+  for (h = bstat->height; h > 0; h--) {
+    bstat->be->path[h] = node;
+    for (m = bpt_node_nkey(node, bstat->order), i = 0; i < m; i++) {
+      if (KEY_CMP(bstat, key, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    node = bpt_node_child(node, i, bstat);
+  }
+  bstat->be->path[0] = node;
+}
+
+/**
+ * be_grow: put @right in the node at height @h of the path, as the child after @left
+ * @sep: the least key of @right
+ *
+ * A full node splits, its messages going with the keys, and so on up, @left being the
+ * root making a new root.
+ *
+ * Returns 0 if OK, -1 on system call failure or if the tree grew too high.
+ */
+static int be_grow(struct bpt_stat *bstat, int h, struct bpt_node left, bpt_key_t sep, struct bpt_node right,
+    int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_node node, sib, nxt, root;
+  struct bpt_be_buf *buf;
+  int order = bstat->order, half = (order + 1) / 2, i, j, m;
+  bpt_key_t keys[order+1];
+  struct bpt_node kids[order+2];
+
+  if (h > bstat->height) {
+    if (h > BPT_BE_HEIGHT) {
+      errno = ENOSPC;
+      return -1;
+    }
+    if ((root = bpt_node_new(bstat, bpt_null_node, bpt_null_node)).entries == NULL)
+      return -1;
+    bpt_node_set_child(root, 0, left, bstat);
+    bpt_node_set_child(root, 1, right, bstat);
+    root.entries[0].key = sep;
+    bpt_node_set_nkey(root, order, 1);
+    set_root(bstat, root, h);
+    COUNT(bstat, root_grows, 1);
+    return 0;
+  }
+  node = bstat->be->path[h];
+  m = bpt_node_nkey(node, order);
+  for (j = 0; bpt_node_child(node, j, bstat).entries != left.entries; j++)
+    ;
+  if (m < order) {
+    for (i = m; i > j; i--) {
+      node.entries[i].key = node.entries[i-1].key;
+      node.entries[i+1].val = node.entries[i].val;
+    }
+    node.entries[j].key = sep;
+    bpt_node_set_child(node, j + 1, right, bstat);
+    bpt_node_set_nkey(node, order, m + 1);
+    return 0;
+  }
+
+  for (i = 0; i <= m; i++)
+    kids[i < j + 1 ? i : i + 1] = bpt_node_child(node, i, bstat);
+  for (i = 0; i < m; i++)
+    keys[i < j ? i : i + 1] = node.entries[i].key;
+  keys[j] = sep;
+  kids[j+1] = right;
+  nxt = bpt_node_nxt(node, bstat);
+  if ((sib = bpt_node_new(bstat, node, nxt)).entries == NULL)
+    return -1;
+  if (nxt.entries != NULL)
+    bpt_node_set_prv(nxt, sib, bstat);
+  bpt_node_set_nxt(node, sib, bstat);
+  for (i = 0; i <= order + 1; i++) {
+    if (i <= half)
+      bpt_node_set_child(node, i, kids[i], bstat);
+    else
+      bpt_node_set_child(sib, i - half - 1, kids[i], bstat);
+  }
+  for (i = 0; i <= order; i++) {
+    if (i < half)
+      node.entries[i].key = keys[i];
+    else if (i > half)
+      sib.entries[i-half-1].key = keys[i];
+  }
+  bpt_node_set_nkey(node, order, half);
+  bpt_node_set_nkey(sib, order, order - half);
+  if ((buf = node_buf(bstat, node)) != NULL && (i = be_find(bstat, buf, keys[half], cmp)) < buf->n) {
+    if (be_add(bstat, sib, &buf->msgs[i], buf->n - i, cmp) == -1)
+      return -1;
+    buf->n = i;
+  }
+  COUNT(bstat, inter_splits, 1);
+  return be_grow(bstat, h + 1, node, keys[half], sib, cmp);
+}
+
+/**
+ * be_drop: take an empty leaf out of the tree, unless it is the only child of its parent
+ */
+static void be_drop(struct bpt_stat *bstat, struct bpt_node leaf)
+{
+  struct bpt_node parent = bstat->be->path[1], prv, nxt;
+  int order = bstat->order, m, i, j;
+
+  if (bstat->height == 0 || (m = bpt_node_nkey(parent, order)) == 0)
+    return;
+  for (j = 0; bpt_node_child(parent, j, bstat).entries != leaf.entries; j++)
+    ;
+  // the key left of the leaf goes with it, or the one right of it for the first child
+  for (i = j > 0 ? j - 1 : 0; i < m - 1; i++)
+    parent.entries[i].key = parent.entries[i+1].key;
+  for (i = j; i < m; i++)
+    parent.entries[i].val = parent.entries[i+1].val;
+  bpt_node_set_nkey(parent, order, m - 1);
+  prv = bpt_node_prv(leaf, bstat);
+  nxt = bpt_node_nxt(leaf, bstat);
+  if (prv.entries != NULL)
+    bpt_node_set_nxt(prv, nxt, bstat);
+  if (nxt.entries != NULL)
+    bpt_node_set_prv(nxt, prv, bstat);
+  bpt_node_delete(bstat, leaf);
+  COUNT(bstat, leaf_merges, 1);
+}
+
+/**
+ * be_apply: merge a run of messages into a leaf, splitting it as many times as it overflows
+ *
+ * The leaf is dropped if it ends up empty, see be_drop().
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int be_apply(struct bpt_stat *bstat, struct bpt_node leaf, const struct bpt_be_msg *msgs, int n,
+    int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_be *be = bstat->be;
+  struct bpt_slot *slots = bpt_leaf_slots(leaf), *tmp;
+  struct bpt_node node, prv, nxt;
+  int nkey = bpt_node_nkey(leaf, bstat->order), i, j, c, cnt, pieces, p, s, e;
+
+  if ((size_t)(nkey + n) > be->tmp_cap) {
+    if ((tmp = realloc(be->tmp, (nkey + n) * sizeof (struct bpt_slot))) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    be->tmp = tmp;
+    be->tmp_cap = nkey + n;
+  }
+  tmp = be->tmp;
+  for (i = 0, j = 0, cnt = 0; i < nkey || j < n; ) {
+    c = i == nkey ? 1 : j == n ? -1 : KEY_CMP(bstat, slots[i].key, msgs[j].key, cmp);
+    if (c < 0) {
+      tmp[cnt++] = slots[i++];
+      continue;
+    }
+    if (msgs[j].op != BPT_BE_DEL) {
+      tmp[cnt].key = msgs[j].key;
+#ifndef BPT_SET
+      tmp[cnt].val = msgs[j].val;
+      if (msgs[j].op == BPT_BE_ADD && c == 0)
+        tmp[cnt].val.off += slots[i].val.off;
+#endif
+      cnt++;
+    }
+    i += c == 0;
+    j++;
+  }
+  be->leaf_writes++;
+
+  pieces = cnt > bstat->leaf_order ? (cnt + bstat->leaf_order - 1) / bstat->leaf_order : 1;
+  for (p = 0, prv = leaf; p < pieces; p++, prv = node) {
+    s = p * (cnt / pieces) + (p < cnt % pieces ? p : cnt % pieces);
+    e = s + cnt / pieces + (p < cnt % pieces);
+    node = leaf;
+    if (p > 0) {
+      nxt = bpt_node_nxt(prv, bstat);
+      if ((node = bpt_node_new(bstat, prv, nxt)).entries == NULL)
+        return -1;
+      if (nxt.entries != NULL)
+        bpt_node_set_prv(nxt, node, bstat);
+      bpt_node_set_nxt(prv, node, bstat);
+      COUNT(bstat, leaf_splits, 1);
+    }
+    memcpy(bpt_leaf_slots(node), &tmp[s], (e - s) * sizeof (struct bpt_slot));
+    bpt_node_set_nkey(node, bstat->order, e - s);
+    if (p > 0) {
+      be_descend(bstat, tmp[s].key, cmp);
+      if (be_grow(bstat, 1, prv, tmp[s].key, node, cmp) == -1)
+        return -1;
+    }
+  }
+  if (cnt == 0) {
+    be_descend(bstat, msgs[0].key, cmp);
+    be_drop(bstat, leaf);
+  }
+  return 0;
+}
+
+// messages of a buffer bound for one child
+struct be_run {
+  int s, e;
+  struct bpt_node child;
+  bpt_key_t key; // the first of them
+};
+
+/**
+ * be_runs: split the buffer of a node by the child its messages are bound for
+ *
+ * Returns how many children get some.
+ */
+static int be_runs(struct bpt_stat *bstat, struct bpt_node node, struct bpt_be_buf *buf, struct be_run *runs,
+    int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  int m = bpt_node_nkey(node, bstat->order), i = 0, n = 0, s, e;
+
+  for (s = 0; s < buf->n; s = e) {
+    while (i < m && KEY_CMP(bstat, buf->msgs[s].key, node.entries[i].key, cmp) >= 0)
+      i++;
+    for (e = s + 1; e < buf->n && (i == m || KEY_CMP(bstat, buf->msgs[e].key, node.entries[i].key, cmp) < 0); e++)
+      ;
+    runs[n].s = s;
+    runs[n].e = e;
+    runs[n].child = bpt_node_child(node, i, bstat);
+    runs[n++].key = buf->msgs[s].key;
+  }
+  return n;
+}
+
+/**
+ * be_flush_node: send messages down from the node at height @h of the path until it holds
+ * no more than the limit, and so on below
+ *
+ * The largest runs go down until the node is down to half the limit, all in one pass, so a
+ * flush costs a scan of the buffer whatever the number of runs it sends. The path is left
+ * leading to the node, or to the part of it the first run went down from.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int be_flush_node(struct bpt_stat *bstat, int h, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_be *be = bstat->be;
+  struct bpt_be_buf *buf;
+  struct bpt_be_msg *run;
+  struct be_run runs[bstat->order+1], tmp;
+  int nrun, nsent, left, r, i, w, at;
+
+  while ((buf = node_buf(bstat, be->path[h])) != NULL && buf->n > be->limit) {
+    nrun = be_runs(bstat, be->path[h], buf, runs, cmp);
+    // the largest runs first, then those sent back in key order
+    for (r = 1; r < nrun; r++) {
+      for (tmp = runs[r], i = r; i > 0 && runs[i-1].e - runs[i-1].s < tmp.e - tmp.s; i--)
+        runs[i] = runs[i-1];
+      runs[i] = tmp;
+    }
+    for (nsent = 0, left = buf->n; nsent < nrun && left > be->limit / 2; nsent++)
+      left -= runs[nsent].e - runs[nsent].s;
+    for (r = 1; r < nsent; r++) {
+      for (tmp = runs[r], i = r; i > 0 && runs[i-1].s > tmp.s; i--)
+        runs[i] = runs[i-1];
+      runs[i] = tmp;
+    }
+    be->flushes += nsent;
+
+    if (h > 1) {
+      for (r = 0; r < nsent; r++) {
+        if (be_add(bstat, runs[r].child, &buf->msgs[runs[r].s], runs[r].e - runs[r].s, cmp) == -1)
+          return -1;
+      }
+    } else if ((size_t)(buf->n - left) > be->run_cap) {
+      if ((run = realloc(be->run, (buf->n - left) * sizeof (struct bpt_be_msg))) == NULL) {
+        syscall_fail("realloc");
+        return -1;
+      }
+      be->run = run;
+      be->run_cap = buf->n - left;
+    }
+    // out of the buffer, leaf runs into be->run first, as splitting the node splits the buffer
+    for (r = 0, i = 0, w = 0, at = 0; i < buf->n; i++) {
+      if (r < nsent && i == runs[r].e)
+        r++;
+      if (r < nsent && i >= runs[r].s) {
+        if (h == 1)
+          be->run[at++] = buf->msgs[i];
+      } else {
+        buf->msgs[w++] = buf->msgs[i];
+      }
+    }
+    buf->n = w;
+
+    for (r = 0, at = 0; r < nsent; r++) {
+      if (h == 1) {
+        if (be_apply(bstat, runs[r].child, &be->run[at], runs[r].e - runs[r].s, cmp) == -1)
+          return -1;
+        at += runs[r].e - runs[r].s;
+        continue;
+      }
+      be_descend(bstat, runs[r].key, cmp);
+      if (node_buf(bstat, be->path[h-1])->n > be->limit && be_flush_node(bstat, h - 1, cmp) == -1)
+        return -1;
+    }
+    be_descend(bstat, runs[0].key, cmp);
+  }
+  return 0;
+}
+
+/**
+ * bpt_init_be: allocate a new write-optimized B+ tree
+ * @bstat: pointer to the struct stating the B+ tree
+ * @order: the order of B+ tree
+ * @buf_max: messages an internal node buffers before sending some down, or 0 for
+ *           BPT_BE_BUF_FACTOR times @order
+ *
+ * Such a tree is written with bpt_be_write() and searched with bpt_be_search(). Cursors and
+ * bpt_search() see the leaves alone, so only after bpt_be_flush().
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_init_be(struct bpt_stat *bstat, int order, int buf_max)
+{
+  struct bpt_be *be;
+
+  if ((be = malloc(sizeof (struct bpt_be))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  memset(be, 0, sizeof (*be));
+  be->buf_max = be->limit = buf_max > 0 ? buf_max : order * BPT_BE_BUF_FACTOR;
+  init_param(bstat, order);
+  bstat->base = NULL;
+  bstat->be = be;
+  bstat->height = 0;
+  bstat->root_node = bpt_node_new(bstat, bpt_null_node, bpt_null_node);
+  if (bstat->root_node.entries != NULL)
+    return 0;
+  free(be);
+  return -1;
+}
+
+/**
+ * bpt_be_write: write to a write-optimized tree
+ * @op: what to do, an enum BPT_BE_OP
+ * @entry: the key and the value of @op
+ *
+ * The write lands in the buffer of the root, unless the root is a leaf, so there's no
+ * telling whether the key was there.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_be_write(struct bpt_stat *bstat, int op, struct bpt_entry entry, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_be_msg msg;
+
+  if (op != BPT_BE_PUT && op != BPT_BE_DEL && op != BPT_BE_ADD) {
+    errno = EINVAL;
+    return -1;
+  }
+  msg.key = entry.key;
+  msg.val = entry.val;
+  msg.op = op;
+  bstat->be->msgs++;
+  if (bstat->height == 0)
+    return be_apply(bstat, bstat->root_node, &msg, 1, cmp);
+  if (be_add(bstat, bstat->root_node, &msg, 1, cmp) == -1)
+    return -1;
+  bstat->be->path[bstat->height] = bstat->root_node;
+  return be_flush_node(bstat, bstat->height, cmp);
+}
+
+/**
+ * bpt_be_search: search a write-optimized tree for an entry
+ * @valp: where the value found is stored, unless NULL
+ *
+ * Returns 0 if found, -1 if not.
+ */
+int bpt_be_search(struct bpt_stat *bstat, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), bpt_t *valp)
+{
+  struct bpt_node node = bstat->root_node;
+  struct bpt_be_buf *buf;
+  struct bpt_be_msg *msg;
+  struct bpt_slot *ls;
+  off_t add = 0;
+  int h, i, m, adding = 0;
+
+  COUNT(bstat, searches, 1);
+  COUNT(bstat, visits, bstat->height + 1);
+  for (h = bstat->height; h > 0; h--) {
+    if ((buf = node_buf(bstat, node)) != NULL && (i = be_find(bstat, buf, search_for, cmp)) < buf->n &&
+        KEY_CMP(bstat, buf->msgs[i].key, search_for, cmp) == 0) {
+      msg = &buf->msgs[i];
+      if (msg->op == BPT_BE_DEL && !adding)
+        return -1;
+      if (msg->op != BPT_BE_ADD) { // the newest message to tell the value
+        if (valp != NULL)
+          valp->off = (msg->op == BPT_BE_PUT ? msg->val.off : 0) + add;
+        return 0;
+      }
+      add += msg->val.off;
+      adding = 1;
+    }
+    for (m = bpt_node_nkey(node, bstat->order), i = 0; i < m; i++) {
+      if (KEY_CMP(bstat, search_for, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    node = bpt_node_child(node, i, bstat);
+  }
+  ls = bpt_leaf_slots(node);
+  for (m = bpt_node_nkey(node, bstat->order), i = 0; i < m; i++) {
+    if (KEY_CMP(bstat, search_for, ls[i].key, cmp) == 0)
+      break;
+  }
+  if (i == m && !adding)
+    return -1;
+  if (valp != NULL) {
+#ifndef BPT_SET
+    valp->off = (i < m ? ls[i].val.off : 0) + add;
+#else
+    valp->off = add;
+#endif
+  }
+  return 0;
+}
+
+/**
+ * bpt_be_flush: send every buffered message of a write-optimized tree down to the leaves
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_be_flush(struct bpt_stat *bstat, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  struct bpt_be *be = bstat->be;
+  struct bpt_be_buf *buf;
+  struct bpt_node node;
+  int h, d, rst = 0;
+
+  be->limit = 0;
+  for (h = bstat->height; h > 0 && rst == 0; h--) {
+    for (node = bstat->root_node, d = bstat->height; d > h; d--)
+      node = bpt_node_child(node, 0, bstat);
+    // nodes split off a node being flushed come right after it
+    for (; node.entries != NULL && rst == 0; node = bpt_node_nxt(node, bstat)) {
+      while (rst == 0 && (buf = node_buf(bstat, node)) != NULL && buf->n > 0) {
+        be_descend(bstat, buf->msgs[0].key, cmp);
+        rst = be_flush_node(bstat, h, cmp);
+      }
+    }
+  }
+  be->limit = be->buf_max;
+  return rst;
+}
+
+static int do_search(bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat, struct bpt_node *leafp)
+{
+  int i, m;
+  struct bpt_node node = bstat->root_node;
+  int h = bstat->height, order = bstat->order;
+
+  COUNT(bstat, searches, 1);
+  COUNT(bstat, visits, h + 1);
+  while (h) {
+    for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+      if (KEY_CMP(bstat, search_for, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    node = bpt_node_child(node, i, bstat);
+    h--;
+  } 
+  for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+    if (KEY_CMP(bstat, search_for, bpt_leaf_slots(node)[i].key, cmp) == 0) {
+      *leafp = node;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * bpt_search: search a B+ tree for an entry with specified key.
+ * @search_for: the specified key
+ * @cmp: pointer to a function comparing two keys. It returns an int greater than, equal to, or less than 0 to indicate
+ *       that the first argument is, repectively, larger than, same as, or smaller than the second argument.
+ * @bstat: pointer to the struct that states the B+ tree.
+ * @leafp: the node containing matched entry will be written to this address if such an entry really exists.
+ *
+ * Returns either the offset of the matched entry in its node whose value will be assigned to *@leafp, 
+ * or -1 to indicate the absence of an entry with the key @search_for.
+ */
+int bpt_search(bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat, struct bpt_node *leafp)
+{
+  struct bpt_entry entry;
+  int rst;
+  LAT_START(bstat, start);
+
+  PROBE(search__start, bstat);
+  rst = do_search(search_for, cmp, bstat, leafp);
+  PROBE(search__done, bstat, rst);
+  LAT_END(bstat, BPT_LAT_SEARCH, start);
+  if (bstat->trace != NULL) {
+    memset(&entry, 0, sizeof (entry));
+    entry.key = search_for;
+#ifndef BPT_SET
+    if (rst != -1)
+      entry.val = leafp->entries[rst].val;
+#endif
+    bstat->trace(bstat->trace_arg, BPT_TRACE_SEARCH, entry, rst != -1 ? BPT_PRED_SUCCESS : BPT_NEXIST);
+  }
+  return rst;
+}
+
+/**
+ * will_need: ask the kernel to read the pages of a file mapped range ahead
+ */
+static void will_need(struct bpt_stat *bstat, char *start, char *end)
+{
+  char *page = (char *)((uintptr_t)start & ~(uintptr_t)(bstat->page_sz - 1));
+
+  madvise(page, end - page, MADV_WILLNEED);
+}
+
+/**
+ * prefetch_node: start bringing a node into the cache, without waiting for it
+ *
+ * File mapped pages aren't advised here: a madvise() per node costs more than the read it
+ * may save once the page is resident. A batch advises a whole group at once instead, see
+ * will_need_group().
+ */
+static inline void prefetch_node(struct bpt_stat *bstat, struct bpt_node node)
+{
+  char *p = (char *)node.entries, *end = p + (bstat->order + 2) * sizeof (struct bpt_entry);
+
+  for (; p < end; p += 64)
+    __builtin_prefetch(p);
+}
+
+#define MINCORE_VEC 64 // pages mincore() is asked about at a time
+#define ADVISE_BACKOFF_MAX 64 // most groups a level goes unchecked after it was found resident
+
+/**
+ * span_resident: if every page from @start up to @end is in memory
+ *
+ * A span mincore() fails on is taken as not resident, so that it is advised all the same.
+ */
+static int span_resident(struct bpt_stat *bstat, char *start, char *end)
+{
+  unsigned char vec[MINCORE_VEC];
+  size_t len, i;
+
+  for (; start < end; start += len) {
+    len = end - start < MINCORE_VEC * bstat->page_sz ? end - start : MINCORE_VEC * bstat->page_sz;
+    if (mincore(start, len, vec) == -1)
+      return 0;
+    for (i = 0; i < (len + bstat->page_sz - 1) / bstat->page_sz; i++) {
+      if (!(vec[i] & 1))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * will_need_group: ask the kernel to read the file mapped pages of a group of nodes ahead
+ * @nodes: the nodes, in any order and with repeats
+ *
+ * The pages of the nodes are sorted and merged into contiguous spans, and a span is only
+ * advised if some page of it is missing, so that the reads of the whole group are under way
+ * together.
+ *
+ * Returns the number of spans advised.
+ */
+static int will_need_group(struct bpt_stat *bstat, const struct bpt_node *nodes, int n)
+{
+  char *lo[BPT_BATCH_GROUP], *hi[BPT_BATCH_GROUP], *l, *h;
+  uintptr_t mask = ~(uintptr_t)(bstat->page_sz - 1);
+  size_t node_sz = ((struct bpt_arena *)bstat->base)->node_sz;
+  int i, j, advised = 0;
+
+  for (i = 0; i < n; i++) { // insertion sort on the first page of each node
+    l = (char *)((uintptr_t)nodes[i].entries & mask);
+    h = (char *)(((uintptr_t)nodes[i].entries + node_sz + bstat->page_sz - 1) & mask);
+    for (j = i; j > 0 && lo[j-1] > l; j--) {
+      lo[j] = lo[j-1];
+      hi[j] = hi[j-1];
+    }
+    lo[j] = l;
+    hi[j] = h;
+  }
+  for (i = 0; i < n; i = j) {
+    for (h = hi[i], j = i + 1; j < n && lo[j] <= h; j++)
+      h = hi[j] > h ? hi[j] : h;
+    if (!span_resident(bstat, lo[i], h)) {
+      madvise(lo[i], h - lo[i], MADV_WILLNEED);
+      advised++;
+    }
+  }
+  return advised;
+}
+
+/**
+ * advise_level: will_need_group() for the nodes a group reached at one level, unless the level
+ * was found resident lately
+ * @backoff, @wait: state of the level, both 0 at first
+ *
+ * Each time the pages of a level are all resident, the level goes unchecked for twice as many
+ * groups as the last time, up to ADVISE_BACKOFF_MAX, so that a tree in memory costs next to no
+ * mincore() calls. A missing page sets the level back to checking every group.
+ */
+static void advise_level(struct bpt_stat *bstat, const struct bpt_node *nodes, int n, int *backoff, int *wait)
+{
+  if (*wait > 0)
+    (*wait)--;
+  else if (will_need_group(bstat, nodes, n) == 0) {
+    *backoff = *backoff == 0 ? 1 : *backoff * 2 < ADVISE_BACKOFF_MAX ? *backoff * 2 : ADVISE_BACKOFF_MAX;
+    *wait = *backoff;
+  } else
+    *backoff = 0;
+}
+
 /**
- * bpt_search: search a B+ tree for an entry with specified key.
- * @search_for: the specified key
- * @cmp: pointer to a function comparing two keys. It returns an int greater than, equal to, or less than 0 to indicate
- *       that the first argument is, repectively, larger than, same as, or smaller than the second argument.
+ * bpt_search_batch: search a B+ tree for many keys at once.
+ * @search_for: the keys
+ * @n: number of keys
+ * @cmp: pointer to a function comparing two keys, see bpt_search().
  * @bstat: pointer to the struct that states the B+ tree.
- * @leafp: the node containing matched entry will be written to this address if such an entry really exists.
+ * @leaves: for each key, the leaf node where it would be
+ * @offsets: for each key, offset of the matched entry in its leaf, or -1 if it's absent
  *
- * Returns either the offset of the matched entry in its node whose value will be assigned to *@leafp, 
- * or -1 to indicate the absence of an entry with the key @search_for.
+ * Lookups descend level by level in groups of BPT_BATCH_GROUP. Each one prefetches the child it
+ * goes to and yields to the next lookup of the group, so the cache misses of a whole group overlap
+ * instead of being waited for one by one. In a tree mapped from a file, the nodes a group goes to
+ * next are advised with MADV_WILLNEED together once the level is done, so that their page faults
+ * overlap as well. Pages found resident aren't advised, and levels found resident are checked
+ * less and less often, see advise_level().
+ *
+ * Returns the number of keys found.
  */
-int bpt_search(bpt_t search_for, int (*cmp)(bpt_t, bpt_t), struct bpt_stat *bstat, struct bpt_node *leafp)
+int bpt_search_batch(const bpt_key_t *search_for, int n, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat,
+    struct bpt_node *leaves, int *offsets)
 {
-  int i, m;
-  struct bpt_node node = bstat->root_node;
-  int h = bstat->height, order = bstat->order;
+  int g, j, end, i, m, h, found = 0;
+  int order = bstat->order;
+  int backoff[BPT_STATS_HEIGHT], wait[BPT_STATS_HEIGHT]; // per level, see advise_level()
+  struct bpt_node node;
 
-  while (h) {
-    for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
-      if (cmp(search_for, node.entries[i].key) < 0)
-        break;
+  if (bstat->paged) {
+    memset(backoff, 0, sizeof (backoff));
+    memset(wait, 0, sizeof (wait));
+  }
+
+  COUNT(bstat, searches, n);
+  COUNT(bstat, visits, (unsigned long)n * (bstat->height + 1));
+  for (g = 0; g < n; g += BPT_BATCH_GROUP) {
+    end = g + BPT_BATCH_GROUP < n ? g + BPT_BATCH_GROUP : n;
+    for (j = g; j < end; j++)
+      leaves[j] = bstat->root_node;
+    for (h = bstat->height; h > 0; h--) {
+      for (j = g; j < end; j++) {
+        node = leaves[j];
+        for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+          if (KEY_CMP(bstat, search_for[j], node.entries[i].key, cmp) < 0)
+            break;
+        }
+        leaves[j] = bpt_node_child(node, i, bstat);
+        prefetch_node(bstat, leaves[j]);
+      }
+      if (bstat->paged && h < BPT_STATS_HEIGHT)
+        advise_level(bstat, &leaves[g], end - g, &backoff[h], &wait[h]);
     }
-    node.entries = node.entries[i].val.ptr;
-    h--;
-  } 
-  for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
-    if (cmp(search_for, node.entries[i].key) == 0) {
-      *leafp = node;
-      return i;
+    for (j = g; j < end; j++) {
+      node = leaves[j];
+      offsets[j] = -1;
+      for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+        if (KEY_CMP(bstat, search_for[j], bpt_leaf_slots(node)[i].key, cmp) == 0) {
+          offsets[j] = i;
+          found++;
+          break;
+        }
+      }
     }
   }
-  return -1;
+  return found;
 }
 
 /**
@@ -110,7 +2046,7 @@ int bpt_search(bpt_t search_for, int (*cmp)(bpt_t, bpt_t), struct bpt_stat *bsta
  * @leafp->entries will be either set as NULL if the -1 return value is because of a failed system call,
  * or as the leaf node if that is because of no such a key.
  */
-int bpt_searchr(bpt_t search_for, int (*cmp)(bpt_t, bpt_t),
+int bpt_searchr(bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat, struct bpt_node *leafp)
 {
@@ -126,25 +2062,276 @@ int bpt_searchr(bpt_t search_for, int (*cmp)(bpt_t, bpt_t),
   } else
     stk->cnt = 0;
 
+  COUNT(bstat, visits, h + 1);
   while (h) {
     for (m = bpt_node_nkey(frm.node, order), frm.offset = 0; frm.offset < m; frm.offset++) {
-      if (cmp(search_for, frm.node.entries[frm.offset].key) < 0)
+      if (KEY_CMP(bstat, search_for, frm.node.entries[frm.offset].key, cmp) < 0)
         break;
     }
     if (gen_stk_push(stk, &frm) == -1)
       return -1;
-    frm.node.entries = frm.node.entries[frm.offset].val.ptr;
+    frm.node = bpt_node_child(frm.node, frm.offset, bstat);
     h--;
   } 
   if (leafp != NULL)
     *leafp = frm.node;
   for (m = bpt_node_nkey(frm.node, order), frm.offset = 0; frm.offset < m; frm.offset++) {
-    if (cmp(search_for, frm.node.entries[frm.offset].key) == 0) 
+    if (KEY_CMP(bstat, search_for, bpt_leaf_slots(frm.node)[frm.offset].key, cmp) == 0)
       return frm.offset;
   }
   return -1;
 }
 
+/**
+ * cursor_readahead: prefetch what a cursor just stepped into a new leaf will read next
+ *
+ * The next leaf is always prefetched into the cache. Once the cursor looks sequential and the
+ * arena is mapped from a file, the arena range behind the leaf is read ahead as well, a window
+ * of BPT_READAHEAD leaves at a time: splits place new leaves right behind their predecessor,
+ * so that range mostly holds the leaves to come.
+ */
+static void cursor_readahead(struct bpt_cursor *cur)
+{
+  struct bpt_stat *bstat = cur->bstat;
+  struct bpt_arena *arena;
+  struct bpt_node nxt;
+  char *leaf = (char *)cur->leaf.entries, *end, *p;
+  size_t len;
+
+  if ((nxt = bpt_node_nxt(cur->leaf, bstat)).entries != NULL) {
+    end = (char *)nxt.entries + (bstat->order + 2) * sizeof (struct bpt_entry);
+    for (p = (char *)nxt.entries; p < end; p += 64)
+      __builtin_prefetch(p);
+  }
+  if (!bstat->paged || cur->seq < BPT_SEQ_TRIGGER)
+    return;
+  arena = (struct bpt_arena *)bstat->base;
+  len = BPT_READAHEAD * arena->node_sz;
+  if (leaf >= cur->ra_start && leaf + len / 2 < cur->ra_end)
+    return;
+  end = leaf + len < bstat->base + arena->brk ? leaf + len : bstat->base + arena->brk;
+  will_need(bstat, leaf, end);
+  cur->ra_start = leaf;
+  cur->ra_end = end;
+}
+
+/**
+ * cursor_settle: move a cursor past the end of its leaf to the next entry along the leaf chain
+ *
+ * Returns 0 if the cursor is at an entry, -1 if it ran off the last leaf.
+ */
+static int cursor_settle(struct bpt_cursor *cur)
+{
+  struct bpt_stat *bstat = cur->bstat;
+
+  while (cur->leaf.entries != NULL && cur->offset >= bpt_node_nkey(cur->leaf, bstat->order)) {
+    cur->leaf = bpt_node_nxt(cur->leaf, bstat);
+    cur->offset = 0;
+    if (cur->leaf.entries != NULL) {
+      cur->seq++;
+      cursor_readahead(cur);
+    }
+  }
+  return cur->leaf.entries == NULL ? -1 : 0;
+}
+
+/**
+ * bpt_cursor_first: put a cursor at the smallest entry of a B+ tree
+ *
+ * A cursor is invalidated by any mutation of the tree.
+ *
+ * Returns 0 if OK, -1 if the tree is empty.
+ */
+int bpt_cursor_first(struct bpt_cursor *cur, struct bpt_stat *bstat)
+{
+  struct bpt_node node = bstat->root_node;
+  int h;
+
+  for (h = bstat->height; h > 0; h--)
+    node = bpt_node_child(node, 0, bstat);
+  cur->bstat = bstat;
+  cur->leaf = node;
+  cur->offset = 0;
+  cur->seq = 0;
+  cur->ra_start = cur->ra_end = NULL;
+  return cursor_settle(cur);
+}
+
+/**
+ * bpt_cursor_seek: put a cursor at the smallest entry whose key is not less than @search_for
+ * @cmp: pointer to a function comparing two keys, see bpt_search().
+ *
+ * Returns 0 if OK, -1 if every key is less than @search_for.
+ */
+int bpt_cursor_seek(struct bpt_cursor *cur, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat)
+{
+  struct bpt_node node = bstat->root_node;
+  int h, i, m, order = bstat->order;
+
+  COUNT(bstat, visits, bstat->height + 1);
+  for (h = bstat->height; h > 0; h--) {
+    for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+      if (KEY_CMP(bstat, search_for, node.entries[i].key, cmp) < 0)
+        break;
+    }
+    node = bpt_node_child(node, i, bstat);
+  }
+  for (m = bpt_node_nkey(node, order), i = 0; i < m; i++) {
+    if (KEY_CMP(bstat, search_for, bpt_leaf_slots(node)[i].key, cmp) <= 0)
+      break;
+  }
+  cur->bstat = bstat;
+  cur->leaf = node;
+  cur->offset = i;
+  cur->seq = 0;
+  cur->ra_start = cur->ra_end = NULL;
+  return cursor_settle(cur);
+}
+
+/**
+ * bpt_cursor_next: step a cursor to the next entry
+ *
+ * Returns 0 if OK, -1 if the cursor ran off the last entry.
+ */
+int bpt_cursor_next(struct bpt_cursor *cur)
+{
+  cur->offset++;
+  return cursor_settle(cur);
+}
+
+/**
+ * bpt_hist_percentile: the latency below which @pct percent of those recorded fall
+ *
+ * Returns the top of the bucket holding that rank, or the largest latency recorded if
+ * that is lower; 0 for an empty histogram.
+ */
+uint64_t bpt_hist_percentile(const struct bpt_hist *hist, double pct)
+{
+  unsigned long rank, seen = 0;
+  uint64_t top;
+  int b, e;
+
+  if (hist->total == 0)
+    return 0;
+  rank = pct >= 100 ? hist->total : (unsigned long)(hist->total * pct / 100) + 1;
+  for (b = 0; b < BPT_HIST_BUCKETS; b++) {
+    if ((seen += hist->count[b]) >= rank)
+      break;
+  }
+  if (b < BPT_HIST_SUB)
+    top = b;
+  else {
+    e = b / BPT_HIST_SUB + 2;
+    top = ((uint64_t)(BPT_HIST_SUB + b % BPT_HIST_SUB + 1) << (e - 3)) - 1;
+  }
+  return top < hist->max ? top : hist->max;
+}
+
+void bpt_hist_merge(struct bpt_hist *to, const struct bpt_hist *from)
+{
+  int b;
+
+  for (b = 0; b < BPT_HIST_BUCKETS; b++)
+    to->count[b] += from->count[b];
+  to->total += from->total;
+  if (from->max > to->max)
+    to->max = from->max;
+}
+
+#ifdef BPT_STATS
+// add up counters a reader may still be adding to, every field an unsigned long
+static void add_counters(struct bpt_counters *to, struct bpt_counters *from)
+{
+  unsigned long *t = (unsigned long *)to, *f = (unsigned long *)from;
+  size_t i;
+
+  for (i = 0; i < sizeof (*to) / sizeof (unsigned long); i++)
+    t[i] += __atomic_load_n(&f[i], __ATOMIC_RELAXED);
+}
+#endif
+
+/**
+ * bpt_get_stats: walk every node of a tree to report its shape, along with its counters
+ * @st: where to report
+ *
+ * Each level is walked along its sibling links, so it takes a live tree, not a snapshot view.
+ */
+void bpt_get_stats(struct bpt_stat *bstat, struct bpt_tree_stats *st)
+{
+  struct bpt_node first = bstat->root_node, node;
+  size_t node_sz;
+  int h, m, cap;
+
+  memset(st, 0, sizeof (*st));
+#ifdef BPT_STATS
+  st->counters = bstat->counters;
+  if (bstat->olc != NULL) {
+    for (h = 0; h < BPT_EBR_READERS; h++)
+      add_counters(&st->counters, &bstat->olc->slots[h].counters);
+  }
+#endif
+  if (bstat->base != NULL)
+    node_sz = ((struct bpt_arena *)bstat->base)->node_sz;
+  else
+    node_sz = node_size(bstat);
+  st->height = bstat->height;
+  for (h = bstat->height; h >= 0; h--) {
+    cap = h > 0 ? bstat->order : bstat->leaf_order;
+    for (node = first; node.entries != NULL; node = bpt_node_nxt(node, bstat)) {
+      m = bpt_node_nkey(node, bstat->order);
+      if (h < BPT_STATS_HEIGHT)
+        st->nodes[h]++;
+      if (h > 0)
+        st->inter_fill[m * BPT_FILL_BUCKETS / (cap + 1)]++;
+      else {
+        st->leaf_fill[m * BPT_FILL_BUCKETS / (cap + 1)]++;
+        st->entries += m;
+      }
+      st->bytes += node_sz;
+    }
+    if (h > 0)
+      first = bpt_node_child(first, 0, bstat);
+  }
+}
+
+/**
+ * bpt_free: release every node of a tree, a level at a time along the sibling links
+ *
+ * It takes a live tree, not a snapshot view, and one no other thread reads any more.
+ */
+void bpt_free(struct bpt_stat *bstat)
+{
+  struct bpt_node first = bstat->root_node, node, nxt;
+  int h;
+
+  for (h = bstat->height; h >= 0; h--) {
+    nxt = h > 0 ? bpt_node_child(first, 0, bstat) : bpt_null_node;
+    for (node = first; node.entries != NULL; node = first) {
+      first = bpt_node_nxt(node, bstat);
+      bpt_node_delete(bstat, node);
+    }
+    first = nxt;
+  }
+}
+
+#ifdef BPT_KEY_SIZE
+/**
+ * bpt_key_cmp_words: order wide keys as unsigned words, the first one most significant
+ */
+int bpt_key_cmp_words(bpt_key_t a, bpt_key_t b)
+{
+  return bpt_key_words(a, b);
+}
+
+/**
+ * bpt_key_cmp_bytes: order wide keys as memcmp() does
+ */
+int bpt_key_cmp_bytes(bpt_key_t a, bpt_key_t b)
+{
+  return memcmp(a.b, b.b, BPT_KEY_SIZE);
+}
+#endif
+
 int bpt_pred_1(bpt_t a, bpt_t b)
 {
   return 1;
@@ -155,6 +2342,35 @@ int bpt_pred_0(bpt_t a, bpt_t b)
   return 0;
 }
 
+static int do_insert(struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
+    struct gen_stk *stk, int has_stk_init,
+    struct bpt_stat *bstat)
+{
+  int m;
+  int h = bstat->height;
+  struct bpt_frm frm = { .node = bstat->root_node };
+
+  if (!has_stk_init) {
+    if (gen_stk_init(stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+      return -1;
+  } else
+    stk->cnt = 0;
+
+  COUNT(bstat, inserts, 1);
+  COUNT(bstat, visits, h + 1);
+  while (h) {
+    for (m = bpt_node_nkey(frm.node, bstat->order), frm.offset = 0; frm.offset < m; frm.offset++) {
+      if (KEY_CMP(bstat, new_entry.key, frm.node.entries[frm.offset].key, cmp) < 0) 
+          break;
+    }
+    if (gen_stk_push(stk, &frm) == -1)
+      return -1;
+    frm.node = bpt_node_child(frm.node, frm.offset, bstat);
+    h--;
+  }
+  return leaf_insert(new_entry, cmp, pred, frm.node, stk, bstat);
+}
+
 /*
  * bpt_insert: insert a new entry to a B+ tree.
  * @new_entry: the entry to be inserted.
@@ -174,34 +2390,23 @@ int bpt_pred_0(bpt_t a, bpt_t b)
  *                       and the replacement succeeded;
  *  BPT_ERROR if any system call failure occurs;
  */
-int bpt_insert(struct bpt_entry new_entry, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+int bpt_insert(struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat)
 {
-  int m;
-  int h = bstat->height;
-  struct bpt_frm frm = { .node = bstat->root_node };
-
-  if (!has_stk_init) {
-    if (gen_stk_init(stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
-      return -1;
-  } else
-    stk->cnt = 0;
+  int rst;
+  LAT_START(bstat, start);
 
-  while (h) {
-    for (m = bpt_node_nkey(frm.node, bstat->order), frm.offset = 0; frm.offset < m; frm.offset++) {
-      if (cmp(new_entry.key, frm.node.entries[frm.offset].key) < 0) 
-          break;
-    }
-    if (gen_stk_push(stk, &frm) == -1)
-      return -1;
-    frm.node.entries = frm.node.entries[frm.offset].val.ptr;
-    h--;
-  }
-  return leaf_insert(new_entry, cmp, pred, frm.node, stk, bstat);
+  PROBE(insert__start, bstat);
+  rst = do_insert(new_entry, cmp, pred, stk, has_stk_init, bstat);
+  PROBE(insert__done, bstat, rst);
+  LAT_END(bstat, BPT_LAT_INSERT, start);
+  if (bstat->trace != NULL)
+    bstat->trace(bstat->trace_arg, BPT_TRACE_INSERT, new_entry, rst);
+  return rst;
 }
 
-static void update_index(bpt_t new_key, struct gen_stk *stk)
+static void update_index(bpt_key_t new_key, struct gen_stk *stk)
 {
   struct bpt_frm frm;
   while (!gen_stk_empty(stk)) {
@@ -275,86 +2480,118 @@ static void mid_between_prv_nxt(struct gen_stk *stk, struct bpt_node *prv_mid_no
  *           
  * returns: identical to bpt_insert().
  */
-static int leaf_insert(struct bpt_entry new_entry, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+static int leaf_insert(struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct bpt_node leaf, struct gen_stk *stk, struct bpt_stat *bstat)
 {
-  int offset, order = bstat->order;
+  int offset, order = bstat->order, leaf_order = bstat->leaf_order;
   int m, result, i;
   struct bpt_node nxt, prv;
+  struct bpt_slot *ls = bpt_leaf_slots(leaf), *ps, *ns, new_slot;
 
   // insert new entry to leaf node
   for (m = bpt_node_nkey(leaf, order), offset = 0; offset < m; offset++) {
-    result = cmp(new_entry.key, leaf.entries[offset].key);
+    result = KEY_CMP(bstat, new_entry.key, ls[offset].key, cmp);
     if (result < 0) 
       break;
     else if (result == 0) {
-      if (pred(new_entry.val, leaf.entries[offset].val)) {
-        leaf.entries[offset].val = new_entry.val;
+#ifdef BPT_SET
+      return BPT_PRED_FAIL;
+#else
+      if (pred(new_entry.val, ls[offset].val)) {
+        if (bstat->log != NULL && bstat->log(bstat->log_arg, BPT_LOG_PUT, new_entry) == -1)
+          return BPT_ERROR;
+        if (bstat->cow != NULL && cow_prepare(bstat, stk, &leaf, COW_IN_PLACE) == -1)
+          return BPT_ERROR;
+        if (bstat->olc != NULL && olc_prepare(bstat, stk, leaf, COW_IN_PLACE, offset) == -1)
+          return BPT_ERROR;
+        bpt_leaf_slots(leaf)[offset].val = new_entry.val;
         return BPT_PRED_SUCCESS;
       } else 
         return BPT_PRED_FAIL;
+#endif
     }
   }
-  if (m < order) {
-    memmove(&leaf.entries[offset+1], &leaf.entries[offset], (m - offset) * sizeof (struct bpt_entry));
-    leaf.entries[offset] = new_entry;
+  if (bstat->log != NULL && bstat->log(bstat->log_arg, BPT_LOG_PUT, new_entry) == -1)
+    return BPT_ERROR;
+  if (bstat->cow != NULL && cow_prepare(bstat, stk, &leaf, m < leaf_order ? COW_IN_PLACE : COW_INSERT_FULL) == -1)
+    return BPT_ERROR;
+  if (bstat->olc != NULL && olc_prepare(bstat, stk, leaf, m < leaf_order ? COW_IN_PLACE : COW_INSERT_FULL, offset) == -1)
+    return BPT_ERROR;
+  ls = bpt_leaf_slots(leaf);
+#ifdef BPT_SET
+  new_slot.key = new_entry.key;
+#else
+  new_slot = new_entry;
+#endif
+  if (m < leaf_order) {
+    memmove(&ls[offset+1], &ls[offset], (m - offset) * sizeof (struct bpt_slot));
+    ls[offset] = new_slot;
     bpt_node_set_nkey(leaf, order, m+1);
-  } else { // m == order, leaf node is full
-    nxt = bpt_node_nxt(leaf, order);
-    prv = bpt_node_prv(leaf, order);
-
-    if (prv.entries != NULL &&
-        (i = bpt_node_nkey(prv, order)) != order) { // push the minimum entry to previous leaf node
-      prv.entries[i] = leaf.entries[0];
-      memmove(&leaf.entries[0], &leaf.entries[1], (offset - 1) * sizeof (struct bpt_entry));
-      leaf.entries[offset - 1] = new_entry;
-      update_index(leaf.entries[0].key, stk);
+  } else { // m == leaf_order, leaf node is full
+    nxt = bpt_node_nxt(leaf, bstat);
+    prv = bpt_node_prv(leaf, bstat);
+    ps = bpt_leaf_slots(prv);
+    ns = bpt_leaf_slots(nxt);
+
+    // keys only move right in B-link trees, so their full leaves always split
+    if (!blink_mode(bstat) && prv.entries != NULL &&
+        (i = bpt_node_nkey(prv, order)) != leaf_order) { // push the minimum entry to previous leaf node
+      ps[i] = ls[0];
+      memmove(&ls[0], &ls[1], (offset - 1) * sizeof (struct bpt_slot));
+      ls[offset - 1] = new_slot;
+      update_index(ls[0].key, stk);
       bpt_node_set_nkey(prv, order, i+1);
+      COUNT(bstat, borrows, 1);
       return BPT_NEXIST;
-    } else if (nxt.entries != NULL &&
-        (i = bpt_node_nkey(nxt, order)) != order) { // push the maximum entry to next leaf node
-      memmove(&nxt.entries[1], &nxt.entries[0], i * sizeof (struct bpt_entry));
-      if (offset == order) {
-        nxt.entries[0] = new_entry;
+    } else if (!blink_mode(bstat) && nxt.entries != NULL &&
+        (i = bpt_node_nkey(nxt, order)) != leaf_order) { // push the maximum entry to next leaf node
+      memmove(&ns[1], &ns[0], i * sizeof (struct bpt_slot));
+      if (offset == leaf_order) {
+        ns[0] = new_slot;
       } else {
-        nxt.entries[0] = leaf.entries[order-1];
-        memmove(&leaf.entries[offset+1], &leaf.entries[offset], (order-offset-1) * sizeof (struct bpt_entry));
-        leaf.entries[offset] = new_entry;
+        ns[0] = ls[leaf_order-1];
+        memmove(&ls[offset+1], &ls[offset], (leaf_order-offset-1) * sizeof (struct bpt_slot));
+        ls[offset] = new_slot;
       }
       struct bpt_node mid_node;
       int mid_offset;
       mid_offset = mid_between_nxt(stk, &mid_node, order);
       assert(mid_offset != -1);
-      mid_node.entries[mid_offset].key = nxt.entries[0].key;
+      mid_node.entries[mid_offset].key = ns[0].key;
       bpt_node_set_nkey(nxt, order, i+1);
+      COUNT(bstat, borrows, 1);
       return BPT_NEXIST;
     } else { // split this leaf node 
       struct bpt_node new_node;
+      struct bpt_slot *nws;
 
-      new_node = bpt_node_new(order, leaf, nxt);
+      new_node = bpt_node_new(bstat, leaf, nxt);
       if (new_node.entries == NULL) {
 #ifndef NDEBUG
         fprintf(stderr, "\nBPT_ERROR 2\n");
 #endif
         return BPT_ERROR;
       }
+      nws = bpt_leaf_slots(new_node);
+      COUNT(bstat, leaf_splits, 1);
+      PROBE(leaf__split, bstat, leaf.entries, new_node.entries);
       bpt_node_set_nkey(leaf, order, bstat->old_leaf_nkey);
       bpt_node_set_nkey(new_node, order, bstat->new_leaf_nkey);
-      bpt_node_set_nxt(leaf, order, new_node);
+      bpt_node_set_nxt(leaf, new_node, bstat);
       if (nxt.entries != NULL) {
-        bpt_node_set_prv(nxt, order, new_node);
+        bpt_node_set_prv(nxt, new_node, bstat);
       }
       if (offset >= bstat->old_leaf_nkey) {
         int ins_pos;
         ins_pos = offset - bstat->old_leaf_nkey;
-        memcpy(&new_node.entries[0], &leaf.entries[bstat->old_leaf_nkey], ins_pos * sizeof (struct bpt_entry));
-        new_node.entries[ins_pos] = new_entry;
-        memcpy(&new_node.entries[ins_pos+1], &leaf.entries[offset], (order - offset) * sizeof (struct bpt_entry));
+        memcpy(&nws[0], &ls[bstat->old_leaf_nkey], ins_pos * sizeof (struct bpt_slot));
+        nws[ins_pos] = new_slot;
+        memcpy(&nws[ins_pos+1], &ls[offset], (leaf_order - offset) * sizeof (struct bpt_slot));
         return internal_insert(leaf, new_node, stk, bstat);
       } else {
-        memcpy(&new_node.entries[0], &leaf.entries[bstat->old_leaf_nkey-1], bstat->new_leaf_nkey * sizeof (struct bpt_entry));
-        memmove(&leaf.entries[offset+1], &leaf.entries[offset], (bstat->old_leaf_nkey - offset - 1) * sizeof (struct bpt_entry));
-        leaf.entries[offset] = new_entry;
+        memcpy(&nws[0], &ls[bstat->old_leaf_nkey-1], bstat->new_leaf_nkey * sizeof (struct bpt_slot));
+        memmove(&ls[offset+1], &ls[offset], (bstat->old_leaf_nkey - offset - 1) * sizeof (struct bpt_slot));
+        ls[offset] = new_slot;
         return internal_insert(leaf, new_node, stk, bstat);
       }
     }
@@ -375,16 +2612,18 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
     struct gen_stk *stk, struct bpt_stat *bstat)
 {
   int order;
-  bpt_t mid;
+  bpt_key_t mid;
   struct bpt_frm frm;
 
   order = bstat->order;
   mid = right_node.entries[0].key;
 
   while (1) {
+    if (blink_mode(bstat))
+      blink_split(bstat, left_node, right_node, mid);
     if (gen_stk_empty(stk)) { // root node has been splitted
       struct bpt_node new_root;
-      new_root = bpt_node_new(bstat->order, bpt_null_node, bpt_null_node);
+      new_root = bpt_node_new(bstat, bpt_null_node, bpt_null_node);
       if (new_root.entries == NULL) {
 #ifndef NDEBUG
         fprintf(stderr, "\nBPT_ERROR 3\n");
@@ -393,38 +2632,43 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
       }
       bpt_node_set_nkey(new_root, order, 1);
       new_root.entries[0].key = mid;
-      new_root.entries[0].val.ptr = left_node.entries;
-      new_root.entries[1].val.ptr = right_node.entries;
-      bstat->root_node = new_root;
-      bstat->height++;
+      bpt_node_set_child(new_root, 0, left_node, bstat);
+      bpt_node_set_child(new_root, 1, right_node, bstat);
+      set_root(bstat, new_root, bstat->height + 1);
+      COUNT(bstat, root_grows, 1);
+      PROBE(root__grow, bstat, bstat->height);
       break;
     } else {
       int m;
 
       gen_stk_pop(stk, &frm);
+      if (blink_mode(bstat) && blink_couple(bstat, frm.node, bstat->height - stk->cnt) == -1)
+        return BPT_ERROR;
       m = bpt_node_nkey(frm.node, order);
       if (m < order) {
         memmove(&frm.node.entries[frm.offset+1], &frm.node.entries[frm.offset], (m + 1 - frm.offset) * sizeof (struct bpt_entry));
         frm.node.entries[frm.offset].key = mid;
-        frm.node.entries[frm.offset+1].val.ptr = right_node.entries;
+        bpt_node_set_child(frm.node, frm.offset+1, right_node, bstat);
         bpt_node_set_nkey(frm.node, order, m+1);
         break;
       } else { // split internal node
-        bpt_t new_mid;
+        bpt_key_t new_mid;
         struct bpt_node new_node, nxt;
 
-        nxt = bpt_node_nxt(frm.node, order);
-        new_node = bpt_node_new(order, frm.node, nxt);
+        nxt = bpt_node_nxt(frm.node, bstat);
+        new_node = bpt_node_new(bstat, frm.node, nxt);
         if (new_node.entries == NULL) {
 #ifndef NDEBUG
           fprintf(stderr, "\nBPT_ERROR 4\n");
 #endif
           return BPT_ERROR;
         }
-        bpt_node_set_nxt(frm.node, order, new_node);
+        bpt_node_set_nxt(frm.node, new_node, bstat);
         if (nxt.entries != NULL) {
-          bpt_node_set_prv(nxt, order, new_node);
+          bpt_node_set_prv(nxt, new_node, bstat);
         }
+        COUNT(bstat, inter_splits, 1);
+        PROBE(inter__split, bstat, frm.node.entries, new_node.entries);
 
         if (frm.offset < bstat->old_inter_nkey) {
           new_mid = frm.node.entries[bstat->old_inter_nkey-1].key;
@@ -432,7 +2676,7 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
           memmove(&frm.node.entries[frm.offset+1], &frm.node.entries[frm.offset], 
               (bstat->old_inter_nkey - frm.offset) * sizeof (struct bpt_entry));
           frm.node.entries[frm.offset].key = mid;
-          frm.node.entries[frm.offset+1].val.ptr = right_node.entries;
+          bpt_node_set_child(frm.node, frm.offset+1, right_node, bstat);
         } else if (frm.offset > bstat->old_inter_nkey) {
           int front;
           new_mid = frm.node.entries[bstat->old_inter_nkey].key;
@@ -440,11 +2684,11 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
           memcpy(&new_node.entries[0], &frm.node.entries[bstat->old_inter_nkey+1], front * sizeof (struct bpt_entry));
           memcpy(&new_node.entries[front], &frm.node.entries[frm.offset], (bstat->new_inter_nkey + 1 - front) * sizeof (struct bpt_entry));
           new_node.entries[front-1].key = mid;
-          new_node.entries[front].val.ptr = right_node.entries;
+          bpt_node_set_child(new_node, front, right_node, bstat);
         } else { // if (frm.offset + 1 == bstat->old_inter_nkey)
           new_mid = mid;
           memcpy(&new_node.entries[0], &frm.node.entries[bstat->old_inter_nkey], (bstat->new_inter_nkey + 1) * sizeof (struct bpt_entry));
-          new_node.entries[0].val.ptr = right_node.entries;
+          bpt_node_set_child(new_node, 0, right_node, bstat);
         }
 
         bpt_node_set_nkey(frm.node, order, bstat->old_inter_nkey);
@@ -458,6 +2702,30 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
   return BPT_NEXIST;
 }
 
+static int do_delete(struct bpt_entry pair, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
+    struct gen_stk *stk, int has_stk_init,
+    struct bpt_stat *bstat)
+{
+  struct bpt_node leaf;
+  int offset;
+
+  COUNT(bstat, deletes, 1);
+  if ((offset = bpt_searchr(pair.key, cmp, stk, has_stk_init, bstat, &leaf)) == -1) {
+    if (leaf.entries == NULL)
+      return BPT_ERROR;
+    else
+      return BPT_NEXIST;
+  }
+#ifdef BPT_SET
+  return bpt_delete_entry(leaf, offset, stk, bstat);
+#else
+  if (pred(pair.val, leaf.entries[offset].val))
+    return bpt_delete_entry(leaf, offset, stk, bstat);
+  else
+    return BPT_PRED_FAIL;
+#endif
+}
+
 /*
  * bpt_delete: delete an entry with specified key from a B+ tree.
  * @pair: a key-value pair whose key is what the function searchs for. Its value part works with the argument @pred shown below.
@@ -477,89 +2745,106 @@ static int internal_insert(struct bpt_node left_node, struct bpt_node right_node
  *                       and the deletion succeeded;
  *  BPT_ERROR if any system call failure occurs;
  */
-int bpt_delete(struct bpt_entry pair, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+int bpt_delete(struct bpt_entry pair, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat)
 {
-  struct bpt_node leaf;
-  int offset;
+  int rst;
+  LAT_START(bstat, start);
 
-  if ((offset = bpt_searchr(pair.key, cmp, stk, has_stk_init, bstat, &leaf)) == -1) {
-    if (leaf.entries == NULL)
-      return BPT_ERROR;
-    else
-      return BPT_NEXIST;
-  }
-  if (pred(pair.val, leaf.entries[offset].val))
-    return bpt_delete_entry(leaf, offset, stk, bstat);
-  else
-    return BPT_PRED_FAIL;
+  PROBE(delete__start, bstat);
+  rst = do_delete(pair, cmp, pred, stk, has_stk_init, bstat);
+  PROBE(delete__done, bstat, rst);
+  LAT_END(bstat, BPT_LAT_DELETE, start);
+  if (bstat->trace != NULL)
+    bstat->trace(bstat->trace_arg, BPT_TRACE_DELETE, pair, rst);
+  return rst;
 }
 
 int bpt_delete_entry(struct bpt_node leaf, int offset, struct gen_stk *stk, struct bpt_stat *bstat)
 {
   int order = bstat->order;
-  int m = bpt_node_nkey(leaf, order), minimal_leaf_nkey = bstat->new_leaf_nkey;
+  int m = bpt_node_nkey(leaf, order), minimal_leaf_nkey = bstat->min_leaf_nkey;
+  struct bpt_slot *ls = bpt_leaf_slots(leaf), *ps, *ns;
+  struct bpt_entry gone;
+
+#ifdef BPT_SET
+  gone.key = ls[offset].key;
+  gone.val.off = 0;
+#else
+  gone = ls[offset];
+#endif
+  if (bstat->log != NULL && bstat->log(bstat->log_arg, BPT_LOG_DEL, gone) == -1)
+    return BPT_ERROR;
+  if (bstat->cow != NULL && cow_prepare(bstat, stk, &leaf, COW_DELETE) == -1)
+    return BPT_ERROR;
+  if (bstat->olc != NULL && olc_prepare(bstat, stk, leaf, COW_DELETE, offset) == -1)
+    return BPT_ERROR;
+  ls = bpt_leaf_slots(leaf);
   if (m != minimal_leaf_nkey || gen_stk_empty(stk)) {
-    memmove(&leaf.entries[offset], &leaf.entries[offset+1], (m - offset - 1) * sizeof (struct bpt_entry));
+    memmove(&ls[offset], &ls[offset+1], (m - offset - 1) * sizeof (struct bpt_slot));
     if (offset == 0)
-      update_index(leaf.entries[0].key, stk);
+      update_index(ls[0].key, stk);
     bpt_node_set_nkey(leaf, order, m - 1);
     return BPT_PRED_SUCCESS;
   } else { // m == minimal_leaf_nkey && frm.node is not root node
-    struct bpt_node prv = bpt_node_prv(leaf, order),
-                    nxt = bpt_node_nxt(leaf, order);
+    struct bpt_node prv = bpt_node_prv(leaf, bstat),
+                    nxt = bpt_node_nxt(leaf, bstat);
     int prv_nkey, nxt_nkey, sum;
     int post_sz = minimal_leaf_nkey - 1 - offset;
+    ps = bpt_leaf_slots(prv);
+    ns = bpt_leaf_slots(nxt);
     if (prv.entries != NULL && (prv_nkey = bpt_node_nkey(prv, order)) != minimal_leaf_nkey) {
       // grab some entries from prv to pad current node
       sum = (minimal_leaf_nkey-1) + prv_nkey;
       int right_nkey = sum / 2, left_nkey = sum - right_nkey;
       int grab = right_nkey - (minimal_leaf_nkey-1);
-      memmove(&leaf.entries[grab+offset], &leaf.entries[offset+1], post_sz * sizeof (struct bpt_entry));
-      memmove(&leaf.entries[grab], &leaf.entries[0], offset * sizeof (struct bpt_entry));
-      memcpy(&leaf.entries[0], &prv.entries[left_nkey], grab * sizeof (struct bpt_entry));
+      memmove(&ls[grab+offset], &ls[offset+1], post_sz * sizeof (struct bpt_slot));
+      memmove(&ls[grab], &ls[0], offset * sizeof (struct bpt_slot));
+      memcpy(&ls[0], &ps[left_nkey], grab * sizeof (struct bpt_slot));
       bpt_node_set_nkey(prv, order, left_nkey);
       bpt_node_set_nkey(leaf, order, right_nkey);
-      update_index(leaf.entries[0].key, stk);
+      update_index(ls[0].key, stk);
+      COUNT(bstat, borrows, 1);
       return BPT_PRED_SUCCESS;
     } else if (nxt.entries != NULL && (nxt_nkey = bpt_node_nkey(nxt, order)) != minimal_leaf_nkey) {
       // grab some entries from nxt to pad current node
       sum = (minimal_leaf_nkey-1) + nxt_nkey;
       int left_nkey = sum / 2, right_nkey = sum - left_nkey;
       int grab = left_nkey - (minimal_leaf_nkey-1);
-      memmove(&leaf.entries[offset], &leaf.entries[offset+1], post_sz * sizeof (struct bpt_entry));
-      memcpy(&leaf.entries[(minimal_leaf_nkey-1)], &nxt.entries[0], grab * sizeof (struct bpt_entry));
-      memmove(&nxt.entries[0], &nxt.entries[grab], right_nkey * sizeof (struct bpt_entry));
+      memmove(&ls[offset], &ls[offset+1], post_sz * sizeof (struct bpt_slot));
+      memcpy(&ls[(minimal_leaf_nkey-1)], &ns[0], grab * sizeof (struct bpt_slot));
+      memmove(&ns[0], &ns[grab], right_nkey * sizeof (struct bpt_slot));
       bpt_node_set_nkey(leaf, order, left_nkey);
       bpt_node_set_nkey(nxt, order, right_nkey);
       struct bpt_node mid_node;
       int mid_offset;
       if (offset != 0 || prv.entries == NULL) {
         mid_offset = mid_between_nxt(stk, &mid_node, order);
-        mid_node.entries[mid_offset].key = nxt.entries[0].key;
+        mid_node.entries[mid_offset].key = ns[0].key;
       } else {
         struct bpt_node prv_mid_node;
         int prv_mid_offset;
         mid_between_prv_nxt(stk, &prv_mid_node, &mid_node, &prv_mid_offset, &mid_offset, order);
-        prv_mid_node.entries[prv_mid_offset].key = leaf.entries[0].key;
-        mid_node.entries[mid_offset].key = nxt.entries[0].key;
+        prv_mid_node.entries[prv_mid_offset].key = ls[0].key;
+        mid_node.entries[mid_offset].key = ns[0].key;
       }
+      COUNT(bstat, borrows, 1);
       return BPT_PRED_SUCCESS;
     } else { // Neither side exists enough entries, try to merge them
       if (prv.entries != NULL) { 
         // merge to previous
-        memcpy(&prv.entries[minimal_leaf_nkey], &leaf.entries[0], offset * sizeof (struct bpt_entry));
-        memcpy(&prv.entries[minimal_leaf_nkey+offset], &leaf.entries[offset+1], post_sz * sizeof (struct bpt_entry));
+        memcpy(&ps[minimal_leaf_nkey], &ls[0], offset * sizeof (struct bpt_slot));
+        memcpy(&ps[minimal_leaf_nkey+offset], &ls[offset+1], post_sz * sizeof (struct bpt_slot));
         bpt_node_set_nkey(prv, order, minimal_leaf_nkey + minimal_leaf_nkey - 1);
-        bpt_node_set_nxt(prv, order, nxt);
+        bpt_node_set_nxt(prv, nxt, bstat);
         if (nxt.entries != NULL)
-          bpt_node_set_prv(nxt, order, prv);
+          bpt_node_set_prv(nxt, prv, bstat);
       } else { // nxt.entries != NULL
         // merge to next
-        memmove(&nxt.entries[minimal_leaf_nkey-1], &nxt.entries[0], minimal_leaf_nkey * sizeof (struct bpt_entry));
-        memcpy(&nxt.entries[0], &leaf.entries[0], offset * sizeof (struct bpt_entry));
-        memcpy(&nxt.entries[offset], &leaf.entries[offset+1], post_sz * sizeof (struct bpt_entry));
+        memmove(&ns[minimal_leaf_nkey-1], &ns[0], minimal_leaf_nkey * sizeof (struct bpt_slot));
+        memcpy(&ns[0], &ls[0], offset * sizeof (struct bpt_slot));
+        memcpy(&ns[offset], &ls[offset+1], post_sz * sizeof (struct bpt_slot));
         {
           struct bpt_node mid_node;
           int mid_offset;
@@ -569,15 +2854,17 @@ int bpt_delete_entry(struct bpt_node leaf, int offset, struct gen_stk *stk, stru
             return -1;
           mid_offset = mid_between_nxt(&tmpstk, &mid_node, order);
           assert(mid_offset != -1);
-          mid_node.entries[mid_offset].key = nxt.entries[0].key;
+          mid_node.entries[mid_offset].key = ns[0].key;
           gen_stk_delete(&tmpstk);
         }
         bpt_node_set_nkey(nxt, order, minimal_leaf_nkey + minimal_leaf_nkey - 1);
-        bpt_node_set_prv(nxt, order, prv);
+        bpt_node_set_prv(nxt, prv, bstat);
         if (prv.entries != NULL)
-          bpt_node_set_nxt(prv, order, nxt);
+          bpt_node_set_nxt(prv, nxt, bstat);
       }
-      bpt_node_delete(leaf);
+      bpt_node_delete(bstat, leaf);
+      COUNT(bstat, leaf_merges, 1);
+      PROBE(leaf__merge, bstat, leaf.entries);
       return bpt_delete_ientry(stk, bstat);
     }
   }
@@ -586,7 +2873,7 @@ int bpt_delete_entry(struct bpt_node leaf, int offset, struct gen_stk *stk, stru
 static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
 {
   struct bpt_frm frm;
-  int m, order = bstat->order, minimal_inter_nkey = bstat->new_inter_nkey;
+  int m, order = bstat->order, minimal_inter_nkey = bstat->min_inter_nkey;
   struct bpt_node mid_node;
   int mid_offset;
   int left_nkey, right_nkey;
@@ -597,11 +2884,12 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
     if (gen_stk_empty(stk)) { // current node is root node
       if (m == 1) {
         if (frm.offset == 0)
-          bstat->root_node.entries = frm.node.entries[1].val.ptr;
+          set_root(bstat, bpt_node_child(frm.node, 1, bstat), bstat->height - 1);
         else
-          bstat->root_node.entries = frm.node.entries[0].val.ptr;
-        bstat->height--;
-        bpt_node_delete(frm.node);
+          set_root(bstat, bpt_node_child(frm.node, 0, bstat), bstat->height - 1);
+        bpt_node_delete(bstat, frm.node);
+        COUNT(bstat, root_shrinks, 1);
+        PROBE(root__shrink, bstat, bstat->height);
       } else {
         if (frm.offset != 0) {
           bpt_t saved_val = frm.node.entries[frm.offset-1].val;
@@ -621,7 +2909,7 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
             (m + 1 - frm.offset) * sizeof (struct bpt_entry));
         frm.node.entries[frm.offset-1].val = saved_val;
       } else { // frm.offset == 0
-        bpt_t nxt_key = frm.node.entries[0].key;
+        bpt_key_t nxt_key = frm.node.entries[0].key;
         memmove(&frm.node.entries[0], &frm.node.entries[1], m * sizeof (struct bpt_entry));
         mid_offset = mid_between_prv(stk, &mid_node);
         if (mid_offset != -1) {
@@ -631,8 +2919,8 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
       bpt_node_set_nkey(frm.node, order, m - 1);
       return BPT_PRED_SUCCESS;
     } else { // m == minimal_inter_nkey
-      struct bpt_node prv = bpt_node_prv(frm.node, order),
-                      nxt = bpt_node_nxt(frm.node, order);
+      struct bpt_node prv = bpt_node_prv(frm.node, bstat),
+                      nxt = bpt_node_nxt(frm.node, bstat);
       int prv_nkey, nxt_nkey;
       int grab;
       if (prv.entries != NULL && (prv_nkey = bpt_node_nkey(prv, order)) != minimal_inter_nkey) {
@@ -643,7 +2931,7 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
         right_nkey = sum / 2;
         left_nkey = sum - right_nkey;
         grab = (right_nkey + 1) - minimal_inter_nkey;
-        bpt_t saved_key = frm.node.entries[frm.offset].key;
+        bpt_key_t saved_key = frm.node.entries[frm.offset].key;
         memmove(&frm.node.entries[grab+frm.offset], &frm.node.entries[1+frm.offset], (minimal_inter_nkey - frm.offset) * sizeof (struct bpt_entry));
         memmove(&frm.node.entries[grab], &frm.node.entries[0], frm.offset * sizeof (struct bpt_entry));
         memcpy(&frm.node.entries[0], &prv.entries[left_nkey+1], grab * sizeof(struct bpt_entry));
@@ -652,6 +2940,7 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
         mid_node.entries[mid_offset].key = prv.entries[left_nkey].key;
         bpt_node_set_nkey(prv, order, left_nkey);
         bpt_node_set_nkey(frm.node, order, right_nkey);
+        COUNT(bstat, borrows, 1);
         return BPT_PRED_SUCCESS;
       } else if (nxt.entries != NULL && (nxt_nkey = bpt_node_nkey(nxt, order)) != minimal_inter_nkey) {
         // grab some entries from nxt to pad current node
@@ -681,22 +2970,25 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
         memmove(&nxt.entries[0], &nxt.entries[grab], (right_nkey + 1) * sizeof (struct bpt_entry));
         bpt_node_set_nkey(frm.node, order, left_nkey);
         bpt_node_set_nkey(nxt, order, right_nkey);
+        COUNT(bstat, borrows, 1);
         return BPT_PRED_SUCCESS;
       } else { // merge with an adjacent node
         struct bpt_frm parent;
         gen_stk_pop(stk, &parent); // take a peep
         if (parent.offset != 0) { // merge to previous node
-          bpt_t saved_key = frm.node.entries[frm.offset].key;
+          bpt_key_t saved_key = frm.node.entries[frm.offset].key;
           memcpy(&prv.entries[minimal_inter_nkey+1], &frm.node.entries[0], frm.offset * sizeof (struct bpt_entry));
           memcpy(&prv.entries[minimal_inter_nkey+1+frm.offset], &frm.node.entries[frm.offset+1], (minimal_inter_nkey - frm.offset) * sizeof (struct bpt_entry));
           prv.entries[minimal_inter_nkey].key = parent.node.entries[parent.offset-1].key;
           // prv.entries[minimal_inter_nkey+1+frm.offset-1].key = saved_key;
           prv.entries[minimal_inter_nkey+frm.offset].key = saved_key;
           bpt_node_set_nkey(prv, order, minimal_inter_nkey + minimal_inter_nkey);
-          bpt_node_set_nxt(prv, order, nxt);
+          bpt_node_set_nxt(prv, nxt, bstat);
           if (nxt.entries != NULL)
-            bpt_node_set_prv(nxt, order, prv);
-          bpt_node_delete(frm.node);
+            bpt_node_set_prv(nxt, prv, bstat);
+          bpt_node_delete(bstat, frm.node);
+          COUNT(bstat, inter_merges, 1);
+          PROBE(inter__merge, bstat, frm.node.entries);
           gen_stk_push(stk, &parent);
         } else { // merge next node to current
           if (frm.offset != 0)
@@ -715,11 +3007,13 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
           memcpy(&frm.node.entries[minimal_inter_nkey], &nxt.entries[0], (minimal_inter_nkey + 1) * sizeof (struct bpt_entry));
           frm.node.entries[minimal_inter_nkey-1].key = parent.node.entries[parent.offset].key;
           bpt_node_set_nkey(frm.node, order, minimal_inter_nkey + minimal_inter_nkey);
-          struct bpt_node nxt_nxt = bpt_node_nxt(nxt, order);
-          bpt_node_set_nxt(frm.node, order, nxt_nxt);
+          struct bpt_node nxt_nxt = bpt_node_nxt(nxt, bstat);
+          bpt_node_set_nxt(frm.node, nxt_nxt, bstat);
           if (nxt_nxt.entries != NULL)
-            bpt_node_set_prv(nxt_nxt, order, frm.node);
-          bpt_node_delete(nxt);
+            bpt_node_set_prv(nxt_nxt, frm.node, bstat);
+          bpt_node_delete(bstat, nxt);
+          COUNT(bstat, inter_merges, 1);
+          PROBE(inter__merge, bstat, nxt.entries);
           parent.offset++;
           gen_stk_push(stk, &parent);
         }
@@ -731,3 +3025,158 @@ static int bpt_delete_ientry(struct gen_stk *stk, struct bpt_stat *bstat)
 
           
 
+
+/*
+ * Drop the separator between the @i-th and (@i+1)-th children of @parent along with the latter,
+ * once it was merged into the former.
+ */
+static void drop_child(struct bpt_stat *bstat, struct bpt_node parent, int i)
+{
+  int m = bpt_node_nkey(parent, bstat->order);
+  bpt_t saved_val = parent.entries[i].val;
+
+  memmove(&parent.entries[i], &parent.entries[i+1], (m - i) * sizeof (struct bpt_entry));
+  parent.entries[i].val = saved_val;
+  bpt_node_set_nkey(parent, bstat->order, m - 1);
+}
+
+/*
+ * Rebalance the @i-th and (@i+1)-th children of @parent, at height @h: merge them if they fit
+ * in one node, else even them out. Returns 1 if they were merged.
+ */
+static int rebalance_pair(struct bpt_stat *bstat, struct bpt_node parent, int i, int h)
+{
+  int order = bstat->order;
+  struct bpt_node left = bpt_node_child(parent, i, bstat), right = bpt_node_child(parent, i + 1, bstat), nxt;
+  int a = bpt_node_nkey(left, order), b = bpt_node_nkey(right, order), na, k;
+  struct bpt_slot *ls = bpt_leaf_slots(left), *rs = bpt_leaf_slots(right);
+  bpt_key_t sep = parent.entries[i].key;
+
+  if (h == 0 && a + b <= bstat->leaf_order) {
+    memcpy(&ls[a], &rs[0], b * sizeof (struct bpt_slot));
+    bpt_node_set_nkey(left, order, a + b);
+    COUNT(bstat, leaf_merges, 1);
+    PROBE(leaf__merge, bstat, right.entries);
+  } else if (h > 0 && a + b + 1 <= order) {
+    left.entries[a].key = sep;
+    memcpy(&left.entries[a+1], &right.entries[0], (b + 1) * sizeof (struct bpt_entry));
+    bpt_node_set_nkey(left, order, a + b + 1);
+    COUNT(bstat, inter_merges, 1);
+    PROBE(inter__merge, bstat, right.entries);
+  } else {
+    na = (a + b) - (a + b) / 2;
+    if (h == 0 && a < na) {
+      k = na - a;
+      memcpy(&ls[a], &rs[0], k * sizeof (struct bpt_slot));
+      memmove(&rs[0], &rs[k], (b - k) * sizeof (struct bpt_slot));
+      b -= k;
+    } else if (h == 0) {
+      k = a - na;
+      memmove(&rs[k], &rs[0], b * sizeof (struct bpt_slot));
+      memcpy(&rs[0], &ls[na], k * sizeof (struct bpt_slot));
+      b += k;
+    } else if (a < na) { // the separator comes down to the left, the key right of the last child moved goes up
+      k = na - a;
+      left.entries[a].key = sep;
+      memcpy(&left.entries[a+1], &right.entries[0], k * sizeof (struct bpt_entry));
+      sep = right.entries[k-1].key;
+      memmove(&right.entries[0], &right.entries[k], (b - k + 1) * sizeof (struct bpt_entry));
+      b -= k;
+    } else {
+      k = a - na;
+      memmove(&right.entries[k], &right.entries[0], (b + 1) * sizeof (struct bpt_entry));
+      memcpy(&right.entries[0], &left.entries[na+1], k * sizeof (struct bpt_entry));
+      right.entries[k-1].key = sep;
+      sep = left.entries[na].key;
+      b += k;
+    }
+    bpt_node_set_nkey(left, order, na);
+    bpt_node_set_nkey(right, order, b);
+    parent.entries[i].key = h == 0 ? rs[0].key : sep;
+    COUNT(bstat, borrows, 1);
+    return 0;
+  }
+  nxt = bpt_node_nxt(right, bstat);
+  bpt_node_set_nxt(left, nxt, bstat);
+  if (nxt.entries != NULL)
+    bpt_node_set_prv(nxt, left, bstat);
+  bpt_node_delete(bstat, right);
+  drop_child(bstat, parent, i);
+  return 1;
+}
+
+/**
+ * bpt_rebalance: bring every node but the root back to the fill a split leaves it with
+ *
+ * The deferred half of relaxed deletion, see bpt_set_watermarks(): levels are walked bottom-up,
+ * and a node short of new_leaf_nkey or new_inter_nkey is merged with a sibling under the same
+ * parent if they fit in one node, else evened out with it. It may be called at any time, say
+ * once a burst of deletes is over, but not on a copy-on-write, concurrent or write-optimized tree.
+ *
+ * Returns the number of nodes merged away, -1 if the tree can't be rebalanced.
+ */
+int bpt_rebalance(struct bpt_stat *bstat)
+{
+  struct bpt_node first, parent, root;
+  int h, i, m, min, again, merged = 0;
+
+  if (bstat->cow != NULL || bstat->olc != NULL || bstat->be != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  do {
+    again = 0;
+    for (h = 0; h < bstat->height; h++) {
+      // the leftmost node above the level, which merges never take away
+      first = bstat->root_node;
+      for (i = bstat->height; i > h + 1; i--)
+        first = bpt_node_child(first, 0, bstat);
+      min = h == 0 ? bstat->new_leaf_nkey : bstat->new_inter_nkey;
+      for (parent = first; parent.entries != NULL; parent = bpt_node_nxt(parent, bstat)) {
+        for (i = 0; i <= (m = bpt_node_nkey(parent, bstat->order)); ) {
+          if (bpt_node_nkey(bpt_node_child(parent, i, bstat), bstat->order) >= min)
+            i++;
+          else if (m == 0) { // an only child, left over from merges below, waits for its parent to get siblings
+            again = 1;
+            break;
+          } else if (rebalance_pair(bstat, parent, i < m ? i : i - 1, h))
+            merged++;
+          else
+            i++;
+        }
+      }
+    }
+    while (bstat->height > 0 && bpt_node_nkey(root = bstat->root_node, bstat->order) == 0) {
+      set_root(bstat, bpt_node_child(root, 0, bstat), bstat->height - 1);
+      bpt_node_delete(bstat, root);
+      COUNT(bstat, root_shrinks, 1);
+      PROBE(root__shrink, bstat, bstat->height);
+    }
+  } while (again);
+  return merged;
+}
+
+/**
+ * bpt_set_watermarks: relax deletion, letting nodes run emptier before they're merged
+ * @leaf_min: fewest entries a leaf other than the root is left with, 1 to new_leaf_nkey
+ * @inter_min: fewest keys an internal node other than the root is left with, 1 to new_inter_nkey
+ *
+ * A node merged at the default watermarks is left nearly full, so a workload inserting and
+ * deleting around the same keys splits it again right away. Lower watermarks leave room after a
+ * merge, and space is taken back by bpt_rebalance() when it suits the caller. Raising them
+ * rebalances the tree first, so that no node is left below the new watermarks.
+ *
+ * Returns 0 if OK, -1 if a watermark is out of range or the tree can't be rebalanced.
+ */
+int bpt_set_watermarks(struct bpt_stat *bstat, int leaf_min, int inter_min)
+{
+  if (leaf_min < 1 || leaf_min > bstat->new_leaf_nkey || inter_min < 1 || inter_min > bstat->new_inter_nkey) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((leaf_min > bstat->min_leaf_nkey || inter_min > bstat->min_inter_nkey) && bpt_rebalance(bstat) == -1)
+    return -1;
+  bstat->min_leaf_nkey = leaf_min;
+  bstat->min_inter_nkey = inter_min;
+  return 0;
+}
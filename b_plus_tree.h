@@ -3,70 +3,467 @@
 
 #include "gen_stk.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define BPT_STK_CAP_INIT 10
+#define BPT_BATCH_GROUP 16 // lookups of a batch descending together
 
 typedef union {
   void *ptr;
   off_t off;
 } bpt_t;
 
+#if defined(BPT_ABBREV) && defined(BPT_KEY_SIZE)
+#error "BPT_ABBREV and BPT_KEY_SIZE don't go together"
+#endif
+
+#ifdef BPT_ABBREV
+/*
+ * Built with BPT_ABBREV, keys stay out of line behind @ref while their first bytes are cached
+ * inline in @abbr, in an order-preserving form such as bpt_abbrev_bytes() makes. Keys whose
+ * @abbr differ compare as their @abbr do, so the tree only calls cmp, and dereferences @ref,
+ * on ties.
+ */
+typedef struct {
+  uint64_t abbr;
+  bpt_t ref;
+} bpt_key_t;
+
+#define BPT_KEY_WORD(k) ((k).ref) // the bpt_t of a key slot that node bookkeeping may reuse
+#elif defined(BPT_KEY_SIZE)
+#if BPT_KEY_SIZE != 16 && BPT_KEY_SIZE != 24 && BPT_KEY_SIZE != 32
+#error "BPT_KEY_SIZE must be 16, 24 or 32"
+#endif
+/*
+ * Built with BPT_KEY_SIZE, keys are that many bytes stored inline, such as UUIDs or
+ * (tenant_id, object_id) pairs. bpt_key_cmp_words() and bpt_key_cmp_bytes() order them
+ * as unsigned words, most significant first, or as memcmp() does.
+ */
+typedef union {
+  bpt_t word;
+  uint64_t w[BPT_KEY_SIZE / 8];
+  unsigned char b[BPT_KEY_SIZE];
+} bpt_key_t;
+
+#define BPT_KEY_WORD(k) ((k).word)
+#else
+typedef bpt_t bpt_key_t;
+
+#define BPT_KEY_WORD(k) (k)
+#define BPT_KEY_PLAIN // keys are bpt_t themselves
+#endif
+
 struct bpt_entry {
-  bpt_t key;
+  bpt_key_t key;
   bpt_t val;
 };
 
+#ifdef BPT_SET
+/*
+ * Built with BPT_SET, trees are sets: leaves hold keys alone, so a leaf of the same size as
+ * an internal node holds about twice as many of them. Internal nodes are unchanged.
+ */
+struct bpt_slot {
+  bpt_key_t key;
+};
+#else
+#define bpt_slot bpt_entry // a leaf slot is a whole entry
+#endif
+
 struct bpt_node {
   struct bpt_entry *entries;
 };
 
+/**
+ * bpt_leaf_slots: the slots of a leaf node, in place of its entries
+ */
+static inline struct bpt_slot *bpt_leaf_slots(struct bpt_node leaf)
+{
+  return (struct bpt_slot *)leaf.entries;
+}
+
+/*
+ * What a tree has been doing, counted when built with BPT_STATS. A tree has one writer,
+ * so counting takes no atomics. Readers of a concurrent tree count into their reader slot
+ * instead, so that they write nothing shared, and bpt_get_stats() adds the slots up.
+ */
+struct bpt_counters {
+  unsigned long searches, inserts, deletes;
+  unsigned long cmps;   // key comparisons
+  unsigned long visits; // nodes descended through, leaves included
+  unsigned long leaf_splits, inter_splits;
+  unsigned long borrows; // entries shifted to or from a sibling instead of a split or merge
+  unsigned long leaf_merges, inter_merges;
+  unsigned long root_grows, root_shrinks;
+};
+
+#define BPT_HIST_SUB 8 // buckets per power of two, so a bucket is at most 1/8 of its values wide
+#define BPT_HIST_BUCKETS (62 * BPT_HIST_SUB)
+
+/*
+ * A log-linear histogram of latencies in nanoseconds, in the manner of HdrHistogram: exact
+ * below BPT_HIST_SUB, then BPT_HIST_SUB buckets for every power of two.
+ */
+struct bpt_hist {
+  unsigned long count[BPT_HIST_BUCKETS];
+  unsigned long total;
+  uint64_t max;
+};
+
+// operations timed into the histograms of a tree built with BPT_LATENCY
+enum BPT_LAT_OP {
+  BPT_LAT_SEARCH,
+  BPT_LAT_INSERT,
+  BPT_LAT_DELETE,
+  BPT_LAT_NODE_NEW, // node allocation, on its own to tell allocator stalls from split cascades
+  BPT_LAT_NR
+};
+
+// B+ tree state
+struct bpt_stat {
+  struct bpt_node root_node;
+  int order;
+  int leaf_order; // capacity of a leaf, order unless leaves are key-only
+  int height;
+
+  int old_leaf_nkey; //  entry count of the leaf node just after being splitted
+  int new_leaf_nkey; // entry count of the new leaf node generated by splitting
+  int old_inter_nkey; // key count of the internal node just after being splitted
+  int new_inter_nkey; // key count of the new internal node generated by splitting
+  int min_leaf_nkey;  // fewest entries a leaf other than the root is left with, new_leaf_nkey unless relaxed
+  int min_inter_nkey; // fewest keys an internal node other than the root is left with, likewise
+
+  char *base; // base of the arena holding all nodes, NULL if nodes are malloc()ed
+  int paged;  // if the arena is mapped from a file, so that nodes may have to be read in first
+  long page_sz; // page size of the mapping, to round readahead advice to
+
+  // called with an enum BPT_LOG_OP before a leaf is modified, NULL if mutations aren't logged.
+  // A return of -1 aborts the mutation with BPT_ERROR.
+  int (*log)(void *log_arg, int op, struct bpt_entry entry);
+  void *log_arg;
+
+  // called with an enum BPT_TRACE_OP, the key and value, and the result after every bpt_search(),
+  // bpt_insert() and bpt_delete(), NULL if operations aren't traced
+  void (*trace)(void *trace_arg, int op, struct bpt_entry entry, int rst);
+  void *trace_arg;
+
+  struct bpt_cow *cow; // copy-on-write state, NULL if nodes are updated in place
+  struct bpt_olc *olc; // concurrency state, NULL if the tree is used by one thread at a time
+  struct bpt_be *be;   // message buffers of internal nodes, NULL unless write-optimized
+
+#ifdef BPT_STATS
+  struct bpt_counters counters;
+#endif
+#ifdef BPT_LATENCY
+  struct bpt_hist *lat; // BPT_LAT_NR histograms operations are timed into, NULL if they aren't timed
+#endif
+};
+
+#define BPT_STATS_HEIGHT 32 // levels bpt_get_stats() reports on
+#define BPT_FILL_BUCKETS 10
+
+// the shape of a tree, see bpt_get_stats()
+struct bpt_tree_stats {
+  int height;
+  size_t nodes[BPT_STATS_HEIGHT]; // nodes per level, 0 being the leaves
+  size_t entries;                 // entries in the leaves
+  size_t leaf_fill[BPT_FILL_BUCKETS];  // leaves by how full they are, in tenths of their capacity
+  size_t inter_fill[BPT_FILL_BUCKETS]; // internal nodes likewise
+  size_t bytes;                   // memory taken by the nodes
+  struct bpt_counters counters;   // all zero unless built with BPT_STATS
+};
+
+/*
+ * A point-in-time snapshot of a copy-on-write tree. Its nodes are never modified again, so it can
+ * be read by other threads while the writer goes on. Sibling links are only maintained for the
+ * live tree, so a snapshot is read top-down: bpt_search() on @view, or bpt_snap_foreach().
+ */
+struct bpt_snap {
+  struct bpt_stat view; // the tree as of the snapshot
+  off_t gen;
+  struct bpt_snap *next;
+};
+
+// A node made at generation g is shared with every live snapshot taken at generation g or later.
+struct bpt_cow {
+  off_t gen;      // generation stamped on nodes made now
+  off_t snap_max; // generation of the youngest live snapshot, -1 if none
+  struct bpt_snap *snaps;
+  struct gen_stk retired; // replaced nodes some snapshot may still read
+  char lock;              // guards @snaps and @retired against bpt_snapshot_release() from readers
+};
+
+struct bpt_retired {
+  struct bpt_node node;
+  off_t died; // generation at which the node left the live tree
+};
+
+#define BPT_EBR_READERS 64       // threads registered to read a concurrent tree at once
+#define BPT_EBR_RETIRED_MAX 4096 // default bound of the nodes a concurrent tree keeps for readers
+#define BPT_EBR_POOL_MAX 256     // reclaimed nodes kept for reuse
+
+/*
+ * The epoch a registered reader of a concurrent tree is reading in, on a cache line of
+ * its own so that readers don't share lines.
+ */
+struct bpt_ebr_slot {
+  off_t epoch; // 0 while the thread reads nothing
+  int used;
+#ifdef BPT_STATS
+  struct bpt_counters counters; // what the thread counted while reading
+#endif
+} __attribute__((aligned(64)));
+
+struct bpt_ebr_stats {
+  unsigned long retired, reclaimed;
+  unsigned long reused;   // reclaimed nodes allocated again
+  unsigned long advances; // times the epoch moved
+  unsigned long stalls;   // times a writer found @retired_max nodes retired and waited for readers
+  off_t max_lag;          // most epochs between the retirement and the reclamation of a node
+  size_t max_pending;     // most nodes retired and not reclaimed at once
+};
+
+/*
+ * A tree read by any number of threads with bpt_olc_search() while writers, serialized by
+ * @wlock, update it in place. Every node carries a version, odd while a writer may be
+ * changing it. A reader takes no lock and writes nothing shared: it reads a node between
+ * two loads of its version and starts over from the root if it changed. Writers only make
+ * odd the nodes their operation may modify, the leaf alone most of the time.
+ *
+ * In B-link mode every node also keeps a high key, above its keys and up to the least key
+ * of its next node. Splits only move keys right, so a reader finding a key at or above the
+ * high key follows the next link instead of starting over, and an inserting writer holds
+ * the node it splits until it holds the parent, two nodes at most. Deletes that borrow or
+ * merge make @moves odd, and readers overlapping them start over.
+ *
+ * Removed nodes are reclaimed by epochs: a reader announces the global @epoch in its slot
+ * while it reads, a node retired in an epoch is reused or freed once the epoch moved two
+ * past it, and the epoch only moves when every reader announced the current one.
+ */
+struct bpt_olc {
+  pthread_mutex_t wlock;
+  struct gen_stk stk;     // traversal journal of the writer
+  struct gen_stk locked;  // nodes the running write made odd
+  off_t seq;              // odd while the root node and the height change
+  struct gen_stk retired; // removed nodes readers may still be looking at, oldest first
+  struct gen_stk pool;    // reclaimed nodes the next splits take first
+  int blink;              // B-link mode
+  off_t moves;            // odd while a delete moves keys between nodes, in B-link mode
+  off_t epoch;
+  size_t retired_max;     // writers wait for readers rather than retire more nodes
+  struct bpt_ebr_stats ebr;
+  struct bpt_ebr_slot slots[BPT_EBR_READERS];
+};
+
+enum BPT_BE_OP {
+  BPT_BE_PUT, // insert the entry, or replace its value
+  BPT_BE_DEL, // delete the entry if there is one
+  BPT_BE_ADD  // add the value to that of the entry, inserting it if there is none
+};
+
+// a write buffered in an internal node, on its way down to the leaves
+struct bpt_be_msg {
+  bpt_key_t key;
+  bpt_t val;
+  int op;
+};
+
+// the messages an internal node holds for its subtree, sorted by key, one per key at most
+struct bpt_be_buf {
+  int n, cap;
+  struct bpt_be_msg msgs[];
+};
+
+#define BPT_BE_HEIGHT 48 // most levels of a write-optimized tree
+#define BPT_BE_BUF_FACTOR 16 // messages buffered per key an internal node holds, by default
+
+/*
+ * A write-optimized tree, in the manner of a B-epsilon tree. Writes are messages added to
+ * the buffer of the root. A buffer holding more than @buf_max messages sends the largest
+ * run of them bound for one child down to that child, so leaves are written a batch at a
+ * time. Searches take the newest message for their key met on the way down. Nodes only
+ * split, leaves left empty are dropped, and underfull nodes are left alone.
+ */
+struct bpt_be {
+  int buf_max;
+  int limit;               // buffers are flushed down to this many messages
+  struct bpt_node path[BPT_BE_HEIGHT+1]; // the nodes a flush goes through, by height
+  struct bpt_slot *tmp;    // a leaf merged with the messages for it
+  size_t tmp_cap;
+  struct bpt_be_msg *run;  // messages taken out of a buffer on their way to a leaf
+  size_t run_cap;
+  unsigned long msgs;      // messages written
+  unsigned long flushes;   // runs sent down a level
+  unsigned long leaf_writes; // runs merged into leaves
+};
+
+/*
+ * Header at the start of an arena region. Every link inside an arena is an offset relative
+ * to the region base, so the region can be mapped at any address by several processes, or
+ * be relocated with a single memcpy().
+ */
+struct bpt_arena {
+  unsigned magic;
+  int order;
+  int height;
+  off_t root;      // offset of the root node
+  size_t size;     // size of the whole region
+  size_t node_sz;  // size of a node
+  off_t brk;       // offset of the first never used byte
+  off_t free_head; // offset of the first freed node, 0 if none
+};
+
+#define BPT_ARENA_MAGIC 0x41545042 // "BPTA"
+#define BPT_FREE_NKEY -1     // key count marking a freed node of an arena
+#define BPT_PLACE_WINDOW 8   // how many nodes behind its neighbour a new node may be placed
+#define BPT_READAHEAD 32     // how many leaves a sequential cursor reads ahead
+#define BPT_SEQ_TRIGGER 2    // leaves a cursor has to step through before reading ahead
+
+/**
+ * bpt_link: encode a node as a link to be stored in another node
+ */
+static inline bpt_t bpt_link(const struct bpt_stat *bstat, struct bpt_node node)
+{
+  bpt_t link;
+
+  if (bstat->base == NULL)
+    link.ptr = node.entries;
+  else
+    link.off = node.entries == NULL ? 0 : (char *)node.entries - bstat->base;
+  return link;
+}
+
+/**
+ * bpt_deref: decode a link made by bpt_link()
+ */
+static inline struct bpt_node bpt_deref(const struct bpt_stat *bstat, bpt_t link)
+{
+  struct bpt_node node;
+
+  if (bstat->base == NULL)
+    node.entries = link.ptr;
+  else
+    node.entries = link.off == 0 ? NULL : (struct bpt_entry *)(bstat->base + link.off);
+  return node;
+}
+
+#ifdef BPT_KEY_SIZE
+int bpt_key_cmp_words(bpt_key_t a, bpt_key_t b);
+int bpt_key_cmp_bytes(bpt_key_t a, bpt_key_t b);
+
+static inline int bpt_key_words(bpt_key_t a, bpt_key_t b)
+{
+  int i;
+
+  for (i = 0; i < BPT_KEY_SIZE / 8; i++) {
+    if (a.w[i] != b.w[i])
+      return a.w[i] < b.w[i] ? -1 : 1;
+  }
+  return 0;
+}
+#endif
+
+/**
+ * bpt_key_cmp: compare two keys with @cmp, or by their inline abbreviations where they differ
+ *
+ * The comparators coming with wide keys are expanded inline instead of being called.
+ */
+static inline int bpt_key_cmp(bpt_key_t a, bpt_key_t b, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+#ifdef BPT_ABBREV
+  if (a.abbr != b.abbr)
+    return a.abbr < b.abbr ? -1 : 1;
+#endif
+#ifdef BPT_KEY_SIZE
+  if (cmp == bpt_key_cmp_words)
+    return bpt_key_words(a, b);
+  if (cmp == bpt_key_cmp_bytes)
+    return memcmp(a.b, b.b, BPT_KEY_SIZE);
+#endif
+  return cmp(a, b);
+}
+
+#ifdef BPT_ABBREV
+/**
+ * bpt_abbrev_bytes: abbreviate a byte string ordered as memcmp() does into its first 8 bytes
+ *
+ * Shorter strings are padded with zero bytes, so two abbreviations only compare equal
+ * when the strings may still differ past them.
+ */
+static inline uint64_t bpt_abbrev_bytes(const void *p, size_t len)
+{
+  const unsigned char *b = p;
+  uint64_t abbr = 0;
+  size_t i;
+
+  for (i = 0; i < 8; i++)
+    abbr = abbr << 8 | (i < len ? b[i] : 0);
+  return abbr;
+}
+#endif
+
 /**
  * bpt_node_nkey: return current number of entries in the node
  */
 static inline int bpt_node_nkey(struct bpt_node node, int order)
 {
-  return (int)node.entries[order].key.ptr;
+  return (int)BPT_KEY_WORD(node.entries[order].key).ptr;
 }
 
 static inline void bpt_node_set_nkey(struct bpt_node node, int order, int nkey)
 {
-  node.entries[order].key.ptr = (void *)nkey;
+  BPT_KEY_WORD(node.entries[order].key).ptr = (void *)nkey;
 }
 
-static inline struct bpt_node bpt_node_nxt(struct bpt_node node, int order)
+/**
+ * bpt_node_child: return the @i-th child of an internal node
+ */
+static inline struct bpt_node bpt_node_child(struct bpt_node node, int i, const struct bpt_stat *bstat)
 {
-  struct bpt_node rnt = { .entries = node.entries[order+1].key.ptr };
-  return rnt;
+  return bpt_deref(bstat, node.entries[i].val);
 }
 
-static inline void bpt_node_set_nxt(struct bpt_node node, int order, struct bpt_node nxt)
+static inline void bpt_node_set_child(struct bpt_node node, int i, struct bpt_node child,
+    const struct bpt_stat *bstat)
 {
-  node.entries[order+1].key.ptr = nxt.entries;
+  node.entries[i].val = bpt_link(bstat, child);
 }
 
-static inline struct bpt_node bpt_node_prv(struct bpt_node node, int order)
+static inline struct bpt_node bpt_node_nxt(struct bpt_node node, const struct bpt_stat *bstat)
 {
-  struct bpt_node rnt = { .entries = node.entries[order+1].val.ptr };
-  return rnt;
+  return bpt_deref(bstat, BPT_KEY_WORD(node.entries[bstat->order+1].key));
 }
 
-static inline void bpt_node_set_prv(struct bpt_node node, int order, struct bpt_node prv)
+static inline void bpt_node_set_nxt(struct bpt_node node, struct bpt_node nxt, const struct bpt_stat *bstat)
 {
-  node.entries[order+1].val.ptr = prv.entries;
+  BPT_KEY_WORD(node.entries[bstat->order+1].key) = bpt_link(bstat, nxt);
 }
 
-// B+ tree state
-struct bpt_stat {
-  struct bpt_node root_node;
-  int order;
-  int height;
+static inline struct bpt_node bpt_node_prv(struct bpt_node node, const struct bpt_stat *bstat)
+{
+  return bpt_deref(bstat, node.entries[bstat->order+1].val);
+}
 
-  int old_leaf_nkey; //  entry count of the leaf node just after being splitted
-  int new_leaf_nkey; // entry count of the new leaf node generated by splitting
-  int old_inter_nkey; // key count of the internal node just after being splitted
-  int new_inter_nkey; // key count of the new internal node generated by splitting
+static inline void bpt_node_set_prv(struct bpt_node node, struct bpt_node prv, const struct bpt_stat *bstat)
+{
+  node.entries[bstat->order+1].val = bpt_link(bstat, prv);
+}
+
+/*
+ * A position in the leaf chain of a tree. A cursor stepping through consecutive leaves
+ * reads the following ones ahead.
+ */
+struct bpt_cursor {
+  struct bpt_stat *bstat;
+  struct bpt_node leaf; // bpt_null_node once past the last entry
+  int offset;
+  int seq;              // leaves stepped through since the last seek
+  char *ra_start;       // arena range last read ahead
+  char *ra_end;
 };
 
 struct bpt_frm {
@@ -74,6 +471,17 @@ struct bpt_frm {
   int offset;
 };
 
+enum BPT_LOG_OP {
+  BPT_LOG_PUT, // an entry is inserted or its value is replaced
+  BPT_LOG_DEL  // an entry is deleted
+};
+
+enum BPT_TRACE_OP {
+  BPT_TRACE_SEARCH, // the value is the one found, the result BPT_PRED_SUCCESS if found, else BPT_NEXIST
+  BPT_TRACE_INSERT,
+  BPT_TRACE_DELETE
+};
+
 enum BPT_RNT {
   BPT_NEXIST, // not exist
   BPT_PRED_FAIL,
@@ -81,23 +489,80 @@ enum BPT_RNT {
   BPT_ERROR
 };
 
-static inline void bpt_node_delete(struct bpt_node node)
-{
-  free(node.entries);
-}
-
-struct bpt_node bpt_node_new(int order, struct bpt_node prv, struct bpt_node nxt);
+struct bpt_node bpt_node_new(struct bpt_stat *bstat, struct bpt_node prv, struct bpt_node nxt);
+void bpt_node_delete(struct bpt_stat *bstat, struct bpt_node node);
 int bpt_init(struct bpt_stat *bstat, int order);
-int bpt_search(bpt_t search_for, int (*cmp)(bpt_t, bpt_t), struct bpt_stat *bstat, struct bpt_node *leafp);
-int bpt_searchr(bpt_t search_for, int (*cmp)(bpt_t, bpt_t),
+int bpt_init_arena(struct bpt_stat *bstat, int order, void *base, size_t size);
+int bpt_attach_arena(struct bpt_stat *bstat, void *base);
+int bpt_init_cow(struct bpt_stat *bstat, int order);
+int bpt_snapshot(struct bpt_stat *bstat, struct bpt_snap *snap);
+void bpt_snapshot_release(struct bpt_stat *bstat, struct bpt_snap *snap);
+int bpt_snap_foreach(struct bpt_snap *snap, int (*fn)(struct bpt_slot *entry, void *arg), void *arg);
+int bpt_init_olc(struct bpt_stat *bstat, int order);
+int bpt_init_blink(struct bpt_stat *bstat, int order);
+int bpt_olc_search(struct bpt_stat *bstat, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), bpt_t *valp);
+int bpt_olc_insert(struct bpt_stat *bstat, struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t),
+    int (*pred)(bpt_t, bpt_t));
+int bpt_olc_delete(struct bpt_stat *bstat, struct bpt_entry pair, int (*cmp)(bpt_key_t, bpt_key_t),
+    int (*pred)(bpt_t, bpt_t));
+void bpt_olc_reclaim(struct bpt_stat *bstat);
+int bpt_olc_register(struct bpt_stat *bstat);
+void bpt_olc_unregister(struct bpt_stat *bstat, int slot);
+void bpt_olc_enter(struct bpt_stat *bstat, int slot);
+void bpt_olc_exit(struct bpt_stat *bstat, int slot);
+int bpt_init_be(struct bpt_stat *bstat, int order, int buf_max);
+int bpt_be_write(struct bpt_stat *bstat, int op, struct bpt_entry entry, int (*cmp)(bpt_key_t, bpt_key_t));
+int bpt_be_search(struct bpt_stat *bstat, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), bpt_t *valp);
+int bpt_be_flush(struct bpt_stat *bstat, int (*cmp)(bpt_key_t, bpt_key_t));
+int bpt_search(bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat, struct bpt_node *leafp);
+int bpt_search_batch(const bpt_key_t *search_for, int n, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat,
+    struct bpt_node *leaves, int *offsets);
+int bpt_searchr(bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat, struct bpt_node *leafp);
+int bpt_cursor_first(struct bpt_cursor *cur, struct bpt_stat *bstat);
+int bpt_cursor_seek(struct bpt_cursor *cur, bpt_key_t search_for, int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_stat *bstat);
+int bpt_cursor_next(struct bpt_cursor *cur);
+void bpt_get_stats(struct bpt_stat *bstat, struct bpt_tree_stats *st);
+void bpt_free(struct bpt_stat *bstat);
+int bpt_set_watermarks(struct bpt_stat *bstat, int leaf_min, int inter_min);
+int bpt_rebalance(struct bpt_stat *bstat);
+
+static inline int bpt_hist_bucket(uint64_t v)
+{
+  int e;
+
+  if (v < BPT_HIST_SUB)
+    return v;
+  e = 63 - __builtin_clzll(v); // BPT_HIST_SUB is 1 << 3
+  return (e - 2) * BPT_HIST_SUB + (int)((v >> (e - 3)) & (BPT_HIST_SUB - 1));
+}
+
+static inline void bpt_hist_record(struct bpt_hist *hist, uint64_t v)
+{
+  hist->count[bpt_hist_bucket(v)]++;
+  hist->total++;
+  if (v > hist->max)
+    hist->max = v;
+}
+
+uint64_t bpt_hist_percentile(const struct bpt_hist *hist, double pct);
+void bpt_hist_merge(struct bpt_hist *to, const struct bpt_hist *from);
+
+/**
+ * bpt_cursor_entry: the leaf slot a valid cursor is at
+ */
+static inline struct bpt_slot *bpt_cursor_entry(struct bpt_cursor *cur)
+{
+  return &bpt_leaf_slots(cur->leaf)[cur->offset];
+}
+
 int bpt_pred_1(bpt_t a, bpt_t b);
 int bpt_pred_0(bpt_t a, bpt_t b);
-int bpt_insert(struct bpt_entry new_entry, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+int bpt_insert(struct bpt_entry new_entry, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat);
-int bpt_delete(struct bpt_entry pair, int (*cmp)(bpt_t, bpt_t), int (*pred)(bpt_t, bpt_t),
+int bpt_delete(struct bpt_entry pair, int (*cmp)(bpt_key_t, bpt_key_t), int (*pred)(bpt_t, bpt_t),
     struct gen_stk *stk, int has_stk_init,
     struct bpt_stat *bstat);
 int bpt_delete_entry(struct bpt_node leaf, int offset, struct gen_stk *stk, struct bpt_stat *bstat);
@@ -0,0 +1,360 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../b_plus_tree.h"
+#include "counters.h"
+
+#if (!defined(BPT_KEY_PLAIN) && !defined(BPT_KEY_SIZE)) || defined(BPT_SET)
+#error "the benchmark makes integer or wide inline keys, with values"
+#endif
+
+#define ZIPF_THETA 0.99
+#define HOT_SET 0.2 // fraction of the records getting HOT_OPS of the operations with -d hotspot
+#define HOT_OPS 0.8
+#define SCAN_MAX 100
+
+enum op { OP_READ, OP_UPDATE, OP_INSERT, OP_DELETE, OP_SCAN, OP_RMW, OP_NR };
+
+static const char *op_names[OP_NR] = { "read", "update", "insert", "delete", "scan", "rmw" };
+
+enum dist { DIST_UNIFORM, DIST_ZIPF, DIST_SEQ, DIST_HOTSPOT, DIST_LATEST };
+
+static const char *dist_names[] = { "uniform", "zipf", "seq", "hotspot", "latest", NULL };
+
+// the YCSB core workloads as percentages of each operation, and their request distribution
+static const struct workload {
+  char name;
+  int mix[OP_NR];
+  enum dist dist;
+} workloads[] = {
+  { 'a', { 50, 50, 0, 0, 0, 0 }, DIST_ZIPF },   // update heavy
+  { 'b', { 95, 5, 0, 0, 0, 0 }, DIST_ZIPF },    // read mostly
+  { 'c', { 100, 0, 0, 0, 0, 0 }, DIST_ZIPF },   // read only
+  { 'd', { 95, 0, 5, 0, 0, 0 }, DIST_LATEST },  // read latest
+  { 'e', { 0, 0, 5, 0, 95, 0 }, DIST_ZIPF },    // short ranges
+  { 'f', { 50, 0, 0, 0, 0, 50 }, DIST_ZIPF },   // read-modify-write
+  { 0 }
+};
+
+struct bench {
+  struct bpt_stat bstat;
+  struct gen_stk stk;
+  uint64_t nrec;  // records inserted so far, record i has key rec_key(i)
+  int ordered;    // keys follow record numbers instead of being scattered
+  enum dist dist;
+  uint64_t rng;
+  uint64_t seq;
+  struct {        // Zipfian generator over the first n records, after Gray et al. as in YCSB
+    uint64_t n;
+    double zetan, zeta2, alpha, eta;
+  } zipf;
+  struct bpt_hist hist[OP_NR];
+  int untimed;    // operations aren't timed one by one, so counters only see the tree
+  struct counters ctr;
+  unsigned long found, scanned;
+};
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// splitmix64: both the generator and a bijection scattering record numbers over the key space
+static inline uint64_t mix64(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static inline uint64_t next_rand(struct bench *b)
+{
+  return mix64(b->rng += 0x9e3779b97f4a7c15ULL);
+}
+
+static inline double next_double(struct bench *b)
+{
+  return (next_rand(b) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline bpt_key_t rec_key(struct bench *b, uint64_t rec)
+{
+  uint64_t k = b->ordered ? rec : mix64(rec) >> 1; // kept positive, keys compare as signed off_t
+  bpt_key_t key;
+
+#ifdef BPT_KEY_SIZE
+  memset(&key, 0, sizeof (key));
+  key.w[0] = k & 15; // a few tenants in the leading word, so comparisons look further
+  key.w[1] = k;
+#else
+  key.off = k;
+#endif
+  return key;
+}
+
+#ifdef BPT_KEY_PLAIN
+static int cmp_key(bpt_key_t a, bpt_key_t b)
+{
+  return a.off < b.off ? -1 : a.off > b.off;
+}
+#else
+#define cmp_key bpt_key_cmp_words
+#endif
+
+static void zipf_grow(struct bench *b, uint64_t n)
+{
+  uint64_t i;
+
+  for (i = b->zipf.n + 1; i <= n; i++)
+    b->zipf.zetan += 1 / pow(i, ZIPF_THETA);
+  b->zipf.n = n;
+  b->zipf.eta = (1 - pow(2.0 / n, 1 - ZIPF_THETA)) / (1 - b->zipf.zeta2 / b->zipf.zetan);
+}
+
+static uint64_t zipf_next(struct bench *b, uint64_t n)
+{
+  double u = next_double(b), uz;
+
+  if (n != b->zipf.n)
+    zipf_grow(b, n);
+  uz = u * b->zipf.zetan;
+  if (uz < 1)
+    return 0;
+  if (uz < 1 + pow(0.5, ZIPF_THETA))
+    return 1;
+  return (uint64_t)(n * pow(b->zipf.eta * u - b->zipf.eta + 1, b->zipf.alpha)) % n;
+}
+
+/**
+ * pick_rec: the record an operation other than an insert goes to
+ */
+static uint64_t pick_rec(struct bench *b)
+{
+  uint64_t n = b->nrec, hot = n * HOT_SET;
+
+  switch (b->dist) {
+  case DIST_ZIPF: // popular records are scattered rather than clustered at the low numbers
+    return mix64(zipf_next(b, n)) % n;
+  case DIST_SEQ:
+    return b->seq++ % n;
+  case DIST_HOTSPOT:
+    if (hot > 0 && next_double(b) < HOT_OPS)
+      return next_rand(b) % hot;
+    return hot + next_rand(b) % (n - hot);
+  case DIST_LATEST:
+    return n - 1 - zipf_next(b, n);
+  default:
+    return next_rand(b) % n;
+  }
+}
+
+static int do_op(struct bench *b, enum op op)
+{
+  struct bpt_entry entry;
+  struct bpt_node leaf;
+  struct bpt_cursor cur;
+  int i, len, rst = 0;
+
+  entry.key = rec_key(b, op == OP_INSERT ? b->nrec : pick_rec(b));
+  entry.val.off = b->nrec;
+  switch (op) {
+  case OP_READ:
+    b->found += bpt_search(entry.key, cmp_key, &b->bstat, &leaf) != -1;
+    break;
+  case OP_RMW:
+    if ((i = bpt_search(entry.key, cmp_key, &b->bstat, &leaf)) != -1)
+      entry.val.off = leaf.entries[i].val.off + 1;
+    // fall through
+  case OP_UPDATE:
+    rst = bpt_insert(entry, cmp_key, bpt_pred_1, &b->stk, 1, &b->bstat);
+    break;
+  case OP_INSERT:
+    if ((rst = bpt_insert(entry, cmp_key, bpt_pred_1, &b->stk, 1, &b->bstat)) != BPT_ERROR)
+      b->nrec++;
+    break;
+  case OP_DELETE:
+    rst = bpt_delete(entry, cmp_key, bpt_pred_1, &b->stk, 1, &b->bstat);
+    break;
+  case OP_SCAN:
+    len = 1 + next_rand(b) % SCAN_MAX;
+    for (rst = bpt_cursor_seek(&cur, entry.key, cmp_key, &b->bstat), i = 0; rst == 0 && i < len; i++)
+      rst = bpt_cursor_next(&cur);
+    b->scanned += i;
+    rst = 0;
+    break;
+  default:
+    break;
+  }
+  return rst == BPT_ERROR ? -1 : 0;
+}
+
+static void report(struct bench *b, const char *phase, unsigned long ops, uint64_t ns)
+{
+  int op;
+
+  printf("%s: %lu ops in %.3f s, %.0f ops/s\n", phase, ops, ns / 1e9, ops / (ns / 1e9));
+  if (b->ctr.fd[CTR_CYCLES] != -1 && b->ctr.fd[CTR_INSTRUCTIONS] != -1 && b->ctr.val[CTR_CYCLES] > 0)
+    printf("  IPC %.2f\n", b->ctr.val[CTR_INSTRUCTIONS] / b->ctr.val[CTR_CYCLES]);
+  for (op = 0; op < CTR_NR; op++) {
+    if (b->ctr.fd[op] != -1)
+      printf("  %-14s %10.2f per op\n", counter_names[op], b->ctr.val[op] / ops);
+  }
+  for (op = 0; op < OP_NR; op++) {
+    if (b->hist[op].total == 0)
+      continue;
+    printf("  %-6s %10lu  p50 %6lu  p99 %6lu  p999 %7lu  max %8lu ns\n", op_names[op], b->hist[op].total,
+        (unsigned long)bpt_hist_percentile(&b->hist[op], 50), (unsigned long)bpt_hist_percentile(&b->hist[op], 99),
+        (unsigned long)bpt_hist_percentile(&b->hist[op], 99.9), (unsigned long)b->hist[op].max);
+  }
+  memset(b->hist, 0, sizeof (b->hist));
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+      "usage: %s [-w a|b|c|d|e|f] [-m read,update,insert,delete,scan,rmw] [-d dist]\n"
+      "          [-n records] [-o ops] [-O order] [-A] [-S] [-T] [-s seed]\n"
+      "  -w  YCSB core workload, a by default\n"
+      "  -m  operation mix in percents, instead of a workload's\n"
+      "  -d  request distribution: uniform, zipf, seq, hotspot or latest\n"
+      "  -n  records loaded before the run, 1000000 by default\n"
+      "  -o  operations run, as many as records by default\n"
+      "  -O  order of the tree, 64 by default\n"
+      "  -A  allocate nodes from an arena instead of malloc()\n"
+      "  -S  keys in record order rather than scattered\n"
+      "  -T  don't time operations one by one, for hardware counters of the tree alone\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct bench b;
+  const struct workload *w = &workloads[0];
+  int mix[OP_NR], i, r, opt, order = 64, arena = 0, dist = -1;
+  unsigned long nload = 1000000, nops = 0, n;
+  uint64_t seed = 1523796176, start, t;
+  size_t arena_sz;
+  char *region;
+
+  while ((opt = getopt(argc, argv, "w:m:d:n:o:O:ASTs:")) != -1) {
+    switch (opt) {
+    case 'w':
+      for (w = workloads; w->name != 0 && w->name != optarg[0]; w++)
+        ;
+      if (w->name == 0)
+        usage(argv[0]);
+      break;
+    case 'm':
+      if (sscanf(optarg, "%d,%d,%d,%d,%d,%d", &mix[0], &mix[1], &mix[2], &mix[3], &mix[4], &mix[5]) != OP_NR)
+        usage(argv[0]);
+      w = NULL;
+      break;
+    case 'd':
+      for (dist = 0; dist_names[dist] != NULL && strcmp(dist_names[dist], optarg) != 0; dist++)
+        ;
+      if (dist_names[dist] == NULL)
+        usage(argv[0]);
+      break;
+    case 'n':
+      nload = strtoul(optarg, NULL, 0);
+      break;
+    case 'o':
+      nops = strtoul(optarg, NULL, 0);
+      break;
+    case 'O':
+      order = atoi(optarg);
+      break;
+    case 'A':
+      arena = 1;
+      break;
+    case 'S':
+      b.ordered = 1;
+      break;
+    case 'T':
+      b.untimed = 1;
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (order < 3 || nload == 0)
+    usage(argv[0]);
+  if (w != NULL)
+    memcpy(mix, w->mix, sizeof (mix));
+  for (i = 1; i < OP_NR; i++)
+    mix[i] += mix[i-1];
+  if (mix[OP_NR-1] != 100)
+    usage(argv[0]);
+  if (nops == 0)
+    nops = nload;
+  b.dist = dist != -1 ? dist : w != NULL ? w->dist : DIST_UNIFORM;
+  b.rng = seed;
+  b.zipf.zeta2 = 1 + pow(0.5, ZIPF_THETA);
+  b.zipf.alpha = 1 / (1 - ZIPF_THETA);
+
+  if (arena) {
+    // nodes at least half full, twice over for the records a run may insert
+    arena_sz = sizeof (struct bpt_arena) + 4 * (nload + nops) / (order / 2) * (order + 2) * sizeof (struct bpt_entry) + (1 << 20);
+    if ((region = malloc(arena_sz)) == NULL || bpt_init_arena(&b.bstat, order, region, arena_sz) == -1)
+      return 1;
+  } else if (bpt_init(&b.bstat, order) == -1)
+    return 1;
+  if (gen_stk_init(&b.stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+
+  if (counters_open(&b.ctr) < CTR_NR) {
+    fprintf(stderr, "counters not available:");
+    for (i = 0; i < CTR_NR; i++) {
+      if (b.ctr.fd[i] == -1)
+        fprintf(stderr, " %s", counter_names[i]);
+    }
+    fprintf(stderr, "\n");
+  }
+
+  printf("workload %c, distribution %s, %lu records, %lu ops, order %d, %d byte keys%s%s\n",
+      w != NULL ? w->name : '-', dist_names[b.dist], nload, nops, order, (int)sizeof (bpt_key_t),
+      arena ? ", arena" : "", b.ordered ? ", ordered" : "");
+  counters_start(&b.ctr);
+  start = now_ns();
+  for (n = 0, t = 0; n < nload; n++) {
+    if (!b.untimed)
+      t = now_ns();
+    if (do_op(&b, OP_INSERT) == -1)
+      return 1;
+    if (!b.untimed)
+      bpt_hist_record(&b.hist[OP_INSERT], now_ns() - t);
+  }
+  t = now_ns() - start;
+  counters_stop(&b.ctr);
+  report(&b, "load", nload, t);
+
+  counters_start(&b.ctr);
+  start = now_ns();
+  for (n = 0; n < nops; n++) {
+    for (r = next_rand(&b) % 100, i = 0; i < OP_NR - 1 && mix[i] <= r; i++)
+      ;
+    if (!b.untimed)
+      t = now_ns();
+    if (do_op(&b, i) == -1)
+      return 1;
+    if (!b.untimed)
+      bpt_hist_record(&b.hist[i], now_ns() - t);
+  }
+  t = now_ns() - start;
+  counters_stop(&b.ctr);
+  report(&b, "run", nops, t);
+  counters_close(&b.ctr);
+  printf("height %d, %lu reads found, %lu entries scanned\n", b.bstat.height, b.found, b.scanned);
+  return 0;
+}
@@ -0,0 +1,92 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "counters.h"
+
+#define CACHE_READ_MISS(cache) ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+const char *counter_names[CTR_NR] = {
+  "cycles", "instructions", "L1d-misses", "LLC-misses", "dTLB-misses", "branch-misses", "page-faults"
+};
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[CTR_NR] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+  { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+  { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+/**
+ * counters_open: open every counter the machine has, disabled, on the calling thread in user space
+ *
+ * Returns how many were opened.
+ */
+int counters_open(struct counters *c)
+{
+  struct perf_event_attr attr;
+  int i, n = 0;
+
+  for (i = 0; i < CTR_NR; i++) {
+    memset(&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if ((c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) != -1)
+      n++;
+    c->val[i] = 0;
+  }
+  return n;
+}
+
+void counters_start(struct counters *c)
+{
+  int i;
+
+  for (i = 0; i < CTR_NR; i++) {
+    if (c->fd[i] != -1) {
+      ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void counters_stop(struct counters *c)
+{
+  uint64_t buf[3]; // value, time enabled, time running
+  int i;
+
+  for (i = 0; i < CTR_NR; i++) {
+    if (c->fd[i] == -1)
+      continue;
+    ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(c->fd[i], buf, sizeof (buf)) != sizeof (buf) || buf[2] == 0)
+      c->val[i] = 0;
+    else
+      c->val[i] = (double)buf[0] * buf[1] / buf[2];
+  }
+}
+
+void counters_close(struct counters *c)
+{
+  int i;
+
+  for (i = 0; i < CTR_NR; i++) {
+    if (c->fd[i] != -1)
+      close(c->fd[i]);
+    c->fd[i] = -1;
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+
+enum counter {
+  CTR_CYCLES,
+  CTR_INSTRUCTIONS,
+  CTR_L1D_MISSES,
+  CTR_LLC_MISSES,
+  CTR_DTLB_MISSES,
+  CTR_BRANCH_MISSES,
+  CTR_PAGE_FAULTS,
+  CTR_NR
+};
+
+/*
+ * Hardware performance counters of the calling thread, read with perf_event_open(2) around
+ * a phase of the benchmark. Counters the kernel or the machine won't give are left closed
+ * and skipped.
+ */
+struct counters {
+  int fd[CTR_NR]; // -1 if not available
+  double val[CTR_NR]; // counts of the last phase, scaled up if the PMU was multiplexed
+};
+
+extern const char *counter_names[CTR_NR];
+
+int counters_open(struct counters *c);
+void counters_start(struct counters *c);
+void counters_stop(struct counters *c);
+void counters_close(struct counters *c);
+
+#endif
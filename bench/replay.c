@@ -0,0 +1,115 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "../b_plus_tree.h"
+#include "../bpt_trace.h"
+#include "counters.h"
+
+static const char *op_names[] = { "search", "insert", "delete" };
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_key(bpt_t a, bpt_t b)
+{
+  return a.off < b.off ? -1 : a.off > b.off;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+      "usage: %s [-O order] [-A arena_mb] [-T] trace\n"
+      "  -O  order of the tree, 64 by default\n"
+      "  -A  allocate nodes from an arena of that many MiB instead of malloc()\n"
+      "  -T  don't time operations one by one\n"
+      "Replays a trace made with bpt_trace_attach() onto an empty tree, and counts the\n"
+      "operations whose results differ from the traced ones.\n", prog);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct bpt_hist hist[3];
+  struct bpt_trace_reader rd;
+  struct bpt_trace_rec rec;
+  struct bpt_stat bstat;
+  struct gen_stk stk;
+  struct counters ctr;
+  unsigned long n = 0, differ = 0;
+  uint64_t start, t = 0;
+  size_t arena_mb = 0;
+  int opt, i, rst, order = 64, untimed = 0;
+  char *region;
+
+  while ((opt = getopt(argc, argv, "O:A:T")) != -1) {
+    switch (opt) {
+    case 'O':
+      order = atoi(optarg);
+      break;
+    case 'A':
+      arena_mb = strtoul(optarg, NULL, 0);
+      break;
+    case 'T':
+      untimed = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || order < 3)
+    usage(argv[0]);
+  if (bpt_trace_reader_open(&rd, argv[optind]) == -1)
+    return 1;
+  if (arena_mb > 0) {
+    if ((region = malloc(arena_mb << 20)) == NULL || bpt_init_arena(&bstat, order, region, arena_mb << 20) == -1)
+      return 1;
+  } else if (bpt_init(&bstat, order) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  counters_open(&ctr);
+
+  counters_start(&ctr);
+  start = now_ns();
+  while ((rst = bpt_trace_next(&rd, &rec)) == 1) {
+    if (!untimed)
+      t = now_ns();
+    if ((rst = bpt_trace_apply(&rec, cmp_key, &stk, &bstat)) == BPT_ERROR)
+      return 1;
+    if (!untimed)
+      bpt_hist_record(&hist[rec.op], now_ns() - t);
+    differ += rst != rec.rst;
+    n++;
+  }
+  t = now_ns() - start;
+  counters_stop(&ctr);
+  if (rst == -1)
+    return 1;
+
+  printf("replay: %lu ops in %.3f s, %.0f ops/s, order %d%s\n", n, t / 1e9, n / (t / 1e9), order,
+      arena_mb > 0 ? ", arena" : "");
+  for (i = 0; i < CTR_NR; i++) {
+    if (ctr.fd[i] != -1 && n > 0)
+      printf("  %-14s %10.2f per op\n", counter_names[i], ctr.val[i] / n);
+  }
+  for (i = 0; i < 3; i++) {
+    if (hist[i].total == 0)
+      continue;
+    printf("  %-6s %10lu  p50 %6lu  p99 %6lu  p999 %7lu  max %8lu ns\n", op_names[i], hist[i].total,
+        (unsigned long)bpt_hist_percentile(&hist[i], 50), (unsigned long)bpt_hist_percentile(&hist[i], 99),
+        (unsigned long)bpt_hist_percentile(&hist[i], 99.9), (unsigned long)hist[i].max);
+  }
+  printf("height %d, %lu results differ from the trace\n", bstat.height, differ);
+  counters_close(&ctr);
+  bpt_trace_reader_close(&rd);
+  return differ != 0;
+}
@@ -0,0 +1,548 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "syscall_fail.h"
+#include "bpt_build.h"
+
+#define RADIX (1 << BPT_BUILD_RADIX_BITS)
+
+/*
+ * State shared by the threads of a build. Every phase splits its work by thread number,
+ * so threads never write the same thing and only meet when a phase is joined.
+ */
+struct build {
+  struct bpt_stat *bstat;
+  int (*cmp)(bpt_key_t, bpt_key_t);
+  int nthread;
+  struct bpt_slot *src, *dst; // sorted from one into the other, then swapped
+  size_t n;
+  size_t (*hist)[RADIX];      // per thread digit counts, then where their slots go
+  int shift;
+  size_t *runs;               // bounds of the sorted runs being merged
+  int nrun;
+  size_t *cut;                // per thread chunks ending at the end of a run of equal keys
+  size_t *at;                 // where the distinct slots of each chunk go
+  struct bpt_node *nodes, *up; // a level of the tree, and the one built over it
+  bpt_key_t *mins, *up_mins;  // least key under each node of both levels
+  size_t nnode, nup;
+  int error;
+};
+
+struct worker {
+  struct build *b;
+  int t;
+};
+
+static inline size_t chunk(size_t n, int t, int nthread)
+{
+  return n * t / nthread;
+}
+
+/**
+ * run_phase: run @fn on every thread of a build and wait for all of them
+ *
+ * Returns 0 if OK, -1 on system call failure here or in @fn.
+ */
+static int run_phase(struct build *b, void *(*fn)(void *))
+{
+  pthread_t tids[b->nthread];
+  struct worker w[b->nthread];
+  int t, started, rst;
+
+  for (t = 1, started = 1; t < b->nthread; t++, started++) {
+    w[t].b = b;
+    w[t].t = t;
+    if ((rst = pthread_create(&tids[t], NULL, fn, &w[t])) != 0) {
+      errno = rst;
+      syscall_fail("pthread_create");
+      b->error = 1;
+      break;
+    }
+  }
+  w[0].b = b;
+  w[0].t = 0;
+  if (!b->error)
+    fn(&w[0]);
+  for (t = 1; t < started; t++)
+    pthread_join(tids[t], NULL);
+  return b->error ? -1 : 0;
+}
+
+static inline unsigned digit(struct bpt_slot *slot, int shift)
+{
+  return (((uint64_t)BPT_KEY_WORD(slot->key).off ^ (1ULL << 63)) >> shift) & (RADIX - 1); // signed order
+}
+
+static void *radix_count(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t i, end = chunk(b->n, w->t + 1, b->nthread);
+
+  memset(b->hist[w->t], 0, sizeof (b->hist[w->t]));
+  for (i = chunk(b->n, w->t, b->nthread); i < end; i++)
+    b->hist[w->t][digit(&b->src[i], b->shift)]++;
+  return NULL;
+}
+
+static void *radix_scatter(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t i, end = chunk(b->n, w->t + 1, b->nthread), *at = b->hist[w->t];
+
+  for (i = chunk(b->n, w->t, b->nthread); i < end; i++)
+    b->dst[at[digit(&b->src[i], b->shift)]++] = b->src[i];
+  return NULL;
+}
+
+/**
+ * radix_sort: stable LSD radix sort of integer keys, a pass per digit some keys differ in
+ */
+static int radix_sort(struct build *b)
+{
+  struct bpt_slot *tmp;
+  size_t at, c;
+  int d, t, skip;
+
+  for (b->shift = 0; b->shift < 64; b->shift += BPT_BUILD_RADIX_BITS) {
+    if (run_phase(b, radix_count) == -1)
+      return -1;
+    for (d = 0, at = 0, skip = 0; d < RADIX; d++) {
+      for (t = 0; t < b->nthread; t++) {
+        c = b->hist[t][d];
+        b->hist[t][d] = at;
+        at += c;
+      }
+      skip |= at - b->hist[0][d] == b->n; // every key has this digit
+    }
+    if (skip)
+      continue;
+    if (run_phase(b, radix_scatter) == -1)
+      return -1;
+    tmp = b->src;
+    b->src = b->dst;
+    b->dst = tmp;
+  }
+  return 0;
+}
+
+static void msort(struct bpt_slot *a, struct bpt_slot *tmp, size_t n, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  size_t i, j, k, h = n / 2;
+
+  if (n < 2)
+    return;
+  msort(a, tmp, h, cmp);
+  msort(a + h, tmp, n - h, cmp);
+  for (i = 0, j = h, k = 0; i < h && j < n; )
+    tmp[k++] = cmp(a[j].key, a[i].key) < 0 ? a[j++] : a[i++];
+  while (i < h)
+    tmp[k++] = a[i++];
+  memcpy(a, tmp, k * sizeof (struct bpt_slot));
+}
+
+static void *sort_run(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t start = b->runs[w->t];
+
+  msort(b->src + start, b->dst + start, b->runs[w->t+1] - start, b->cmp);
+  return NULL;
+}
+
+/**
+ * co_rank: how many of the first @k slots of the merge of @a and @b come from @a, ties taken from @a first
+ */
+static size_t co_rank(size_t k, struct bpt_slot *a, size_t na, struct bpt_slot *b, size_t nb,
+    int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  size_t lo = k > nb ? k - nb : 0, hi = k < na ? k : na, i;
+
+  while (lo < hi) {
+    i = (lo + hi) / 2;
+    if (k - i > 0 && i < na && cmp(b[k-i-1].key, a[i].key) >= 0)
+      lo = i + 1;
+    else
+      hi = i;
+  }
+  return lo;
+}
+
+/**
+ * merge_runs: merge every pair of runs, each thread writing its share of every merge
+ */
+static void *merge_runs(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  struct bpt_slot *a, *c, *out;
+  size_t na, nc, m, k0, k1, i0, i1, j0, j1;
+  int r;
+
+  for (r = 0; r < b->nrun; r += 2) {
+    a = b->src + b->runs[r];
+    na = b->runs[r+1] - b->runs[r];
+    c = b->src + b->runs[r+1];
+    nc = r + 1 < b->nrun ? b->runs[r+2] - b->runs[r+1] : 0;
+    out = b->dst + b->runs[r];
+    m = na + nc;
+    k0 = chunk(m, w->t, b->nthread);
+    k1 = chunk(m, w->t + 1, b->nthread);
+    i0 = co_rank(k0, a, na, c, nc, b->cmp);
+    i1 = co_rank(k1, a, na, c, nc, b->cmp);
+    for (j0 = k0 - i0, j1 = k1 - i1; i0 < i1 && j0 < j1; )
+      out[k0++] = b->cmp(c[j0].key, a[i0].key) < 0 ? c[j0++] : a[i0++];
+    while (i0 < i1)
+      out[k0++] = a[i0++];
+    while (j0 < j1)
+      out[k0++] = c[j0++];
+  }
+  return NULL;
+}
+
+/**
+ * merge_sort: stable sort by @cmp, runs sorted by every thread alone, then merged in rounds
+ */
+static int merge_sort(struct build *b)
+{
+  struct bpt_slot *tmp;
+  int r;
+
+  if ((b->runs = malloc((b->nthread + 1) * sizeof (size_t))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  for (r = 0; r <= b->nthread; r++)
+    b->runs[r] = chunk(b->n, r, b->nthread);
+  if (run_phase(b, sort_run) == -1)
+    return -1;
+  for (b->nrun = b->nthread; b->nrun > 1; b->nrun = (b->nrun + 1) / 2) {
+    if (run_phase(b, merge_runs) == -1)
+      return -1;
+    for (r = 0; r <= b->nrun; r += 2)
+      b->runs[r/2] = b->runs[r];
+    b->runs[(b->nrun + 1) / 2] = b->n;
+    tmp = b->src;
+    b->src = b->dst;
+    b->dst = tmp;
+  }
+  return 0;
+}
+
+static inline int same_key(struct build *b, size_t i, size_t j)
+{
+  if (b->cmp == NULL)
+    return BPT_KEY_WORD(b->src[i].key).off == BPT_KEY_WORD(b->src[j].key).off;
+  return b->cmp(b->src[i].key, b->src[j].key) == 0;
+}
+
+static void *count_distinct(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t i, cnt = 0;
+
+  for (i = b->cut[w->t]; i < b->cut[w->t+1]; i++)
+    cnt += i + 1 == b->n || !same_key(b, i, i + 1);
+  b->at[w->t] = cnt;
+  return NULL;
+}
+
+static void *copy_distinct(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t i, at = b->at[w->t];
+
+  for (i = b->cut[w->t]; i < b->cut[w->t+1]; i++) {
+    if (i + 1 == b->n || !same_key(b, i, i + 1))
+      b->dst[at++] = b->src[i];
+  }
+  return NULL;
+}
+
+/**
+ * dedup: keep the last slot of every key, as inserting them in order would
+ */
+static int dedup(struct build *b)
+{
+  struct bpt_slot *tmp;
+  size_t sum, c;
+  int t;
+
+  if ((b->cut = malloc((b->nthread + 1) * sizeof (size_t))) == NULL ||
+      (b->at = malloc(b->nthread * sizeof (size_t))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  b->cut[0] = 0;
+  for (t = 1; t <= b->nthread; t++) {
+    b->cut[t] = chunk(b->n, t, b->nthread);
+    if (b->cut[t] < b->cut[t-1])
+      b->cut[t] = b->cut[t-1];
+    while (b->cut[t] > 0 && b->cut[t] < b->n && same_key(b, b->cut[t] - 1, b->cut[t]))
+      b->cut[t]++;
+  }
+  if (run_phase(b, count_distinct) == -1)
+    return -1;
+  for (t = 0, sum = 0; t < b->nthread; t++) {
+    c = b->at[t];
+    b->at[t] = sum;
+    sum += c;
+  }
+  if (run_phase(b, copy_distinct) == -1)
+    return -1;
+  tmp = b->src;
+  b->src = b->dst;
+  b->dst = tmp;
+  b->n = sum;
+  return 0;
+}
+
+/**
+ * spread: where the @i-th of @parts even parts of @n items starts
+ */
+static inline size_t spread(size_t n, size_t parts, size_t i)
+{
+  return i * (n / parts) + (i < n % parts ? i : n % parts);
+}
+
+static void *build_leaves(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  struct bpt_stat *bstat = b->bstat;
+  size_t i, s, e, end = chunk(b->nup, w->t + 1, b->nthread);
+  struct bpt_node leaf;
+
+  for (i = chunk(b->nup, w->t, b->nthread); i < end; i++) {
+    if ((leaf = bpt_node_new(bstat, bpt_null_node, bpt_null_node)).entries == NULL) {
+      b->error = 1;
+      return NULL;
+    }
+    s = spread(b->n, b->nup, i);
+    e = spread(b->n, b->nup, i + 1);
+    memcpy(bpt_leaf_slots(leaf), &b->src[s], (e - s) * sizeof (struct bpt_slot));
+    bpt_node_set_nkey(leaf, bstat->order, e - s);
+    b->up[i] = leaf;
+    b->up_mins[i] = b->src[s].key;
+  }
+  return NULL;
+}
+
+static void *build_internal(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  struct bpt_stat *bstat = b->bstat;
+  size_t i, j, s, e, end = chunk(b->nup, w->t + 1, b->nthread);
+  struct bpt_node node;
+
+  for (i = chunk(b->nup, w->t, b->nthread); i < end; i++) {
+    if ((node = bpt_node_new(bstat, bpt_null_node, bpt_null_node)).entries == NULL) {
+      b->error = 1;
+      return NULL;
+    }
+    s = spread(b->nnode, b->nup, i);
+    e = spread(b->nnode, b->nup, i + 1);
+    for (j = s; j < e; j++) {
+      bpt_node_set_child(node, j - s, b->nodes[j], bstat);
+      if (j > s)
+        node.entries[j-s-1].key = b->mins[j];
+    }
+    bpt_node_set_nkey(node, bstat->order, e - s - 1);
+    b->up[i] = node;
+    b->up_mins[i] = b->mins[s];
+  }
+  return NULL;
+}
+
+static void *link_level(void *arg)
+{
+  struct worker *w = arg;
+  struct build *b = w->b;
+  size_t i, end = chunk(b->nup, w->t + 1, b->nthread);
+
+  for (i = chunk(b->nup, w->t, b->nthread); i < end; i++) {
+    bpt_node_set_prv(b->up[i], i > 0 ? b->up[i-1] : bpt_null_node, b->bstat);
+    bpt_node_set_nxt(b->up[i], i + 1 < b->nup ? b->up[i+1] : bpt_null_node, b->bstat);
+  }
+  return NULL;
+}
+
+/**
+ * drop_levels: free the nodes of a failed build, leaving the tree as bpt_init() left it
+ * @height: height of the whole level under the one that failed, or -1 if the leaves did
+ */
+static void drop_levels(struct build *b, int height)
+{
+  struct bpt_stat *bstat = b->bstat;
+  struct bpt_node root = bstat->root_node;
+  size_t i;
+
+  for (i = 0; i < b->nup; i++) {
+    if (b->up[i].entries != NULL)
+      bpt_node_delete(bstat, b->up[i]);
+  }
+  if (height >= 0) { // every level up to that one is whole and linked
+    bstat->root_node = b->nodes[0];
+    bstat->height = height;
+    bpt_free(bstat);
+    bstat->root_node = root;
+    bstat->height = 0;
+  }
+}
+
+/**
+ * build_levels: build the leaves over the sorted distinct slots, then every level over the last one
+ *
+ * Returns 0 if OK, -1 on system call failure, in which case the nodes built are freed.
+ */
+static int build_levels(struct build *b)
+{
+  struct bpt_stat *bstat = b->bstat;
+  struct bpt_node *nodes;
+  bpt_key_t *mins;
+  int height = 0;
+
+  b->nup = (b->n + bstat->leaf_order - 1) / bstat->leaf_order;
+  if ((b->nodes = malloc(b->nup * sizeof (struct bpt_node))) == NULL ||
+      (b->up = calloc(b->nup, sizeof (struct bpt_node))) == NULL ||
+      (b->mins = malloc(b->nup * sizeof (bpt_key_t))) == NULL ||
+      (b->up_mins = malloc(b->nup * sizeof (bpt_key_t))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  if (run_phase(b, build_leaves) == -1 || run_phase(b, link_level) == -1) {
+    drop_levels(b, -1);
+    return -1;
+  }
+  while (b->nup > 1) {
+    nodes = b->nodes;
+    b->nodes = b->up;
+    b->up = nodes;
+    mins = b->mins;
+    b->mins = b->up_mins;
+    b->up_mins = mins;
+    b->nnode = b->nup;
+    b->nup = (b->nnode + bstat->order) / (bstat->order + 1);
+    memset(b->up, 0, b->nup * sizeof (struct bpt_node));
+    if (run_phase(b, build_internal) == -1 || run_phase(b, link_level) == -1) {
+      drop_levels(b, height);
+      return -1;
+    }
+    height++;
+  }
+  bpt_node_delete(bstat, bstat->root_node);
+  bstat->root_node = b->up[0];
+  bstat->height = height;
+  return 0;
+}
+
+static void build_release(struct build *b, struct bpt_slot *slots)
+{
+  free(b->src != slots ? b->src : b->dst);
+  free(b->hist);
+  free(b->runs);
+  free(b->cut);
+  free(b->at);
+  free(b->nodes);
+  free(b->up);
+  free(b->mins);
+  free(b->up_mins);
+}
+
+/**
+ * bpt_build_parallel: build a new heap B+ tree out of unsorted slots, on @nthread threads
+ * @order: the order of the new tree
+ * @slots: the entries to load, used as scratch space, so left in no particular order
+ * @cmp: key comparison function of the new tree, or NULL for integer keys in bpt_t.off ordered
+ *       as signed numbers, which are radix sorted
+ * @nthread: threads to use, or 0 for every online CPU
+ *
+ * Slots are sorted by parallel radix or merge sort, keeping the last of each key. Leaves are
+ * then filled evenly and as full as they go by every thread for its own range of them, and
+ * so is every internal level over them, leaving nodes as bpt_insert() in key order would.
+ *
+ * Returns 0 if OK, -1 on system call failure, in which case nothing is left to free, or if
+ * @cmp is NULL for keys other than bpt_t.
+ */
+int bpt_build_parallel(struct bpt_stat *bstat, int order, struct bpt_slot *slots, size_t n,
+    int (*cmp)(bpt_key_t, bpt_key_t), int nthread)
+{
+  struct build b;
+  int rst = -1;
+
+#ifndef BPT_KEY_PLAIN
+  if (cmp == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+#endif
+  if (nthread <= 0 && (nthread = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    nthread = 1;
+  if (bpt_init(bstat, order) == -1)
+    return -1;
+  if (n == 0)
+    return 0;
+  memset(&b, 0, sizeof (b));
+  b.bstat = bstat;
+  b.cmp = cmp;
+  b.nthread = (size_t)nthread > n ? (int)n : nthread;
+  b.src = slots;
+  b.n = n;
+  if ((b.dst = malloc(n * sizeof (struct bpt_slot))) == NULL ||
+      (b.hist = malloc(b.nthread * sizeof (*b.hist))) == NULL) {
+    syscall_fail("malloc");
+    goto out;
+  }
+  if ((cmp == NULL ? radix_sort(&b) : merge_sort(&b)) == -1 || dedup(&b) == -1 || build_levels(&b) == -1)
+    goto out;
+  rst = 0;
+out:
+  build_release(&b, slots);
+  if (rst == -1)
+    bpt_free(bstat);
+  return rst;
+}
+
+/**
+ * bpt_build_sorted: build a new heap B+ tree out of slots already sorted, on @nthread threads
+ * @order: the order of the new tree
+ * @slots: the entries to load, in strictly increasing key order, left as they are
+ * @nthread: threads to use, or 0 for every online CPU
+ *
+ * Skips the sort and fills the levels as bpt_build_parallel() does, so loading n sorted
+ * entries costs O(n) rather than the O(n log n) of inserting them one by one.
+ *
+ * Returns 0 if OK, -1 on system call failure, in which case nothing is left to free.
+ */
+int bpt_build_sorted(struct bpt_stat *bstat, int order, struct bpt_slot *slots, size_t n, int nthread)
+{
+  struct build b;
+  int rst;
+
+  if (nthread <= 0 && (nthread = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    nthread = 1;
+  if (bpt_init(bstat, order) == -1)
+    return -1;
+  if (n == 0)
+    return 0;
+  memset(&b, 0, sizeof (b));
+  b.bstat = bstat;
+  b.nthread = (size_t)nthread > n ? (int)n : nthread;
+  b.src = slots;
+  b.n = n;
+  rst = build_levels(&b);
+  build_release(&b, slots);
+  if (rst == -1)
+    bpt_free(bstat);
+  return rst;
+}
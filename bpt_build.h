@@ -0,0 +1,12 @@
+#ifndef BPT_BUILD_H
+#define BPT_BUILD_H
+
+#include "b_plus_tree.h"
+
+#define BPT_BUILD_RADIX_BITS 8 // key bits sorted per radix pass
+
+int bpt_build_parallel(struct bpt_stat *bstat, int order, struct bpt_slot *slots, size_t n,
+    int (*cmp)(bpt_key_t, bpt_key_t), int nthread);
+int bpt_build_sorted(struct bpt_stat *bstat, int order, struct bpt_slot *slots, size_t n, int nthread);
+
+#endif
@@ -0,0 +1,1148 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "syscall_fail.h"
+#include "bpt_lsm.h"
+
+struct run_hdr {
+  uint32_t magic;
+  uint32_t block; // records per block, runs of another build are refused
+  uint64_t nrec;
+};
+
+struct manifest_hdr {
+  uint32_t magic;
+  uint32_t n;     // ids of the runs follow, oldest first
+};
+
+// reads the records of a run in order, a block at a time
+struct run_iter {
+  struct bpt_lsm_run *run;
+  size_t next; // first record not read yet
+  struct bpt_lsm_rec buf[BPT_LSM_BLOCK];
+  int n, pos;
+};
+
+struct run_writer {
+  int fd;
+  size_t nrec;
+  struct gen_stk index;
+  struct bpt_lsm_rec buf[BPT_LSM_BLOCK];
+  int n;
+};
+
+// what a source of a cursor holds from where the cursor is on
+struct lsm_src {
+  struct bpt_lsm_rec recs[BPT_LSM_BATCH];
+  int n, pos;
+  int more; // records past @recs may follow
+};
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, buf, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      syscall_fail("write");
+      return -1;
+    }
+    buf = (const char *)buf + n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int pread_all(int fd, void *buf, size_t len, off_t at)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = pread(fd, buf, len, at)) == -1) {
+      if (errno == EINTR)
+        continue;
+      syscall_fail("pread");
+      return -1;
+    }
+    if (n == 0) {
+      fprintf(stderr, "pread: file cut short\n");
+      return -1;
+    }
+    buf = (char *)buf + n;
+    len -= n;
+    at += n;
+  }
+  return 0;
+}
+
+static int sync_dir(const char *path)
+{
+  char *dir, *slash;
+  int fd, rst = 0;
+
+  if ((dir = strdup(path)) == NULL) {
+    syscall_fail("strdup");
+    return -1;
+  }
+  if ((slash = strrchr(dir, '/')) == NULL)
+    strcpy(dir, ".");
+  else if (slash == dir)
+    slash[1] = '\0';
+  else
+    *slash = '\0';
+  if ((fd = open(dir, O_RDONLY)) == -1) {
+    syscall_fail("open");
+    rst = -1;
+  } else {
+    if ((rst = fsync(fd)) == -1)
+      syscall_fail("fsync");
+    close(fd);
+  }
+  free(dir);
+  return rst;
+}
+
+static char *run_path(struct bpt_lsm *lsm, unsigned long long id)
+{
+  char *path;
+
+  if ((path = malloc(strlen(lsm->path) + 24)) == NULL) {
+    syscall_fail("malloc");
+    return NULL;
+  }
+  sprintf(path, "%s-%llu", lsm->path, id);
+  return path;
+}
+
+static inline off_t rec_at(size_t i)
+{
+  return sizeof (struct run_hdr) + i * sizeof (struct bpt_lsm_rec);
+}
+
+static inline size_t blocks_for(size_t nrec)
+{
+  return (nrec + BPT_LSM_BLOCK - 1) / BPT_LSM_BLOCK;
+}
+
+static struct bpt_lsm_run *run_open(struct bpt_lsm *lsm, unsigned long long id)
+{
+  struct bpt_lsm_run *run;
+  struct run_hdr hdr;
+  size_t nblock;
+  char *path;
+
+  if ((path = run_path(lsm, id)) == NULL)
+    return NULL;
+  if ((run = calloc(1, sizeof (*run))) == NULL) {
+    syscall_fail("calloc");
+    goto fail;
+  }
+  if ((run->fd = open(path, O_RDONLY)) == -1) {
+    syscall_fail("open");
+    goto fail_run;
+  }
+  if (pread_all(run->fd, &hdr, sizeof (hdr), 0) == -1)
+    goto fail_fd;
+  if (hdr.magic != BPT_LSM_MAGIC || hdr.block != BPT_LSM_BLOCK) {
+    fprintf(stderr, "%s: not a run\n", path);
+    goto fail_fd;
+  }
+  run->id = id;
+  run->nrec = hdr.nrec;
+  nblock = blocks_for(run->nrec);
+  if ((run->index = malloc(nblock * sizeof (bpt_t) + 1)) == NULL) {
+    syscall_fail("malloc");
+    goto fail_fd;
+  }
+  if (pread_all(run->fd, run->index, nblock * sizeof (bpt_t), rec_at(run->nrec)) == -1)
+    goto fail_index;
+  free(path);
+  return run;
+
+fail_index:
+  free(run->index);
+fail_fd:
+  close(run->fd);
+fail_run:
+  free(run);
+fail:
+  free(path);
+  return NULL;
+}
+
+/**
+ * run_close: release a run nothing holds any more, removing its file if it was compacted away
+ */
+static void run_close(struct bpt_lsm *lsm, struct bpt_lsm_run *run)
+{
+  char *path;
+
+  close(run->fd);
+  if (run->obsolete && (path = run_path(lsm, run->id)) != NULL) {
+    if (unlink(path) == -1)
+      syscall_fail("unlink");
+    free(path);
+  }
+  free(run->index);
+  free(run);
+}
+
+/**
+ * run_block: the last block of @run whose first key isn't greater than @key, -1 if there's none
+ */
+static long run_block(struct bpt_lsm *lsm, struct bpt_lsm_run *run, bpt_t key)
+{
+  size_t lo = 0, hi = blocks_for(run->nrec), mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (lsm->cmp(run->index[mid], key) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (long)lo - 1;
+}
+
+/**
+ * run_get: look @key up in a run, reading the one block that may hold it
+ *
+ * Returns 1 and stores the record to *@rec if found, 0 if not, -1 on system call failure.
+ */
+static int run_get(struct bpt_lsm *lsm, struct bpt_lsm_run *run, bpt_t key, struct bpt_lsm_rec *rec)
+{
+  struct bpt_lsm_rec buf[BPT_LSM_BLOCK];
+  size_t lo, hi, mid, first;
+  long b;
+  int c;
+
+  if ((b = run_block(lsm, run, key)) == -1)
+    return 0;
+  first = (size_t)b * BPT_LSM_BLOCK;
+  hi = run->nrec - first < BPT_LSM_BLOCK ? run->nrec - first : BPT_LSM_BLOCK;
+  if (pread_all(run->fd, buf, hi * sizeof (struct bpt_lsm_rec), rec_at(first)) == -1)
+    return -1;
+  for (lo = 0; lo < hi; ) {
+    mid = (lo + hi) / 2;
+    if ((c = lsm->cmp(buf[mid].key, key)) == 0) {
+      *rec = buf[mid];
+      return 1;
+    }
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
+
+static void iter_init(struct run_iter *it, struct bpt_lsm_run *run, size_t at)
+{
+  it->run = run;
+  it->next = at;
+  it->n = it->pos = 0;
+}
+
+/**
+ * iter_head: the record a run iterator is at, reading the next block once the buffered one is used up
+ *
+ * Returns 1 if there's one, 0 past the last record, -1 on system call failure.
+ */
+static int iter_head(struct run_iter *it, struct bpt_lsm_rec **recp)
+{
+  size_t n;
+
+  if (it->pos == it->n) {
+    if (it->next >= it->run->nrec)
+      return 0;
+    n = it->run->nrec - it->next < BPT_LSM_BLOCK ? it->run->nrec - it->next : BPT_LSM_BLOCK;
+    if (pread_all(it->run->fd, it->buf, n * sizeof (struct bpt_lsm_rec), rec_at(it->next)) == -1)
+      return -1;
+    it->next += n;
+    it->n = n;
+    it->pos = 0;
+  }
+  *recp = &it->buf[it->pos];
+  return 1;
+}
+
+static int writer_open(struct bpt_lsm *lsm, struct run_writer *w, unsigned long long id)
+{
+  struct run_hdr hdr;
+  char *path;
+
+  if ((path = run_path(lsm, id)) == NULL)
+    return -1;
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  free(path);
+  if (w->fd == -1) {
+    syscall_fail("open");
+    return -1;
+  }
+  memset(&hdr, 0, sizeof (hdr)); // written for real once the run is complete
+  if (write_all(w->fd, &hdr, sizeof (hdr)) == -1 ||
+      gen_stk_init(&w->index, BPT_STK_CAP_INIT, sizeof (bpt_t)) == -1) {
+    close(w->fd);
+    return -1;
+  }
+  w->nrec = 0;
+  w->n = 0;
+  return 0;
+}
+
+static int writer_put(struct run_writer *w, struct bpt_lsm_rec *rec)
+{
+  if (w->n == 0 && gen_stk_push(&w->index, &rec->key) == -1)
+    return -1;
+  w->buf[w->n++] = *rec;
+  w->nrec++;
+  if (w->n == BPT_LSM_BLOCK) {
+    if (write_all(w->fd, w->buf, sizeof (w->buf)) == -1)
+      return -1;
+    w->n = 0;
+  }
+  return 0;
+}
+
+static void writer_abort(struct bpt_lsm *lsm, struct run_writer *w, unsigned long long id)
+{
+  char *path;
+
+  close(w->fd);
+  if ((path = run_path(lsm, id)) != NULL) {
+    unlink(path);
+    free(path);
+  }
+  gen_stk_delete(&w->index);
+}
+
+/**
+ * writer_close: complete a run and make it durable, then open it for reading
+ *
+ * Returns 0 if OK, with the run in *@runp, or NULL there if it had no record and was removed;
+ * -1 on system call failure.
+ */
+static int writer_close(struct bpt_lsm *lsm, struct run_writer *w, unsigned long long id, struct bpt_lsm_run **runp)
+{
+  struct run_hdr hdr = { .magic = BPT_LSM_MAGIC, .block = BPT_LSM_BLOCK, .nrec = w->nrec };
+
+  if (w->nrec == 0) {
+    writer_abort(lsm, w, id);
+    *runp = NULL;
+    return 0;
+  }
+  if (write_all(w->fd, w->buf, w->n * sizeof (struct bpt_lsm_rec)) == -1 ||
+      write_all(w->fd, w->index.addr, w->index.cnt * sizeof (bpt_t)) == -1)
+    goto fail;
+  if (pwrite(w->fd, &hdr, sizeof (hdr), 0) != sizeof (hdr)) {
+    syscall_fail("pwrite");
+    goto fail;
+  }
+  if (fsync(w->fd) == -1) {
+    syscall_fail("fsync");
+    goto fail;
+  }
+  close(w->fd);
+  gen_stk_delete(&w->index);
+  return (*runp = run_open(lsm, id)) == NULL ? -1 : 0;
+
+fail:
+  writer_abort(lsm, w, id);
+  return -1;
+}
+
+static struct bpt_lsm_set *set_new(int cap)
+{
+  struct bpt_lsm_set *set;
+
+  if ((set = malloc(sizeof (*set) + cap * sizeof (set->runs[0]))) == NULL) {
+    syscall_fail("malloc");
+    return NULL;
+  }
+  set->refs = 1;
+  set->n = 0;
+  return set;
+}
+
+static void set_add(struct bpt_lsm_set *set, struct bpt_lsm_run *run)
+{
+  set->runs[set->n++] = run;
+  run->refs++;
+}
+
+/**
+ * set_release: let a run set go, with @lsm->lock held
+ */
+static void set_release(struct bpt_lsm *lsm, struct bpt_lsm_set *set)
+{
+  int i;
+
+  if (--set->refs > 0)
+    return;
+  for (i = 0; i < set->n; i++) {
+    if (--set->runs[i]->refs == 0)
+      run_close(lsm, set->runs[i]);
+  }
+  free(set);
+}
+
+/**
+ * write_manifest: replace the run list on disk with the runs of @set
+ *
+ * The list is written aside and renamed over the old one, so a crash leaves either list.
+ */
+static int write_manifest(struct bpt_lsm *lsm, struct bpt_lsm_set *set)
+{
+  struct manifest_hdr hdr = { .magic = BPT_LSM_MAGIC, .n = set->n };
+  uint64_t id;
+  char *tmp_path;
+  int fd, i, rst = -1;
+
+  if ((tmp_path = malloc(strlen(lsm->path) + 5)) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  sprintf(tmp_path, "%s.tmp", lsm->path);
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    syscall_fail("open");
+    goto out;
+  }
+  if (write_all(fd, &hdr, sizeof (hdr)) == -1)
+    goto out_close;
+  for (i = 0; i < set->n; i++) {
+    id = set->runs[i]->id;
+    if (write_all(fd, &id, sizeof (id)) == -1)
+      goto out_close;
+  }
+  if (fsync(fd) == -1) {
+    syscall_fail("fsync");
+    goto out_close;
+  }
+  if (rename(tmp_path, lsm->path) == -1) {
+    syscall_fail("rename");
+    goto out_close;
+  }
+  rst = sync_dir(lsm->path);
+out_close:
+  close(fd);
+out:
+  free(tmp_path);
+  return rst;
+}
+
+static int read_manifest(struct bpt_lsm *lsm)
+{
+  struct manifest_hdr hdr;
+  struct bpt_lsm_run *run;
+  uint64_t id;
+  uint32_t i;
+  int fd;
+
+  if ((fd = open(lsm->path, O_RDONLY)) == -1) {
+    if (errno != ENOENT) {
+      syscall_fail("open");
+      return -1;
+    }
+    return (lsm->set = set_new(0)) == NULL ? -1 : 0;
+  }
+  if (pread_all(fd, &hdr, sizeof (hdr), 0) == -1)
+    goto fail;
+  if (hdr.magic != BPT_LSM_MAGIC) {
+    fprintf(stderr, "%s: not an LSM tree\n", lsm->path);
+    goto fail;
+  }
+  if ((lsm->set = set_new(hdr.n)) == NULL)
+    goto fail;
+  for (i = 0; i < hdr.n; i++) {
+    if (pread_all(fd, &id, sizeof (id), sizeof (hdr) + i * sizeof (id)) == -1 ||
+        (run = run_open(lsm, id)) == NULL) {
+      set_release(lsm, lsm->set);
+      goto fail;
+    }
+    set_add(lsm->set, run);
+    if (id >= lsm->next_id)
+      lsm->next_id = id + 1;
+  }
+  close(fd);
+  return 0;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+static struct bpt_lsm_mem *mem_new(int order)
+{
+  struct bpt_lsm_mem *m;
+
+  if ((m = malloc(sizeof (*m))) == NULL) {
+    syscall_fail("malloc");
+    return NULL;
+  }
+  if (bpt_init(&m->live, order) == -1)
+    goto fail;
+  if (bpt_init(&m->dead, order) == -1)
+    goto fail_live;
+  if (gen_stk_init(&m->stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    goto fail_dead;
+  m->n = 0;
+  return m;
+
+fail_dead:
+  bpt_free(&m->dead);
+fail_live:
+  bpt_free(&m->live);
+fail:
+  free(m);
+  return NULL;
+}
+
+static void mem_free(struct bpt_lsm_mem *m)
+{
+  bpt_free(&m->live);
+  bpt_free(&m->dead);
+  gen_stk_delete(&m->stk);
+  free(m);
+}
+
+/**
+ * mem_get: look @key up in a memtable
+ *
+ * Returns 1 and stores the value to *@valp if it was written there, 0 if it was deleted,
+ * -1 if the memtable doesn't know it.
+ */
+static int mem_get(struct bpt_lsm *lsm, struct bpt_lsm_mem *m, bpt_t key, bpt_t *valp)
+{
+  struct bpt_node leaf;
+  int offset;
+
+  if ((offset = bpt_search(key, lsm->cmp, &m->live, &leaf)) != -1) {
+    *valp = bpt_leaf_slots(leaf)[offset].val;
+    return 1;
+  }
+  return bpt_search(key, lsm->cmp, &m->dead, &leaf) != -1 ? 0 : -1;
+}
+
+static int mem_write(struct bpt_lsm *lsm, struct bpt_entry entry, int dead)
+{
+  struct bpt_lsm_mem *m = lsm->mem;
+  struct bpt_stat *to = dead ? &m->dead : &m->live, *from = dead ? &m->live : &m->dead;
+  int rst;
+
+  if ((rst = bpt_delete(entry, lsm->cmp, bpt_pred_1, &m->stk, 1, from)) == BPT_ERROR)
+    return -1;
+  if (rst == BPT_PRED_SUCCESS)
+    m->n--;
+  if ((rst = bpt_insert(entry, lsm->cmp, bpt_pred_1, &m->stk, 1, to)) == BPT_ERROR)
+    return -1;
+  if (rst == BPT_NEXIST)
+    m->n++;
+  return 0;
+}
+
+/**
+ * freeze: hand the memtable to the background thread once it holds @min entries, and start an empty one
+ *
+ * Called with @lsm->lock held. Waits while the memtable frozen last is still being written out,
+ * so writers can't get ahead of the disk by more than one memtable.
+ *
+ * Returns 0 if OK, -1 on system call failure, or if a run couldn't be written.
+ */
+static int freeze(struct bpt_lsm *lsm, size_t min)
+{
+  struct bpt_lsm_mem *m;
+
+  if (lsm->imm != NULL)
+    lsm->stalls++;
+  while (lsm->imm != NULL && !lsm->error)
+    pthread_cond_wait(&lsm->flushed, &lsm->lock);
+  if (lsm->error)
+    return -1;
+  if (lsm->mem->n < min) // frozen by another writer meanwhile
+    return 0;
+  if ((m = mem_new(lsm->order)) == NULL)
+    return -1;
+  lsm->imm = lsm->mem;
+  lsm->mem = m;
+  pthread_cond_signal(&lsm->work);
+  return 0;
+}
+
+/**
+ * install: make @set the runs of @lsm once the run list on disk says so
+ *
+ * Called with @lsm->lock held, which is dropped while the list is written. The caller lets
+ * the set replaced go.
+ */
+static int install(struct bpt_lsm *lsm, struct bpt_lsm_set *set)
+{
+  int rst;
+
+  pthread_mutex_unlock(&lsm->lock);
+  rst = write_manifest(lsm, set);
+  pthread_mutex_lock(&lsm->lock);
+  if (rst == -1) {
+    set_release(lsm, set);
+    return -1;
+  }
+  lsm->set = set;
+  return 0;
+}
+
+/**
+ * write_mem: write a frozen memtable out as run @id by walking the leaf chains of its trees
+ * @drop: if tombstones have no older run to hide entries in
+ */
+static int write_mem(struct bpt_lsm *lsm, struct bpt_lsm_mem *m, unsigned long long id, int drop,
+    struct bpt_lsm_run **runp)
+{
+  struct run_writer w;
+  struct bpt_cursor live, dead;
+  struct bpt_lsm_rec rec;
+  int l, d;
+
+  if (writer_open(lsm, &w, id) == -1)
+    return -1;
+  l = bpt_cursor_first(&live, &m->live) == 0;
+  d = bpt_cursor_first(&dead, &m->dead) == 0;
+  while (l || d) {
+    if (l && (!d || lsm->cmp(bpt_cursor_entry(&live)->key, bpt_cursor_entry(&dead)->key) < 0)) {
+      rec.key = bpt_cursor_entry(&live)->key;
+      rec.val = bpt_cursor_entry(&live)->val;
+      rec.dead = 0;
+      l = bpt_cursor_next(&live) == 0;
+    } else {
+      rec.key = bpt_cursor_entry(&dead)->key;
+      rec.val.off = 0;
+      rec.dead = 1;
+      d = bpt_cursor_next(&dead) == 0;
+      if (drop)
+        continue;
+    }
+    if (writer_put(&w, &rec) == -1) {
+      writer_abort(lsm, &w, id);
+      return -1;
+    }
+  }
+  return writer_close(lsm, &w, id, runp);
+}
+
+/**
+ * flush_imm: write the frozen memtable out as the newest run
+ *
+ * Called with @lsm->lock held, which is dropped while writing. Readers keep finding the
+ * entries in the memtable until the run list on disk holds the run.
+ */
+static int flush_imm(struct bpt_lsm *lsm)
+{
+  struct bpt_lsm_mem *imm = lsm->imm;
+  struct bpt_lsm_set *old = lsm->set, *set;
+  struct bpt_lsm_run *run;
+  unsigned long long id = lsm->next_id++;
+  int i, rst;
+
+  // only this thread changes the runs, so @old stays theirs while unlocked
+  pthread_mutex_unlock(&lsm->lock);
+  rst = write_mem(lsm, imm, id, old->n == 0, &run);
+  pthread_mutex_lock(&lsm->lock);
+  if (rst == -1)
+    return -1;
+  if (run != NULL) {
+    if ((set = set_new(old->n + 1)) == NULL) {
+      run_close(lsm, run);
+      return -1;
+    }
+    for (i = 0; i < old->n; i++)
+      set_add(set, old->runs[i]);
+    set_add(set, run);
+    if (install(lsm, set) == -1)
+      return -1;
+    set_release(lsm, old);
+  }
+  lsm->imm = NULL;
+  lsm->flushes++;
+  mem_free(imm);
+  return 0;
+}
+
+/**
+ * compact_from: the oldest run to merge with every newer one, -1 if runs are fine as they are
+ *
+ * A run is merged once the newer runs hold 1/@lsm->ratio of its records, so sizes grow
+ * geometrically from the newest run to the oldest and there are logarithmically many.
+ */
+static int compact_from(struct bpt_lsm *lsm)
+{
+  struct bpt_lsm_set *set = lsm->set;
+  size_t sum;
+  int i;
+
+  if (set->n < 2)
+    return -1;
+  i = set->n - 1;
+  sum = set->runs[i]->nrec;
+  while (i > 0 && set->runs[i-1]->nrec <= lsm->ratio * sum)
+    sum += set->runs[--i]->nrec;
+  return i < set->n - 1 ? i : -1;
+}
+
+/**
+ * compact: merge the runs from @from on into one, the newest record of a key winning
+ *
+ * Called with @lsm->lock held, which is dropped while merging. Tombstones are dropped when
+ * the oldest run takes part.
+ */
+static int compact(struct bpt_lsm *lsm, int from)
+{
+  struct bpt_lsm_set *old = lsm->set, *set;
+  struct bpt_lsm_run *run = NULL;
+  struct bpt_lsm_rec *rec, *top, out;
+  struct run_iter *its;
+  struct run_writer w;
+  unsigned long long id = lsm->next_id++;
+  int i, r, k = old->n - from, rst = -1;
+
+  pthread_mutex_unlock(&lsm->lock);
+  if ((its = malloc(k * sizeof (struct run_iter))) == NULL) {
+    syscall_fail("malloc");
+    goto out;
+  }
+  for (i = 0; i < k; i++)
+    iter_init(&its[i], old->runs[from + i], 0);
+  if (writer_open(lsm, &w, id) == -1)
+    goto out_free;
+  while (1) {
+    for (i = k - 1, top = NULL; i >= 0; i--) { // newest first, so it wins ties
+      if ((r = iter_head(&its[i], &rec)) == -1)
+        goto out_abort;
+      if (r == 1 && (top == NULL || lsm->cmp(rec->key, top->key) < 0))
+        top = rec;
+    }
+    if (top == NULL)
+      break;
+    out = *top;
+    for (i = 0; i < k; i++) {
+      if (its[i].pos < its[i].n && lsm->cmp(its[i].buf[its[i].pos].key, out.key) == 0)
+        its[i].pos++;
+    }
+    if (!(out.dead && from == 0) && writer_put(&w, &out) == -1)
+      goto out_abort;
+  }
+  rst = writer_close(lsm, &w, id, &run);
+  goto out_free;
+out_abort:
+  writer_abort(lsm, &w, id);
+out_free:
+  free(its);
+out:
+  pthread_mutex_lock(&lsm->lock);
+  if (rst == -1)
+    return -1;
+  if ((set = set_new(from + 1)) == NULL) {
+    if (run != NULL)
+      run_close(lsm, run);
+    return -1;
+  }
+  for (i = 0; i < from; i++)
+    set_add(set, old->runs[i]);
+  if (run != NULL)
+    set_add(set, run);
+  if (install(lsm, set) == -1)
+    return -1;
+  for (i = from; i < old->n; i++)
+    old->runs[i]->obsolete = 1;
+  set_release(lsm, old);
+  lsm->compactions++;
+  return 0;
+}
+
+/**
+ * lsm_main: the background thread, writing frozen memtables out first and compacting runs otherwise
+ */
+static void *lsm_main(void *arg)
+{
+  struct bpt_lsm *lsm = arg;
+  int from;
+
+  pthread_mutex_lock(&lsm->lock);
+  while (!lsm->error) {
+    if (lsm->imm != NULL) {
+      if (flush_imm(lsm) == -1)
+        lsm->error = 1;
+      pthread_cond_broadcast(&lsm->flushed);
+    } else if ((from = compact_from(lsm)) != -1) {
+      if (compact(lsm, from) == -1)
+        lsm->error = 1;
+    } else if (lsm->stop)
+      break;
+    else
+      pthread_cond_wait(&lsm->work, &lsm->lock);
+  }
+  pthread_cond_broadcast(&lsm->flushed);
+  pthread_mutex_unlock(&lsm->lock);
+  return NULL;
+}
+
+/**
+ * bpt_lsm_open: open an LSM tree, creating it if it doesn't exist
+ * @lsm: the struct stating the LSM tree
+ * @path: path of the run list, runs are kept at "@path-<id>"
+ * @order: the order of the memtables
+ * @cmp: key comparison function, see bpt_insert()
+ *
+ * Starts the background thread, which runs until bpt_lsm_close().
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_lsm_open(struct bpt_lsm *lsm, const char *path, int order, int (*cmp)(bpt_t, bpt_t))
+{
+  int rst;
+
+  memset(lsm, 0, sizeof (*lsm));
+  lsm->cmp = cmp;
+  lsm->order = order;
+  lsm->mem_max = BPT_LSM_MEM_MAX;
+  lsm->ratio = BPT_LSM_RATIO;
+  lsm->next_id = 1;
+  if ((lsm->path = strdup(path)) == NULL) {
+    syscall_fail("strdup");
+    return -1;
+  }
+  if (read_manifest(lsm) == -1)
+    goto fail;
+  if ((lsm->mem = mem_new(order)) == NULL)
+    goto fail_set;
+  pthread_mutex_init(&lsm->lock, NULL);
+  pthread_cond_init(&lsm->work, NULL);
+  pthread_cond_init(&lsm->flushed, NULL);
+  if ((rst = pthread_create(&lsm->bg, NULL, lsm_main, lsm)) != 0) {
+    errno = rst;
+    syscall_fail("pthread_create");
+    goto fail_mem;
+  }
+  return 0;
+
+fail_mem:
+  pthread_mutex_destroy(&lsm->lock);
+  pthread_cond_destroy(&lsm->work);
+  pthread_cond_destroy(&lsm->flushed);
+  mem_free(lsm->mem);
+fail_set:
+  set_release(lsm, lsm->set);
+fail:
+  free(lsm->path);
+  return -1;
+}
+
+static int lsm_write(struct bpt_lsm *lsm, struct bpt_entry entry, int dead)
+{
+  int rst = 0;
+
+  pthread_mutex_lock(&lsm->lock);
+  if (lsm->error || mem_write(lsm, entry, dead) == -1)
+    rst = -1;
+  else if (lsm->mem->n >= lsm->mem_max)
+    rst = freeze(lsm, lsm->mem_max);
+  pthread_mutex_unlock(&lsm->lock);
+  return rst;
+}
+
+/**
+ * bpt_lsm_put: write an entry into an LSM tree, replacing any entry with the same key
+ *
+ * The write never reads the runs, so whether the key existed is unknown.
+ *
+ * Returns 0 if OK, -1 on system call failure, or if a run couldn't be written.
+ */
+int bpt_lsm_put(struct bpt_lsm *lsm, struct bpt_entry entry)
+{
+  return lsm_write(lsm, entry, 0);
+}
+
+/**
+ * bpt_lsm_delete: delete @key from an LSM tree, by writing a tombstone for it
+ *
+ * Returns 0 if OK, -1 on system call failure, or if a run couldn't be written.
+ */
+int bpt_lsm_delete(struct bpt_lsm *lsm, bpt_t key)
+{
+  struct bpt_entry entry;
+
+  entry.key = key;
+  entry.val.off = 0;
+  return lsm_write(lsm, entry, 1);
+}
+
+/**
+ * bpt_lsm_search: look up @search_for in the memtables, then in the runs from the newest one
+ *
+ * The runs are read without the lock held, so writers don't wait for the disk.
+ *
+ * Returns 0 and stores the value to *@valp if found, -1 otherwise or on system call failure.
+ */
+int bpt_lsm_search(struct bpt_lsm *lsm, bpt_t search_for, bpt_t *valp)
+{
+  struct bpt_lsm_set *set;
+  struct bpt_lsm_rec rec;
+  bpt_t val;
+  int i, rst;
+
+  pthread_mutex_lock(&lsm->lock);
+  if ((rst = mem_get(lsm, lsm->mem, search_for, &val)) == -1 && lsm->imm != NULL)
+    rst = mem_get(lsm, lsm->imm, search_for, &val);
+  if (rst != -1) {
+    pthread_mutex_unlock(&lsm->lock);
+    if (rst == 0)
+      return -1;
+    *valp = val;
+    return 0;
+  }
+  set = lsm->set;
+  set->refs++;
+  pthread_mutex_unlock(&lsm->lock);
+
+  for (i = set->n - 1, rst = 0; i >= 0 && rst == 0; i--)
+    rst = run_get(lsm, set->runs[i], search_for, &rec);
+
+  pthread_mutex_lock(&lsm->lock);
+  set_release(lsm, set);
+  pthread_mutex_unlock(&lsm->lock);
+  if (rst != 1 || rec.dead)
+    return -1;
+  *valp = rec.val;
+  return 0;
+}
+
+/**
+ * bpt_lsm_flush: write the memtable out and wait until it's in a run on disk
+ *
+ * Returns 0 if OK, -1 on system call failure, or if a run couldn't be written.
+ */
+int bpt_lsm_flush(struct bpt_lsm *lsm)
+{
+  int rst;
+
+  pthread_mutex_lock(&lsm->lock);
+  rst = lsm->mem->n > 0 ? freeze(lsm, 1) : 0;
+  while (rst == 0 && lsm->imm != NULL && !lsm->error)
+    pthread_cond_wait(&lsm->flushed, &lsm->lock);
+  if (lsm->error)
+    rst = -1;
+  pthread_mutex_unlock(&lsm->lock);
+  return rst;
+}
+
+static int tree_gather(struct bpt_lsm_cursor *cur, struct bpt_stat *bstat, int dead, struct bpt_lsm_rec *recs)
+{
+  int (*cmp)(bpt_t, bpt_t) = cur->lsm->cmp;
+  struct bpt_cursor c;
+  int n, rst;
+
+  if (cur->start)
+    rst = bpt_cursor_first(&c, bstat);
+  else if ((rst = bpt_cursor_seek(&c, cur->next, cmp, bstat)) == 0 && !cur->incl &&
+      cmp(bpt_cursor_entry(&c)->key, cur->next) == 0)
+    rst = bpt_cursor_next(&c);
+  for (n = 0; rst == 0 && n < BPT_LSM_BATCH; rst = bpt_cursor_next(&c), n++) {
+    recs[n].key = bpt_cursor_entry(&c)->key;
+    recs[n].val = bpt_cursor_entry(&c)->val;
+    recs[n].dead = dead;
+  }
+  return n;
+}
+
+/**
+ * mem_gather: merge out of a memtable the entries and tombstones from where a cursor is on
+ *
+ * The first BPT_LSM_BATCH of both trees together are exactly those of the batches of both.
+ */
+static void mem_gather(struct bpt_lsm_cursor *cur, struct bpt_lsm_mem *m, struct lsm_src *src)
+{
+  struct bpt_lsm_rec live[BPT_LSM_BATCH], dead[BPT_LSM_BATCH];
+  int i, j, nl, nd;
+
+  nl = tree_gather(cur, &m->live, 0, live);
+  nd = tree_gather(cur, &m->dead, 1, dead);
+  for (i = j = src->n = 0; (i < nl || j < nd) && src->n < BPT_LSM_BATCH; ) {
+    if (i < nl && (j == nd || cur->lsm->cmp(live[i].key, dead[j].key) < 0))
+      src->recs[src->n++] = live[i++];
+    else
+      src->recs[src->n++] = dead[j++];
+  }
+  src->pos = 0;
+  src->more = nl == BPT_LSM_BATCH || nd == BPT_LSM_BATCH || i < nl || j < nd;
+}
+
+static int run_gather(struct bpt_lsm_cursor *cur, struct bpt_lsm_run *run, struct lsm_src *src)
+{
+  struct run_iter it;
+  struct bpt_lsm_rec *rec;
+  long b;
+  int c, r = 0;
+
+  b = cur->start ? -1 : run_block(cur->lsm, run, cur->next);
+  iter_init(&it, run, b == -1 ? 0 : (size_t)b * BPT_LSM_BLOCK);
+  for (src->n = 0; src->n < BPT_LSM_BATCH && (r = iter_head(&it, &rec)) == 1; it.pos++) {
+    if (!cur->start && ((c = cur->lsm->cmp(rec->key, cur->next)) < 0 || (c == 0 && !cur->incl)))
+      continue;
+    src->recs[src->n++] = *rec;
+  }
+  src->pos = 0;
+  src->more = src->n == BPT_LSM_BATCH;
+  return r == -1 ? -1 : 0;
+}
+
+/**
+ * cursor_fill: merge the next batch of entries out of the memtables and the runs
+ *
+ * Every source gives its first BPT_LSM_BATCH records from where the cursor is on. The merge
+ * stops at the last record of a source that may hold more, since the records past it are unknown.
+ */
+static int cursor_fill(struct bpt_lsm_cursor *cur)
+{
+  struct bpt_lsm *lsm = cur->lsm;
+  struct bpt_lsm_set *set;
+  struct bpt_lsm_rec *top, rec;
+  struct lsm_src *srcs;
+  bpt_t limit;
+  int i, nsrc, more, rst = 0;
+
+  cur->n = cur->pos = 0;
+  while (cur->n == 0) {
+    if (cur->end)
+      return -1;
+    pthread_mutex_lock(&lsm->lock);
+    if ((srcs = malloc((lsm->set->n + 2) * sizeof (struct lsm_src))) == NULL) {
+      pthread_mutex_unlock(&lsm->lock);
+      syscall_fail("malloc");
+      return -1;
+    }
+    nsrc = 0;
+    mem_gather(cur, lsm->mem, &srcs[nsrc++]);
+    if (lsm->imm != NULL)
+      mem_gather(cur, lsm->imm, &srcs[nsrc++]);
+    set = lsm->set;
+    set->refs++;
+    pthread_mutex_unlock(&lsm->lock);
+    for (i = set->n - 1; i >= 0 && rst == 0; i--)
+      rst = run_gather(cur, set->runs[i], &srcs[nsrc++]);
+    pthread_mutex_lock(&lsm->lock);
+    set_release(lsm, set);
+    pthread_mutex_unlock(&lsm->lock);
+    if (rst == -1) {
+      free(srcs);
+      return -1;
+    }
+    limit.off = 0;
+    for (i = 0, more = 0; i < nsrc; i++) {
+      if (srcs[i].more && (!more || lsm->cmp(srcs[i].recs[srcs[i].n-1].key, limit) < 0)) {
+        limit = srcs[i].recs[srcs[i].n-1].key;
+        more = 1;
+      }
+    }
+    while (cur->n < BPT_LSM_BATCH) {
+      for (i = 0, top = NULL; i < nsrc; i++) { // newest first, so it wins ties
+        if (srcs[i].pos < srcs[i].n && (top == NULL || lsm->cmp(srcs[i].recs[srcs[i].pos].key, top->key) < 0))
+          top = &srcs[i].recs[srcs[i].pos];
+      }
+      if (top == NULL || (more && lsm->cmp(top->key, limit) > 0))
+        break;
+      rec = *top;
+      for (i = 0; i < nsrc; i++) {
+        if (srcs[i].pos < srcs[i].n && lsm->cmp(srcs[i].recs[srcs[i].pos].key, rec.key) == 0)
+          srcs[i].pos++;
+      }
+      if (!rec.dead) {
+        cur->buf[cur->n].key = rec.key;
+        cur->buf[cur->n].val = rec.val;
+        cur->n++;
+      }
+      cur->next = rec.key;
+      cur->incl = 0;
+      cur->start = 0;
+    }
+    if (cur->n < BPT_LSM_BATCH) {
+      if (more) { // everything up to @limit is merged
+        cur->next = limit;
+        cur->incl = 0;
+        cur->start = 0;
+      } else
+        cur->end = 1;
+    }
+    free(srcs);
+  }
+  return 0;
+}
+
+/**
+ * bpt_lsm_cursor_first: put a cursor at the least entry of an LSM tree
+ *
+ * Returns 0 if OK, -1 if there is no entry, or on system call failure.
+ */
+int bpt_lsm_cursor_first(struct bpt_lsm_cursor *cur, struct bpt_lsm *lsm)
+{
+  cur->lsm = lsm;
+  cur->start = 1;
+  cur->end = 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_lsm_cursor_seek: put a cursor at the least entry whose key is not less than @search_for
+ *
+ * Returns 0 if OK, -1 if every key is less than @search_for, or on system call failure.
+ */
+int bpt_lsm_cursor_seek(struct bpt_lsm_cursor *cur, struct bpt_lsm *lsm, bpt_t search_for)
+{
+  cur->lsm = lsm;
+  cur->next = search_for;
+  cur->incl = 1;
+  cur->start = 0;
+  cur->end = 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_lsm_cursor_next: step a cursor to the next entry
+ *
+ * Returns 0 if OK, -1 if the cursor ran off the last entry, or on system call failure.
+ */
+int bpt_lsm_cursor_next(struct bpt_lsm_cursor *cur)
+{
+  if (++cur->pos < cur->n)
+    return 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_lsm_close: write the memtable out, wait for the background thread and release an LSM tree
+ *
+ * Returns 0 if OK, -1 if the memtable couldn't be written out.
+ */
+int bpt_lsm_close(struct bpt_lsm *lsm)
+{
+  int rst;
+
+  rst = bpt_lsm_flush(lsm);
+  pthread_mutex_lock(&lsm->lock);
+  lsm->stop = 1;
+  pthread_cond_signal(&lsm->work);
+  pthread_mutex_unlock(&lsm->lock);
+  pthread_join(lsm->bg, NULL);
+
+  mem_free(lsm->mem);
+  if (lsm->imm != NULL)
+    mem_free(lsm->imm);
+  set_release(lsm, lsm->set);
+  pthread_mutex_destroy(&lsm->lock);
+  pthread_cond_destroy(&lsm->work);
+  pthread_cond_destroy(&lsm->flushed);
+  free(lsm->path);
+  return rst;
+}
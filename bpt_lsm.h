@@ -0,0 +1,121 @@
+#ifndef BPT_LSM_H
+#define BPT_LSM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "b_plus_tree.h"
+
+#if !defined(BPT_KEY_PLAIN) || defined(BPT_SET)
+#error "LSM runs only take plain bpt_t integer keys and values"
+#endif
+
+#define BPT_LSM_MAGIC 0x4d534c42
+#define BPT_LSM_MEM_MAX 65536 // entries a memtable takes before it's frozen
+#define BPT_LSM_BLOCK 128     // records per indexed block of a run
+#define BPT_LSM_RATIO 2       // a run is compacted with the newer ones once they hold 1/RATIO of its records
+#define BPT_LSM_BATCH 64      // entries a cursor merges out of every source at a time
+
+/*
+ * A record of a run: the value an entry had when the run was written, or a tombstone
+ * hiding the entry in older runs.
+ */
+struct bpt_lsm_rec {
+  bpt_t key;
+  bpt_t val;
+  off_t dead;
+};
+
+/*
+ * An immutable sorted run kept in the file "@path-@id": a header, the records in key order,
+ * then the first key of every block of BPT_LSM_BLOCK records. The index is kept in memory, so a
+ * lookup reads one block.
+ */
+struct bpt_lsm_run {
+  int fd;
+  unsigned long long id;
+  size_t nrec;
+  bpt_t *index;
+  int refs;     // run sets holding it
+  int obsolete; // compacted away, its file is removed once the last set lets it go
+};
+
+/*
+ * The runs of an LSM tree at some point, oldest first. A set is never changed once made,
+ * readers hold one while they read its runs outside the lock.
+ */
+struct bpt_lsm_set {
+  int refs;
+  int n;
+  struct bpt_lsm_run *runs[];
+};
+
+/*
+ * A memtable: the entries written since it was made, and the keys deleted since then.
+ * A key is in one of the two trees at most.
+ */
+struct bpt_lsm_mem {
+  struct bpt_stat live;
+  struct bpt_stat dead;
+  struct gen_stk stk;
+  size_t n;
+};
+
+/*
+ * A log-structured tree: writes go to an in-memory B+ tree, frozen once it holds @mem_max
+ * entries and written out by a background thread as a sorted run. The same thread merges
+ * runs of similar sizes. Reads merge the memtables and the runs, newest first.
+ *
+ * Keys and values must be plain integers. The list of runs is kept in the file @path, and
+ * only what was written out survives a restart.
+ */
+struct bpt_lsm {
+  pthread_mutex_t lock;
+  pthread_cond_t work;    // wakes the background thread
+  pthread_cond_t flushed; // signals that a frozen memtable is in a run
+  pthread_t bg;
+  int (*cmp)(bpt_t, bpt_t);
+  int order;
+  char *path;
+  struct bpt_lsm_mem *mem; // takes the writes
+  struct bpt_lsm_mem *imm; // frozen, being written out
+  struct bpt_lsm_set *set;
+  unsigned long long next_id;
+  size_t mem_max;
+  int ratio;
+  int stop;
+  int error;               // a run or the run list couldn't be written, writes fail from then on
+  unsigned long flushes;
+  unsigned long compactions;
+  unsigned long stalls;    // writes that waited for a frozen memtable to be written out
+};
+
+/*
+ * An ordered walk over an LSM tree. Entries are merged out of every source a batch at a
+ * time, so the cursor holds nothing between calls and sees each batch as it was when merged.
+ */
+struct bpt_lsm_cursor {
+  struct bpt_lsm *lsm;
+  struct bpt_slot buf[BPT_LSM_BATCH];
+  int n, pos;
+  bpt_t next; // where the next batch starts
+  int incl;   // if the next batch may start with @next itself
+  int start;  // the next batch starts at the least key
+  int end;    // no batch follows the buffered one
+};
+
+int bpt_lsm_open(struct bpt_lsm *lsm, const char *path, int order, int (*cmp)(bpt_t, bpt_t));
+int bpt_lsm_put(struct bpt_lsm *lsm, struct bpt_entry entry);
+int bpt_lsm_delete(struct bpt_lsm *lsm, bpt_t key);
+int bpt_lsm_search(struct bpt_lsm *lsm, bpt_t search_for, bpt_t *valp);
+int bpt_lsm_flush(struct bpt_lsm *lsm);
+int bpt_lsm_cursor_first(struct bpt_lsm_cursor *cur, struct bpt_lsm *lsm);
+int bpt_lsm_cursor_seek(struct bpt_lsm_cursor *cur, struct bpt_lsm *lsm, bpt_t search_for);
+int bpt_lsm_cursor_next(struct bpt_lsm_cursor *cur);
+int bpt_lsm_close(struct bpt_lsm *lsm);
+
+static inline struct bpt_slot *bpt_lsm_cursor_entry(struct bpt_lsm_cursor *cur)
+{
+  return &cur->buf[cur->pos];
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "syscall_fail.h"
+#include "bpt_build.h"
+#include "bpt_pack.h"
+
+#define FENCE_CAP_INIT 64
+
+static inline int bits_for(uint64_t x)
+{
+  return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+static inline size_t words_for(int n, int bits)
+{
+  return ((size_t)n * bits + 63) / 64;
+}
+
+static inline void put_bits(uint64_t *data, int i, int bits, uint64_t v)
+{
+  size_t p = (size_t)i * bits;
+  int s = p & 63;
+
+  if (bits == 0)
+    return;
+  data[p >> 6] |= v << s;
+  if (s + bits > 64)
+    data[(p >> 6) + 1] |= v >> (64 - s);
+}
+
+static inline uint64_t get_bits(const uint64_t *data, int i, int bits)
+{
+  size_t p = (size_t)i * bits;
+  int s = p & 63;
+  uint64_t v;
+
+  if (bits == 0)
+    return 0;
+  v = data[p >> 6] >> s;
+  if (s + bits > 64)
+    v |= data[(p >> 6) + 1] << (64 - s);
+  return bits == 64 ? v : v & (((uint64_t)1 << bits) - 1);
+}
+
+/**
+ * pack_page: append @n entries, sorted by key, to @pack as one page
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int pack_page(struct bpt_pack *pack, const struct bpt_entry *entries, int n)
+{
+  struct bpt_pack_page *page;
+  struct bpt_pack_fence fence;
+  off_t vmin = entries[0].val.off, vmax = vmin;
+  size_t kwords, sz, new_cap;
+  char *new_buf;
+  int i, kbits, vbits;
+
+  for (i = 1; i < n; i++) {
+    if (entries[i].val.off < vmin)
+      vmin = entries[i].val.off;
+    if (entries[i].val.off > vmax)
+      vmax = entries[i].val.off;
+  }
+  kbits = bits_for((uint64_t)entries[n-1].key.off - (uint64_t)entries[0].key.off);
+  vbits = bits_for((uint64_t)vmax - (uint64_t)vmin);
+  kwords = words_for(n, kbits);
+  sz = sizeof (*page) + (kwords + words_for(n, vbits)) * sizeof (uint64_t);
+  if (pack->size + sz > pack->cap) {
+    for (new_cap = pack->cap ? pack->cap : 4096; new_cap < pack->size + sz; new_cap *= 2)
+      ;
+    if ((new_buf = realloc(pack->buf, new_cap)) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    pack->buf = new_buf;
+    pack->cap = new_cap;
+  }
+  page = (struct bpt_pack_page *)(pack->buf + pack->size);
+  memset(page, 0, sz);
+  page->kbase = entries[0].key.off;
+  page->vbase = vmin;
+  page->nkey = n;
+  page->kbits = kbits;
+  page->vbits = vbits;
+  for (i = 0; i < n; i++) {
+    put_bits(page->data, i, page->kbits, (uint64_t)entries[i].key.off - (uint64_t)page->kbase);
+    put_bits(page->data + kwords, i, page->vbits, (uint64_t)entries[i].val.off - (uint64_t)vmin);
+  }
+  fence.key = page->kbase;
+  fence.at = pack->size;
+  if (gen_stk_push(&pack->fences, &fence) == -1)
+    return -1;
+  pack->size += sz;
+  pack->nkey += n;
+  return 0;
+}
+
+/**
+ * bpt_pack_build: make a packed copy of a B+ tree
+ * @pack: the packed copy to fill in
+ * @bstat: the tree, which must order its keys as signed integers in bpt_t.off
+ *
+ * Entries are cut into pages of BPT_PACK_KEYS in key order, so for dense IDs each key costs
+ * a few bits and each value no more than the spread of values in its page needs.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_pack_build(struct bpt_pack *pack, struct bpt_stat *bstat)
+{
+  struct bpt_entry entries[BPT_PACK_KEYS];
+  struct bpt_cursor cur;
+  int rst, n = 0;
+
+  memset(pack, 0, sizeof (*pack));
+  if (gen_stk_init(&pack->fences, FENCE_CAP_INIT, sizeof (struct bpt_pack_fence)) == -1)
+    return -1;
+  for (rst = bpt_cursor_first(&cur, bstat); rst == 0; rst = bpt_cursor_next(&cur)) {
+    entries[n++] = *bpt_cursor_entry(&cur);
+    if (n == BPT_PACK_KEYS) {
+      if (pack_page(pack, entries, n) == -1)
+        goto fail;
+      n = 0;
+    }
+  }
+  if (n > 0 && pack_page(pack, entries, n) == -1)
+    goto fail;
+  return 0;
+fail:
+  bpt_pack_free(pack);
+  return -1;
+}
+
+/**
+ * bpt_pack_search: look a key up in a packed tree
+ *
+ * The pages are found by binary search over the fences, and the key by binary search
+ * over the packed deltas, so nothing is decoded but the probed keys.
+ *
+ * Returns 0 and stores the value through @valp if found, -1 if not.
+ */
+int bpt_pack_search(struct bpt_pack *pack, bpt_t search_for, bpt_t *valp)
+{
+  struct bpt_pack_fence *fences = pack->fences.addr;
+  struct bpt_pack_page *page;
+  size_t lo = 0, n = pack->fences.cnt, half;
+  uint64_t delta;
+  int i, m, h;
+
+  if (n == 0 || search_for.off < fences[0].key)
+    return -1;
+  while (n > 1) {
+    half = n / 2;
+    if (fences[lo+half].key <= search_for.off)
+      lo += half;
+    n -= half;
+  }
+  page = bpt_pack_page(pack, lo);
+  delta = (uint64_t)search_for.off - (uint64_t)page->kbase;
+  for (i = 0, m = page->nkey; m > 1; m -= h) {
+    h = m / 2;
+    if (get_bits(page->data, i + h, page->kbits) <= delta)
+      i += h;
+  }
+  if (get_bits(page->data, i, page->kbits) != delta)
+    return -1;
+  valp->off = page->vbase + (off_t)get_bits(page->data + words_for(page->nkey, page->kbits), i, page->vbits);
+  return 0;
+}
+
+/**
+ * bpt_pack_page_decode: unpack every entry of a page into @out
+ *
+ * The loops have no data dependent branches, the compiler is free to vectorize them.
+ *
+ * Returns the number of entries.
+ */
+int bpt_pack_page_decode(struct bpt_pack_page *page, struct bpt_entry *out)
+{
+  const uint64_t *vdata = page->data + words_for(page->nkey, page->kbits);
+  int i, n = page->nkey;
+
+  for (i = 0; i < n; i++)
+    out[i].key.off = page->kbase + (off_t)get_bits(page->data, i, page->kbits);
+  for (i = 0; i < n; i++)
+    out[i].val.off = page->vbase + (off_t)get_bits(vdata, i, page->vbits);
+  return n;
+}
+
+/**
+ * bpt_pack_foreach: call @fn on every entry of a packed tree in key order
+ *
+ * Returns 0 if OK, or the first non-zero value @fn returns.
+ */
+int bpt_pack_foreach(struct bpt_pack *pack, int (*fn)(struct bpt_entry *entry, void *arg), void *arg)
+{
+  struct bpt_entry entries[BPT_PACK_KEYS];
+  size_t p;
+  int i, n, rst;
+
+  for (p = 0; p < pack->fences.cnt; p++) {
+    n = bpt_pack_page_decode(bpt_pack_page(pack, p), entries);
+    for (i = 0; i < n; i++) {
+      if ((rst = fn(&entries[i], arg)) != 0)
+        return rst;
+    }
+  }
+  return 0;
+}
+
+/**
+ * bpt_pack_thaw: build a new heap B+ tree holding the entries of a packed one
+ * @cmp: key comparison function of the new tree, it must agree with the packed order
+ *
+ * The pages are decoded in key order and the tree is built bottom up over them by
+ * bpt_build_sorted(), in time linear in the number of entries.
+ *
+ * Returns 0 if OK, -1 on system call failure, in which case nothing is left to free.
+ */
+int bpt_pack_thaw(struct bpt_pack *pack, struct bpt_stat *bstat, int order, int (*cmp)(bpt_t, bpt_t))
+{
+  struct bpt_entry *entries = NULL;
+  size_t p, n;
+  int rst;
+
+  if (pack->nkey > 0 && (entries = malloc(pack->nkey * sizeof (struct bpt_entry))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  for (p = 0, n = 0; p < pack->fences.cnt; p++)
+    n += bpt_pack_page_decode(bpt_pack_page(pack, p), &entries[n]);
+  rst = bpt_build_sorted(bstat, order, entries, n, 1);
+  free(entries);
+  return rst;
+}
+
+void bpt_pack_free(struct bpt_pack *pack)
+{
+  free(pack->buf);
+  gen_stk_delete(&pack->fences);
+  memset(pack, 0, sizeof (*pack));
+}
@@ -0,0 +1,58 @@
+#ifndef BPT_PACK_H
+#define BPT_PACK_H
+
+#include <stdint.h>
+#include "b_plus_tree.h"
+
+#if !defined(BPT_KEY_PLAIN) || defined(BPT_SET)
+#error "packed pages only take plain bpt_t integer keys and values"
+#endif
+
+#define BPT_PACK_KEYS 128 // entries per packed page
+
+/*
+ * A packed page: keys stored as deltas from the first key, values as deltas from the
+ * smallest value, each bit-packed at the width of the largest delta of the page.
+ */
+struct bpt_pack_page {
+  off_t kbase;
+  off_t vbase;
+  unsigned short nkey;
+  unsigned char kbits, vbits;
+  uint64_t data[]; // nkey keys of kbits bits, then nkey values of vbits bits from a fresh word
+};
+
+struct bpt_pack_fence {
+  off_t key;  // first key of the page
+  size_t at;  // offset of the page in the page buffer
+};
+
+/*
+ * A read-only compressed copy of a B+ tree whose keys are integers in bpt_t.off ordered as
+ * signed numbers. Values are taken as integers too. Search it in place; thaw it back into
+ * a tree to modify it.
+ *
+ * Packing is all or nothing: a live tree never holds packed leaves, so cold leaves cannot be
+ * packed while the rest of the tree stays writable. Freeze a whole tree that has gone cold
+ * into a pack, and free the tree if its memory is what is wanted back.
+ */
+struct bpt_pack {
+  char *buf;             // the pages, back to back
+  size_t size, cap;
+  struct gen_stk fences; // one struct bpt_pack_fence per page, in key order
+  size_t nkey;
+};
+
+int bpt_pack_build(struct bpt_pack *pack, struct bpt_stat *bstat);
+int bpt_pack_search(struct bpt_pack *pack, bpt_t search_for, bpt_t *valp);
+int bpt_pack_page_decode(struct bpt_pack_page *page, struct bpt_entry *out);
+int bpt_pack_foreach(struct bpt_pack *pack, int (*fn)(struct bpt_entry *entry, void *arg), void *arg);
+int bpt_pack_thaw(struct bpt_pack *pack, struct bpt_stat *bstat, int order, int (*cmp)(bpt_t, bpt_t));
+void bpt_pack_free(struct bpt_pack *pack);
+
+static inline struct bpt_pack_page *bpt_pack_page(struct bpt_pack *pack, size_t i)
+{
+  return (struct bpt_pack_page *)(pack->buf + ((struct bpt_pack_fence *)pack->fences.addr)[i].at);
+}
+
+#endif
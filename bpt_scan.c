@@ -0,0 +1,424 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "syscall_fail.h"
+#include "bpt_scan.h"
+
+/*
+ * The partitions left to a scan thread, the next one in the low half of @range and the end
+ * in the high half. Its thread takes them from the front, idle ones steal from the back.
+ */
+struct scan_queue {
+  uint64_t range;
+} __attribute__((aligned(64)));
+
+struct scan {
+  struct bpt_stat *bstat;
+  int (*cmp)(bpt_key_t, bpt_key_t);
+  const struct bpt_scan_ops *ops;
+  void *arg;
+  const bpt_key_t *lo, *hi;
+  bpt_key_t *bounds;  // partition i takes the keys from bounds[i-1] below bounds[i]
+  int npart;
+  char *accs;
+  struct scan_queue *queues;
+  int nthread;
+  int stop;
+};
+
+struct scan_worker {
+  struct scan *s;
+  int t;
+};
+
+static inline uint64_t queue_range(uint32_t first, uint32_t end)
+{
+  return (uint64_t)end << 32 | first;
+}
+
+/**
+ * queue_take: take a partition off the front of a queue, or off its back if stealing
+ *
+ * Returns the partition, -1 if the queue is empty.
+ */
+static int queue_take(struct scan_queue *q, int steal)
+{
+  uint64_t range = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE), taken;
+  uint32_t first, end;
+
+  do {
+    first = (uint32_t)range;
+    end = range >> 32;
+    if (first >= end)
+      return -1;
+    taken = steal ? queue_range(first, end - 1) : queue_range(first + 1, end);
+  } while (!__atomic_compare_exchange_n(&q->range, &range, taken, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return steal ? (int)end - 1 : (int)first;
+}
+
+/**
+ * leaf_end: how many slots of a leaf, from @offset on, lie below @hi
+ */
+static int leaf_end(struct scan *s, struct bpt_node leaf, int offset, const bpt_key_t *hi)
+{
+  struct bpt_slot *slots = bpt_leaf_slots(leaf);
+  int lo = offset, end = bpt_node_nkey(leaf, s->bstat->order), mid;
+
+  if (hi == NULL)
+    return end;
+  while (lo < end) {
+    mid = (lo + end) / 2;
+    if (bpt_key_cmp(slots[mid].key, *hi, s->cmp) < 0)
+      lo = mid + 1;
+    else
+      end = mid;
+  }
+  return lo;
+}
+
+/**
+ * scan_part: feed every slot of a partition to the accumulator of the partition
+ */
+static void scan_part(struct scan *s, int part)
+{
+  const bpt_key_t *lo = part > 0 ? &s->bounds[part-1] : s->lo;
+  const bpt_key_t *hi = part < s->npart - 1 ? &s->bounds[part] : s->hi;
+  void *acc = s->accs + part * s->ops->acc_size;
+  struct bpt_cursor cur;
+  struct bpt_node leaf;
+  int offset, end, nkey;
+
+  if ((lo != NULL ? bpt_cursor_seek(&cur, *lo, s->cmp, s->bstat) : bpt_cursor_first(&cur, s->bstat)) == -1)
+    return;
+  for (leaf = cur.leaf, offset = cur.offset; leaf.entries != NULL && !__atomic_load_n(&s->stop, __ATOMIC_RELAXED);
+      leaf = bpt_node_nxt(leaf, s->bstat), offset = 0) {
+    nkey = bpt_node_nkey(leaf, s->bstat->order);
+    if (bpt_node_nxt(leaf, s->bstat).entries != NULL)
+      __builtin_prefetch(bpt_node_nxt(leaf, s->bstat).entries); // the kernels stream through leaves
+    end = leaf_end(s, leaf, offset, hi);
+    if (end > offset && s->ops->leaf(acc, bpt_leaf_slots(leaf) + offset, end - offset, s->arg) != 0)
+      __atomic_store_n(&s->stop, 1, __ATOMIC_RELAXED);
+    if (end < nkey)
+      break;
+  }
+}
+
+static void *scan_thread(void *arg)
+{
+  struct scan_worker *w = arg;
+  struct scan *s = w->s;
+  int part, i;
+
+  while ((part = queue_take(&s->queues[w->t], 0)) != -1)
+    scan_part(s, part);
+  for (i = 1; i < s->nthread; i++) {
+    while ((part = queue_take(&s->queues[(w->t + i) % s->nthread], 1)) != -1)
+      scan_part(s, part);
+  }
+  return NULL;
+}
+
+/**
+ * split_range: cut the range of a scan into partitions at the keys of the highest level
+ * of the tree with enough of them
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int split_range(struct scan *s)
+{
+  struct bpt_stat *bstat = s->bstat;
+  struct bpt_node *level, *below, *tmp;
+  bpt_key_t *bounds;
+  size_t n = 1, nbelow, cap = 1;
+  int target = s->nthread * BPT_SCAN_PARTS, h, i, m;
+  size_t j;
+
+  if ((level = malloc(sizeof (struct bpt_node))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  level[0] = bstat->root_node;
+  s->npart = 1;
+  for (h = bstat->height; h > 0 && s->npart < target; h--) {
+    cap = n * (bstat->order + 1);
+    if ((below = malloc(cap * sizeof (struct bpt_node))) == NULL ||
+        (bounds = malloc(cap * sizeof (bpt_key_t))) == NULL) {
+      free(below);
+      free(level);
+      syscall_fail("malloc");
+      return -1;
+    }
+    // the children overlapping the range, at least the one @lo falls in, and the least key
+    // of all but the first of them
+    for (j = 0, nbelow = 0; j < n; j++) {
+      for (m = bpt_node_nkey(level[j], bstat->order), i = 0; i <= m; i++) {
+        if (i < m && s->lo != NULL && bpt_key_cmp(level[j].entries[i].key, *s->lo, s->cmp) <= 0)
+          continue;
+        if (nbelow > 0 && i > 0 && s->hi != NULL && bpt_key_cmp(level[j].entries[i-1].key, *s->hi, s->cmp) >= 0)
+          break;
+        if (nbelow > 0) // a first child starts where its parent does
+          bounds[nbelow-1] = i > 0 ? level[j].entries[i-1].key : s->bounds[j-1];
+        below[nbelow++] = bpt_node_child(level[j], i, bstat);
+      }
+    }
+    free(s->bounds);
+    s->bounds = bounds;
+    s->npart = nbelow;
+    tmp = level;
+    level = below;
+    n = nbelow;
+    free(tmp);
+  }
+  free(level);
+  return 0;
+}
+
+/**
+ * run_scan: run every scan thread and wait for all of them
+ *
+ * Threads that fail to start leave their partitions to be stolen.
+ */
+static void run_scan(struct scan *s)
+{
+  pthread_t tids[s->nthread];
+  struct scan_worker w[s->nthread];
+  int t, started, rst;
+
+  for (t = 0; t < s->nthread; t++) {
+    w[t].s = s;
+    w[t].t = t;
+  }
+  for (t = 1, started = 1; t < s->nthread; t++, started++) {
+    if ((rst = pthread_create(&tids[t], NULL, scan_thread, &w[t])) != 0) {
+      errno = rst;
+      syscall_fail("pthread_create");
+      break;
+    }
+  }
+  scan_thread(&w[0]);
+  for (t = 1; t < started; t++)
+    pthread_join(tids[t], NULL);
+}
+
+/**
+ * bpt_scan_parallel: run over a range of a tree on @nthread threads, a partition at a time
+ * @lo: least key of the range, or NULL to start at the least key of the tree
+ * @hi: the range ends below this key, or NULL to run to the end of the tree
+ * @cmp: key comparison function of the tree, used with @lo and @hi alone
+ * @result: where the merged accumulators of all partitions go, @ops->acc_size bytes
+ * @nthread: threads to use, or 0 for every online CPU
+ *
+ * The range is cut at the separator keys of the highest level of the tree with some
+ * BPT_SCAN_PARTS partitions per thread in it, so each partition is one or a few subtrees.
+ * Threads take partitions from their own queue, then steal from the others once theirs
+ * runs dry. The tree must not change during the scan.
+ *
+ * Returns 0 if the whole range was scanned, 1 if @ops->leaf stopped the scan, -1 on
+ * system call failure.
+ */
+int bpt_scan_parallel(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), const struct bpt_scan_ops *ops, void *arg, void *result, int nthread)
+{
+  struct scan s;
+  int p, t, rst = -1;
+
+  if (nthread <= 0 && (nthread = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    nthread = 1;
+  memset(&s, 0, sizeof (s));
+  s.bstat = bstat;
+  s.cmp = cmp;
+  s.ops = ops;
+  s.arg = arg;
+  s.lo = lo;
+  s.hi = lo != NULL && hi != NULL && bpt_key_cmp(*lo, *hi, cmp) > 0 ? lo : hi; // empty either way
+  s.nthread = nthread;
+  if (split_range(&s) == -1)
+    goto out;
+  if (s.npart < s.nthread)
+    s.nthread = s.npart;
+  if ((s.accs = malloc(s.npart * ops->acc_size + 1)) == NULL ||
+      posix_memalign((void **)&s.queues, 64, s.nthread * sizeof (struct scan_queue)) != 0) {
+    syscall_fail("malloc");
+    goto out;
+  }
+  for (p = 0; p < s.npart; p++) {
+    if (ops->init != NULL)
+      ops->init(s.accs + p * ops->acc_size, arg);
+    else
+      memset(s.accs + p * ops->acc_size, 0, ops->acc_size);
+  }
+  for (t = 0; t < s.nthread; t++)
+    s.queues[t].range = queue_range((uint64_t)s.npart * t / s.nthread, (uint64_t)s.npart * (t + 1) / s.nthread);
+  run_scan(&s);
+  if (ops->merge != NULL) {
+    memcpy(result, s.accs, ops->acc_size);
+    for (p = 1; p < s.npart; p++)
+      ops->merge(result, s.accs + p * ops->acc_size, arg);
+  }
+  rst = s.stop;
+out:
+  free(s.bounds);
+  free(s.accs);
+  free(s.queues);
+  return rst;
+}
+
+// where bpt_scan_keys() gathers keys to
+struct gather {
+  bpt_key_t *out;
+  size_t n, cap;
+};
+
+static int gather_leaf(void *acc, const struct bpt_slot *slots, int n, void *arg)
+{
+  struct gather *g = arg;
+  bpt_key_t *restrict out = g->out + g->n;
+  int i;
+
+  if ((size_t)n > g->cap - g->n)
+    n = g->cap - g->n;
+  for (i = 0; i < n; i++)
+    out[i] = slots[i].key;
+  g->n += n;
+  return g->n == g->cap;
+}
+
+/**
+ * bpt_scan_keys: copy the keys of a range in order, up to @cap of them
+ * @lo: least key of the range, or NULL to start at the least key of the tree
+ * @hi: the range ends below this key, or NULL to run to the end of the tree
+ *
+ * Returns how many keys were copied, which is @cap if the range may hold more, or -1
+ * cast to size_t on system call failure.
+ */
+size_t bpt_scan_keys(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), bpt_key_t *out, size_t cap)
+{
+  static const struct bpt_scan_ops ops = { 0, NULL, gather_leaf, NULL };
+  struct gather g = { out, 0, cap };
+
+  if (cap == 0)
+    return 0;
+  if (bpt_scan_parallel(bstat, lo, hi, cmp, &ops, &g, NULL, 1) == -1) // one thread, partitions in order
+    return (size_t)-1;
+  return g.n;
+}
+
+#ifndef BPT_SET
+#ifdef __AVX2__
+typedef int64_t agg_vec __attribute__((vector_size(32))); // lanes as wide as off_t
+#endif
+
+void bpt_agg_init(struct bpt_agg *agg, off_t vlo, off_t vhi)
+{
+  agg->vlo = vlo;
+  agg->vhi = vhi;
+  agg->cnt = 0;
+  agg->sum = 0;
+  agg->min = INT64_MAX;
+  agg->max = INT64_MIN;
+}
+
+/**
+ * bpt_agg_slots: fold a run of leaf slots into the aggregates of the values in range
+ *
+ * Values are folded branch-free, so that matches as likely as not cost no mispredictions.
+ * Built for AVX2, four slots at a time go through GCC vector extensions, which need its
+ * 64-bit compares to beat the scalar loop.
+ */
+void bpt_agg_slots(struct bpt_agg *agg, const struct bpt_slot *slots, int n)
+{
+  uint64_t vlo = agg->vlo, width = (uint64_t)agg->vhi - vlo;
+  off_t sum = 0, min = agg->min, max = agg->max, v, m, c;
+  long cnt = 0;
+  int i = 0;
+#ifdef __AVX2__
+  agg_vec lo4 = { agg->vlo, agg->vlo, agg->vlo, agg->vlo }, hi4 = { agg->vhi, agg->vhi, agg->vhi, agg->vhi };
+  agg_vec cnt4 = { 0 }, sum4 = { 0 }, min4 = { min, min, min, min }, max4 = { max, max, max, max }, v4, m4, t4;
+  int l;
+#endif
+
+  if (agg->vlo > agg->vhi)
+    return;
+#ifdef __AVX2__
+  for (; i + 4 <= n; i += 4) {
+    v4 = (agg_vec){ slots[i].val.off, slots[i+1].val.off, slots[i+2].val.off, slots[i+3].val.off };
+    m4 = (v4 >= lo4) & (v4 <= hi4); // all ones where the value matches
+    cnt4 -= m4;
+    sum4 += v4 & m4;
+    t4 = m4 & (v4 < min4);
+    min4 = (v4 & t4) | (min4 & ~t4);
+    t4 = m4 & (v4 > max4);
+    max4 = (v4 & t4) | (max4 & ~t4);
+  }
+  for (l = 0; l < 4; l++) {
+    cnt += cnt4[l];
+    sum += sum4[l];
+    min = min4[l] < min ? min4[l] : min;
+    max = max4[l] > max ? max4[l] : max;
+  }
+#endif
+  for (; i < n; i++) {
+    v = slots[i].val.off;
+    m = -(off_t)((uint64_t)v - vlo <= width); // all ones where the value matches
+    cnt -= m;
+    sum += v & m;
+    c = (v & m) | (INT64_MAX & ~m);
+    min = c < min ? c : min;
+    c = (v & m) | (INT64_MIN & ~m);
+    max = c > max ? c : max;
+  }
+  agg->cnt += cnt;
+  agg->sum += sum;
+  agg->min = min;
+  agg->max = max;
+}
+
+static void agg_init(void *acc, void *arg)
+{
+  const struct bpt_agg *filter = arg;
+
+  bpt_agg_init(acc, filter->vlo, filter->vhi);
+}
+
+static int agg_leaf(void *acc, const struct bpt_slot *slots, int n, void *arg)
+{
+  bpt_agg_slots(acc, slots, n);
+  return 0;
+}
+
+static void agg_merge(void *acc, const void *from, void *arg)
+{
+  struct bpt_agg *a = acc;
+  const struct bpt_agg *f = from;
+
+  a->cnt += f->cnt;
+  a->sum += f->sum;
+  if (f->min < a->min)
+    a->min = f->min;
+  if (f->max > a->max)
+    a->max = f->max;
+}
+
+/**
+ * bpt_scan_agg: count, sum and bound the values of a range within a value range, in parallel
+ * @agg: set up by bpt_agg_init() with the value range, then holding the aggregates
+ *
+ * See bpt_scan_parallel() for the other arguments.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_scan_agg(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_agg *agg, int nthread)
+{
+  static const struct bpt_scan_ops ops = { sizeof (struct bpt_agg), agg_init, agg_leaf, agg_merge };
+  struct bpt_agg filter = *agg;
+
+  return bpt_scan_parallel(bstat, lo, hi, cmp, &ops, &filter, agg, nthread);
+}
+#endif
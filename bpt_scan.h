@@ -0,0 +1,45 @@
+#ifndef BPT_SCAN_H
+#define BPT_SCAN_H
+
+#include "b_plus_tree.h"
+
+#define BPT_SCAN_PARTS 8 // partitions a scan aims at per thread, so that stealing evens them out
+
+/*
+ * What a parallel scan does with the slots of each partition. Every partition gets its
+ * own accumulator of @acc_size bytes, set up by @init, or zeroed if @init is NULL, fed the
+ * runs of slots of its range by @leaf, leaf by leaf in key order, and merged in key order
+ * into the result by @merge, which may be NULL if @leaf keeps its results elsewhere.
+ * @leaf returns 0 to go on, anything else to stop the scan.
+ */
+struct bpt_scan_ops {
+  size_t acc_size;
+  void (*init)(void *acc, void *arg);
+  int (*leaf)(void *acc, const struct bpt_slot *slots, int n, void *arg);
+  void (*merge)(void *acc, const void *from, void *arg);
+};
+
+#ifndef BPT_SET
+/*
+ * Aggregates of the values of a range falling within [@vlo, @vhi], as bpt_agg_slots()
+ * folds whole runs of leaf slots into them. @min is above @max while nothing matched.
+ */
+struct bpt_agg {
+  off_t vlo, vhi;
+  long cnt;
+  off_t sum, min, max;
+};
+#endif
+
+int bpt_scan_parallel(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), const struct bpt_scan_ops *ops, void *arg, void *result, int nthread);
+size_t bpt_scan_keys(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), bpt_key_t *out, size_t cap);
+#ifndef BPT_SET
+void bpt_agg_init(struct bpt_agg *agg, off_t vlo, off_t vhi);
+void bpt_agg_slots(struct bpt_agg *agg, const struct bpt_slot *slots, int n);
+int bpt_scan_agg(struct bpt_stat *bstat, const bpt_key_t *lo, const bpt_key_t *hi,
+    int (*cmp)(bpt_key_t, bpt_key_t), struct bpt_agg *agg, int nthread);
+#endif
+
+#endif
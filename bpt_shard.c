@@ -0,0 +1,432 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include "syscall_fail.h"
+#include "bpt_shard.h"
+
+static inline struct bpt_entry slot_entry(const struct bpt_slot *slot)
+{
+  struct bpt_entry entry;
+
+#ifdef BPT_SET
+  entry.key = slot->key;
+  entry.val.off = 0;
+#else
+  entry = *slot;
+#endif
+  return entry;
+}
+
+static void sort_keys(bpt_key_t *keys, bpt_key_t *tmp, size_t n, int (*cmp)(bpt_key_t, bpt_key_t))
+{
+  size_t i, j, k, h = n / 2;
+
+  if (n < 2)
+    return;
+  sort_keys(keys, tmp, h, cmp);
+  sort_keys(keys + h, tmp, n - h, cmp);
+  for (i = 0, j = h, k = 0; i < h && j < n; )
+    tmp[k++] = cmp(keys[j], keys[i]) < 0 ? keys[j++] : keys[i++];
+  while (i < h)
+    tmp[k++] = keys[i++];
+  memcpy(keys, tmp, k * sizeof (bpt_key_t));
+}
+
+// bounds are copied a word at a time with relaxed atomics, since lookups read them unlocked
+typedef char low_words_check[sizeof (bpt_key_t) % sizeof (unsigned long) == 0 ? 1 : -1];
+
+static inline void copy_low(bpt_key_t *to, const bpt_key_t *from)
+{
+  unsigned long *t = (unsigned long *)to;
+  const unsigned long *f = (const unsigned long *)from;
+  size_t i;
+
+  for (i = 0; i < sizeof (bpt_key_t) / sizeof (unsigned long); i++)
+    __atomic_store_n(&t[i], __atomic_load_n(&f[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+static void shard_free(struct bpt_shard *shard)
+{
+  bpt_free(&shard->bstat);
+  gen_stk_delete(&shard->stk);
+  pthread_mutex_destroy(&shard->lock);
+}
+
+/**
+ * bpt_shard_init: make a container of @nshard empty trees, splitting the key space at quantiles of @sample
+ * @order: the order of every tree
+ * @cmp: key comparison function, see bpt_search()
+ * @sample: keys drawn from those to come, at least @nshard of them, in any order
+ *
+ * Returns 0 if OK, -1 on system call failure or if @sample is too small.
+ */
+int bpt_shard_init(struct bpt_sharded *sh, int nshard, int order, int (*cmp)(bpt_key_t, bpt_key_t),
+    const bpt_key_t *sample, size_t nsample)
+{
+  bpt_key_t *keys;
+  int i;
+
+  if (nshard < 1 || nsample < (size_t)nshard) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((keys = malloc(2 * nsample * sizeof (bpt_key_t))) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  memcpy(keys, sample, nsample * sizeof (bpt_key_t));
+  sort_keys(keys, keys + nsample, nsample, cmp);
+  if ((errno = posix_memalign((void **)&sh->shards, 64, nshard * sizeof (struct bpt_shard))) != 0) {
+    syscall_fail("posix_memalign");
+    free(keys);
+    return -1;
+  }
+  for (i = 0; i < nshard; i++) {
+    if (bpt_init(&sh->shards[i].bstat, order) == -1)
+      goto fail;
+    if (gen_stk_init(&sh->shards[i].stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1) {
+      bpt_free(&sh->shards[i].bstat);
+      goto fail;
+    }
+    pthread_mutex_init(&sh->shards[i].lock, NULL);
+    sh->shards[i].low = keys[nsample * i / nshard];
+    sh->shards[i].nkey = 0;
+  }
+  free(keys);
+  sh->nshard = nshard;
+  sh->cmp = cmp;
+  sh->bounds = 0;
+  pthread_mutex_init(&sh->rebalance, NULL);
+  return 0;
+
+fail:
+  while (i-- > 0)
+    shard_free(&sh->shards[i]);
+  free(sh->shards);
+  free(keys);
+  return -1;
+}
+
+/**
+ * shard_lock: lock the shard taking a key
+ *
+ * The shard is looked up without a lock, between two reads of the @bounds of the container,
+ * and looked up again if a bound changed meanwhile. @cmp may thus be handed a bound torn by
+ * the change, whose result is thrown away. The shard is then checked again under its own
+ * lock, which no rebalancing can move a bound of.
+ *
+ * Returns the index of the locked shard.
+ */
+static int shard_lock(struct bpt_sharded *sh, bpt_key_t key)
+{
+  struct bpt_shard *shards = sh->shards;
+  bpt_key_t low;
+  off_t s;
+  int lo, hi, mid;
+
+  while (1) {
+    while ((s = __atomic_load_n(&sh->bounds, __ATOMIC_ACQUIRE)) & 1)
+      sched_yield();
+    for (lo = 0, hi = sh->nshard - 1; lo < hi; ) { // last shard whose low isn't above the key
+      mid = (lo + hi + 1) / 2;
+      copy_low(&low, &shards[mid].low);
+      if (sh->cmp(key, low) >= 0)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&sh->bounds, __ATOMIC_RELAXED) != s)
+      continue;
+    pthread_mutex_lock(&shards[lo].lock);
+    if ((lo == 0 || sh->cmp(key, shards[lo].low) >= 0) &&
+        (lo == sh->nshard - 1 || sh->cmp(key, shards[lo+1].low) < 0))
+      return lo;
+    pthread_mutex_unlock(&shards[lo].lock);
+  }
+}
+
+/**
+ * bpt_shard_search: look a key up
+ * @valp: where the value found is stored, unless NULL
+ *
+ * Returns 0 if found, -1 if not.
+ */
+int bpt_shard_search(struct bpt_sharded *sh, bpt_key_t search_for, bpt_t *valp)
+{
+  struct bpt_shard *shard = &sh->shards[shard_lock(sh, search_for)];
+  struct bpt_node leaf;
+  int offset;
+
+  offset = bpt_search(search_for, sh->cmp, &shard->bstat, &leaf);
+#ifndef BPT_SET
+  if (offset != -1 && valp != NULL)
+    *valp = bpt_leaf_slots(leaf)[offset].val;
+#endif
+  pthread_mutex_unlock(&shard->lock);
+  return offset != -1 ? 0 : -1;
+}
+
+/**
+ * bpt_shard_insert: bpt_insert() into the shard taking the key
+ */
+int bpt_shard_insert(struct bpt_sharded *sh, struct bpt_entry new_entry, int (*pred)(bpt_t, bpt_t))
+{
+  struct bpt_shard *shard = &sh->shards[shard_lock(sh, new_entry.key)];
+  int rst;
+
+  rst = bpt_insert(new_entry, sh->cmp, pred, &shard->stk, 1, &shard->bstat);
+  if (rst == BPT_NEXIST)
+    shard->nkey++;
+  pthread_mutex_unlock(&shard->lock);
+  return rst;
+}
+
+/**
+ * bpt_shard_delete: bpt_delete() from the shard taking the key
+ */
+int bpt_shard_delete(struct bpt_sharded *sh, struct bpt_entry pair, int (*pred)(bpt_t, bpt_t))
+{
+  struct bpt_shard *shard = &sh->shards[shard_lock(sh, pair.key)];
+  int rst;
+
+  rst = bpt_delete(pair, sh->cmp, pred, &shard->stk, 1, &shard->bstat);
+  if (rst == BPT_PRED_SUCCESS)
+    shard->nkey--;
+  pthread_mutex_unlock(&shard->lock);
+  return rst;
+}
+
+/**
+ * last_slots: copy the @n greatest entries of a tree, in order
+ */
+static void last_slots(struct bpt_stat *bstat, struct bpt_slot *buf, int n)
+{
+  struct bpt_node node = bstat->root_node;
+  int h, m;
+
+  for (h = bstat->height; h > 0; h--)
+    node = bpt_node_child(node, bpt_node_nkey(node, bstat->order), bstat);
+  for (m = bpt_node_nkey(node, bstat->order); n > 0; ) {
+    if (m == 0) {
+      node = bpt_node_prv(node, bstat);
+      m = bpt_node_nkey(node, bstat->order);
+      continue;
+    }
+    buf[--n] = bpt_leaf_slots(node)[--m];
+  }
+}
+
+/**
+ * move_entries: move @n entries from one shard to another, from the one nearest @to on
+ * @buf: the entries, in key order
+ * @rev: if @to is the right shard of the two, so that @buf is moved from its last entry down
+ *
+ * Each entry is inserted into @to before it is deleted from @from, and the insert is undone
+ * if the delete fails, so that on failure every entry is in just one shard, and those moved
+ * are the ones nearest @to.
+ *
+ * Returns the number of entries moved, which falls short of @n on system call failure.
+ */
+static int move_entries(struct bpt_sharded *sh, struct bpt_shard *from, struct bpt_shard *to,
+    const struct bpt_slot *buf, int n, int rev)
+{
+  struct bpt_entry entry;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    entry = slot_entry(&buf[rev ? n - 1 - i : i]);
+    if (bpt_insert(entry, sh->cmp, bpt_pred_1, &to->stk, 1, &to->bstat) == BPT_ERROR)
+      break;
+    if (bpt_delete(entry, sh->cmp, bpt_pred_1, &from->stk, 1, &from->bstat) == BPT_ERROR) {
+      bpt_delete(entry, sh->cmp, bpt_pred_1, &to->stk, 1, &to->bstat);
+      break;
+    }
+    from->nkey--;
+    to->nkey++;
+  }
+  return i;
+}
+
+/**
+ * set_low: make the least key of shard @i its low key, with it and the previous shard locked
+ */
+static void set_low(struct bpt_sharded *sh, int i)
+{
+  struct bpt_cursor cur;
+
+  __atomic_store_n(&sh->bounds, sh->bounds + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  bpt_cursor_first(&cur, &sh->shards[i].bstat);
+  copy_low(&sh->shards[i].low, &bpt_cursor_entry(&cur)->key);
+  __atomic_store_n(&sh->bounds, sh->bounds + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * rebalance_pair: even out the shards @i and @i+1 by at most BPT_SHARD_MOVE entries
+ *
+ * Returns the number of entries moved, -1 on system call failure.
+ */
+static long rebalance_pair(struct bpt_sharded *sh, int i, double slack)
+{
+  struct bpt_slot buf[BPT_SHARD_MOVE];
+  struct bpt_shard *left = &sh->shards[i], *right = &sh->shards[i+1];
+  struct bpt_cursor cur;
+  size_t big, small;
+  int n, k, moved;
+
+  pthread_mutex_lock(&left->lock);
+  pthread_mutex_lock(&right->lock);
+  big = left->nkey > right->nkey ? left->nkey : right->nkey;
+  small = left->nkey > right->nkey ? right->nkey : left->nkey;
+  n = (big - small) / 2 < BPT_SHARD_MOVE ? (big - small) / 2 : BPT_SHARD_MOVE;
+  if (big <= (small + 1) * (1 + slack))
+    n = 0;
+  if (n > 0) {
+    if (left->nkey > right->nkey) { // the greatest keys of the left shard go right
+      last_slots(&left->bstat, buf, n);
+      moved = move_entries(sh, left, right, buf, n, 1);
+    } else { // the least keys of the right shard go left, one stays at least
+      for (k = 0, bpt_cursor_first(&cur, &right->bstat); k < n; k++, bpt_cursor_next(&cur))
+        buf[k] = *bpt_cursor_entry(&cur);
+      moved = move_entries(sh, right, left, buf, n, 0);
+    }
+    // the bound follows whatever was moved, even short of a failure
+    if (moved > 0)
+      set_low(sh, i + 1);
+    if (moved < n)
+      n = -1;
+  }
+  pthread_mutex_unlock(&right->lock);
+  pthread_mutex_unlock(&left->lock);
+  return n;
+}
+
+/**
+ * bpt_shard_rebalance: move entries between neighbouring shards whose sizes differ by more than @slack
+ * @slack: how much larger than its neighbour a shard may grow, 0.25 lets it hold a quarter more
+ *
+ * One pass steps through every pair of neighbours once, holding only the pair it is at.
+ * Passes are repeated until one moves nothing to reach balance.
+ *
+ * Returns the number of entries moved, -1 on system call failure.
+ */
+long bpt_shard_rebalance(struct bpt_sharded *sh, double slack)
+{
+  long moved = 0, n;
+  int i;
+
+  pthread_mutex_lock(&sh->rebalance);
+  for (i = 0; i < sh->nshard - 1; i++) {
+    if ((n = rebalance_pair(sh, i, slack)) == -1) {
+      moved = -1;
+      break;
+    }
+    moved += n;
+  }
+  pthread_mutex_unlock(&sh->rebalance);
+  return moved;
+}
+
+/**
+ * cursor_fill: copy the next batch of entries into a cursor
+ *
+ * Batches continue from the last key copied, whichever shard takes it by then. A shard with
+ * nothing left sends the cursor on to the low key of the next one.
+ *
+ * Returns 0 if OK, -1 past the last entry.
+ */
+static int cursor_fill(struct bpt_shard_cursor *cur)
+{
+  struct bpt_sharded *sh = cur->sh;
+  struct bpt_shard *shard;
+  struct bpt_cursor c;
+  int i, rst;
+
+  cur->n = cur->pos = 0;
+  while (cur->n == 0) {
+    if (cur->end)
+      return -1;
+    if (cur->start) {
+      pthread_mutex_lock(&sh->shards[0].lock);
+      i = 0;
+      rst = bpt_cursor_first(&c, &sh->shards[0].bstat);
+    } else {
+      i = shard_lock(sh, cur->next);
+      rst = bpt_cursor_seek(&c, cur->next, sh->cmp, &sh->shards[i].bstat);
+      if (rst == 0 && !cur->incl && sh->cmp(bpt_cursor_entry(&c)->key, cur->next) == 0)
+        rst = bpt_cursor_next(&c);
+    }
+    shard = &sh->shards[i];
+    for (; rst == 0 && cur->n < BPT_SHARD_BATCH; rst = bpt_cursor_next(&c))
+      cur->buf[cur->n++] = *bpt_cursor_entry(&c);
+    if (cur->n > 0) {
+      cur->next = cur->buf[cur->n-1].key;
+      cur->incl = 0;
+    } else if (i == sh->nshard - 1)
+      cur->end = 1;
+    else {
+      cur->next = sh->shards[i+1].low;
+      cur->incl = 1;
+    }
+    cur->start = 0;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return 0;
+}
+
+/**
+ * bpt_shard_cursor_first: put a cursor at the least entry of every shard
+ *
+ * Returns 0 if OK, -1 if there is no entry.
+ */
+int bpt_shard_cursor_first(struct bpt_shard_cursor *cur, struct bpt_sharded *sh)
+{
+  cur->sh = sh;
+  cur->start = 1;
+  cur->end = 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_shard_cursor_seek: put a cursor at the least entry whose key is not less than @search_for
+ *
+ * Returns 0 if OK, -1 if every key is less than @search_for.
+ */
+int bpt_shard_cursor_seek(struct bpt_shard_cursor *cur, struct bpt_sharded *sh, bpt_key_t search_for)
+{
+  cur->sh = sh;
+  cur->next = search_for;
+  cur->incl = 1;
+  cur->start = 0;
+  cur->end = 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_shard_cursor_next: step a cursor to the next entry
+ *
+ * Returns 0 if OK, -1 if the cursor ran off the last entry.
+ */
+int bpt_shard_cursor_next(struct bpt_shard_cursor *cur)
+{
+  if (++cur->pos < cur->n)
+    return 0;
+  return cursor_fill(cur);
+}
+
+/**
+ * bpt_shard_free: release every shard, no other thread may use the container any more
+ */
+void bpt_shard_free(struct bpt_sharded *sh)
+{
+  int i;
+
+  for (i = 0; i < sh->nshard; i++)
+    shard_free(&sh->shards[i]);
+  pthread_mutex_destroy(&sh->rebalance);
+  free(sh->shards);
+}
@@ -0,0 +1,66 @@
+#ifndef BPT_SHARD_H
+#define BPT_SHARD_H
+
+#include <pthread.h>
+#include "b_plus_tree.h"
+
+#define BPT_SHARD_BATCH 64 // entries a cursor copies out of a shard at a time
+#define BPT_SHARD_MOVE 256 // most entries a rebalancing step moves between two shards
+
+/*
+ * One tree of a sharded container, taking the keys from @low up to the @low of the next
+ * shard. @low is only changed with both this shard and the previous one locked, and while
+ * the @bounds of the container are odd.
+ */
+struct bpt_shard {
+  pthread_mutex_t lock;
+  struct bpt_stat bstat;
+  struct gen_stk stk;
+  bpt_key_t low; // unused for the first shard, which takes every key below the second one
+  size_t nkey;
+} __attribute__((aligned(64)));
+
+/*
+ * A container of trees partitioned by key range, each with its own lock, so that writers
+ * to different ranges never wait for each other. Rebalancing moves a few entries at a
+ * time between two neighbouring shards, with only those two locked.
+ */
+struct bpt_sharded {
+  struct bpt_shard *shards;
+  int nshard;
+  int (*cmp)(bpt_key_t, bpt_key_t);
+  pthread_mutex_t rebalance; // one rebalancing pass at a time
+  off_t bounds;              // odd while a rebalancing step changes the low key of a shard
+};
+
+/*
+ * An ordered walk over every shard. Entries are copied out a batch at a time, so the
+ * cursor holds no lock between calls and sees each batch as it was when copied.
+ */
+struct bpt_shard_cursor {
+  struct bpt_sharded *sh;
+  struct bpt_slot buf[BPT_SHARD_BATCH];
+  int n, pos;
+  bpt_key_t next; // where the next batch starts
+  int incl;       // if the next batch may start with @next itself
+  int start;      // the next batch starts at the least key
+  int end;        // no batch follows the buffered one
+};
+
+int bpt_shard_init(struct bpt_sharded *sh, int nshard, int order, int (*cmp)(bpt_key_t, bpt_key_t),
+    const bpt_key_t *sample, size_t nsample);
+int bpt_shard_search(struct bpt_sharded *sh, bpt_key_t search_for, bpt_t *valp);
+int bpt_shard_insert(struct bpt_sharded *sh, struct bpt_entry new_entry, int (*pred)(bpt_t, bpt_t));
+int bpt_shard_delete(struct bpt_sharded *sh, struct bpt_entry pair, int (*pred)(bpt_t, bpt_t));
+long bpt_shard_rebalance(struct bpt_sharded *sh, double slack);
+int bpt_shard_cursor_first(struct bpt_shard_cursor *cur, struct bpt_sharded *sh);
+int bpt_shard_cursor_seek(struct bpt_shard_cursor *cur, struct bpt_sharded *sh, bpt_key_t search_for);
+int bpt_shard_cursor_next(struct bpt_shard_cursor *cur);
+void bpt_shard_free(struct bpt_sharded *sh);
+
+static inline struct bpt_slot *bpt_shard_cursor_entry(struct bpt_shard_cursor *cur)
+{
+  return &cur->buf[cur->pos];
+}
+
+#endif
@@ -0,0 +1,745 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "syscall_fail.h"
+#include "bpt_str.h"
+
+#define FENCE_CAP_INIT 64
+#define PAGE_KEYS_MAX ((BPT_STR_PAGE - sizeof (struct bpt_str_page)) / (sizeof (struct bpt_str_slot) + sizeof (bpt_t)))
+#define REC_MIN (sizeof (struct bpt_str_slot) + sizeof (bpt_t))
+#define NODE_KEYS_MAX ((BPT_STR_PAGE - sizeof (struct bpt_str_node)) / REC_MIN)
+#define SCRATCH_SIZE ((2 * NODE_KEYS_MAX + 4) * BPT_STR_TREE_KEY_MAX) // two nodes merged, fences and all
+
+struct pending {
+  const unsigned char *key;
+  size_t len;
+  bpt_t val;
+};
+
+static size_t lcp(const unsigned char *a, size_t alen, const unsigned char *b, size_t blen)
+{
+  size_t i, n = alen < blen ? alen : blen;
+
+  for (i = 0; i < n && a[i] == b[i]; i++)
+    ;
+  return i;
+}
+
+static inline int str_cmp(const void *a, size_t alen, const void *b, size_t blen)
+{
+  int r = memcmp(a, b, alen < blen ? alen : blen);
+
+  return r != 0 ? r : (alen > blen) - (alen < blen);
+}
+
+static inline size_t page_size(size_t n, size_t plen, size_t sumlen)
+{
+  return sizeof (struct bpt_str_page) + n * (sizeof (struct bpt_str_slot) + sizeof (bpt_t)) + plen + sumlen - n * plen;
+}
+
+/**
+ * emit_page: append a page holding @n pending entries sharing a @plen byte prefix
+ * @last: the last entry of the previous page, NULL for the first page
+ *
+ * The page's separator is the shortest prefix of its first key that sorts after @last.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int emit_page(struct bpt_str_pack *pack, struct pending *pend, int n, size_t plen, struct pending *last)
+{
+  struct bpt_str_page *page;
+  struct bpt_str_fence fence;
+  size_t off = BPT_STR_PAGE, new_cap, rlen;
+  char *new_buf;
+  int i;
+
+  if (pack->npage == pack->cap) {
+    new_cap = pack->cap ? pack->cap * 2 : 16;
+    if ((new_buf = realloc(pack->pages, new_cap * BPT_STR_PAGE)) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    pack->pages = new_buf;
+    pack->cap = new_cap;
+  }
+  page = bpt_str_page(pack, pack->npage);
+  memset(page, 0, BPT_STR_PAGE);
+  page->nkey = n;
+  page->plen = plen;
+  off -= plen;
+  memcpy((char *)page + off, pend[0].key, plen);
+  page->poff = off;
+  for (i = 0; i < n; i++) {
+    rlen = pend[i].len - plen;
+    off -= sizeof (bpt_t) + rlen;
+    memcpy((char *)page + off, &pend[i].val, sizeof (bpt_t));
+    memcpy((char *)page + off + sizeof (bpt_t), pend[i].key + plen, rlen);
+    page->slot[i].off = off;
+    page->slot[i].len = rlen;
+  }
+  page->free = off;
+
+  fence.at = pack->seps_len;
+  fence.len = last == NULL ? 0 : lcp(last->key, last->len, pend[0].key, pend[0].len) + 1;
+  if (pack->seps_len + fence.len > pack->seps_cap) {
+    for (new_cap = pack->seps_cap ? pack->seps_cap : 4096; new_cap < pack->seps_len + fence.len; new_cap *= 2)
+      ;
+    if ((new_buf = realloc(pack->seps, new_cap)) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    pack->seps = new_buf;
+    pack->seps_cap = new_cap;
+  }
+  if (fence.len > 0)
+    memcpy(pack->seps + pack->seps_len, pend[0].key, fence.len);
+  if (gen_stk_push(&pack->fences, &fence) == -1)
+    return -1;
+  pack->seps_len += fence.len;
+  pack->npage++;
+  pack->nkey += n;
+  return 0;
+}
+
+/**
+ * bpt_str_build: make a slotted page copy of a B+ tree with byte-string keys
+ * @pack: the copy to fill in
+ * @bstat: the tree, which must order its keys as memcmp() does, shorter first on ties
+ * @key_bytes: returns the bytes of a key of the tree and stores their count through @lenp
+ *
+ * Pages are filled in key order as far as they go; the longer the prefix their keys share,
+ * the more keys a page holds.
+ *
+ * Returns 0 if OK, -1 if a key is longer than BPT_STR_KEY_MAX or on system call failure.
+ */
+int bpt_str_build(struct bpt_str_pack *pack, struct bpt_stat *bstat,
+    const void *(*key_bytes)(bpt_key_t key, size_t *lenp))
+{
+  struct pending pend[PAGE_KEYS_MAX], last;
+  struct bpt_cursor cur;
+  const unsigned char *key;
+  size_t len, plen = 0, nplen, sumlen = 0;
+  int rst, n = 0, has_last = 0;
+
+  memset(pack, 0, sizeof (*pack));
+  if (gen_stk_init(&pack->fences, FENCE_CAP_INIT, sizeof (struct bpt_str_fence)) == -1)
+    return -1;
+  for (rst = bpt_cursor_first(&cur, bstat); rst == 0; rst = bpt_cursor_next(&cur)) {
+    key = key_bytes(bpt_cursor_entry(&cur)->key, &len);
+    if (len > BPT_STR_KEY_MAX) {
+      errno = EINVAL;
+      goto fail;
+    }
+    if (n > 0) {
+      nplen = lcp(pend[0].key, plen, key, len);
+      if (n == PAGE_KEYS_MAX || page_size(n + 1, nplen, sumlen + len) > BPT_STR_PAGE) {
+        if (emit_page(pack, pend, n, plen, has_last ? &last : NULL) == -1)
+          goto fail;
+        last = pend[n-1];
+        has_last = 1;
+        n = 0;
+      } else
+        plen = nplen;
+    }
+    if (n == 0) {
+      plen = len;
+      sumlen = 0;
+    }
+    pend[n].key = key;
+    pend[n].len = len;
+    pend[n].val = bpt_cursor_entry(&cur)->val;
+    n++;
+    sumlen += len;
+  }
+  if (n > 0 && emit_page(pack, pend, n, plen, has_last ? &last : NULL) == -1)
+    goto fail;
+  return 0;
+fail:
+  bpt_str_free(pack);
+  return -1;
+}
+
+/**
+ * bpt_str_search: look a key up in a slotted page copy
+ *
+ * Returns 0 and stores the value through @valp if found, -1 if not.
+ */
+int bpt_str_search(struct bpt_str_pack *pack, const void *key, size_t len, bpt_t *valp)
+{
+  struct bpt_str_fence *fences = pack->fences.addr;
+  struct bpt_str_page *page;
+  const char *suffix;
+  size_t lo = 0, n = pack->npage, half;
+  int l, h, m, r;
+
+  if (n == 0)
+    return -1;
+  while (n > 1) {
+    half = n / 2;
+    if (str_cmp(pack->seps + fences[lo+half].at, fences[lo+half].len, key, len) <= 0)
+      lo += half;
+    n -= half;
+  }
+  page = bpt_str_page(pack, lo);
+  if (len < page->plen || memcmp(key, (char *)page + page->poff, page->plen) != 0)
+    return -1;
+  suffix = (const char *)key + page->plen;
+  len -= page->plen;
+  for (l = 0, h = page->nkey - 1; l <= h; ) {
+    m = (l + h) / 2;
+    r = str_cmp((char *)page + page->slot[m].off + sizeof (bpt_t), page->slot[m].len, suffix, len);
+    if (r == 0) {
+      memcpy(valp, (char *)page + page->slot[m].off, sizeof (bpt_t));
+      return 0;
+    } else if (r < 0)
+      l = m + 1;
+    else
+      h = m - 1;
+  }
+  return -1;
+}
+
+/**
+ * bpt_str_foreach: call @fn on every entry of a slotted page copy in key order
+ *
+ * The key passed to @fn only lives until it returns.
+ *
+ * Returns 0 if OK, or the first non-zero value @fn returns.
+ */
+int bpt_str_foreach(struct bpt_str_pack *pack,
+    int (*fn)(const void *key, size_t len, bpt_t val, void *arg), void *arg)
+{
+  struct bpt_str_page *page;
+  char key[BPT_STR_KEY_MAX];
+  bpt_t val;
+  size_t p;
+  int i, rst;
+
+  for (p = 0; p < pack->npage; p++) {
+    page = bpt_str_page(pack, p);
+    memcpy(key, (char *)page + page->poff, page->plen);
+    for (i = 0; i < page->nkey; i++) {
+      memcpy(&val, (char *)page + page->slot[i].off, sizeof (bpt_t));
+      memcpy(key + page->plen, (char *)page + page->slot[i].off + sizeof (bpt_t), page->slot[i].len);
+      if ((rst = fn(key, page->plen + page->slot[i].len, val, arg)) != 0)
+        return rst;
+    }
+  }
+  return 0;
+}
+
+void bpt_str_free(struct bpt_str_pack *pack)
+{
+  free(pack->pages);
+  free(pack->seps);
+  gen_stk_delete(&pack->fences);
+  memset(pack, 0, sizeof (*pack));
+}
+
+// a position in the path from the root down to a leaf
+struct str_frm {
+  struct bpt_str_node *node;
+  int idx; // the child taken, -1 for the first one
+};
+
+static const struct pending unbounded = { .key = NULL };
+
+static inline unsigned char *node_rec(struct bpt_str_node *node, int i)
+{
+  return (unsigned char *)node + node->slot[i].off;
+}
+
+static inline bpt_t node_val(struct bpt_str_node *node, int i)
+{
+  bpt_t val;
+
+  memcpy(&val, node_rec(node, i), sizeof (val));
+  return val;
+}
+
+static inline struct bpt_str_node *node_child(struct bpt_str_node *node, int idx)
+{
+  return idx < 0 ? node->first : node_val(node, idx).ptr;
+}
+
+static inline size_t node_room(struct bpt_str_node *node)
+{
+  return node->free - sizeof (struct bpt_str_node) - node->nkey * sizeof (struct bpt_str_slot);
+}
+
+static inline size_t node_used(struct bpt_str_node *node)
+{
+  return BPT_STR_PAGE - node_room(node) - node->dead;
+}
+
+/**
+ * node_find: the first record of a node whose key isn't less than @key
+ * @found: set if that record holds @key itself
+ *
+ * @key must lie within the fences of the node, so that it shares the node's prefix.
+ */
+static int node_find(struct bpt_str_node *node, const unsigned char *key, size_t len, int *found)
+{
+  int l = 0, h = node->nkey, m, r;
+
+  assert(len >= node->plen);
+  key += node->plen;
+  len -= node->plen;
+  *found = 0;
+  while (l < h) {
+    m = (l + h) / 2;
+    r = str_cmp(node_rec(node, m) + sizeof (bpt_t), node->slot[m].len, key, len);
+    if (r < 0)
+      l = m + 1;
+    else {
+      *found |= r == 0;
+      h = m;
+    }
+  }
+  return l;
+}
+
+/**
+ * node_decode: copy the full keys of a node to @buf and list its records in @ents
+ * @low, @high: where to copy the fences to as well, unless NULL
+ *
+ * Returns the end of what was copied to @buf.
+ */
+static unsigned char *node_decode(struct bpt_str_node *node, struct pending *ents, unsigned char *buf,
+    struct pending *low, struct pending *high)
+{
+  const unsigned char *prefix = (unsigned char *)node + node->low;
+  int i;
+
+  if (low != NULL) {
+    *low = node->low_len < 0 ? unbounded : (struct pending){ .key = buf, .len = node->low_len };
+    memcpy(buf, prefix, node->low_len < 0 ? 0 : node->low_len);
+    buf += low->len;
+  }
+  if (high != NULL) {
+    *high = node->high_len < 0 ? unbounded : (struct pending){ .key = buf, .len = node->high_len };
+    memcpy(buf, (unsigned char *)node + node->high, node->high_len < 0 ? 0 : node->high_len);
+    buf += high->len;
+  }
+  for (i = 0; i < node->nkey; i++) {
+    memcpy(buf, prefix, node->plen);
+    memcpy(buf + node->plen, node_rec(node, i) + sizeof (bpt_t), node->slot[i].len);
+    ents[i].key = buf;
+    ents[i].len = node->plen + node->slot[i].len;
+    ents[i].val = node_val(node, i);
+    buf += ents[i].len;
+  }
+  return buf;
+}
+
+static inline size_t fences_plen(const struct pending *low, const struct pending *high)
+{
+  return low->key != NULL && high->key != NULL ? lcp(low->key, low->len, high->key, high->len) : 0;
+}
+
+// bytes a node built out of @n entries between two fences takes
+static size_t node_size(const struct pending *low, const struct pending *high, struct pending *ents, int n)
+{
+  size_t plen = fences_plen(low, high), size;
+  int i;
+
+  size = sizeof (struct bpt_str_node) + n * (REC_MIN - plen);
+  size += (low->key != NULL ? low->len : 0) + (high->key != NULL ? high->len : 0);
+  for (i = 0; i < n; i++)
+    size += ents[i].len;
+  return size;
+}
+
+/**
+ * node_build: lay a node out anew, which must fit in a page
+ *
+ * Neither the fences nor the entries may lie in the node itself. The leaf link is left alone.
+ */
+static void node_build(struct bpt_str_node *node, int level, const struct pending *low, const struct pending *high,
+    struct pending *ents, int n, struct bpt_str_node *first)
+{
+  size_t off = BPT_STR_PAGE, plen = fences_plen(low, high), rlen;
+  int i;
+
+  assert(node_size(low, high, ents, n) <= BPT_STR_PAGE);
+  node->nkey = n;
+  node->level = level;
+  node->plen = plen;
+  node->dead = 0;
+  node->first = first;
+  node->low_len = node->high_len = -1;
+  if (high->key != NULL) {
+    off -= high->len;
+    memcpy((char *)node + off, high->key, high->len);
+    node->high = off;
+    node->high_len = high->len;
+  }
+  if (low->key != NULL) {
+    off -= low->len;
+    memcpy((char *)node + off, low->key, low->len);
+    node->low_len = low->len;
+  }
+  node->low = off;
+  for (i = 0; i < n; i++) {
+    rlen = ents[i].len - plen;
+    off -= sizeof (bpt_t) + rlen;
+    memcpy((char *)node + off, &ents[i].val, sizeof (bpt_t));
+    memcpy((char *)node + off + sizeof (bpt_t), ents[i].key + plen, rlen);
+    node->slot[i].off = off;
+    node->slot[i].len = rlen;
+  }
+  node->free = off;
+}
+
+/**
+ * node_put: insert a record into a node, taking back the space of deleted ones if need be
+ *
+ * Returns 0 if OK, -1 if the node has no room for it.
+ */
+static int node_put(struct bpt_str_tree *t, struct bpt_str_node *node, int pos,
+    const unsigned char *key, size_t len, bpt_t val)
+{
+  struct pending ents[NODE_KEYS_MAX], low, high;
+  size_t rlen = len - node->plen;
+
+  if (node_room(node) < REC_MIN + rlen) {
+    if (node_room(node) + node->dead < REC_MIN + rlen)
+      return -1;
+    node_decode(node, ents, t->scratch, &low, &high);
+    node_build(node, node->level, &low, &high, ents, node->nkey, node->first);
+  }
+  node->free -= sizeof (bpt_t) + rlen;
+  memcpy((char *)node + node->free, &val, sizeof (bpt_t));
+  memcpy((char *)node + node->free + sizeof (bpt_t), key + node->plen, rlen);
+  memmove(&node->slot[pos+1], &node->slot[pos], (node->nkey - pos) * sizeof (struct bpt_str_slot));
+  node->slot[pos].off = node->free;
+  node->slot[pos].len = rlen;
+  node->nkey++;
+  return 0;
+}
+
+static void node_remove(struct bpt_str_node *node, int pos)
+{
+  node->dead += sizeof (bpt_t) + node->slot[pos].len;
+  memmove(&node->slot[pos], &node->slot[pos+1], (node->nkey - pos - 1) * sizeof (struct bpt_str_slot));
+  node->nkey--;
+}
+
+/**
+ * reserve: put aside enough pages for @n splits, so that none fails halfway up the tree
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+static int reserve(struct bpt_str_tree *t, int n)
+{
+  struct bpt_str_node *node;
+
+  for (; t->nspare < n; t->nspare++) {
+    if ((node = malloc(BPT_STR_PAGE)) == NULL) {
+      syscall_fail("malloc");
+      return -1;
+    }
+    node->nxt = t->spare;
+    t->spare = node;
+  }
+  return 0;
+}
+
+static struct bpt_str_node *page_take(struct bpt_str_tree *t)
+{
+  struct bpt_str_node *node = t->spare;
+
+  t->spare = node->nxt;
+  t->nspare--;
+  t->npage++;
+  return node;
+}
+
+static void page_drop(struct bpt_str_tree *t, struct bpt_str_node *node)
+{
+  t->npage--;
+  if (t->nspare >= BPT_STR_HEIGHT_MAX) {
+    free(node);
+    return;
+  }
+  node->nxt = t->spare;
+  t->spare = node;
+  t->nspare++;
+}
+
+/**
+ * node_split: split the node at depth @d of @path, which has no room for the record going to @pos
+ *
+ * The halves are cut at about half their bytes. Leaves are told apart by the shortest prefix of
+ * the first key of the right half that sorts after the last key of the left one; internal nodes
+ * push their middle separator up. The new fences lengthen the prefix of both halves.
+ */
+static void node_split(struct bpt_str_tree *t, struct str_frm *path, int d, int pos,
+    const unsigned char *key, size_t len, bpt_t val)
+{
+  struct bpt_str_node *node = path[d].node, *right = page_take(t), *root;
+  struct pending ents[NODE_KEYS_MAX + 1], low, high, sep;
+  unsigned char sepbuf[BPT_STR_TREE_KEY_MAX];
+  size_t total = 0, acc = 0;
+  int n = node->nkey, m;
+
+  node_decode(node, ents, t->scratch, &low, &high);
+  memmove(&ents[pos+1], &ents[pos], (n - pos) * sizeof (struct pending));
+  ents[pos] = (struct pending){ .key = key, .len = len, .val = val };
+  n++;
+  for (m = 0; m < n; m++)
+    total += REC_MIN + ents[m].len;
+  for (m = 0; m < n - 1 && acc + REC_MIN + ents[m].len <= total / 2; m++)
+    acc += REC_MIN + ents[m].len;
+  if (node->level == 0) {
+    m = m < 1 ? 1 : m;
+    sep.len = lcp(ents[m-1].key, ents[m-1].len, ents[m].key, ents[m].len) + 1;
+    memcpy(sepbuf, ents[m].key, sep.len);
+    sep.key = sepbuf;
+    node_build(right, 0, &sep, &high, &ents[m], n - m, NULL);
+    node_build(node, 0, &low, &sep, ents, m, NULL);
+    right->nxt = node->nxt;
+    node->nxt = right;
+  } else {
+    m = m < 1 ? 1 : m > n - 2 ? n - 2 : m;
+    sep.len = ents[m].len;
+    memcpy(sepbuf, ents[m].key, sep.len);
+    sep.key = sepbuf;
+    node_build(right, node->level, &sep, &high, &ents[m+1], n - m - 1, ents[m].val.ptr);
+    node_build(node, node->level, &low, &sep, ents, m, node->first);
+    right->nxt = NULL;
+  }
+  sep.val.ptr = right;
+  if (d == 0) {
+    root = page_take(t);
+    node_build(root, node->level + 1, &unbounded, &unbounded, &sep, 1, node);
+    root->nxt = NULL;
+    t->root = root;
+    t->height++;
+  } else if (node_put(t, path[d-1].node, path[d-1].idx + 1, sepbuf, sep.len, sep.val) == -1)
+    node_split(t, path, d - 1, path[d-1].idx + 1, sepbuf, sep.len, sep.val);
+}
+
+/**
+ * node_merge: merge the children either side of the @i-th separator of @parent into the left one,
+ * if they fit in a page together
+ *
+ * The merged node spans both fence ranges, so its prefix may get shorter and its records longer.
+ *
+ * Returns 1 if they were merged.
+ */
+static int node_merge(struct bpt_str_tree *t, struct bpt_str_node *parent, int i)
+{
+  struct bpt_str_node *left = node_child(parent, i - 1), *right = node_child(parent, i);
+  struct pending ents[2 * NODE_KEYS_MAX + 1], low, high;
+  unsigned char *buf;
+  int n = left->nkey;
+
+  buf = node_decode(left, ents, t->scratch, &low, NULL);
+  if (left->level > 0) { // the separator comes down, over the first child of the right node
+    memcpy(buf, (unsigned char *)parent + parent->low, parent->plen);
+    memcpy(buf + parent->plen, node_rec(parent, i) + sizeof (bpt_t), parent->slot[i].len);
+    ents[n].key = buf;
+    ents[n].len = parent->plen + parent->slot[i].len;
+    ents[n].val.ptr = right->first;
+    buf += ents[n++].len;
+  }
+  node_decode(right, &ents[n], buf, NULL, &high);
+  n += right->nkey;
+  if (node_size(&low, &high, ents, n) > BPT_STR_PAGE)
+    return 0;
+  node_build(left, left->level, &low, &high, ents, n, left->first);
+  left->nxt = right->nxt;
+  node_remove(parent, i);
+  page_drop(t, right);
+  return 1;
+}
+
+static struct bpt_str_node *descend(struct bpt_str_tree *t, const unsigned char *key, size_t len,
+    struct str_frm *path)
+{
+  struct bpt_str_node *node = t->root;
+  int d, i, found;
+
+  for (d = 0; d < t->height; d++) {
+    i = node_find(node, key, len, &found);
+    path[d].node = node;
+    path[d].idx = found ? i : i - 1;
+    node = node_child(node, path[d].idx);
+  }
+  path[d].node = node;
+  path[d].idx = -1;
+  return node;
+}
+
+/**
+ * bpt_str_tree_init: make an empty string-keyed tree
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_str_tree_init(struct bpt_str_tree *t)
+{
+  memset(t, 0, sizeof (*t));
+  if ((t->scratch = malloc(SCRATCH_SIZE)) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  if (reserve(t, 1) == -1) {
+    free(t->scratch);
+    return -1;
+  }
+  t->root = page_take(t);
+  node_build(t->root, 0, &unbounded, &unbounded, NULL, 0, NULL);
+  t->root->nxt = NULL;
+  return 0;
+}
+
+/**
+ * bpt_str_tree_search: look a key up in a string-keyed tree
+ *
+ * Returns 0 and stores the value through @valp if found, -1 if not.
+ */
+int bpt_str_tree_search(struct bpt_str_tree *t, const void *key, size_t len, bpt_t *valp)
+{
+  struct bpt_str_node *node = t->root;
+  int h, i, found;
+
+  for (h = t->height; h > 0; h--) {
+    i = node_find(node, key, len, &found);
+    node = node_child(node, found ? i : i - 1);
+  }
+  i = node_find(node, key, len, &found);
+  if (!found)
+    return -1;
+  *valp = node_val(node, i);
+  return 0;
+}
+
+/**
+ * bpt_str_tree_insert: insert an entry into a string-keyed tree
+ * @pred: see bpt_insert()
+ *
+ * Returns as bpt_insert() does; BPT_ERROR with errno set to EINVAL if the key is longer than
+ * BPT_STR_TREE_KEY_MAX. The tree is left as it was on failure.
+ */
+int bpt_str_tree_insert(struct bpt_str_tree *t, const void *key, size_t len, bpt_t val, int (*pred)(bpt_t, bpt_t))
+{
+  struct str_frm path[BPT_STR_HEIGHT_MAX];
+  struct bpt_str_node *leaf;
+  int pos, found;
+
+  if (len > BPT_STR_TREE_KEY_MAX) {
+    errno = EINVAL;
+    return BPT_ERROR;
+  }
+  leaf = descend(t, key, len, path);
+  pos = node_find(leaf, key, len, &found);
+  if (found) {
+    if (!pred(val, node_val(leaf, pos)))
+      return BPT_PRED_FAIL;
+    memcpy(node_rec(leaf, pos), &val, sizeof (bpt_t));
+    return BPT_PRED_SUCCESS;
+  }
+  if (node_put(t, leaf, pos, key, len, val) == -1) {
+    // a split at every level and a new root at most
+    if (t->height + 2 > BPT_STR_HEIGHT_MAX || reserve(t, t->height + 2) == -1)
+      return BPT_ERROR;
+    node_split(t, path, t->height, pos, key, len, val);
+  }
+  t->nkey++;
+  return BPT_NEXIST;
+}
+
+/**
+ * bpt_str_tree_delete: delete an entry from a string-keyed tree
+ *
+ * A node left less than a quarter full is merged with a sibling under the same parent if they
+ * fit in a page together; one that doesn't fit stays as it is until later deletes make room.
+ *
+ * Returns BPT_PRED_SUCCESS if the entry was deleted, BPT_NEXIST if there was none.
+ */
+int bpt_str_tree_delete(struct bpt_str_tree *t, const void *key, size_t len)
+{
+  struct str_frm path[BPT_STR_HEIGHT_MAX];
+  struct bpt_str_node *leaf, *parent, *old;
+  int pos, found, d, c;
+
+  if (len > BPT_STR_TREE_KEY_MAX)
+    return BPT_NEXIST;
+  leaf = descend(t, key, len, path);
+  pos = node_find(leaf, key, len, &found);
+  if (!found)
+    return BPT_NEXIST;
+  node_remove(leaf, pos);
+  t->nkey--;
+  // a node that couldn't merge before may be able to now, so every level on the way up is tried
+  for (d = t->height; d > 0; d--) {
+    if (node_used(path[d].node) >= BPT_STR_PAGE / 4)
+      continue;
+    parent = path[d-1].node;
+    c = path[d-1].idx;
+    if (!(c + 1 < parent->nkey && node_merge(t, parent, c + 1)) && c >= 0)
+      node_merge(t, parent, c);
+  }
+  while (t->height > 0 && t->root->nkey == 0) {
+    old = t->root;
+    t->root = old->first;
+    t->height--;
+    page_drop(t, old);
+  }
+  return BPT_PRED_SUCCESS;
+}
+
+/**
+ * bpt_str_tree_foreach: call @fn on every entry of a string-keyed tree in key order
+ *
+ * The key passed to @fn only lives until it returns, and @fn may not modify the tree.
+ *
+ * Returns 0 if OK, or the first non-zero value @fn returns.
+ */
+int bpt_str_tree_foreach(struct bpt_str_tree *t,
+    int (*fn)(const void *key, size_t len, bpt_t val, void *arg), void *arg)
+{
+  struct bpt_str_node *node;
+  unsigned char key[BPT_STR_TREE_KEY_MAX];
+  int i, rst;
+
+  for (node = t->root; node->level > 0; node = node->first)
+    ;
+  for (; node != NULL; node = node->nxt) {
+    memcpy(key, (char *)node + node->low, node->plen);
+    for (i = 0; i < node->nkey; i++) {
+      memcpy(key + node->plen, node_rec(node, i) + sizeof (bpt_t), node->slot[i].len);
+      if ((rst = fn(key, node->plen + node->slot[i].len, node_val(node, i), arg)) != 0)
+        return rst;
+    }
+  }
+  return 0;
+}
+
+static void node_free(struct bpt_str_node *node)
+{
+  int i;
+
+  if (node->level > 0) {
+    node_free(node->first);
+    for (i = 0; i < node->nkey; i++)
+      node_free(node_child(node, i));
+  }
+  free(node);
+}
+
+void bpt_str_tree_free(struct bpt_str_tree *t)
+{
+  struct bpt_str_node *node;
+
+  node_free(t->root);
+  while ((node = t->spare) != NULL) {
+    t->spare = node->nxt;
+    free(node);
+  }
+  free(t->scratch);
+  memset(t, 0, sizeof (*t));
+}
@@ -0,0 +1,106 @@
+#ifndef BPT_STR_H
+#define BPT_STR_H
+
+#include "b_plus_tree.h"
+
+#ifdef BPT_SET
+#error "slotted pages keep the values of the tree"
+#endif
+
+#define BPT_STR_PAGE 4096   // bytes per slotted page
+#define BPT_STR_KEY_MAX 1024 // longest key a page takes
+
+/*
+ * A slotted page. Slots grow up from the header and point at records growing down from
+ * the end of the page; a record is the value followed by the key bytes past the prefix
+ * every key of the page shares, which is stored once.
+ */
+struct bpt_str_page {
+  unsigned short nkey;
+  unsigned short plen; // length of the shared prefix
+  unsigned short poff; // offset of the shared prefix in the page
+  unsigned short free; // lowest offset taken by the record area
+  struct bpt_str_slot {
+    unsigned short off;
+    unsigned short len; // key bytes past the prefix
+  } slot[];
+};
+
+struct bpt_str_fence {
+  size_t at;          // offset of the separator in the separator buffer
+  unsigned short len;
+};
+
+/*
+ * A read-only copy of a B+ tree with byte-string keys, stored inline in slotted pages.
+ * Pages are told apart by the shortest separator between the last key of a page and the
+ * first of the next, so lookups only memcmp() a few short contiguous strings before
+ * reaching a page.
+ */
+struct bpt_str_pack {
+  char *pages;           // npage pages of BPT_STR_PAGE bytes
+  size_t npage, cap;
+  char *seps;            // separator bytes, back to back
+  size_t seps_len, seps_cap;
+  struct gen_stk fences; // one struct bpt_str_fence per page, the first one empty
+  size_t nkey;
+};
+
+#define BPT_STR_TREE_KEY_MAX (BPT_STR_PAGE / 8) // longest key a live tree takes, so that halves of a split fit
+#define BPT_STR_HEIGHT_MAX 32
+
+/*
+ * A node of a live string-keyed tree, one slotted page laid out as above. A record is the
+ * value, or in an internal node the child right of the separator, followed by the key bytes
+ * past the prefix. A node covers the keys from its low fence up to its high fence, the
+ * separators around it in its parent, so every key it may ever hold shares the prefix of its
+ * two fences. That prefix is stored once, as the head of the low fence.
+ */
+struct bpt_str_node {
+  unsigned short nkey;
+  unsigned short level; // 0 for leaves
+  unsigned short plen;  // length of the prefix the keys share
+  unsigned short free;  // lowest offset taken by the record area
+  unsigned short dead;  // bytes of records deleted since the page was last rebuilt
+  unsigned short low, high; // offsets of the fences
+  short low_len, high_len;  // lengths of the fences, -1 if unbounded
+  struct bpt_str_node *first; // child left of every separator, NULL in leaves
+  struct bpt_str_node *nxt;   // next leaf
+  struct bpt_str_slot slot[];
+};
+
+/*
+ * A B+ tree with byte-string keys stored inline in slotted pages, ordered as memcmp() does,
+ * shorter first on ties. Descents memcmp() contiguous key suffixes, and a split promotes the
+ * shortest separator telling its halves apart, so internal nodes hold many short separators.
+ */
+struct bpt_str_tree {
+  struct bpt_str_node *root;
+  int height;
+  size_t nkey;
+  size_t npage;
+  struct bpt_str_node *spare; // pages put aside for splits, linked through nxt
+  int nspare;
+  unsigned char *scratch;     // full keys of the nodes being rebuilt
+};
+
+int bpt_str_build(struct bpt_str_pack *pack, struct bpt_stat *bstat,
+    const void *(*key_bytes)(bpt_key_t key, size_t *lenp));
+int bpt_str_search(struct bpt_str_pack *pack, const void *key, size_t len, bpt_t *valp);
+int bpt_str_foreach(struct bpt_str_pack *pack,
+    int (*fn)(const void *key, size_t len, bpt_t val, void *arg), void *arg);
+void bpt_str_free(struct bpt_str_pack *pack);
+int bpt_str_tree_init(struct bpt_str_tree *t);
+int bpt_str_tree_insert(struct bpt_str_tree *t, const void *key, size_t len, bpt_t val, int (*pred)(bpt_t, bpt_t));
+int bpt_str_tree_delete(struct bpt_str_tree *t, const void *key, size_t len);
+int bpt_str_tree_search(struct bpt_str_tree *t, const void *key, size_t len, bpt_t *valp);
+int bpt_str_tree_foreach(struct bpt_str_tree *t,
+    int (*fn)(const void *key, size_t len, bpt_t val, void *arg), void *arg);
+void bpt_str_tree_free(struct bpt_str_tree *t);
+
+static inline struct bpt_str_page *bpt_str_page(struct bpt_str_pack *pack, size_t i)
+{
+  return (struct bpt_str_page *)(pack->pages + i * BPT_STR_PAGE);
+}
+
+#endif
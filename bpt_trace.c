@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "syscall_fail.h"
+#include "bpt_trace.h"
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, buf, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      syscall_fail("write");
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static inline size_t put_varint(char *p, off_t d)
+{
+  uint64_t v = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63); // zigzag, small either way
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (char)v;
+  return n;
+}
+
+static inline size_t get_varint(const char *p, const char *end, off_t *dp)
+{
+  uint64_t v = 0;
+  size_t n = 0;
+  int s;
+
+  for (s = 0; p + n < end && s < 64; s += 7) {
+    v |= (uint64_t)(p[n] & 0x7f) << s;
+    if ((p[n++] & 0x80) == 0) {
+      *dp = (off_t)(v >> 1) ^ -(off_t)(v & 1);
+      return n;
+    }
+  }
+  return 0;
+}
+
+/**
+ * record: the tracing hook of the tree, appends a record to the buffer and writes out a full one
+ */
+static void record(void *trace_arg, int op, struct bpt_entry entry, int rst)
+{
+  struct bpt_trace *trace = trace_arg;
+  char *p;
+
+  if (trace->error)
+    return;
+  if (trace->len + BPT_TRACE_REC_MAX > BPT_TRACE_BUF) {
+    if (write_all(trace->fd, trace->buf, trace->len) == -1) {
+      trace->error = 1;
+      return;
+    }
+    trace->len = 0;
+  }
+  p = trace->buf + trace->len;
+  *p++ = op | rst << 2;
+  p += put_varint(p, entry.key.off - trace->prev_key);
+  p += put_varint(p, entry.val.off - trace->prev_val);
+  trace->len = p - trace->buf;
+  trace->prev_key = entry.key.off;
+  trace->prev_val = entry.val.off;
+  trace->nrec++;
+}
+
+/**
+ * bpt_trace_open: create a trace file, replacing any file at @path
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_trace_open(struct bpt_trace *trace, const char *path)
+{
+  memset(trace, 0, sizeof (*trace));
+  if ((trace->buf = malloc(BPT_TRACE_BUF)) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  if ((trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    syscall_fail("open");
+    free(trace->buf);
+    return -1;
+  }
+  memcpy(trace->buf, BPT_TRACE_MAGIC, sizeof (BPT_TRACE_MAGIC));
+  trace->len = sizeof (BPT_TRACE_MAGIC);
+  return 0;
+}
+
+/**
+ * bpt_trace_attach: record the operations done on a tree from now on
+ *
+ * The tree must not be shared by threads while it is traced.
+ */
+void bpt_trace_attach(struct bpt_trace *trace, struct bpt_stat *bstat)
+{
+  bstat->trace = record;
+  bstat->trace_arg = trace;
+}
+
+/**
+ * bpt_trace_close: write out the buffered records and close the trace file
+ *
+ * Detach the trace from its tree first.
+ *
+ * Returns 0 if OK, -1 if some records couldn't be written.
+ */
+int bpt_trace_close(struct bpt_trace *trace)
+{
+  int rst = trace->error ? -1 : write_all(trace->fd, trace->buf, trace->len);
+
+  if (close(trace->fd) == -1) {
+    syscall_fail("close");
+    rst = -1;
+  }
+  free(trace->buf);
+  return rst;
+}
+
+/**
+ * bpt_trace_reader_open: open a trace file to read its records in order
+ *
+ * Returns 0 if OK, -1 on system call failure or if the file is no trace.
+ */
+int bpt_trace_reader_open(struct bpt_trace_reader *rd, const char *path)
+{
+  char magic[sizeof (BPT_TRACE_MAGIC)];
+  ssize_t n;
+
+  memset(rd, 0, sizeof (*rd));
+  if ((rd->fd = open(path, O_RDONLY)) == -1) {
+    syscall_fail("open");
+    return -1;
+  }
+  if ((n = read(rd->fd, magic, sizeof (magic))) != sizeof (magic) || memcmp(magic, BPT_TRACE_MAGIC, sizeof (magic)) != 0) {
+    if (n != -1)
+      errno = EINVAL;
+    syscall_fail("bpt_trace");
+    close(rd->fd);
+    return -1;
+  }
+  if ((rd->buf = malloc(BPT_TRACE_BUF)) == NULL) {
+    syscall_fail("malloc");
+    close(rd->fd);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * bpt_trace_next: read the next record of a trace
+ *
+ * A record cut short at the end of the file, as a crash of the tracing process leaves it,
+ * ends the trace.
+ *
+ * Returns 1 if a record was read, 0 at the end of the trace, -1 on system call failure.
+ */
+int bpt_trace_next(struct bpt_trace_reader *rd, struct bpt_trace_rec *rec)
+{
+  off_t dk, dv;
+  size_t nk, nv;
+  ssize_t n;
+
+  if (rd->len - rd->pos < BPT_TRACE_REC_MAX && !rd->eof) {
+    memmove(rd->buf, rd->buf + rd->pos, rd->len - rd->pos);
+    rd->len -= rd->pos;
+    rd->pos = 0;
+    while (rd->len < BPT_TRACE_BUF && !rd->eof) {
+      if ((n = read(rd->fd, rd->buf + rd->len, BPT_TRACE_BUF - rd->len)) == -1) {
+        if (errno == EINTR)
+          continue;
+        syscall_fail("read");
+        return -1;
+      }
+      rd->len += n;
+      rd->eof = n == 0;
+    }
+  }
+  if (rd->pos == rd->len)
+    return 0;
+  if ((nk = get_varint(rd->buf + rd->pos + 1, rd->buf + rd->len, &dk)) == 0 ||
+      (nv = get_varint(rd->buf + rd->pos + 1 + nk, rd->buf + rd->len, &dv)) == 0)
+    return 0;
+  rec->op = rd->buf[rd->pos] & 3;
+  rec->rst = (rd->buf[rd->pos] >> 2) & 3;
+  rec->entry.key.off = rd->prev_key += dk;
+  rec->entry.val.off = rd->prev_val += dv;
+  rd->pos += 1 + nk + nv;
+  return 1;
+}
+
+void bpt_trace_reader_close(struct bpt_trace_reader *rd)
+{
+  close(rd->fd);
+  free(rd->buf);
+}
+
+/**
+ * bpt_trace_apply: redo a traced operation on a tree, which may be of any order or allocator
+ * @cmp: key comparison function, it must agree with the one of the traced tree
+ *
+ * Inserts and deletes replace or remove an entry exactly when they did in the trace, so
+ * replaying a whole trace onto the tree it started from rebuilds the same content.
+ *
+ * Returns the result of the operation, in the terms of the trace, or BPT_ERROR.
+ */
+int bpt_trace_apply(struct bpt_trace_rec *rec, int (*cmp)(bpt_t, bpt_t), struct gen_stk *stk, struct bpt_stat *bstat)
+{
+  struct bpt_node leaf;
+
+  switch (rec->op) {
+  case BPT_TRACE_SEARCH:
+    return bpt_search(rec->entry.key, cmp, bstat, &leaf) != -1 ? BPT_PRED_SUCCESS : BPT_NEXIST;
+  case BPT_TRACE_INSERT:
+    return bpt_insert(rec->entry, cmp, rec->rst == BPT_PRED_FAIL ? bpt_pred_0 : bpt_pred_1, stk, 1, bstat);
+  case BPT_TRACE_DELETE:
+    return bpt_delete(rec->entry, cmp, rec->rst == BPT_PRED_FAIL ? bpt_pred_0 : bpt_pred_1, stk, 1, bstat);
+  default:
+    errno = EINVAL;
+    syscall_fail("bpt_trace");
+    return BPT_ERROR;
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef BPT_TRACE_H
+#define BPT_TRACE_H
+
+#include "b_plus_tree.h"
+
+#ifndef BPT_KEY_PLAIN
+#error "traces only take plain bpt_t integer keys"
+#endif
+
+#define BPT_TRACE_BUF 65536
+#define BPT_TRACE_MAGIC "BPTTRC1" // first 8 bytes of a trace file, the NUL included
+#define BPT_TRACE_REC_MAX 21       // op byte plus two varints
+
+/*
+ * A trace of every search, insert and delete done on a tree, with their results. A record
+ * is one byte holding the enum BPT_TRACE_OP and the result, then the key and the value as
+ * zigzag varints of their differences from those of the previous record, so traces of
+ * clustered keys take a few bytes per operation.
+ */
+struct bpt_trace {
+  int fd;
+  char *buf;
+  size_t len;
+  off_t prev_key, prev_val;
+  unsigned long nrec;
+  int error; // a write failed, records from then on are lost
+};
+
+struct bpt_trace_rec {
+  int op;
+  int rst;
+  struct bpt_entry entry;
+};
+
+struct bpt_trace_reader {
+  int fd;
+  char *buf;
+  size_t len, pos;
+  off_t prev_key, prev_val;
+  int eof;
+};
+
+int bpt_trace_open(struct bpt_trace *trace, const char *path);
+void bpt_trace_attach(struct bpt_trace *trace, struct bpt_stat *bstat);
+int bpt_trace_close(struct bpt_trace *trace);
+int bpt_trace_reader_open(struct bpt_trace_reader *rd, const char *path);
+int bpt_trace_next(struct bpt_trace_reader *rd, struct bpt_trace_rec *rec);
+void bpt_trace_reader_close(struct bpt_trace_reader *rd);
+int bpt_trace_apply(struct bpt_trace_rec *rec, int (*cmp)(bpt_t, bpt_t), struct gen_stk *stk, struct bpt_stat *bstat);
+
+#endif
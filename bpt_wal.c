@@ -0,0 +1,461 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "syscall_fail.h"
+#include "bpt_wal.h"
+
+static unsigned rec_sum(struct bpt_wal_rec *rec)
+{
+  unsigned char *p = (unsigned char *)rec;
+  unsigned sum = 2166136261u, i;
+
+  for (i = 0; i < sizeof (struct bpt_wal_rec); i++) {
+    if (i >= offsetof(struct bpt_wal_rec, sum) && i < offsetof(struct bpt_wal_rec, key))
+      continue;
+    sum = (sum ^ p[i]) * 16777619u;
+  }
+  return sum;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, buf, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      syscall_fail("write");
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * log_rec: the logging hook of the tree, appends a record to the in-memory log buffer
+ *
+ * Runs with @wal->lock held, before the leaf is touched.
+ */
+static int log_rec(void *log_arg, int op, struct bpt_entry entry)
+{
+  struct bpt_wal *wal = log_arg;
+  struct bpt_wal_rec rec;
+  char *new_buf;
+  size_t new_cap;
+
+  if (wal->error)
+    return -1;
+  if (wal->buf_len + sizeof (rec) > wal->buf_cap) {
+    new_cap = wal->buf_cap * 2;
+    if ((new_buf = realloc(wal->buf, new_cap)) == NULL) {
+      syscall_fail("realloc");
+      return -1;
+    }
+    wal->buf = new_buf;
+    wal->buf_cap = new_cap;
+  }
+  memset(&rec, 0, sizeof (rec));
+  rec.op = op;
+  rec.key = entry.key;
+  rec.val = entry.val;
+  rec.sum = rec_sum(&rec);
+  memcpy(wal->buf + wal->buf_len, &rec, sizeof (rec));
+  wal->buf_len += sizeof (rec);
+  wal->logged += sizeof (rec);
+  return 0;
+}
+
+/**
+ * flush_log: make the log durable up to @target bytes
+ *
+ * Called with @wal->lock held. The first thread that finds nobody flushing becomes the leader:
+ * it takes every record buffered so far, drops the lock, and pays one write() plus one fdatasync()
+ * for all of them. Others wait for the leader, and find their records already durable unless
+ * they arrived after the leader swapped buffers, in which case one of them leads the next round.
+ *
+ * Returns 0 if OK, -1 if the log can't be written.
+ */
+static int flush_log(struct bpt_wal *wal, unsigned long long target)
+{
+  char *tmp;
+  size_t len, cap;
+  unsigned long long end;
+  int rst;
+
+  while (wal->durable < target && !wal->error) {
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->flushed, &wal->lock);
+      continue;
+    }
+    wal->flushing = 1;
+    tmp = wal->wbuf, cap = wal->wbuf_cap;
+    wal->wbuf = wal->buf, wal->wbuf_cap = wal->buf_cap;
+    wal->buf = tmp, wal->buf_cap = cap;
+    len = wal->buf_len;
+    wal->buf_len = 0;
+    end = wal->logged;
+    pthread_mutex_unlock(&wal->lock);
+
+    if ((rst = write_all(wal->log_fd, wal->wbuf, len)) == 0 && (rst = fdatasync(wal->log_fd)) == -1)
+      syscall_fail("fdatasync");
+
+    pthread_mutex_lock(&wal->lock);
+    wal->flushing = 0;
+    if (rst == -1)
+      wal->error = 1;
+    else
+      wal->durable = end;
+    pthread_cond_broadcast(&wal->flushed);
+  }
+  return wal->error ? -1 : 0;
+}
+
+static int sync_dir(const char *path)
+{
+  char *dir, *slash;
+  int fd, rst = 0;
+
+  if ((dir = strdup(path)) == NULL) {
+    syscall_fail("strdup");
+    return -1;
+  }
+  if ((slash = strrchr(dir, '/')) == NULL)
+    strcpy(dir, ".");
+  else if (slash == dir)
+    slash[1] = '\0';
+  else
+    *slash = '\0';
+  if ((fd = open(dir, O_RDONLY)) == -1) {
+    syscall_fail("open");
+    rst = -1;
+  } else {
+    if ((rst = fsync(fd)) == -1)
+      syscall_fail("fsync");
+    close(fd);
+  }
+  free(dir);
+  return rst;
+}
+
+/**
+ * checkpoint_locked: write the tree image and truncate the log, with @wal->lock held
+ *
+ * The image is written aside and renamed over the old one, so the image on disk is always
+ * a complete checkpoint. It is only written once every record it reflects is durable.
+ */
+static int checkpoint_locked(struct bpt_wal *wal)
+{
+  struct bpt_arena *arena = (struct bpt_arena *)wal->bstat.base;
+  char *tmp_path;
+  int fd, rst = -1;
+
+  // the leader drops the lock while writing, so loop until nothing is in flight
+  while (wal->durable < wal->logged) {
+    if (flush_log(wal, wal->logged) == -1)
+      return -1;
+  }
+  if ((tmp_path = malloc(strlen(wal->img_path) + 5)) == NULL) {
+    syscall_fail("malloc");
+    return -1;
+  }
+  sprintf(tmp_path, "%s.tmp", wal->img_path);
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    syscall_fail("open");
+    goto out;
+  }
+  if (write_all(fd, wal->bstat.base, arena->brk) == -1)
+    goto out_close;
+  if (ftruncate(fd, wal->map_sz) == -1) {
+    syscall_fail("ftruncate");
+    goto out_close;
+  }
+  if (fsync(fd) == -1) {
+    syscall_fail("fsync");
+    goto out_close;
+  }
+  if (rename(tmp_path, wal->img_path) == -1) {
+    syscall_fail("rename");
+    goto out_close;
+  }
+  if (sync_dir(wal->img_path) == -1)
+    goto out_close;
+  // replaying an old log over the new image is harmless, so a crash around here loses nothing
+  if (ftruncate(wal->log_fd, 0) == -1) {
+    syscall_fail("ftruncate");
+    goto out_close;
+  }
+  if (fdatasync(wal->log_fd) == -1) {
+    syscall_fail("fdatasync");
+    goto out_close;
+  }
+  wal->log_base = wal->logged;
+  rst = 0;
+out_close:
+  close(fd);
+out:
+  free(tmp_path);
+  return rst;
+}
+
+/**
+ * replay: redo every intact record of the log against the checkpointed tree
+ *
+ * A record states the final effect of a mutation, so redoing records that the image
+ * already reflects does no harm. A torn record at the tail ends the log and is cut off.
+ */
+static int replay(struct bpt_wal *wal)
+{
+  struct bpt_wal_rec recs[BUFSIZ / sizeof (struct bpt_wal_rec)];
+  struct bpt_entry entry;
+  ssize_t n;
+  off_t valid = 0;
+  int i, cnt, rst;
+
+  while ((n = read(wal->log_fd, recs, sizeof (recs))) > 0) {
+    cnt = n / sizeof (struct bpt_wal_rec);
+    for (i = 0; i < cnt; i++) {
+      if (recs[i].sum != rec_sum(&recs[i]) || (recs[i].op != BPT_LOG_PUT && recs[i].op != BPT_LOG_DEL))
+        goto torn;
+      entry.key = recs[i].key;
+      entry.val = recs[i].val;
+      if (recs[i].op == BPT_LOG_PUT)
+        rst = bpt_insert(entry, wal->cmp, bpt_pred_1, &wal->stk, 1, &wal->bstat);
+      else
+        rst = bpt_delete(entry, wal->cmp, bpt_pred_1, &wal->stk, 1, &wal->bstat);
+      if (rst == BPT_ERROR)
+        return -1;
+      valid += sizeof (struct bpt_wal_rec);
+    }
+    if (cnt * sizeof (struct bpt_wal_rec) != n)
+      break;
+  }
+  if (n == -1) {
+    syscall_fail("read");
+    return -1;
+  }
+torn:
+  if (ftruncate(wal->log_fd, valid) == -1) {
+    syscall_fail("ftruncate");
+    return -1;
+  }
+  wal->logged = wal->durable = valid;
+  wal->log_base = 0;
+  return 0;
+}
+
+/**
+ * bpt_wal_open: open a persistent B+ tree, creating it if it doesn't exist
+ * @wal: the struct stating the persistent tree
+ * @path: path of the tree image, the log is kept at "@path-wal"
+ * @order: the order of a newly created tree
+ * @size: arena size of a newly created tree, an existing one keeps its own
+ * @cmp: key comparison function, see bpt_insert()
+ *
+ * The last checkpointed image is mapped privately, so pages only reach the disk through
+ * checkpoints, then the log is replayed on top of it.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_wal_open(struct bpt_wal *wal, const char *path, int order, size_t size, int (*cmp)(bpt_t, bpt_t))
+{
+  struct bpt_arena hdr;
+  void *base;
+  int fd;
+
+  memset(wal, 0, sizeof (*wal));
+  wal->cmp = cmp;
+  wal->ckpt_size = BPT_WAL_CKPT_SIZE;
+  if ((wal->img_path = strdup(path)) == NULL || (wal->log_path = malloc(strlen(path) + 5)) == NULL) {
+    syscall_fail("malloc");
+    goto fail;
+  }
+  sprintf(wal->log_path, "%s-wal", path);
+
+  if ((fd = open(path, O_RDWR)) != -1) {
+    if (pread(fd, &hdr, sizeof (hdr), 0) != sizeof (hdr) || hdr.magic != BPT_ARENA_MAGIC) {
+      fprintf(stderr, "%s: not a B+ tree image\n", path);
+      close(fd);
+      goto fail;
+    }
+    wal->map_sz = hdr.size;
+    base = mmap(NULL, wal->map_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      syscall_fail("mmap");
+      goto fail;
+    }
+    bpt_attach_arena(&wal->bstat, base);
+    wal->bstat.paged = 1;
+  } else if (errno == ENOENT) {
+    wal->map_sz = size;
+    if ((base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+      syscall_fail("mmap");
+      goto fail;
+    }
+    if (bpt_init_arena(&wal->bstat, order, base, size) == -1)
+      goto fail_unmap;
+  } else {
+    syscall_fail("open");
+    goto fail;
+  }
+
+  if (gen_stk_init(&wal->stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    goto fail_unmap;
+  if ((wal->log_fd = open(wal->log_path, O_RDWR | O_CREAT | O_APPEND, 0644)) == -1) {
+    syscall_fail("open");
+    goto fail_stk;
+  }
+  if (replay(wal) == -1)
+    goto fail_log;
+  if ((wal->buf = malloc(BPT_WAL_BUF_INIT)) == NULL || (wal->wbuf = malloc(BPT_WAL_BUF_INIT)) == NULL) {
+    syscall_fail("malloc");
+    goto fail_log;
+  }
+  wal->buf_cap = wal->wbuf_cap = BPT_WAL_BUF_INIT;
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->flushed, NULL);
+  wal->bstat.log = log_rec;
+  wal->bstat.log_arg = wal;
+  return 0;
+
+fail_log:
+  close(wal->log_fd);
+fail_stk:
+  gen_stk_delete(&wal->stk);
+fail_unmap:
+  munmap(wal->bstat.base, wal->map_sz);
+fail:
+  free(wal->buf);
+  free(wal->wbuf);
+  free(wal->img_path);
+  free(wal->log_path);
+  return -1;
+}
+
+/*
+ * Drop the records logged since @logged by a mutation that failed after logging, so that
+ * recovery doesn't redo it. The lock was held all along, so they're still in the buffer.
+ */
+static void unlog(struct bpt_wal *wal, unsigned long long logged)
+{
+  wal->buf_len -= wal->logged - logged;
+  wal->logged = logged;
+}
+
+/**
+ * bpt_wal_insert: bpt_insert() into a persistent tree
+ *
+ * The mutation is logged before the leaf is touched, but it's durable only after a
+ * following bpt_wal_commit() returns. Its record is dropped if it fails.
+ */
+int bpt_wal_insert(struct bpt_wal *wal, struct bpt_entry new_entry, int (*pred)(bpt_t, bpt_t))
+{
+  unsigned long long logged;
+  int rst;
+
+  pthread_mutex_lock(&wal->lock);
+  logged = wal->logged;
+  if ((rst = bpt_insert(new_entry, wal->cmp, pred, &wal->stk, 1, &wal->bstat)) == BPT_ERROR)
+    unlog(wal, logged);
+  pthread_mutex_unlock(&wal->lock);
+  return rst;
+}
+
+/**
+ * bpt_wal_delete: bpt_delete() from a persistent tree, durable after a following bpt_wal_commit()
+ */
+int bpt_wal_delete(struct bpt_wal *wal, struct bpt_entry pair, int (*pred)(bpt_t, bpt_t))
+{
+  unsigned long long logged;
+  int rst;
+
+  pthread_mutex_lock(&wal->lock);
+  logged = wal->logged;
+  if ((rst = bpt_delete(pair, wal->cmp, pred, &wal->stk, 1, &wal->bstat)) == BPT_ERROR)
+    unlog(wal, logged);
+  pthread_mutex_unlock(&wal->lock);
+  return rst;
+}
+
+/**
+ * bpt_wal_search: look up @search_for in a persistent tree
+ *
+ * Returns 0 and stores the value to *@valp if found, -1 otherwise.
+ */
+int bpt_wal_search(struct bpt_wal *wal, bpt_t search_for, bpt_t *valp)
+{
+  struct bpt_node leaf;
+  int offset;
+
+  pthread_mutex_lock(&wal->lock);
+  if ((offset = bpt_search(search_for, wal->cmp, &wal->bstat, &leaf)) != -1)
+    *valp = leaf.entries[offset].val;
+  pthread_mutex_unlock(&wal->lock);
+  return offset == -1 ? -1 : 0;
+}
+
+/**
+ * bpt_wal_commit: wait until every mutation done so far, by any thread, is durable
+ *
+ * Concurrent committers are batched into a single fdatasync(). A checkpoint is taken
+ * once the log grows beyond @wal->ckpt_size.
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_wal_commit(struct bpt_wal *wal)
+{
+  int rst;
+
+  pthread_mutex_lock(&wal->lock);
+  rst = flush_log(wal, wal->logged);
+  if (rst == 0 && wal->ckpt_size != 0 && wal->logged - wal->log_base >= wal->ckpt_size)
+    rst = checkpoint_locked(wal);
+  pthread_mutex_unlock(&wal->lock);
+  return rst;
+}
+
+/**
+ * bpt_wal_checkpoint: write the current tree image and truncate the log
+ *
+ * Returns 0 if OK, -1 on system call failure.
+ */
+int bpt_wal_checkpoint(struct bpt_wal *wal)
+{
+  int rst;
+
+  pthread_mutex_lock(&wal->lock);
+  rst = checkpoint_locked(wal);
+  pthread_mutex_unlock(&wal->lock);
+  return rst;
+}
+
+/**
+ * bpt_wal_close: commit and release a persistent tree, without checkpointing it
+ *
+ * Returns 0 if OK, -1 if the last commit failed.
+ */
+int bpt_wal_close(struct bpt_wal *wal)
+{
+  int rst;
+
+  rst = bpt_wal_commit(wal);
+  close(wal->log_fd);
+  munmap(wal->bstat.base, wal->map_sz);
+  gen_stk_delete(&wal->stk);
+  pthread_mutex_destroy(&wal->lock);
+  pthread_cond_destroy(&wal->flushed);
+  free(wal->buf);
+  free(wal->wbuf);
+  free(wal->img_path);
+  free(wal->log_path);
+  return rst;
+}
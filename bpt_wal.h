@@ -0,0 +1,57 @@
+#ifndef BPT_WAL_H
+#define BPT_WAL_H
+
+#include <pthread.h>
+#include "b_plus_tree.h"
+
+#if !defined(BPT_KEY_PLAIN) || defined(BPT_SET)
+#error "the write-ahead log only takes plain bpt_t keys and values"
+#endif
+
+#define BPT_WAL_BUF_INIT 4096
+#define BPT_WAL_CKPT_SIZE (64 << 20) // log size that triggers a checkpoint
+
+/*
+ * A persistent B+ tree: an arena tree whose checkpointed image is kept in a file,
+ * plus an append-only write-ahead log of every mutation done since that checkpoint.
+ * Keys and values must be plain integers, pointers don't survive a restart.
+ */
+struct bpt_wal {
+  struct bpt_stat bstat;
+  struct gen_stk stk;
+  int (*cmp)(bpt_t, bpt_t);
+  char *img_path;
+  char *log_path;
+  int log_fd;
+  size_t map_sz;
+
+  pthread_mutex_t lock; // serializes the tree and the log buffers
+  pthread_cond_t flushed;
+  char *buf;            // records not handed to a flusher yet
+  size_t buf_len, buf_cap;
+  char *wbuf;           // records being written by the flusher
+  size_t wbuf_cap;
+  unsigned long long logged;  // bytes of log appended so far
+  unsigned long long durable; // bytes of log known to be on disk
+  unsigned long long log_base; // bytes of log appended before the last checkpoint
+  int flushing;               // if some thread is writing the log
+  int error;                  // a log write failed, the log can't be trusted anymore
+  size_t ckpt_size;           // log size that triggers a checkpoint, 0 to disable
+};
+
+struct bpt_wal_rec {
+  unsigned op;
+  unsigned sum;
+  bpt_t key;
+  bpt_t val;
+};
+
+int bpt_wal_open(struct bpt_wal *wal, const char *path, int order, size_t size, int (*cmp)(bpt_t, bpt_t));
+int bpt_wal_insert(struct bpt_wal *wal, struct bpt_entry new_entry, int (*pred)(bpt_t, bpt_t));
+int bpt_wal_delete(struct bpt_wal *wal, struct bpt_entry pair, int (*pred)(bpt_t, bpt_t));
+int bpt_wal_search(struct bpt_wal *wal, bpt_t search_for, bpt_t *valp);
+int bpt_wal_commit(struct bpt_wal *wal);
+int bpt_wal_checkpoint(struct bpt_wal *wal);
+int bpt_wal_close(struct bpt_wal *wal);
+
+#endif
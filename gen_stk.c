@@ -24,7 +24,7 @@ int gen_stk_push(struct gen_stk *self, void *elem)
 
   if (self->cnt >= self->cap) {
     new_cap = self->cap + self->init_cap;
-    if ((new_addr = realloc(self->addr, new_cap)) == NULL) {
+    if ((new_addr = realloc(self->addr, new_cap * self->uni_siz)) == NULL) {
       syscall_fail("realloc");
       return -1;
     }
@@ -44,7 +44,7 @@ int gen_stk_trunc(struct gen_stk *self, size_t new_cap)
 {
   void *new_addr;
 
-  if ((new_addr = realloc(self->addr, new_cap)) == NULL) {
+  if ((new_addr = realloc(self->addr, new_cap * self->uni_siz)) == NULL) {
     syscall_fail("realloc");
     return -1;
   }
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 16
+#define ENTRY_CNT 50000
+#define SILENT
+
+#ifndef BPT_ABBREV
+#error "build with -DBPT_ABBREV"
+#endif
+
+long cmp_calls;
+
+int cmp_str(bpt_key_t a, bpt_key_t b)
+{
+  cmp_calls++;
+  return strcmp(a.ref.ptr, b.ref.ptr);
+}
+
+bpt_key_t make_key(char *s)
+{
+  bpt_key_t key = { .abbr = bpt_abbrev_bytes(s, strlen(s)), .ref.ptr = s };
+
+  return key;
+}
+
+int main(void)
+{
+  static const char *hosts[] = { "api.example.com", "cdn.example.com", "example.org", "www.example.com" };
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct bpt_cursor cur;
+  struct bpt_node leaf;
+  struct gen_stk stk;
+  char buf[128], *prev = NULL, **keys, *dead;
+  int i, j, rst, offset, nkey = 0, nlive = 0;
+
+  srand(1523796176);
+  if ((keys = malloc(ENTRY_CNT * sizeof (char *))) == NULL || (dead = calloc(ENTRY_CNT, 1)) == NULL)
+    return 1;
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  // distinct URL-like keys past the scheme; some share more than 8 bytes so their abbreviations tie
+  for (i = 0; i < ENTRY_CNT; i++) {
+    if (i % 32 == 0)
+      sprintf(buf, "%s/%d", hosts[rand() % 4], i * 7919 % 100000);
+    else
+      sprintf(buf, "%05d/%s", i * 7919 % 100000, hosts[rand() % 4]);
+    if ((entry.key.ref.ptr = malloc(strlen(buf) + 1)) == NULL)
+      return 1;
+    strcpy(entry.key.ref.ptr, buf);
+    entry.key = make_key(entry.key.ref.ptr);
+    entry.val.off = i;
+    if ((rst = bpt_insert(entry, cmp_str, bpt_pred_1, &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    assert(rst == BPT_NEXIST);
+    keys[nkey++] = entry.key.ref.ptr;
+    nlive++;
+    if (i % 3 == 0) {
+      j = rand() % nkey;
+      entry.key = make_key(keys[j]);
+      if ((rst = bpt_delete(entry, cmp_str, bpt_pred_1, &stk, 1, &bstat)) == BPT_ERROR)
+        return 1;
+      assert(rst == (dead[j] ? BPT_NEXIST : BPT_PRED_SUCCESS));
+      nlive -= !dead[j];
+      dead[j] = 1;
+    }
+  }
+
+  // the leaf chain is in strcmp() order and holds the live keys only
+  for (i = 0, rst = bpt_cursor_first(&cur, &bstat); rst == 0; rst = bpt_cursor_next(&cur), i++) {
+    assert(prev == NULL || strcmp(prev, bpt_cursor_entry(&cur)->key.ref.ptr) < 0);
+    prev = bpt_cursor_entry(&cur)->key.ref.ptr;
+  }
+  assert(i == nlive);
+
+  // lookups find what is there and miss what was deleted, mostly deciding on the inline abbreviations
+  cmp_calls = 0;
+  for (i = 0; i < nkey; i++) {
+    offset = bpt_search(make_key(keys[i]), cmp_str, &bstat, &leaf);
+    if (dead[i])
+      assert(offset == -1);
+    else
+      assert(offset != -1 && leaf.entries[offset].key.ref.ptr == keys[i]);
+  }
+#ifndef SILENT
+  printf("%.2f cmp calls per lookup\n", (double)cmp_calls / nkey);
+#endif
+  assert(cmp_calls < 2 * nkey);
+  return 0;
+}
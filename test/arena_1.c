@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 4
+#define SILENT
+#define ENTRY_CNT 50000
+#define SAMPLE_MAX 5000
+#define ARENA_SIZE (4 << 20)
+// #define UPDATE_RANDSEED
+
+void print_bpt(struct bpt_stat *bstat);
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat bstat, moved;
+  struct bpt_node leaf;
+  struct gen_stk stk;
+  char *region, *copy;
+  int i, rst, offset;
+  int ins_cnt = 0, del_cnt = 0;
+#ifdef UPDATE_RANDSEED
+  FILE *fp;
+  time_t time_val = time(NULL);
+
+  if ((fp = fopen("random_seed", "a")) == NULL) {
+    perror("fopen");
+    exit(1);
+  }
+  srand(time_val);
+  fprintf(fp, "Random seed: %lu\n", (unsigned long)time_val);
+  fflush(fp);
+  fclose(fp);
+#else
+  srand(1523796176);
+#endif
+  if ((region = malloc(ARENA_SIZE)) == NULL || (copy = malloc(ARENA_SIZE)) == NULL)
+    return 1;
+  if (bpt_init_arena(&bstat, BPT_ORDER, region, ARENA_SIZE) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    entry.val.ptr = (void *)(rand() % SAMPLE_MAX);
+    if ((rst = bpt_insert(entry, cmp_int, bpt_pred_1,
+        &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    if (rst == BPT_NEXIST)
+      ins_cnt++;
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    if ((rst = bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    if (rst == BPT_PRED_SUCCESS)
+      del_cnt++;
+  }
+  check_bpt(&bstat);
+
+  // relocate the whole tree with one memcpy() and wipe the original region
+  memcpy(copy, region, ARENA_SIZE);
+  memset(region, 0, ARENA_SIZE);
+  if (bpt_attach_arena(&moved, copy) == -1)
+    return 1;
+  check_bpt(&moved);
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.ptr = (void *)i;
+    offset = bpt_search(entry.key, cmp_int, &moved, &leaf);
+    assert(offset == -1 || ((char *)leaf.entries > copy && (char *)leaf.entries < copy + ARENA_SIZE));
+  }
+
+#ifndef SILENT
+  printf("\n");
+  printf("effective insertions count: %d\n", ins_cnt);
+  printf("effective deletions count: %d\n", del_cnt);
+  printf("\n");
+  print_bpt(&moved);
+#endif
+  return 0;
+}
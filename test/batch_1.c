@@ -0,0 +1,118 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 16
+#define ENTRY_CNT 200000
+#define SAMPLE_MAX 400000
+#define BATCH_SIZE 1000
+#define IMG_PATH "batch_1.img"
+#define IMG_SIZE (64 << 20)
+#define SILENT
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+struct bpt_node leaf, leaves[BATCH_SIZE];
+bpt_t keys[BATCH_SIZE];
+int offsets[BATCH_SIZE];
+
+int fill(struct bpt_stat *bstat, struct gen_stk *stk, unsigned seed)
+{
+  struct bpt_entry entry;
+  int i;
+
+  srand(seed);
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    entry.val.ptr = (void *)i;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, stk, 1, bstat) == BPT_ERROR)
+      return -1;
+  }
+  return 0;
+}
+
+// every batch agrees with one-by-one lookups, including a partial last group
+void check_batches(struct bpt_stat *bstat)
+{
+  int i, j, offset, found, expected;
+
+  for (i = 0; i < SAMPLE_MAX / BATCH_SIZE; i++) {
+    for (j = 0; j < BATCH_SIZE - i % BPT_BATCH_GROUP; j++)
+      keys[j].ptr = (void *)(rand() % SAMPLE_MAX);
+    found = bpt_search_batch(keys, j, cmp_int, bstat, leaves, offsets);
+    for (expected = 0, j--; j >= 0; j--) {
+      offset = bpt_search(keys[j], cmp_int, bstat, &leaf);
+      assert(offset == offsets[j]);
+      if (offset != -1) {
+        assert(leaf.entries == leaves[j].entries);
+        expected++;
+      }
+    }
+    assert(found == expected);
+  }
+}
+
+int main(void)
+{
+  struct bpt_stat bstat, mapped;
+  struct gen_stk stk;
+  void *base;
+  int fd;
+#ifndef SILENT
+  clock_t start;
+  int i, j;
+#endif
+
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  if (fill(&bstat, &stk, 9) == -1)
+    return 1;
+  check_batches(&bstat);
+
+  // a tree mapped from a file advises the nodes of each group, and finds the same
+  if ((fd = open(IMG_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1 || ftruncate(fd, IMG_SIZE) == -1)
+    return 1;
+  if ((base = mmap(NULL, IMG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    return 1;
+  if (bpt_init_arena(&mapped, BPT_ORDER, base, IMG_SIZE) == -1)
+    return 1;
+  mapped.paged = 1;
+  if (fill(&mapped, &stk, 9) == -1)
+    return 1;
+  // dropped from the mapping and from the page cache, so pages are read in again
+  msync(base, IMG_SIZE, MS_SYNC);
+  madvise(base, IMG_SIZE, MADV_DONTNEED);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  check_batches(&mapped);
+  close(fd);
+  munmap(base, IMG_SIZE);
+  unlink(IMG_PATH);
+
+#ifndef SILENT
+  start = clock();
+  for (i = 0; i < SAMPLE_MAX; i += BATCH_SIZE) {
+    for (j = 0; j < BATCH_SIZE; j++)
+      keys[j].ptr = (void *)(rand() % SAMPLE_MAX);
+    bpt_search_batch(keys, BATCH_SIZE, cmp_int, &bstat, leaves, offsets);
+  }
+  printf("batched: %.3fs\n", (double)(clock() - start) / CLOCKS_PER_SEC);
+  start = clock();
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    keys[0].ptr = (void *)(rand() % SAMPLE_MAX);
+    bpt_search(keys[0], cmp_int, &bstat, &leaf);
+  }
+  printf("one by one: %.3fs\n", (double)(clock() - start) / CLOCKS_PER_SEC);
+#endif
+  return 0;
+}
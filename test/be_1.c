@@ -0,0 +1,149 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define ENTRY_CNT 300000
+#define SAMPLE_MAX 50000
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+static off_t vals[SAMPLE_MAX];
+static char present[SAMPLE_MAX];
+static struct bpt_node next_leaf;
+
+/*
+ * Separators need not be the least keys right of them, as emptied leaves are dropped and
+ * minimums deleted without touching them, so every key is checked to fall between the
+ * separators around it. Leaves must also be chained in key order.
+ */
+static void check_range(struct bpt_stat *bstat, struct bpt_node node, int h, long lo, long hi)
+{
+  int i, m = bpt_node_nkey(node, bstat->order);
+  long k, prev = lo - 1;
+
+  if (h == 0) {
+    assert(node.entries == next_leaf.entries);
+    next_leaf = bpt_node_nxt(node, bstat);
+    for (i = 0; i < m; i++) {
+      k = bpt_leaf_slots(node)[i].key.off;
+      assert(k > prev && k >= lo && k < hi);
+      prev = k;
+    }
+    return;
+  }
+  for (i = 0; i <= m; i++) {
+    k = i < m ? node.entries[i].key.off : hi;
+    assert(k > prev && k <= hi);
+    check_range(bstat, bpt_node_child(node, i, bstat), h - 1, i > 0 ? prev : lo, k);
+    prev = k;
+  }
+}
+
+static void check_be(struct bpt_stat *bstat)
+{
+  struct bpt_node leaf = bstat->root_node;
+  int h;
+
+  for (h = bstat->height; h > 0; h--)
+    leaf = bpt_node_child(leaf, 0, bstat);
+  next_leaf = leaf;
+  check_range(bstat, bstat->root_node, bstat->height, -1, SAMPLE_MAX);
+  assert(next_leaf.entries == NULL);
+}
+
+static void check_search(struct bpt_stat *bstat, int key)
+{
+  bpt_key_t k;
+  bpt_t val;
+
+  k.off = key;
+  if (present[key]) {
+    assert(bpt_be_search(bstat, k, cmp_int, &val) == 0);
+    assert(val.off == vals[key]);
+  } else {
+    assert(bpt_be_search(bstat, k, cmp_int, &val) == -1);
+  }
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct bpt_cursor cur;
+  long n;
+  int i, op, rst;
+
+  srand(1528230087);
+  if (bpt_init_be(&bstat, 8, 32) == -1)
+    return 1;
+
+  // puts, deletes and additions in any order, every message newer than the last
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = i < ENTRY_CNT / 2 ? rand() % SAMPLE_MAX : rand() % (SAMPLE_MAX / 4);
+    entry.val.off = rand() % 1000 - 500;
+    op = rand() % 5 < 2 ? BPT_BE_PUT : rand() % 3 ? BPT_BE_DEL : BPT_BE_ADD;
+    if (bpt_be_write(&bstat, op, entry, cmp_int) == -1)
+      return 1;
+    switch (op) {
+    case BPT_BE_PUT:
+      vals[entry.key.off] = entry.val.off;
+      present[entry.key.off] = 1;
+      break;
+    case BPT_BE_DEL:
+      present[entry.key.off] = 0;
+      break;
+    default:
+      vals[entry.key.off] = (present[entry.key.off] ? vals[entry.key.off] : 0) + entry.val.off;
+      present[entry.key.off] = 1;
+    }
+    check_search(&bstat, rand() % SAMPLE_MAX);
+    if (i % 50000 == 0)
+      check_be(&bstat);
+  }
+  check_be(&bstat);
+  for (i = 0; i < SAMPLE_MAX; i++)
+    check_search(&bstat, i);
+  assert(bstat.be->leaf_writes < bstat.be->msgs / 4);
+
+  // once flushed, the leaves hold everything
+  if (bpt_be_flush(&bstat, cmp_int) == -1)
+    return 1;
+  check_be(&bstat);
+  for (rst = bpt_cursor_first(&cur, &bstat), n = 0; rst == 0; rst = bpt_cursor_next(&cur), n++) {
+    assert(present[bpt_cursor_entry(&cur)->key.off]);
+    assert(bpt_cursor_entry(&cur)->val.off == vals[bpt_cursor_entry(&cur)->key.off]);
+  }
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    n -= present[i];
+    check_search(&bstat, i);
+  }
+  assert(n == 0);
+
+  // deleting everything leaves empty leaves behind, and a tree still taking writes
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = i;
+    if (bpt_be_write(&bstat, BPT_BE_DEL, entry, cmp_int) == -1)
+      return 1;
+  }
+  if (bpt_be_flush(&bstat, cmp_int) == -1)
+    return 1;
+  check_be(&bstat);
+  assert(bpt_cursor_first(&cur, &bstat) == -1);
+  entry.key.off = 7;
+  entry.val.off = 3;
+  if (bpt_be_write(&bstat, BPT_BE_ADD, entry, cmp_int) == -1)
+    return 1;
+  if (bpt_be_write(&bstat, BPT_BE_ADD, entry, cmp_int) == -1)
+    return 1;
+  assert(bpt_be_search(&bstat, entry.key, cmp_int, &entry.val) == 0 && entry.val.off == 6);
+  entry.val.off = 0;
+  rst = bpt_be_write(&bstat, 3, entry, cmp_int);
+  assert(rst == -1);
+  return 0;
+}
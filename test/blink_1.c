@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 5
+#define ENTRY_CNT 200000
+#define SAMPLE_MAX 4000
+#define READER_CNT 3
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+int subtree_key(struct bpt_stat *bstat, struct bpt_node node, int height, int last)
+{
+  int m;
+
+  for (; height > 0; height--)
+    node = bpt_node_child(node, last ? bpt_node_nkey(node, bstat->order) : 0, bstat);
+  m = bpt_node_nkey(node, bstat->order);
+  return (int)node.entries[last ? m - 1 : 0].key.ptr;
+}
+
+// every high key lies above the keys of its node and up to the least key of the next one
+void check_fences(struct bpt_stat *bstat)
+{
+  struct bpt_node first = bstat->root_node, node, nxt;
+  int h, high;
+
+  for (h = bstat->height; h >= 0; h--) {
+    for (node = first; (nxt = bpt_node_nxt(node, bstat)).entries != NULL; node = nxt) {
+      high = (int)node.entries[bstat->order+3].key.ptr;
+      assert(subtree_key(bstat, node, h, 1) < high);
+      assert(high <= subtree_key(bstat, nxt, h, 0));
+    }
+    if (h > 0)
+      first = bpt_node_child(first, 0, bstat);
+  }
+}
+
+struct reader_arg {
+  struct bpt_stat *bstat;
+  volatile int *stop;
+  unsigned seed;
+  unsigned long found;
+};
+
+// even keys stay in the tree, odd ones come and go, and every value is thrice its key
+void *reader(void *arg)
+{
+  struct reader_arg *ra = arg;
+  bpt_t key, val;
+  int k, slot = bpt_olc_register(ra->bstat);
+
+  assert(slot != -1);
+  while (!*ra->stop) {
+    ra->seed = ra->seed * 1103515245 + 12345;
+    k = (ra->seed >> 8) % SAMPLE_MAX;
+    key.ptr = (void *)k;
+    bpt_olc_enter(ra->bstat, slot);
+    if (bpt_olc_search(ra->bstat, key, cmp_int, &val) == 0) {
+      assert((int)val.ptr == k * 3);
+      ra->found++;
+    } else
+      assert(k % 2 == 1);
+    bpt_olc_exit(ra->bstat, slot);
+  }
+  bpt_olc_unregister(ra->bstat, slot);
+  return NULL;
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct reader_arg ra[READER_CNT];
+  pthread_t tids[READER_CNT];
+  volatile int stop = 0;
+  int i, k, rst;
+
+  srand(1523796176);
+  if (bpt_init_blink(&bstat, BPT_ORDER) == -1)
+    return 1;
+  for (k = 0; k < SAMPLE_MAX; k += 2) {
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 3);
+    rst = bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1);
+    assert(rst == BPT_NEXIST);
+  }
+  check_bpt(&bstat);
+  check_fences(&bstat);
+
+  for (i = 0; i < READER_CNT; i++) {
+    ra[i] = (struct reader_arg){ .bstat = &bstat, .stop = &stop, .seed = i + 1 };
+    pthread_create(&tids[i], NULL, reader, &ra[i]);
+  }
+  for (i = 0; i < ENTRY_CNT; i++) {
+    k = rand() % (SAMPLE_MAX / 2) * 2 + 1;
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 3);
+    if (rand() % 2) {
+      if (bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+        return 1;
+    } else {
+      if (bpt_olc_delete(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+        return 1;
+    }
+    if (i % 64 == 0)
+      sched_yield();
+  }
+  stop = 1;
+  for (i = 0; i < READER_CNT; i++)
+    pthread_join(tids[i], NULL);
+  check_bpt(&bstat);
+  check_fences(&bstat);
+  for (i = 0; i < READER_CNT; i++)
+    assert(ra[i].found > 0);
+
+  // emptied down to the stable keys and filled up again, fences hold through merges
+  for (k = 1; k < SAMPLE_MAX; k += 2) {
+    entry.key.ptr = (void *)k;
+    if (bpt_olc_delete(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+      return 1;
+  }
+  check_bpt(&bstat);
+  check_fences(&bstat);
+  for (k = SAMPLE_MAX - 1; k > 0; k -= 2) {
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 3);
+    rst = bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1);
+    assert(rst == BPT_NEXIST);
+  }
+  check_bpt(&bstat);
+  check_fences(&bstat);
+  bpt_olc_reclaim(&bstat);
+  return 0;
+}
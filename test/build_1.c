@@ -0,0 +1,115 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+#include "../bpt_build.h"
+
+#define ENTRY_CNT 200000
+#define SAMPLE_MAX 150000
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+static struct bpt_slot slots[ENTRY_CNT];
+static off_t last[SAMPLE_MAX];
+
+// fill slots with keys, duplicates included, and note the last value of each key
+static void fill(void)
+{
+  int i;
+
+  memset(last, 0xff, sizeof (last));
+  for (i = 0; i < ENTRY_CNT; i++) {
+    slots[i].key.off = rand() % SAMPLE_MAX;
+    slots[i].val.off = i;
+    last[slots[i].key.off] = i;
+  }
+}
+
+// the tree holds exactly the last value of every key filled in
+static void same_as_last(struct bpt_stat *bstat)
+{
+  struct bpt_cursor cur;
+  long n = 0, want = 0;
+  int i, rst;
+
+  for (i = 0; i < SAMPLE_MAX; i++)
+    want += last[i] != -1;
+  for (rst = bpt_cursor_first(&cur, bstat); rst == 0; rst = bpt_cursor_next(&cur), n++)
+    assert(last[bpt_cursor_entry(&cur)->key.off] == bpt_cursor_entry(&cur)->val.off);
+  assert(n == want);
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct bpt_node leaf;
+  struct bpt_cursor cur;
+  struct gen_stk stk;
+  int i, nthread, cmp;
+  long n;
+
+  srand(1526571903);
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+
+  // radix and merge sort, on as many threads as there are runs to merge and more
+  for (cmp = 0; cmp < 2; cmp++) {
+    for (nthread = 1; nthread <= 7; nthread += 3) {
+      fill();
+      if (bpt_build_parallel(&bstat, 4 + nthread, slots, ENTRY_CNT, cmp ? cmp_int : NULL, nthread) == -1)
+        return 1;
+      check_bpt(&bstat);
+      same_as_last(&bstat);
+
+      // still a tree like any other
+      for (i = 0; i < ENTRY_CNT / 4; i++) {
+        entry.key.off = rand() % SAMPLE_MAX;
+        entry.val.off = ENTRY_CNT + i;
+        if (rand() % 2) {
+          if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+            return 1;
+          last[entry.key.off] = entry.val.off;
+        } else {
+          if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+            return 1;
+          last[entry.key.off] = -1;
+        }
+      }
+      check_bpt(&bstat);
+      same_as_last(&bstat);
+    }
+  }
+
+  // integer keys sort as signed ones
+  for (i = 0; i < 100; i++) {
+    slots[i].key.off = 50 - i;
+    slots[i].val.off = i;
+  }
+  if (bpt_build_parallel(&bstat, 4, slots, 100, NULL, 3) == -1)
+    return 1;
+  for (i = bpt_cursor_first(&cur, &bstat), n = -49; i == 0; i = bpt_cursor_next(&cur), n++)
+    assert(bpt_cursor_entry(&cur)->key.off == n);
+  assert(n == 51);
+
+  // few and no entries, more threads than entries
+  slots[0].key.off = slots[1].key.off = 3;
+  slots[0].val.off = 1;
+  slots[1].val.off = 2;
+  if (bpt_build_parallel(&bstat, 4, slots, 2, NULL, 8) == -1)
+    return 1;
+  entry.key.off = 3;
+  assert(bstat.height == 0 && bpt_search(entry.key, cmp_int, &bstat, &leaf) == 0);
+  assert(leaf.entries[0].val.off == 2);
+  if (bpt_build_parallel(&bstat, 4, slots, 0, cmp_int, 0) == -1)
+    return 1;
+  assert(bpt_node_nkey(bstat.root_node, bstat.order) == 0);
+  return 0;
+}
@@ -4,10 +4,10 @@
 
 #define SILENT
 
-int find_minimal_key(struct bpt_node node, int height)
+int find_minimal_key(struct bpt_node node, int height, struct bpt_stat *bstat)
 {
   while (height > 0) {
-    node.entries = node.entries[0].val.ptr;
+    node = bpt_node_child(node, 0, bstat);
     height--;
   }
   return (int)node.entries[0].key.ptr;
@@ -24,7 +24,7 @@ void check_bpt(struct bpt_stat *bstat)
   while (height >= 0) {
     prev = -1;
     key_cnt = 0;
-    for (node = first; node.entries != NULL; node = bpt_node_nxt(node, order)) {
+    for (node = first; node.entries != NULL; node = bpt_node_nxt(node, bstat)) {
       m = bpt_node_nkey(node, order);
       key_cnt += m;
       for (i = 0; i < m; i++) {
@@ -35,8 +35,8 @@ void check_bpt(struct bpt_stat *bstat)
         }
         prev = cur;
         if (height > 0) {
-          child.entries = node.entries[i+1].val.ptr;
-          mini = find_minimal_key(child, height - 1);
+          child = bpt_node_child(node, i+1, bstat);
+          mini = find_minimal_key(child, height - 1, bstat);
           if (mini != cur) {
             fprintf(stderr, "Internal node mapping wrong: %d %d\n", cur, mini);
             exit(1);
@@ -48,6 +48,7 @@ void check_bpt(struct bpt_stat *bstat)
     printf("Lv.%d key count: %d\n", height, key_cnt);
 #endif
     height--;
-    first.entries = first.entries[0].val.ptr;
+    if (height >= 0)
+      first = bpt_node_child(first, 0, bstat);
   }
 }
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 4
+#define ENTRY_CNT 50000
+#define SAMPLE_MAX 5000
+#define SCAN_CNT 20
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+struct image {
+  int vals[SAMPLE_MAX];
+  int prev;
+};
+
+int record(struct bpt_entry *entry, void *arg)
+{
+  struct image *img = arg;
+
+  assert((int)entry->key.ptr > img->prev);
+  img->prev = (int)entry->key.ptr;
+  img->vals[img->prev] = (int)entry->val.ptr;
+  return 0;
+}
+
+void take_image(struct bpt_snap *snap, struct image *img)
+{
+  memset(img->vals, -1, sizeof (img->vals));
+  img->prev = -1;
+  bpt_snap_foreach(snap, record, img);
+}
+
+struct scan_arg {
+  struct bpt_snap *snap;
+  struct image *img;
+};
+
+// scans a snapshot from another thread while the main thread keeps writing
+void *scanner(void *arg)
+{
+  struct scan_arg *sa = arg;
+  struct image img;
+  int i;
+
+  for (i = 0; i < SCAN_CNT; i++) {
+    take_image(sa->snap, &img);
+    assert(memcmp(img.vals, sa->img->vals, sizeof (img.vals)) == 0);
+  }
+  return NULL;
+}
+
+int mutate(struct bpt_stat *bstat, struct gen_stk *stk, int cnt)
+{
+  struct bpt_entry entry;
+  int i;
+
+  for (i = 0; i < cnt; i++) {
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    entry.val.ptr = (void *)(rand() % SAMPLE_MAX);
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, stk, 1, bstat) == BPT_ERROR)
+      return -1;
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, stk, 1, bstat) == BPT_ERROR)
+      return -1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_snap snap1, snap2;
+  struct image img1, img2, img;
+  struct scan_arg sa = { .snap = &snap1, .img = &img1 };
+  struct gen_stk stk;
+  struct bpt_node leaf;
+  pthread_t tid;
+  bpt_t key;
+  int i, offset;
+
+  srand(1523796176);
+  if (bpt_init_cow(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  if (mutate(&bstat, &stk, ENTRY_CNT) == -1)
+    return 1;
+
+  if (bpt_snapshot(&bstat, &snap1) == -1)
+    return 1;
+  take_image(&snap1, &img1);
+  pthread_create(&tid, NULL, scanner, &sa);
+  if (mutate(&bstat, &stk, ENTRY_CNT / 2) == -1)
+    return 1;
+  check_bpt(&bstat);
+
+  if (bpt_snapshot(&bstat, &snap2) == -1)
+    return 1;
+  take_image(&snap2, &img2);
+  if (mutate(&bstat, &stk, ENTRY_CNT / 2) == -1)
+    return 1;
+  pthread_join(tid, NULL);
+  check_bpt(&bstat);
+
+  // both snapshots still read as they were taken, by scans and by lookups
+  take_image(&snap1, &img);
+  assert(memcmp(img.vals, img1.vals, sizeof (img.vals)) == 0);
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    key.ptr = (void *)i;
+    offset = bpt_search(key, cmp_int, &snap2.view, &leaf);
+    assert(offset == -1 ? img2.vals[i] == -1 : (int)leaf.entries[offset].val.ptr == img2.vals[i]);
+  }
+  bpt_snapshot_release(&bstat, &snap1);
+  take_image(&snap2, &img);
+  assert(memcmp(img.vals, img2.vals, sizeof (img.vals)) == 0);
+  bpt_snapshot_release(&bstat, &snap2);
+  assert(bstat.cow->retired.cnt == 0);
+
+  // without snapshots, nodes are updated in place again
+  if (mutate(&bstat, &stk, ENTRY_CNT / 2) == -1)
+    return 1;
+  assert(bstat.cow->retired.cnt == 0);
+  check_bpt(&bstat);
+  return 0;
+}
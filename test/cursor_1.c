@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 50000
+#define SAMPLE_MAX 20000
+#define ARENA_SIZE (8 << 20)
+#define SILENT
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+int expected[SAMPLE_MAX];
+
+// a full scan yields every entry, in order, and returns how many leaves sit right behind their predecessor
+int scan(struct bpt_stat *bstat, int *leaves)
+{
+  struct bpt_cursor cur;
+  struct bpt_node leaf = bpt_null_node;
+  size_t node_sz = ((struct bpt_arena *)bstat->base)->node_sz;
+  int rst, key = -1, adjacent = 0;
+
+  *leaves = 0;
+  for (rst = bpt_cursor_first(&cur, bstat); rst == 0; rst = bpt_cursor_next(&cur)) {
+    for (key++; key < (int)bpt_cursor_entry(&cur)->key.off; key++)
+      assert(expected[key] == -1);
+    assert(expected[key] == (int)bpt_cursor_entry(&cur)->val.off);
+    if (cur.leaf.entries != leaf.entries) {
+      if (leaf.entries != NULL && (char *)cur.leaf.entries == (char *)leaf.entries + node_sz)
+        adjacent++;
+      leaf = cur.leaf;
+      (*leaves)++;
+    }
+  }
+  for (key++; key < SAMPLE_MAX; key++)
+    assert(expected[key] == -1);
+  return adjacent;
+}
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct bpt_cursor cur;
+  struct gen_stk stk;
+  char *region;
+  int i, j, leaves, adjacent;
+
+  srand(1523796176);
+  memset(expected, -1, sizeof (expected));
+  if ((region = malloc(ARENA_SIZE)) == NULL)
+    return 1;
+  if (bpt_init_arena(&bstat, BPT_ORDER, region, ARENA_SIZE) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+
+  // ascending loads lay leaves out mostly in key order, internal nodes sit in between
+  for (i = 0; i < SAMPLE_MAX; i += 2) {
+    entry.key.off = i;
+    entry.val.off = i * 3;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+    expected[i] = i * 3;
+  }
+  check_bpt(&bstat);
+  adjacent = scan(&bstat, &leaves);
+  assert(adjacent * 4 >= leaves * 3);
+
+  // random churn, freed nodes get reused near their neighbours
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = rand() % SAMPLE_MAX;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+    expected[entry.key.off] = entry.val.off;
+    entry.key.off = rand() % SAMPLE_MAX;
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+    expected[entry.key.off] = -1;
+  }
+  check_bpt(&bstat);
+  adjacent = scan(&bstat, &leaves);
+#ifndef SILENT
+  printf("%d of %d leaves follow their predecessor\n", adjacent, leaves);
+#endif
+
+  // seek lands on the first key not less than the one asked for
+  for (i = 0; i < SAMPLE_MAX; i += 7) {
+    entry.key.off = i;
+    for (j = i; j < SAMPLE_MAX && expected[j] == -1; j++)
+      ;
+    if (bpt_cursor_seek(&cur, entry.key, cmp_int, &bstat) == -1) {
+      assert(j == SAMPLE_MAX);
+      continue;
+    }
+    assert((int)bpt_cursor_entry(&cur)->key.off == j);
+  }
+  entry.key.off = SAMPLE_MAX;
+  assert(bpt_cursor_seek(&cur, entry.key, cmp_int, &bstat) == -1);
+  return 0;
+}
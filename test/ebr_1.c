@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 4
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 3000
+#define RETIRED_MAX 16
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+int churn(struct bpt_stat *bstat, int cnt)
+{
+  struct bpt_entry entry;
+  int i;
+
+  for (i = 0; i < cnt; i++) {
+    entry.key.ptr = (void *)(rand() % SAMPLE_MAX);
+    entry.val.ptr = entry.key.ptr;
+    if (rand() % 2 ? bpt_olc_insert(bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR :
+        bpt_olc_delete(bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+      return -1;
+  }
+  return 0;
+}
+
+struct reader_arg {
+  struct bpt_stat *bstat;
+  volatile int *stop;
+};
+
+// reads in short epochs, every value being its key
+void *reader(void *arg)
+{
+  struct reader_arg *ra = arg;
+  bpt_t key, val;
+  int i, slot = bpt_olc_register(ra->bstat);
+
+  assert(slot != -1);
+  for (i = 0; !*ra->stop; i++) {
+    key.ptr = (void *)(i % SAMPLE_MAX);
+    bpt_olc_enter(ra->bstat, slot);
+    if (bpt_olc_search(ra->bstat, key, cmp_int, &val) == 0)
+      assert(val.ptr == key.ptr);
+    bpt_olc_exit(ra->bstat, slot);
+    if (i % 16 == 0)
+      sched_yield();
+  }
+  bpt_olc_unregister(ra->bstat, slot);
+  return NULL;
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_olc *olc;
+  volatile int stop = 0;
+  struct reader_arg ra = { .bstat = &bstat, .stop = &stop };
+  unsigned long retired;
+  pthread_t tid;
+  int slot, i;
+
+  srand(1523796176);
+  if (bpt_init_olc(&bstat, BPT_ORDER) == -1)
+    return 1;
+  olc = bstat.olc;
+  assert(churn(&bstat, ENTRY_CNT) == 0);
+  assert(olc->ebr.retired > 0 && olc->ebr.reused > 0);
+  assert(olc->ebr.max_lag >= 2);
+
+  // nothing retired while a reader is in can be reclaimed
+  slot = bpt_olc_register(&bstat);
+  assert(slot != -1);
+  bpt_olc_enter(&bstat, slot);
+  retired = olc->ebr.retired;
+  assert(churn(&bstat, ENTRY_CNT / 10) == 0);
+  assert(olc->ebr.retired > retired && olc->retired.cnt >= olc->ebr.retired - retired);
+  for (i = 0; i < (int)olc->retired.cnt; i++)
+    assert(((struct bpt_retired *)olc->retired.addr)[i].died + 1 >= olc->slots[slot].epoch);
+  assert(olc->retired.cnt > 0);
+  bpt_olc_exit(&bstat, slot);
+  assert(churn(&bstat, 100) == 0);
+  assert(olc->retired.cnt < 10);
+  bpt_olc_unregister(&bstat, slot);
+  check_bpt(&bstat);
+
+  // with a bound, writers wait for readers rather than keep more nodes
+  olc->retired_max = RETIRED_MAX;
+  pthread_create(&tid, NULL, reader, &ra);
+  olc->ebr.max_pending = 0;
+  assert(churn(&bstat, ENTRY_CNT) == 0);
+  stop = 1;
+  pthread_join(tid, NULL);
+  assert(olc->ebr.max_pending < RETIRED_MAX + 2 * 10);
+  assert(olc->retired.cnt < RETIRED_MAX);
+  check_bpt(&bstat);
+  bpt_olc_reclaim(&bstat);
+  assert(olc->ebr.reclaimed == olc->ebr.retired);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+#include "../bpt_scan.h"
+
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 200000
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+static off_t vals[SAMPLE_MAX];
+static bpt_key_t keys[SAMPLE_MAX];
+
+// aggregate the values put in for [lo, hi) within [vlo, vhi] and check the kernels agree
+static void check_agg(struct bpt_stat *bstat, off_t lo, off_t hi, off_t vlo, off_t vhi, int nthread)
+{
+  struct bpt_agg agg, want;
+  bpt_key_t klo, khi;
+  off_t k;
+
+  klo.off = lo;
+  khi.off = hi;
+  bpt_agg_init(&agg, vlo, vhi);
+  bpt_agg_init(&want, vlo, vhi);
+  assert(bpt_scan_agg(bstat, &klo, &khi, cmp_int, &agg, nthread) == 0);
+  for (k = lo; k < hi; k++) {
+    if (vals[k] == -1 || vals[k] - 1000 < vlo || vals[k] - 1000 > vhi)
+      continue;
+    want.cnt++;
+    want.sum += vals[k] - 1000;
+    if (vals[k] - 1000 < want.min)
+      want.min = vals[k] - 1000;
+    if (vals[k] - 1000 > want.max)
+      want.max = vals[k] - 1000;
+  }
+  assert(agg.cnt == want.cnt && agg.sum == want.sum && agg.min == want.min && agg.max == want.max);
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct gen_stk stk;
+  struct bpt_slot run[7];
+  struct bpt_agg agg;
+  bpt_key_t klo, khi;
+  size_t n, j;
+  off_t k;
+  int i;
+
+  srand(1527711460);
+  memset(vals, 0xff, sizeof (vals));
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+
+  // the vector loop and the tail agree, negative values included
+  for (i = 0; i < 7; i++)
+    run[i].val.off = (i % 2 ? -1 : 1) * i * 10;
+  bpt_agg_init(&agg, -40, 60);
+  bpt_agg_slots(&agg, run, 7);
+  assert(agg.cnt == 6 && agg.sum == 0 + 20 - 30 + 40 + 60 - 10 && agg.min == -30 && agg.max == 60);
+  bpt_agg_init(&agg, 100, 200);
+  bpt_agg_slots(&agg, run, 7);
+  assert(agg.cnt == 0 && agg.min > agg.max);
+
+  if (bpt_init(&bstat, 7) == -1)
+    return 1;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = (vals[entry.key.off] = rand() % 2000) - 1000;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+  }
+
+  for (i = 0; i < 40; i++) {
+    klo.off = rand() % SAMPLE_MAX;
+    khi.off = klo.off + rand() % (SAMPLE_MAX - klo.off + 1);
+    check_agg(&bstat, klo.off, khi.off, -1000, 1000, 1 + i % 5);
+    check_agg(&bstat, klo.off, khi.off, rand() % 2000 - 1000, rand() % 2000 - 1000, 1 + i % 5);
+
+    // gathered keys are those of the range, cut at the buffer's end
+    n = bpt_scan_keys(&bstat, &klo, &khi, cmp_int, keys, i % 2 ? SAMPLE_MAX : 100);
+    for (k = klo.off, j = 0; k < khi.off && j < n; k++) {
+      if (vals[k] != -1)
+        assert(keys[j++].off == k);
+    }
+    for (; n < 100 && k < khi.off; k++)
+      assert(vals[k] == -1);
+    assert(j == n);
+  }
+  assert(bpt_scan_keys(&bstat, NULL, NULL, cmp_int, keys, SAMPLE_MAX) < SAMPLE_MAX);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 20000
+#define SILENT
+
+#ifndef BPT_LATENCY
+#error "build with -DBPT_LATENCY"
+#endif
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+struct bpt_hist lat[BPT_LAT_NR], hist;
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct bpt_node leaf;
+  struct gen_stk stk;
+  uint64_t v, prev;
+  int i, b, inserted = 0;
+
+  // buckets are contiguous and at most an eighth of their values wide
+  for (prev = 0, v = 1; v < ((uint64_t)1 << 40); v += v / 16 + 1) {
+    b = bpt_hist_bucket(v);
+    assert(b == bpt_hist_bucket(prev) || b == bpt_hist_bucket(prev) + 1);
+    assert(b < BPT_HIST_BUCKETS);
+    prev = v;
+  }
+  assert(bpt_hist_bucket(UINT64_MAX) == BPT_HIST_BUCKETS - 1);
+  for (v = 1; v <= 1000; v++)
+    bpt_hist_record(&hist, v * 1000);
+  assert(bpt_hist_percentile(&hist, 100) == 1000000);
+  v = bpt_hist_percentile(&hist, 50);
+  assert(v >= 500000 && v <= 500000 * 9 / 8);
+  v = bpt_hist_percentile(&hist, 99);
+  assert(v >= 990000 && v <= 1000000);
+  bpt_hist_merge(&hist, &hist);
+  assert(hist.total == 2000 && bpt_hist_percentile(&hist, 100) == 1000000);
+
+  srand(1523796176);
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  bstat.lat = lat;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = i;
+    if (bpt_insert(entry, cmp_int, bpt_pred_0, &stk, 1, &bstat) == BPT_NEXIST)
+      inserted++;
+    entry.key.off = rand() % SAMPLE_MAX;
+    bpt_search(entry.key, cmp_int, &bstat, &leaf);
+  }
+  for (i = 0; i < SAMPLE_MAX / 2; i++) {
+    entry.key.off = i;
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+  }
+  // every call is timed, and every node allocated by a split
+  assert(lat[BPT_LAT_INSERT].total == ENTRY_CNT);
+  assert(lat[BPT_LAT_SEARCH].total == ENTRY_CNT);
+  assert(lat[BPT_LAT_DELETE].total == SAMPLE_MAX / 2);
+  assert(lat[BPT_LAT_NODE_NEW].total > (unsigned long)inserted / BPT_ORDER);
+  for (i = 0; i < BPT_LAT_NR; i++)
+    assert(bpt_hist_percentile(&lat[i], 50) <= bpt_hist_percentile(&lat[i], 99));
+#ifndef SILENT
+  for (i = 0; i < BPT_LAT_NR; i++)
+    printf("op %d: p50 %lu p99 %lu p999 %lu max %lu ns\n", i, (unsigned long)bpt_hist_percentile(&lat[i], 50),
+        (unsigned long)bpt_hist_percentile(&lat[i], 99), (unsigned long)bpt_hist_percentile(&lat[i], 99.9),
+        (unsigned long)lat[i].max);
+#endif
+
+  // untimed trees are left alone
+  bstat.lat = NULL;
+  entry.key.off = 0;
+  bpt_search(entry.key, cmp_int, &bstat, &leaf);
+  assert(lat[BPT_LAT_SEARCH].total == ENTRY_CNT);
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include "../bpt_lsm.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 40000
+#define SAMPLE_MAX 5000
+#define MEM_MAX 300
+#define READER_CNT 2
+#define LSM_PATH "lsm_1.db"
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+int expected[SAMPLE_MAX];
+
+void verify(struct bpt_lsm *lsm)
+{
+  struct bpt_lsm_cursor cur;
+  bpt_t key, val;
+  int i, k, rst;
+
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    key.off = i;
+    rst = bpt_lsm_search(lsm, key, &val);
+    if (expected[i] == -1)
+      assert(rst == -1);
+    else
+      assert(rst == 0 && val.off == expected[i]);
+  }
+  // the merged walk sees every live entry once, in order
+  for (i = 0, rst = bpt_lsm_cursor_first(&cur, lsm); rst == 0; rst = bpt_lsm_cursor_next(&cur), i++) {
+    for (; expected[i] == -1; i++)
+      ;
+    assert(bpt_lsm_cursor_entry(&cur)->key.off == i && bpt_lsm_cursor_entry(&cur)->val.off == expected[i]);
+  }
+  for (; i < SAMPLE_MAX; i++)
+    assert(expected[i] == -1);
+  for (k = 0; k < SAMPLE_MAX; k += 97) {
+    key.off = k;
+    for (i = k; i < SAMPLE_MAX && expected[i] == -1; i++)
+      ;
+    rst = bpt_lsm_cursor_seek(&cur, lsm, key);
+    if (i == SAMPLE_MAX)
+      assert(rst == -1);
+    else
+      assert(rst == 0 && bpt_lsm_cursor_entry(&cur)->key.off == i);
+  }
+}
+
+struct reader_arg {
+  struct bpt_lsm *lsm;
+  volatile int *stop;
+  unsigned seed;
+  unsigned long found;
+};
+
+// even keys stay with thrice their key while odd ones come and go
+void *reader(void *arg)
+{
+  struct reader_arg *ra = arg;
+  bpt_t key, val;
+  int k;
+
+  while (!*ra->stop) {
+    ra->seed = ra->seed * 1103515245 + 12345;
+    k = (ra->seed >> 8) % SAMPLE_MAX;
+    key.off = k;
+    if (bpt_lsm_search(ra->lsm, key, &val) == 0) {
+      assert(val.off == k * 3);
+      ra->found++;
+    } else
+      assert(k % 2 == 1);
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  struct bpt_lsm lsm;
+  struct bpt_entry entry;
+  struct reader_arg ra[READER_CNT];
+  pthread_t tids[READER_CNT];
+  volatile int stop = 0;
+  unsigned long long ids[64];
+  int i, n;
+
+  unlink(LSM_PATH);
+  srand(1523796176);
+  memset(expected, -1, sizeof (expected));
+
+  // a small memtable flushes often, and the runs it leaves get compacted
+  if (bpt_lsm_open(&lsm, LSM_PATH, BPT_ORDER, cmp_int) == -1)
+    return 1;
+  lsm.mem_max = MEM_MAX;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = rand() % SAMPLE_MAX;
+    if (bpt_lsm_put(&lsm, entry) == -1)
+      return 1;
+    expected[entry.key.off] = entry.val.off;
+    entry.key.off = rand() % SAMPLE_MAX;
+    if (bpt_lsm_delete(&lsm, entry.key) == -1)
+      return 1;
+    expected[entry.key.off] = -1;
+    if (i % 5000 == 0)
+      verify(&lsm);
+  }
+  verify(&lsm);
+  if (bpt_lsm_flush(&lsm) == -1)
+    return 1;
+  assert(lsm.mem->n == 0 && lsm.imm == NULL);
+  verify(&lsm);
+  assert(lsm.flushes > 0 && lsm.compactions > 0);
+  if (bpt_lsm_close(&lsm) == -1)
+    return 1;
+
+  // only the runs on disk are left to reopen from
+  if (bpt_lsm_open(&lsm, LSM_PATH, BPT_ORDER, cmp_int) == -1)
+    return 1;
+  assert(lsm.set->n > 0);
+  verify(&lsm);
+
+  // searches race with flushes and compactions
+  lsm.mem_max = MEM_MAX;
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = i;
+    entry.val.off = i * 3;
+    if (i % 2 == 0 && bpt_lsm_put(&lsm, entry) == -1)
+      return 1;
+    expected[i] = i % 2 == 0 ? i * 3 : -1;
+    if (i % 2 == 1 && bpt_lsm_delete(&lsm, entry.key) == -1)
+      return 1;
+  }
+  for (i = 0; i < READER_CNT; i++) {
+    ra[i] = (struct reader_arg){ .lsm = &lsm, .stop = &stop, .seed = i + 1 };
+    pthread_create(&tids[i], NULL, reader, &ra[i]);
+  }
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % (SAMPLE_MAX / 2) * 2 + 1;
+    entry.val.off = entry.key.off * 3;
+    if (rand() % 2) {
+      if (bpt_lsm_put(&lsm, entry) == -1)
+        return 1;
+      expected[entry.key.off] = entry.val.off;
+    } else {
+      if (bpt_lsm_delete(&lsm, entry.key) == -1)
+        return 1;
+      expected[entry.key.off] = -1;
+    }
+  }
+  stop = 1;
+  for (i = 0; i < READER_CNT; i++) {
+    pthread_join(tids[i], NULL);
+    assert(ra[i].found > 0);
+  }
+  if (bpt_lsm_close(&lsm) == -1)
+    return 1;
+
+  if (bpt_lsm_open(&lsm, LSM_PATH, BPT_ORDER, cmp_int) == -1)
+    return 1;
+  verify(&lsm);
+  for (n = 0; n < lsm.set->n && n < 64; n++)
+    ids[n] = lsm.set->runs[n]->id;
+  assert(n < 64);
+  if (bpt_lsm_close(&lsm) == -1)
+    return 1;
+
+  for (i = 0; i < n; i++) {
+    char path[64];
+
+    sprintf(path, "%s-%llu", LSM_PATH, ids[i]);
+    unlink(path);
+  }
+  unlink(LSM_PATH);
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 5
+#define ENTRY_CNT 200000
+#define SAMPLE_MAX 4000
+#define READER_CNT 3
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+struct reader_arg {
+  struct bpt_stat *bstat;
+  volatile int *stop;
+  unsigned seed;
+  unsigned long found;
+};
+
+// even keys stay in the tree, odd ones come and go, and every value is thrice its key
+void *reader(void *arg)
+{
+  struct reader_arg *ra = arg;
+  bpt_t key, val;
+  int k, slot = bpt_olc_register(ra->bstat);
+
+  assert(slot != -1);
+  while (!*ra->stop) {
+    ra->seed = ra->seed * 1103515245 + 12345;
+    k = (ra->seed >> 8) % SAMPLE_MAX;
+    key.ptr = (void *)k;
+    bpt_olc_enter(ra->bstat, slot);
+    if (bpt_olc_search(ra->bstat, key, cmp_int, &val) == 0) {
+      assert((int)val.ptr == k * 3);
+      ra->found++;
+    } else
+      assert(k % 2 == 1);
+    bpt_olc_exit(ra->bstat, slot);
+  }
+  bpt_olc_unregister(ra->bstat, slot);
+  return NULL;
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct reader_arg ra[READER_CNT];
+  pthread_t tids[READER_CNT];
+  volatile int stop = 0;
+  bpt_t val;
+  int i, k, rst;
+
+  srand(1523796176);
+  if (bpt_init_olc(&bstat, BPT_ORDER) == -1)
+    return 1;
+  for (k = 0; k < SAMPLE_MAX; k += 2) {
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 3);
+    rst = bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1);
+    assert(rst == BPT_NEXIST);
+  }
+
+  for (i = 0; i < READER_CNT; i++) {
+    ra[i] = (struct reader_arg){ .bstat = &bstat, .stop = &stop, .seed = i + 1 };
+    pthread_create(&tids[i], NULL, reader, &ra[i]);
+  }
+  // splits, merges and root changes all happen under the readers
+  for (i = 0; i < ENTRY_CNT; i++) {
+    k = rand() % (SAMPLE_MAX / 2) * 2 + 1;
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 3);
+    if (rand() % 2) {
+      if (bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+        return 1;
+    } else {
+      if (bpt_olc_delete(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+        return 1;
+    }
+    if (i % 64 == 0)
+      sched_yield();
+  }
+  stop = 1;
+  for (i = 0; i < READER_CNT; i++)
+    pthread_join(tids[i], NULL);
+  check_bpt(&bstat);
+  bpt_olc_reclaim(&bstat);
+  assert(bstat.olc->retired.cnt == 0);
+
+  // the versions a writer bumped are all even again
+  for (k = 0; k < SAMPLE_MAX; k += 2) {
+    entry.key.ptr = (void *)k;
+    assert(bpt_olc_search(&bstat, entry.key, cmp_int, &val) == 0 && (int)val.ptr == k * 3);
+  }
+  for (i = 0; i < READER_CNT; i++)
+    assert(ra[i].found > 0);
+  return 0;
+}
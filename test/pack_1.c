@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../bpt_pack.h"
+
+#define BPT_ORDER 16
+#define ENTRY_CNT 100000
+#define KEY_BASE 1000000000000LL
+#define SILENT
+
+int cmp_off(bpt_t a, bpt_t b)
+{
+  return a.off < b.off ? -1 : a.off > b.off;
+}
+
+struct walk {
+  struct bpt_cursor cur;
+  int rst;
+};
+
+// the packed copy and a thawed tree read back exactly the original entries
+int same_entry(struct bpt_entry *entry, void *arg)
+{
+  struct walk *w = arg;
+
+  assert(w->rst == 0);
+  assert(bpt_cursor_entry(&w->cur)->key.off == entry->key.off);
+  assert(bpt_cursor_entry(&w->cur)->val.off == entry->val.off);
+  w->rst = bpt_cursor_next(&w->cur);
+  return 0;
+}
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat bstat, thawed;
+  struct bpt_node leaf;
+  struct bpt_pack pack;
+  struct gen_stk stk;
+  struct walk w;
+  bpt_t val;
+  off_t key;
+  int i, offset;
+
+  srand(1523796176);
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  // dense IDs with small gaps and small values, plus a few outliers at both ends
+  for (key = KEY_BASE, i = 0; i < ENTRY_CNT; i++) {
+    key += 1 + rand() % 3;
+    entry.key.off = key;
+    entry.val.off = rand() % 1000;
+    if (bpt_insert(entry, cmp_off, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+  }
+  entry.key.off = -5;
+  entry.val.off = (off_t)1 << 62;
+  if (bpt_insert(entry, cmp_off, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+    return 1;
+  entry.key.off = (off_t)1 << 62;
+  entry.val.off = -(off_t)1 << 62;
+  if (bpt_insert(entry, cmp_off, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+    return 1;
+
+  if (bpt_pack_build(&pack, &bstat) == -1)
+    return 1;
+  assert(pack.nkey == ENTRY_CNT + 2);
+  // at least 4x smaller than 16 bytes per entry, fences included
+  assert((pack.size + pack.fences.cnt * sizeof (struct bpt_pack_fence)) * 4 <= pack.nkey * sizeof (struct bpt_entry));
+#ifndef SILENT
+  printf("%.2f bytes per entry\n", (double)(pack.size + pack.fences.cnt * sizeof (struct bpt_pack_fence)) / pack.nkey);
+#endif
+
+  for (key = -10; key < KEY_BASE + 3 * ENTRY_CNT + 10; key = key == 10 ? KEY_BASE - 10 : key + 1) {
+    entry.key.off = key;
+    offset = bpt_search(entry.key, cmp_off, &bstat, &leaf);
+    if (offset == -1) {
+      assert(bpt_pack_search(&pack, entry.key, &val) == -1);
+    } else {
+      assert(bpt_pack_search(&pack, entry.key, &val) == 0);
+      assert(val.off == leaf.entries[offset].val.off);
+    }
+  }
+  entry.key.off = (off_t)1 << 62;
+  assert(bpt_pack_search(&pack, entry.key, &val) == 0 && val.off == -(off_t)1 << 62);
+
+  w.rst = bpt_cursor_first(&w.cur, &bstat);
+  bpt_pack_foreach(&pack, same_entry, &w);
+  assert(w.rst == -1);
+
+  if (bpt_pack_thaw(&pack, &thawed, BPT_ORDER, cmp_off) == -1)
+    return 1;
+  w.rst = bpt_cursor_first(&w.cur, &thawed);
+  bpt_pack_foreach(&pack, same_entry, &w);
+  assert(w.rst == -1);
+  bpt_pack_free(&pack);
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 4000
+#define CHURN_CNT 200000
+#define SILENT
+
+#ifndef BPT_STATS
+#error "build with -DBPT_STATS"
+#endif
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+char expected[SAMPLE_MAX];
+
+// no node but the root may be left with less than the watermarks
+void check_fill(struct bpt_stat *bstat, int leaf_min, int inter_min)
+{
+  struct bpt_node first = bstat->root_node, node;
+  int h;
+
+  for (h = bstat->height; h >= 0; h--) {
+    for (node = first; node.entries != NULL; node = bpt_node_nxt(node, bstat))
+      assert(h == bstat->height || bpt_node_nkey(node, bstat->order) >= (h > 0 ? inter_min : leaf_min));
+    if (h > 0)
+      first = bpt_node_child(first, 0, bstat);
+  }
+}
+
+void check_entries(struct bpt_stat *bstat)
+{
+  struct bpt_tree_stats st;
+  struct bpt_node leaf;
+  bpt_t key;
+  int i, nkey = 0;
+
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    key.off = i;
+    assert((bpt_search(key, cmp_int, bstat, &leaf) != -1) == expected[i]);
+    nkey += expected[i];
+  }
+  bpt_get_stats(bstat, &st);
+  assert(st.entries == nkey);
+  assert(st.height == st.counters.root_grows - st.counters.root_shrinks);
+  assert(st.nodes[0] == 1 + st.counters.leaf_splits - st.counters.leaf_merges);
+}
+
+// inserts and deletes around a steady size, the way deletion_2 does
+void churn(struct bpt_stat *bstat, struct gen_stk *stk, unsigned seed)
+{
+  struct bpt_entry entry;
+  int i, rst;
+
+  srand(seed);
+  for (i = 0; i < CHURN_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = i;
+    if (rand() % 2) {
+      rst = bpt_insert(entry, cmp_int, bpt_pred_1, stk, 1, bstat);
+      assert(rst != BPT_ERROR);
+      expected[entry.key.off] = 1;
+    } else {
+      rst = bpt_delete(entry, cmp_int, bpt_pred_1, stk, 1, bstat);
+      assert(rst != BPT_ERROR);
+      expected[entry.key.off] = 0;
+    }
+  }
+}
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat strict, relaxed;
+  struct gen_stk stk;
+  char saved[SAMPLE_MAX];
+  unsigned long strict_smo, relaxed_smo;
+  int i, merged, rst;
+
+  if (bpt_init(&strict, BPT_ORDER) == -1 || bpt_init(&relaxed, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  assert(relaxed.min_leaf_nkey == relaxed.new_leaf_nkey && relaxed.min_inter_nkey == relaxed.new_inter_nkey);
+  rst = bpt_set_watermarks(&relaxed, 0, 1);
+  assert(rst == -1 && errno == EINVAL);
+  rst = bpt_set_watermarks(&relaxed, 1, relaxed.new_inter_nkey + 1);
+  assert(rst == -1 && errno == EINVAL);
+  if (bpt_set_watermarks(&relaxed, 1, 1) == -1)
+    return 1;
+
+  // the same workload splits and merges less once merges leave room behind
+  churn(&strict, &stk, 1523796176);
+  check_bpt(&strict);
+  check_fill(&strict, strict.new_leaf_nkey, strict.new_inter_nkey);
+  check_entries(&strict);
+  memcpy(saved, expected, sizeof (saved));
+  memset(expected, 0, sizeof (expected));
+  churn(&relaxed, &stk, 1523796176);
+  assert(memcmp(saved, expected, sizeof (saved)) == 0);
+  check_bpt(&relaxed);
+  check_fill(&relaxed, 1, 1);
+  check_entries(&relaxed);
+  strict_smo = strict.counters.leaf_splits + strict.counters.leaf_merges;
+  relaxed_smo = relaxed.counters.leaf_splits + relaxed.counters.leaf_merges;
+#ifndef SILENT
+  printf("strict: %lu splits, %lu merges; relaxed: %lu splits, %lu merges\n",
+      strict.counters.leaf_splits, strict.counters.leaf_merges,
+      relaxed.counters.leaf_splits, relaxed.counters.leaf_merges);
+#endif
+  assert(relaxed_smo < strict_smo);
+
+  // delete most of it, then take the space back in one pass
+  srand(1523796177);
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    if (entry.key.off % 8 == 0)
+      continue;
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &relaxed) == BPT_ERROR)
+      return 1;
+    expected[entry.key.off] = 0;
+  }
+  check_bpt(&relaxed);
+  check_fill(&relaxed, 1, 1);
+  check_entries(&relaxed);
+  merged = bpt_rebalance(&relaxed);
+  assert(merged > 0);
+  check_bpt(&relaxed);
+  check_fill(&relaxed, relaxed.new_leaf_nkey, relaxed.new_inter_nkey);
+  check_entries(&relaxed);
+  rst = bpt_rebalance(&relaxed);
+  assert(rst == 0);
+
+  // raising the watermarks rebalances first, so strict deletion finds every node as it expects
+  churn(&relaxed, &stk, 1523796178);
+  if (bpt_set_watermarks(&relaxed, relaxed.new_leaf_nkey, relaxed.new_inter_nkey) == -1)
+    return 1;
+  check_fill(&relaxed, relaxed.new_leaf_nkey, relaxed.new_inter_nkey);
+  churn(&relaxed, &stk, 1523796179);
+  check_bpt(&relaxed);
+  check_fill(&relaxed, relaxed.new_leaf_nkey, relaxed.new_inter_nkey);
+  check_entries(&relaxed);
+
+  // emptied at the lowest watermarks, the tree shrinks down to a root leaf
+  if (bpt_set_watermarks(&relaxed, 1, 1) == -1)
+    return 1;
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = i;
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &relaxed) == BPT_ERROR)
+      return 1;
+    expected[i] = 0;
+  }
+  check_bpt(&relaxed);
+  check_entries(&relaxed);
+  assert(relaxed.height == 0 && bpt_node_nkey(relaxed.root_node, BPT_ORDER) == 0);
+
+  // a copy-on-write tree takes relaxed deletes, but not the pass
+  if (bpt_init_cow(&strict, BPT_ORDER) == -1)
+    return 1;
+  if (bpt_set_watermarks(&strict, 1, 1) == -1)
+    return 1;
+  churn(&strict, &stk, 1523796180);
+  check_bpt(&strict);
+  check_fill(&strict, 1, 1);
+  rst = bpt_rebalance(&strict);
+  assert(rst == -1 && errno == EINVAL);
+  rst = bpt_set_watermarks(&strict, strict.new_leaf_nkey, 1);
+  assert(rst == -1 && errno == EINVAL);
+  gen_stk_delete(&stk);
+  return 0;
+}
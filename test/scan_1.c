@@ -0,0 +1,145 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+#include "../bpt_scan.h"
+
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 200000
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+// what a partition saw, merged in key order
+struct acc {
+  long cnt, sum;
+  off_t first, last;
+  int sorted;
+};
+
+static void acc_init(void *acc, void *arg)
+{
+  struct acc *a = acc;
+
+  memset(a, 0, sizeof (*a));
+  a->first = a->last = -1;
+  a->sorted = 1;
+}
+
+static int acc_leaf(void *acc, const struct bpt_slot *slots, int n, void *arg)
+{
+  struct acc *a = acc;
+  off_t *stop_at = arg;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (slots[i].key.off <= a->last)
+      a->sorted = 0;
+    if (a->first == -1)
+      a->first = slots[i].key.off;
+    a->last = slots[i].key.off;
+    a->cnt++;
+    a->sum += slots[i].val.off;
+    if (slots[i].key.off == *stop_at)
+      return 1;
+  }
+  return 0;
+}
+
+static void acc_merge(void *acc, const void *from, void *arg)
+{
+  struct acc *a = acc;
+  const struct acc *f = from;
+
+  if (f->cnt == 0)
+    return;
+  if (a->cnt > 0 && f->first <= a->last)
+    a->sorted = 0;
+  if (a->cnt == 0)
+    a->first = f->first;
+  a->last = f->last;
+  a->cnt += f->cnt;
+  a->sum += f->sum;
+  a->sorted &= f->sorted;
+}
+
+static const struct bpt_scan_ops ops = { sizeof (struct acc), acc_init, acc_leaf, acc_merge };
+
+static off_t vals[SAMPLE_MAX];
+
+// scan [lo, hi) and check the result against the values put in
+static void check_range(struct bpt_stat *bstat, off_t lo, off_t hi, int use_lo, int use_hi, int nthread)
+{
+  struct acc acc;
+  bpt_key_t klo, khi;
+  off_t stop_at = -1, k;
+  long cnt = 0, sum = 0;
+
+  klo.off = lo;
+  khi.off = hi;
+  assert(bpt_scan_parallel(bstat, use_lo ? &klo : NULL, use_hi ? &khi : NULL, cmp_int, &ops, &stop_at, &acc,
+      nthread) == 0);
+  for (k = use_lo ? lo : 0; k < (use_hi ? hi : SAMPLE_MAX); k++) {
+    if (k >= 0 && k < SAMPLE_MAX && vals[k] != -1) {
+      cnt++;
+      sum += vals[k];
+    }
+  }
+  assert(acc.sorted && acc.cnt == cnt && acc.sum == sum);
+}
+
+int main(void)
+{
+  struct bpt_stat bstat;
+  struct bpt_entry entry;
+  struct gen_stk stk;
+  struct acc acc;
+  off_t stop_at;
+  int i, nthread, rst;
+
+  srand(1527113062);
+  memset(vals, 0xff, sizeof (vals));
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+
+  // an empty tree, then one of a single leaf
+  if (bpt_init(&bstat, 6) == -1)
+    return 1;
+  check_range(&bstat, 0, 0, 0, 0, 4);
+  for (i = 0; i < 5; i++) {
+    entry.key.off = i * 7;
+    entry.val.off = vals[i*7] = i;
+    rst = bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat);
+    assert(rst == BPT_NEXIST);
+  }
+  check_range(&bstat, 0, 0, 0, 0, 4);
+  check_range(&bstat, 7, 22, 1, 1, 4);
+
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = vals[entry.key.off] = rand() % 1000;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+  }
+  check_bpt(&bstat);
+
+  // whole tree and ranges cut anywhere, partitions stolen or not
+  for (nthread = 1; nthread <= 9; nthread += 4) {
+    check_range(&bstat, 0, 0, 0, 0, nthread);
+    for (i = 0; i < 50; i++)
+      check_range(&bstat, rand() % SAMPLE_MAX, rand() % SAMPLE_MAX, rand() % 4 != 0, rand() % 4 != 0, nthread);
+    check_range(&bstat, -5, SAMPLE_MAX + 5, 1, 1, nthread);
+  }
+
+  // stopped by the callback
+  for (stop_at = SAMPLE_MAX / 2; vals[stop_at] == -1; stop_at++)
+    ;
+  assert(bpt_scan_parallel(&bstat, NULL, NULL, cmp_int, &ops, &stop_at, &acc, 4) == 1);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 20000
+
+#ifndef BPT_SET
+#error "build with -DBPT_SET"
+#endif
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+char expected[SAMPLE_MAX];
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct bpt_cursor cur;
+  struct bpt_node leaf, prev_leaf = bpt_null_node;
+  struct gen_stk stk;
+  int i, rst, key, nkey = 0, leaves = 0;
+
+  srand(1523796176);
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  assert(bstat.leaf_order == 2 * BPT_ORDER);
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  // no values and no predicates: insert and erase are plain set operations
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    if ((rst = bpt_insert(entry, cmp_int, NULL, &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    assert(rst == (expected[entry.key.off] ? BPT_PRED_FAIL : BPT_NEXIST));
+    expected[entry.key.off] = 1;
+    entry.key.off = rand() % SAMPLE_MAX;
+    if ((rst = bpt_delete(entry, cmp_int, NULL, &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    assert(rst == (expected[entry.key.off] ? BPT_PRED_SUCCESS : BPT_NEXIST));
+    expected[entry.key.off] = 0;
+  }
+
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = i;
+    assert((bpt_search(entry.key, cmp_int, &bstat, &leaf) != -1) == expected[i]);
+    nkey += expected[i];
+  }
+  for (key = -1, rst = bpt_cursor_first(&cur, &bstat); rst == 0; rst = bpt_cursor_next(&cur)) {
+    for (key++; !expected[key]; key++)
+      ;
+    assert(bpt_cursor_entry(&cur)->key.off == key);
+    if (cur.leaf.entries != prev_leaf.entries)
+      leaves++, prev_leaf = cur.leaf;
+  }
+  for (key++; key < SAMPLE_MAX; key++)
+    assert(!expected[key]);
+  // leaves hold more keys than an entry leaf of the same size could
+  assert(nkey > leaves * BPT_ORDER);
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+#include "../bpt_shard.h"
+
+#define BPT_ORDER 8
+#define NSHARD 4
+#define NWRITER 4
+#define SAMPLE_CNT 1000
+#define KEY_MAX 200000
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.ptr - (int)b.ptr;
+}
+
+struct bpt_sharded sh;
+volatile int stop;
+
+// the keys of a writer are those equal to its number modulo NWRITER, all in the lower half
+void *writer(void *arg)
+{
+  struct bpt_entry entry;
+  int k, rst;
+
+  for (k = (int)(long)arg; k < KEY_MAX / 2; k += NWRITER) {
+    entry.key.ptr = (void *)k;
+    entry.val.ptr = (void *)(k * 2);
+    rst = bpt_shard_insert(&sh, entry, bpt_pred_1);
+    assert(rst == BPT_NEXIST);
+  }
+  return NULL;
+}
+
+void *rebalancer(void *arg)
+{
+  long rst;
+
+  while (!stop) {
+    rst = bpt_shard_rebalance(&sh, 0.1);
+    assert(rst != -1);
+  }
+  return NULL;
+}
+
+// walks every shard in order while they fill and move
+void *scanner(void *arg)
+{
+  struct bpt_shard_cursor cur;
+  int prev, rst;
+
+  while (!stop) {
+    for (prev = -1, rst = bpt_shard_cursor_first(&cur, &sh); rst == 0; rst = bpt_shard_cursor_next(&cur)) {
+      assert((int)bpt_shard_cursor_entry(&cur)->key.ptr > prev);
+      prev = (int)bpt_shard_cursor_entry(&cur)->key.ptr;
+      assert((int)bpt_shard_cursor_entry(&cur)->val.ptr == prev * 2);
+    }
+  }
+  return NULL;
+}
+
+// every shard holds the keys of its range only
+void check_ranges(void)
+{
+  struct bpt_cursor cur;
+  int i, rst;
+  size_t n;
+
+  for (i = 0; i < NSHARD; i++) {
+    check_bpt(&sh.shards[i].bstat);
+    for (n = 0, rst = bpt_cursor_first(&cur, &sh.shards[i].bstat); rst == 0; rst = bpt_cursor_next(&cur), n++) {
+      assert(i == 0 || cmp_int(bpt_cursor_entry(&cur)->key, sh.shards[i].low) >= 0);
+      assert(i == NSHARD - 1 || cmp_int(bpt_cursor_entry(&cur)->key, sh.shards[i+1].low) < 0);
+    }
+    assert(n == sh.shards[i].nkey);
+  }
+}
+
+int main(void)
+{
+  bpt_key_t sample[SAMPLE_CNT];
+  struct bpt_shard_cursor cur;
+  struct bpt_entry entry;
+  pthread_t tids[NWRITER + 2];
+  bpt_t val;
+  size_t lo, hi;
+  int i, k, rst;
+
+  srand(1523796176);
+  for (i = 0; i < SAMPLE_CNT; i++)
+    sample[i].ptr = (void *)(rand() % KEY_MAX);
+  rst = bpt_shard_init(&sh, NSHARD, BPT_ORDER, cmp_int, sample, 2);
+  assert(rst == -1);
+  if (bpt_shard_init(&sh, NSHARD, BPT_ORDER, cmp_int, sample, SAMPLE_CNT) == -1)
+    return 1;
+
+  // the sample spreads over every key, the writes go to the lower half
+  for (i = 0; i < NWRITER; i++)
+    pthread_create(&tids[i], NULL, writer, (void *)(long)i);
+  pthread_create(&tids[NWRITER], NULL, rebalancer, NULL);
+  pthread_create(&tids[NWRITER+1], NULL, scanner, NULL);
+  for (i = 0; i < NWRITER; i++)
+    pthread_join(tids[i], NULL);
+  stop = 1;
+  pthread_join(tids[NWRITER], NULL);
+  pthread_join(tids[NWRITER+1], NULL);
+  check_ranges();
+  for (k = 0; k < KEY_MAX; k++) {
+    entry.key.ptr = (void *)k;
+    assert(bpt_shard_search(&sh, entry.key, &val) == (k < KEY_MAX / 2 ? 0 : -1));
+    assert(k >= KEY_MAX / 2 || (int)val.ptr == k * 2);
+  }
+
+  // rebalanced to the end, no shard is much larger than its neighbours
+  while ((rst = bpt_shard_rebalance(&sh, 0.1)) > 0)
+    ;
+  assert(rst == 0);
+  check_ranges();
+  for (lo = hi = sh.shards[0].nkey, i = 1; i < NSHARD; i++) {
+    lo = sh.shards[i].nkey < lo ? sh.shards[i].nkey : lo;
+    hi = sh.shards[i].nkey > hi ? sh.shards[i].nkey : hi;
+  }
+  assert(hi < lo * 2);
+
+  // deletes and seeks across shard bounds
+  for (k = 0; k < KEY_MAX / 2; k += 2) {
+    entry.key.ptr = (void *)k;
+    rst = bpt_shard_delete(&sh, entry, bpt_pred_1);
+    assert(rst == BPT_PRED_SUCCESS);
+  }
+  check_ranges();
+  for (i = 1; i < NSHARD; i++) {
+    entry.key.ptr = (void *)((int)sh.shards[i].low.ptr - 1);
+    rst = bpt_shard_cursor_seek(&cur, &sh, entry.key);
+    assert(rst == 0);
+    k = (int)entry.key.ptr | 1;
+    for (rst = 0; rst == 0 && k < KEY_MAX / 2; rst = bpt_shard_cursor_next(&cur), k += 2)
+      assert((int)bpt_shard_cursor_entry(&cur)->key.ptr == k);
+    assert(k >= KEY_MAX / 2 && rst == -1);
+  }
+  entry.key.ptr = (void *)KEY_MAX;
+  rst = bpt_shard_cursor_seek(&cur, &sh, entry.key);
+  assert(rst == -1);
+  bpt_shard_free(&sh);
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 20000
+#define READER_CNT 4
+#define SILENT
+
+#ifndef BPT_STATS
+#error "build with -DBPT_STATS"
+#endif
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+char expected[SAMPLE_MAX];
+
+// the shape of the tree must agree with the splits and merges that built it
+void check_stats(struct bpt_stat *bstat, int nkey)
+{
+  struct bpt_tree_stats st;
+  struct bpt_counters *c = &st.counters;
+  size_t inter = 0, fill = 0;
+  int h;
+
+  bpt_get_stats(bstat, &st);
+  assert(st.entries == nkey);
+  assert(st.height == c->root_grows - c->root_shrinks);
+  assert(st.nodes[0] == 1 + c->leaf_splits - c->leaf_merges);
+  for (h = 1; h <= st.height; h++)
+    inter += st.nodes[h];
+  assert(inter == c->inter_splits + c->root_grows - c->inter_merges - c->root_shrinks);
+  for (h = 0; h < BPT_FILL_BUCKETS; h++)
+    fill += st.leaf_fill[h];
+  assert(fill == st.nodes[0]);
+  assert(st.bytes == (st.nodes[0] + inter) * (BPT_ORDER + 2) * sizeof (struct bpt_entry));
+#ifndef SILENT
+  printf("height %d, %zu leaves, %zu internal nodes, %zu entries\n", st.height, st.nodes[0], inter, st.entries);
+  printf("%lu searches, %lu cmps, %lu visits, %lu borrows\n", c->searches, c->cmps, c->visits, c->borrows);
+#endif
+}
+
+// looks every key up in a concurrent tree, from a reader slot of its own
+void *reader(void *arg)
+{
+  struct bpt_stat *bstat = arg;
+  bpt_key_t key;
+  int i, slot = bpt_olc_register(bstat);
+
+  assert(slot != -1);
+  bpt_olc_enter(bstat, slot);
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    key.off = i;
+    assert(bpt_olc_search(bstat, key, cmp_int, NULL) == 0);
+  }
+  bpt_olc_exit(bstat, slot);
+  bpt_olc_unregister(bstat, slot);
+  return NULL;
+}
+
+int main(void)
+{
+  pthread_t readers[READER_CNT];
+  struct bpt_tree_stats st;
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct gen_stk stk;
+  struct bpt_node leaf;
+  int i, nkey = 0;
+  unsigned long cmps;
+
+  srand(1523796176);
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = i;
+    if (bpt_insert(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+    nkey += !expected[entry.key.off];
+    expected[entry.key.off] = 1;
+  }
+  check_bpt(&bstat);
+  check_stats(&bstat, nkey);
+  assert(bstat.counters.inserts == ENTRY_CNT);
+  assert(bstat.counters.leaf_splits > 0 && bstat.counters.root_grows > 0);
+
+  // a lookup visits one node per level and compares a bounded number of keys in each
+  bstat.counters.visits = bstat.counters.cmps = 0;
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = i;
+    assert((bpt_search(entry.key, cmp_int, &bstat, &leaf) != -1) == expected[i]);
+  }
+  assert(bstat.counters.visits == (unsigned long)SAMPLE_MAX * (bstat.height + 1));
+  cmps = bstat.counters.cmps;
+  assert(cmps > 0 && cmps <= (unsigned long)SAMPLE_MAX * (bstat.height + 1) * (BPT_ORDER + 1));
+
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    if (bpt_delete(entry, cmp_int, bpt_pred_1, &stk, 1, &bstat) == BPT_ERROR)
+      return 1;
+    nkey -= expected[entry.key.off];
+    expected[entry.key.off] = 0;
+  }
+  check_bpt(&bstat);
+  check_stats(&bstat, nkey);
+  assert(bstat.counters.deletes == ENTRY_CNT);
+  assert(bstat.counters.leaf_merges > 0 && bstat.counters.borrows > 0);
+
+  // readers of a concurrent tree leave its counters alone, and the stats add up their slots
+  if (bpt_init_olc(&bstat, BPT_ORDER) == -1)
+    return 1;
+  for (i = 0; i < SAMPLE_MAX; i++) {
+    entry.key.off = entry.val.off = i;
+    if (bpt_olc_insert(&bstat, entry, cmp_int, bpt_pred_1) == BPT_ERROR)
+      return 1;
+  }
+  cmps = bstat.counters.cmps;
+  for (i = 0; i < READER_CNT; i++)
+    pthread_create(&readers[i], NULL, reader, &bstat);
+  for (i = 0; i < READER_CNT; i++)
+    pthread_join(readers[i], NULL);
+  assert(bstat.counters.searches == 0 && bstat.counters.cmps == cmps);
+  bpt_get_stats(&bstat, &st);
+  assert(st.counters.searches == (unsigned long)READER_CNT * SAMPLE_MAX);
+  assert(st.counters.visits - bstat.counters.visits == st.counters.searches * (bstat.height + 1));
+  assert(st.counters.cmps > cmps && st.counters.inserts == SAMPLE_MAX);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../bpt_str.h"
+
+#define BPT_ORDER 16
+#define ENTRY_CNT 50000
+#define SILENT
+
+int cmp_str(bpt_t a, bpt_t b)
+{
+  return strcmp(a.ptr, b.ptr);
+}
+
+const void *str_bytes(bpt_t key, size_t *lenp)
+{
+  *lenp = strlen(key.ptr);
+  return key.ptr;
+}
+
+struct walk {
+  struct bpt_cursor cur;
+  int rst;
+};
+
+int same_entry(const void *key, size_t len, bpt_t val, void *arg)
+{
+  struct walk *w = arg;
+  const char *expect = bpt_cursor_entry(&w->cur)->key.ptr;
+
+  assert(w->rst == 0);
+  assert(len == strlen(expect) && memcmp(key, expect, len) == 0);
+  assert(val.off == bpt_cursor_entry(&w->cur)->val.off);
+  w->rst = bpt_cursor_next(&w->cur);
+  return 0;
+}
+
+int main(void)
+{
+  static const char *kinds[] = { "profile", "posts", "posts/archive", "settings" };
+  struct bpt_entry entry;
+  struct bpt_stat bstat;
+  struct bpt_str_pack pack;
+  struct gen_stk stk;
+  struct walk w;
+  char buf[128];
+  size_t raw = 0;
+  bpt_t val;
+  int i, rst;
+
+  srand(1523796176);
+  if (bpt_init(&bstat, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  // URLs sharing long prefixes, a few short and empty keys on the side
+  for (i = 0; i < ENTRY_CNT; i++) {
+    if (i < 3)
+      sprintf(buf, "%.*s", i, "ab");
+    else
+      sprintf(buf, "https://example.com/users/%07d/%s", rand() % 1000000, kinds[rand() % 4]);
+    if ((entry.key.ptr = malloc(strlen(buf) + 1)) == NULL)
+      return 1;
+    strcpy(entry.key.ptr, buf);
+    entry.val.off = i;
+    if ((rst = bpt_insert(entry, cmp_str, bpt_pred_1, &stk, 1, &bstat)) == BPT_ERROR)
+      return 1;
+    if (rst == BPT_NEXIST)
+      raw += strlen(buf) + sizeof (struct bpt_entry);
+  }
+
+  if (bpt_str_build(&pack, &bstat, str_bytes) == -1)
+    return 1;
+  // inline keys with shared prefixes take less than out-of-line keys plus entries
+  assert(pack.npage * BPT_STR_PAGE + pack.seps_len < raw);
+#ifndef SILENT
+  printf("%zu pages, %zu separator bytes for %zu keys, %zu bytes unpacked\n",
+      pack.npage, pack.seps_len, pack.nkey, raw);
+#endif
+
+  for (rst = bpt_cursor_first(&w.cur, &bstat); rst == 0; rst = bpt_cursor_next(&w.cur)) {
+    entry = *bpt_cursor_entry(&w.cur);
+    assert(bpt_str_search(&pack, entry.key.ptr, strlen(entry.key.ptr), &val) == 0);
+    assert(val.off == entry.val.off);
+    // neighbours that are not keys are not found
+    sprintf(buf, "%s!", (char *)entry.key.ptr);
+    entry.key.ptr = buf;
+    assert(bpt_str_search(&pack, buf, strlen(buf), &val) == -1 ||
+        bpt_search(entry.key, cmp_str, &bstat, &w.cur.leaf) != -1);
+  }
+  assert(bpt_str_search(&pack, "https://example.com/users/", 26, &val) == -1);
+  assert(bpt_str_search(&pack, "zzz", 3, &val) == -1);
+
+  w.rst = bpt_cursor_first(&w.cur, &bstat);
+  bpt_str_foreach(&pack, same_entry, &w);
+  assert(w.rst == -1);
+  bpt_str_free(&pack);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "../bpt_str.h"
+
+#define KEY_CNT 20000
+#define OP_CNT 400000
+#define SILENT
+
+char *keys[KEY_CNT];
+long expected[KEY_CNT]; // -1 if not in the tree
+
+int cmp_key(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+struct walk {
+  int i, n;
+};
+
+// entries come in key order, and they are exactly the live ones
+int next_live(const void *key, size_t len, bpt_t val, void *arg)
+{
+  struct walk *w = arg;
+
+  while (w->i < KEY_CNT && expected[w->i] == -1)
+    w->i++;
+  assert(w->i < KEY_CNT);
+  assert(len == strlen(keys[w->i]) && memcmp(key, keys[w->i], len) == 0);
+  assert(val.off == expected[w->i]);
+  w->i++;
+  w->n++;
+  return 0;
+}
+
+void check_tree(struct bpt_str_tree *t)
+{
+  struct walk w = { 0, 0 };
+  size_t nkey = 0;
+  bpt_t val;
+  int i;
+
+  for (i = 0; i < KEY_CNT; i++) {
+    if (expected[i] == -1)
+      assert(bpt_str_tree_search(t, keys[i], strlen(keys[i]), &val) == -1);
+    else {
+      assert(bpt_str_tree_search(t, keys[i], strlen(keys[i]), &val) == 0);
+      assert(val.off == expected[i]);
+      nkey++;
+    }
+  }
+  assert(t->nkey == nkey);
+  assert(bpt_str_tree_foreach(t, next_live, &w) == 0);
+  assert(w.n == nkey);
+}
+
+int main(void)
+{
+  static const char *kinds[] = { "profile", "posts", "posts/archive", "settings" };
+  struct bpt_str_tree t;
+  char buf[BPT_STR_TREE_KEY_MAX + 2];
+  bpt_t val;
+  int i, j, rst;
+
+  srand(1523796176);
+  // URLs sharing long prefixes, a few short and empty keys on the side
+  for (i = 0; i < KEY_CNT; i++) {
+    if (i < 3)
+      sprintf(buf, "%.*s", i, "ab");
+    else
+      sprintf(buf, "https://example.com/users/%07d/%s", i * 37 % 1000000, kinds[rand() % 4]);
+    if ((keys[i] = malloc(strlen(buf) + 1)) == NULL)
+      return 1;
+    strcpy(keys[i], buf);
+    expected[i] = -1;
+  }
+  qsort(keys, KEY_CNT, sizeof (char *), cmp_key);
+  if (bpt_str_tree_init(&t) == -1)
+    return 1;
+
+  // random inserts, replacements and deletes against the expected table
+  for (i = 0; i < OP_CNT; i++) {
+    j = rand() % KEY_CNT;
+    val.off = i;
+    if (rand() % 3) {
+      if ((rst = bpt_str_tree_insert(&t, keys[j], strlen(keys[j]), val, bpt_pred_1)) == BPT_ERROR)
+        return 1;
+      assert(rst == (expected[j] == -1 ? BPT_NEXIST : BPT_PRED_SUCCESS));
+      expected[j] = i;
+    } else {
+      rst = bpt_str_tree_delete(&t, keys[j], strlen(keys[j]));
+      assert(rst == (expected[j] == -1 ? BPT_NEXIST : BPT_PRED_SUCCESS));
+      expected[j] = -1;
+    }
+    if (i % (OP_CNT / 4) == 0)
+      check_tree(&t);
+  }
+  check_tree(&t);
+  assert(t.height > 0);
+#ifndef SILENT
+  printf("%zu keys in %zu pages, height %d\n", t.nkey, t.npage, t.height);
+#endif
+  // inline keys with shared prefixes take less than a page per order-16 leaf would
+  assert(t.npage * BPT_STR_PAGE < t.nkey * (BPT_STR_PAGE / 16));
+
+  // neighbours that are not keys are not found
+  for (i = 0; i < KEY_CNT; i++) {
+    sprintf(buf, "%s!", keys[i]);
+    assert(bpt_str_tree_search(&t, buf, strlen(buf), &val) == -1);
+  }
+  assert(bpt_str_tree_search(&t, "https://example.com/users/", 26, &val) == -1);
+  assert(bpt_str_tree_search(&t, "zzz", 3, &val) == -1);
+
+  // a key too long for a node is refused and changes nothing
+  memset(buf, 'x', BPT_STR_TREE_KEY_MAX + 1);
+  val.off = 0;
+  errno = 0;
+  rst = bpt_str_tree_insert(&t, buf, BPT_STR_TREE_KEY_MAX + 1, val, bpt_pred_1);
+  assert(rst == BPT_ERROR && errno == EINVAL);
+  rst = bpt_str_tree_delete(&t, buf, BPT_STR_TREE_KEY_MAX + 1);
+  assert(rst == BPT_NEXIST);
+  check_tree(&t);
+
+  // a failed predicate leaves the value alone
+  for (j = 0; expected[j] == -1; j++)
+    ;
+  rst = bpt_str_tree_insert(&t, keys[j], strlen(keys[j]), val, bpt_pred_0);
+  assert(rst == BPT_PRED_FAIL);
+  check_tree(&t);
+
+  // emptied, the tree shrinks down to a root leaf
+  for (i = 0; i < KEY_CNT; i++) {
+    j = (i * 7919) % KEY_CNT;
+    rst = bpt_str_tree_delete(&t, keys[j], strlen(keys[j]));
+    assert(rst == (expected[j] == -1 ? BPT_NEXIST : BPT_PRED_SUCCESS));
+    expected[j] = -1;
+  }
+  check_tree(&t);
+  assert(t.height == 0 && t.nkey == 0 && t.npage == 1);
+  bpt_str_tree_free(&t);
+  for (i = 0; i < KEY_CNT; i++)
+    free(keys[i]);
+  return 0;
+}
@@ -0,0 +1,109 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include "../b_plus_tree.h"
+#include "../bpt_trace.h"
+
+#define ENTRY_CNT 100000
+#define SAMPLE_MAX 20000
+#define TRACE_PATH "trace_1.trc"
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+// both trees hold the same entries
+void same_content(struct bpt_stat *a, struct bpt_stat *b)
+{
+  struct bpt_cursor ca, cb;
+  int ra, rb;
+
+  for (ra = bpt_cursor_first(&ca, a), rb = bpt_cursor_first(&cb, b); ra == 0 && rb == 0;
+      ra = bpt_cursor_next(&ca), rb = bpt_cursor_next(&cb)) {
+    assert(bpt_cursor_entry(&ca)->key.off == bpt_cursor_entry(&cb)->key.off);
+    assert(bpt_cursor_entry(&ca)->val.off == bpt_cursor_entry(&cb)->val.off);
+  }
+  assert(ra == -1 && rb == -1);
+}
+
+int main(void)
+{
+  struct bpt_trace trace;
+  struct bpt_trace_reader rd;
+  struct bpt_trace_rec rec;
+  struct bpt_entry entry;
+  struct bpt_stat bstat, replayed;
+  struct bpt_node leaf;
+  struct gen_stk stk;
+  unsigned long n = 0, results[3][4];
+  int i, rst, op, fd;
+
+  srand(1523796176);
+  memset(results, 0, sizeof (results));
+  if (bpt_init(&bstat, 8) == -1 || bpt_init(&replayed, 5) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  if (bpt_trace_open(&trace, TRACE_PATH) == -1)
+    return 1;
+  bpt_trace_attach(&trace, &bstat);
+
+  // a mix of everything, values far apart so deltas of both signs go through the varints
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = (off_t)rand() * rand() - RAND_MAX;
+    switch (op = rand() % 3) {
+    case BPT_TRACE_SEARCH:
+      rst = bpt_search(entry.key, cmp_int, &bstat, &leaf) != -1 ? BPT_PRED_SUCCESS : BPT_NEXIST;
+      break;
+    case BPT_TRACE_INSERT:
+      rst = bpt_insert(entry, cmp_int, rand() % 2 ? bpt_pred_1 : bpt_pred_0, &stk, 1, &bstat);
+      break;
+    default:
+      rst = bpt_delete(entry, cmp_int, rand() % 4 ? bpt_pred_1 : bpt_pred_0, &stk, 1, &bstat);
+    }
+    assert(rst != BPT_ERROR);
+    results[op][rst]++;
+  }
+  bstat.trace = NULL;
+  assert(trace.nrec == ENTRY_CNT);
+  if (bpt_trace_close(&trace) == -1)
+    return 1;
+
+  // replayed onto a tree of another order, every result and the final content agree
+  if (bpt_trace_reader_open(&rd, TRACE_PATH) == -1)
+    return 1;
+  while ((rst = bpt_trace_next(&rd, &rec)) == 1) {
+    rst = bpt_trace_apply(&rec, cmp_int, &stk, &replayed);
+    assert(rst == rec.rst);
+    results[rec.op][rec.rst]--;
+    n++;
+  }
+  assert(rst == 0 && n == ENTRY_CNT);
+  for (op = 0; op < 3; op++) {
+    for (i = 0; i < 4; i++)
+      assert(results[op][i] == 0);
+  }
+  bpt_trace_reader_close(&rd);
+  check_bpt(&replayed);
+  same_content(&bstat, &replayed);
+
+  // a trace cut in the middle of a record ends at the last whole one
+  if ((fd = open(TRACE_PATH, O_RDWR)) == -1 || ftruncate(fd, lseek(fd, 0, SEEK_END) - 1) == -1)
+    return 1;
+  close(fd);
+  if (bpt_trace_reader_open(&rd, TRACE_PATH) == -1)
+    return 1;
+  for (n = 0; bpt_trace_next(&rd, &rec) == 1; n++)
+    ;
+  bpt_trace_reader_close(&rd);
+  assert(n == ENTRY_CNT - 1);
+  unlink(TRACE_PATH);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include "../bpt_wal.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 20000
+#define SAMPLE_MAX 5000
+#define ARENA_SIZE (8 << 20)
+#define CKPT_SIZE (64 << 10)
+#define THREAD_CNT 4
+#define THREAD_INS 200
+#define IMG_PATH "wal_1.img"
+#define FULL_PATH "wal_1_full.img"
+#define FULL_SIZE (16 << 10)
+
+void check_bpt(struct bpt_stat *bstat);
+
+int cmp_int(bpt_t a, bpt_t b)
+{
+  return (int)a.off - (int)b.off;
+}
+
+int expected[SAMPLE_MAX + THREAD_CNT * THREAD_INS];
+
+void verify(struct bpt_wal *wal, int nkey)
+{
+  bpt_t key, val;
+  int i, rst;
+
+  check_bpt(&wal->bstat);
+  for (i = 0; i < nkey; i++) {
+    key.off = i;
+    rst = bpt_wal_search(wal, key, &val);
+    if (expected[i] == -1)
+      assert(rst == -1);
+    else
+      assert(rst == 0 && val.off == expected[i]);
+  }
+}
+
+void *committer(void *arg)
+{
+  struct bpt_wal *wal = arg;
+  struct bpt_entry entry;
+  static int next = SAMPLE_MAX;
+  static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+  int i;
+
+  for (i = 0; i < THREAD_INS; i++) {
+    pthread_mutex_lock(&next_lock);
+    entry.key.off = next++;
+    pthread_mutex_unlock(&next_lock);
+    entry.val.off = entry.key.off * 2;
+    expected[entry.key.off] = entry.val.off;
+    if (bpt_wal_insert(wal, entry, bpt_pred_1) == BPT_ERROR || bpt_wal_commit(wal) == -1)
+      exit(1);
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  struct bpt_wal wal;
+  struct bpt_entry entry;
+  pthread_t tids[THREAD_CNT];
+  int i, rst, fd;
+
+  unlink(IMG_PATH);
+  unlink(IMG_PATH "-wal");
+  srand(1523796176);
+  memset(expected, -1, sizeof (expected));
+
+  // random mutations with a few automatic checkpoints in between
+  if (bpt_wal_open(&wal, IMG_PATH, BPT_ORDER, ARENA_SIZE, cmp_int) == -1)
+    return 1;
+  wal.ckpt_size = CKPT_SIZE;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    entry.key.off = rand() % SAMPLE_MAX;
+    entry.val.off = rand() % SAMPLE_MAX;
+    if ((rst = bpt_wal_insert(&wal, entry, bpt_pred_1)) == BPT_ERROR)
+      return 1;
+    expected[entry.key.off] = entry.val.off;
+    entry.key.off = rand() % SAMPLE_MAX;
+    if ((rst = bpt_wal_delete(&wal, entry, bpt_pred_1)) == BPT_ERROR)
+      return 1;
+    expected[entry.key.off] = -1;
+    if (i % 64 == 0 && bpt_wal_commit(&wal) == -1)
+      return 1;
+  }
+  if (bpt_wal_commit(&wal) == -1)
+    return 1;
+
+  // crash: abandon the tree without a checkpoint, recover from image plus log
+  if (bpt_wal_open(&wal, IMG_PATH, BPT_ORDER, ARENA_SIZE, cmp_int) == -1)
+    return 1;
+  verify(&wal, SAMPLE_MAX);
+
+  // group commit from several threads, then a torn record at the log tail
+  for (i = 0; i < THREAD_CNT; i++)
+    pthread_create(&tids[i], NULL, committer, &wal);
+  for (i = 0; i < THREAD_CNT; i++)
+    pthread_join(tids[i], NULL);
+  if ((fd = open(IMG_PATH "-wal", O_WRONLY | O_APPEND)) == -1 || write(fd, "torn", 4) != 4)
+    return 1;
+  close(fd);
+  if (bpt_wal_open(&wal, IMG_PATH, BPT_ORDER, ARENA_SIZE, cmp_int) == -1)
+    return 1;
+  verify(&wal, SAMPLE_MAX + THREAD_CNT * THREAD_INS);
+
+  // a clean checkpoint leaves an empty log
+  if (bpt_wal_checkpoint(&wal) == -1 || bpt_wal_close(&wal) == -1)
+    return 1;
+  if (bpt_wal_open(&wal, IMG_PATH, BPT_ORDER, ARENA_SIZE, cmp_int) == -1)
+    return 1;
+  assert(wal.logged == 0);
+  verify(&wal, SAMPLE_MAX + THREAD_CNT * THREAD_INS);
+  bpt_wal_close(&wal);
+
+  // an insert failing on a full arena leaves nothing in the log for recovery to redo
+  unlink(FULL_PATH);
+  unlink(FULL_PATH "-wal");
+  if (bpt_wal_open(&wal, FULL_PATH, BPT_ORDER, FULL_SIZE, cmp_int) == -1)
+    return 1;
+  for (i = 0; ; i++) {
+    unsigned long long logged = wal.logged;
+
+    entry.key.off = entry.val.off = i;
+    if ((rst = bpt_wal_insert(&wal, entry, bpt_pred_1)) == BPT_ERROR) {
+      assert(wal.logged == logged);
+      break;
+    }
+    assert(i < SAMPLE_MAX);
+  }
+  if (bpt_wal_close(&wal) == -1)
+    return 1;
+  if (bpt_wal_open(&wal, FULL_PATH, BPT_ORDER, FULL_SIZE, cmp_int) == -1)
+    return 1;
+  assert(wal.logged == (unsigned long long)i * sizeof (struct bpt_wal_rec));
+  memset(expected, -1, sizeof (expected));
+  for (rst = 0; rst < i; rst++)
+    expected[rst] = rst;
+  verify(&wal, i + 1);
+  bpt_wal_close(&wal);
+
+  unlink(IMG_PATH);
+  unlink(IMG_PATH "-wal");
+  unlink(FULL_PATH);
+  unlink(FULL_PATH "-wal");
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../b_plus_tree.h"
+
+#define BPT_ORDER 8
+#define ENTRY_CNT 100000
+#define TENANT_CNT 16
+#define OBJECT_CNT 1000
+
+#ifndef BPT_KEY_SIZE
+#error "build with -DBPT_KEY_SIZE=16, 24 or 32"
+#endif
+
+int expected[TENANT_CNT][OBJECT_CNT];
+
+// (tenant, object) as words for one tree, as big-endian bytes for the other
+bpt_key_t words_key(int tenant, int object)
+{
+  bpt_key_t key;
+
+  memset(&key, 0, sizeof (key));
+  key.w[0] = tenant;
+  key.w[1] = object;
+  return key;
+}
+
+bpt_key_t bytes_key(int tenant, int object)
+{
+  bpt_key_t key;
+  int i;
+
+  memset(&key, 0, sizeof (key));
+  for (i = 0; i < 8; i++) {
+    key.b[7-i] = (uint64_t)tenant >> (i * 8);
+    key.b[15-i] = (uint64_t)object >> (i * 8);
+  }
+  return key;
+}
+
+void verify(struct bpt_stat *bstat, int (*cmp)(bpt_key_t, bpt_key_t), bpt_key_t (*make)(int, int))
+{
+  struct bpt_cursor cur;
+  struct bpt_node leaf;
+  int t, o, offset, rst, cnt = 0, nkey = 0;
+
+  for (t = 0; t < TENANT_CNT; t++) {
+    for (o = 0; o < OBJECT_CNT; o++) {
+      offset = bpt_search(make(t, o), cmp, bstat, &leaf);
+      if (expected[t][o] == -1) {
+        assert(offset == -1);
+      } else {
+        assert(offset != -1 && leaf.entries[offset].val.off == expected[t][o]);
+        nkey++;
+      }
+    }
+  }
+  // the leaf chain holds every key once, in tenant then object order
+  for (t = 0, o = -1, rst = bpt_cursor_first(&cur, bstat); rst == 0; rst = bpt_cursor_next(&cur), cnt++) {
+    for (o++; o == OBJECT_CNT || expected[t][o] == -1; o++) {
+      if (o == OBJECT_CNT)
+        t++, o = -1;
+    }
+    assert(cmp(bpt_cursor_entry(&cur)->key, make(t, o)) == 0);
+  }
+  assert(cnt == nkey);
+}
+
+int main(void)
+{
+  struct bpt_entry entry;
+  struct bpt_stat words, bytes;
+  struct gen_stk stk;
+  int i, t, o;
+
+  srand(1523796176);
+  memset(expected, -1, sizeof (expected));
+  if (bpt_init(&words, BPT_ORDER) == -1 || bpt_init(&bytes, BPT_ORDER) == -1)
+    return 1;
+  if (gen_stk_init(&stk, BPT_STK_CAP_INIT, sizeof (struct bpt_frm)) == -1)
+    return 1;
+  for (i = 0; i < ENTRY_CNT; i++) {
+    t = rand() % TENANT_CNT;
+    o = rand() % OBJECT_CNT;
+    entry.val.off = i;
+    entry.key = words_key(t, o);
+    if (bpt_insert(entry, bpt_key_cmp_words, bpt_pred_1, &stk, 1, &words) == BPT_ERROR)
+      return 1;
+    entry.key = bytes_key(t, o);
+    if (bpt_insert(entry, bpt_key_cmp_bytes, bpt_pred_1, &stk, 1, &bytes) == BPT_ERROR)
+      return 1;
+    expected[t][o] = i;
+
+    t = rand() % TENANT_CNT;
+    o = rand() % OBJECT_CNT;
+    entry.key = words_key(t, o);
+    if (bpt_delete(entry, bpt_key_cmp_words, bpt_pred_1, &stk, 1, &words) == BPT_ERROR)
+      return 1;
+    entry.key = bytes_key(t, o);
+    if (bpt_delete(entry, bpt_key_cmp_bytes, bpt_pred_1, &stk, 1, &bytes) == BPT_ERROR)
+      return 1;
+    expected[t][o] = -1;
+  }
+  verify(&words, bpt_key_cmp_words, words_key);
+  verify(&bytes, bpt_key_cmp_bytes, bytes_key);
+  return 0;
+}